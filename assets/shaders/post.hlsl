@@ -7,6 +7,26 @@ struct VSInput {
   float3 bitangent : BITANGENT;
 };
 
+#ifdef PACKED_VERTICES
+struct VSPackedInput {
+  float4 position : POSITION;
+  float2 normal : NORMAL;
+  float2 uv : TEXCOORD;
+  float2 tangent : TANGENT;
+};
+
+// the quad is packed against fixed bounds, only the position and uv are used
+VSInput decode_vertex( VSPackedInput p ) {
+  VSInput v;
+  v.position = float4( p.position.xy * 2.0f - 1.0f, 0.0f, 1.0f );
+  v.normal = float3( 0.0f, 0.0f, 0.0f );
+  v.uv = p.uv;
+  v.tangent = float3( 0.0f, 0.0f, 0.0f );
+  v.bitangent = float3( 0.0f, 0.0f, 0.0f );
+  return v;
+}
+#endif
+
 struct PSInput {
   float4 position : SV_POSITION;
   float3 normal : NORMAL;
@@ -18,7 +38,12 @@ struct PSInput {
 Texture2D textures : register( t0 );
 SamplerState m_sampler : register( s0 );
 
+#ifdef PACKED_VERTICES
+PSInput VSMain( VSPackedInput packed ) {
+  VSInput input = decode_vertex( packed );
+#else
 PSInput VSMain( VSInput input ) {
+#endif
   PSInput result;
   result.position = float4( input.position.xyz, 1.0f );
   result.normal = input.normal;
@@ -3,11 +3,23 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 packed_position;
+layout (location = 1) in vec2 packed_normal;
+layout (location = 2) in vec2 uv;
+layout (location = 3) in vec2 packed_tangent;
+
+vec3 position;
+vec3 normal;
+vec3 tangent;
+vec3 bitangent;
+#else
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 uv;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in vec3 bitangent;
+#endif
 
 layout (location = 0) out vec2 frag_uv;
 
@@ -20,10 +32,25 @@ layout (set = 0, binding = 0) uniform UBO1
   uint d_texture_id;
   uint n_texture_id;
   uint s_texture_id;
+  uint pad0;
+
+  vec4 bounds_min;
+  vec4 bounds_scale;
 
-  uint pad[13];
+  uint pad[4];
 } instance;
 
+#ifdef PACKED_VERTICES
+// the quad is packed against fixed bounds, only the position and uv are used
+void decode_vertex()
+{
+  position = vec3( packed_position.xy * 2.0 - 1.0, 0.0 );
+  normal = vec3( 0.0 );
+  tangent = vec3( 0.0 );
+  bitangent = vec3( 0.0 );
+}
+#endif
+
 layout (set = 1, binding = 0) uniform UBO2
 {
   vec3            light_pos;
@@ -39,6 +66,9 @@ layout (set = 1, binding = 0) uniform UBO2
 
 void main() 
 {
+#ifdef PACKED_VERTICES
+  decode_vertex();
+#endif
 	frag_uv = uv;
 	gl_Position = vec4(position.xyz, 1.0);
 }
@@ -13,8 +13,12 @@ layout (set = 0, binding = 0) uniform UBO1
   uint d_texture_id;
   uint n_texture_id;
   uint s_texture_id;
+  uint pad0;
 
-  uint pad[13];
+  vec4 bounds_min;
+  vec4 bounds_scale;
+
+  uint pad[4];
 } instance;
 
 layout (set = 1, binding = 0) uniform UBO2
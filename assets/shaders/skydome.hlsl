@@ -25,10 +25,40 @@ cbuffer InstanceData : register( b0 ) {
   uint d_texture_id;
   uint n_texture_id;
   uint s_texture_id;
+  uint pad0;
 
-  uint pad[13];
+  float4 bounds_min;
+  float4 bounds_scale;
+
+  uint pad[4];
+};
+
+#ifdef PACKED_VERTICES
+struct VSPackedInput {
+  float4 position : POSITION;
+  float2 normal : NORMAL;
+  float2 uv : TEXCOORD;
+  float2 tangent : TANGENT;
 };
 
+float3 decode_octahedral( float2 e ) {
+  float3 n = float3( e.xy, 1.0f - abs( e.x ) - abs( e.y ) );
+  if( n.z < 0.0f )
+    n.xy = ( 1.0f - abs( e.yx ) ) * float2( e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f );
+  return normalize( n );
+}
+
+VSInput decode_vertex( VSPackedInput p ) {
+  VSInput v;
+  v.position = float4( bounds_min.xyz + p.position.xyz * bounds_scale.xyz, 1.0f );
+  v.normal = decode_octahedral( p.normal );
+  v.uv = p.uv;
+  v.tangent = decode_octahedral( p.tangent );
+  v.bitangent = cross( v.normal, v.tangent ) * ( p.position.w * 2.0f - 1.0f );
+  return v;
+}
+#endif
+
 cbuffer FrameData : register( b1 ) {
   float3 light_pos;
   float sky_color;
@@ -66,7 +96,12 @@ static const float3 all_top_sky_color[5] =
   float3( 73.0f / 256.f, 133.0f / 256.f, 226.0f / 256.f )  // Day
 };
 
+#ifdef PACKED_VERTICES
+PSInput VSMain( VSPackedInput packed ) {
+  VSInput input = decode_vertex( packed );
+#else
 PSInput VSMain( VSInput input ) {
+#endif
   PSInput result;
 
   result.position = mul( float4( input.position.xyz, 1.0f ), mvp );
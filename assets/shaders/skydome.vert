@@ -3,11 +3,23 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 packed_position;
+layout (location = 1) in vec2 packed_normal;
+layout (location = 2) in vec2 uv;
+layout (location = 3) in vec2 packed_tangent;
+
+vec3 position;
+vec3 normal;
+vec3 tangent;
+vec3 bitangent;
+#else
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 uv;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in vec3 bitangent;
+#endif
 
 layout (set = 0, binding = 0) uniform UBO1
 {
@@ -18,10 +30,32 @@ layout (set = 0, binding = 0) uniform UBO1
   uint d_texture_id;
   uint n_texture_id;
   uint s_texture_id;
+  uint pad0;
+
+  vec4 bounds_min;
+  vec4 bounds_scale;
 
-  uint pad[13];
+  uint pad[4];
 } instance;
 
+#ifdef PACKED_VERTICES
+vec3 decode_octahedral( vec2 e )
+{
+  vec3 n = vec3( e.xy, 1.0 - abs( e.x ) - abs( e.y ) );
+  if( n.z < 0.0 )
+    n.xy = ( 1.0 - abs( e.yx ) ) * vec2( e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0 );
+  return normalize( n );
+}
+
+void decode_vertex()
+{
+  position = instance.bounds_min.xyz + packed_position.xyz * instance.bounds_scale.xyz;
+  normal = decode_octahedral( packed_normal );
+  tangent = decode_octahedral( packed_tangent );
+  bitangent = cross( normal, tangent ) * ( packed_position.w * 2.0 - 1.0 );
+}
+#endif
+
 layout (set = 1, binding = 0) uniform UBO2
 {
   vec3            light_pos;
@@ -41,6 +75,9 @@ layout (location = 2) out float frag_angle;
 
 void main() 
 {
+#ifdef PACKED_VERTICES
+  decode_vertex();
+#endif
   frag_distance = ( instance.model *vec4( position.xyz, 1.0f ) ).xyz;
   frag_height = frag_distance.y / 1000.f + 0.25f;
 
@@ -1,10 +1,17 @@
-glslangvalidator -V basic.vert -o basic.vert.spv
-glslangvalidator -V basic.frag -o basic.frag.spv
-glslangvalidator -V texture.vert -o texture.vert.spv
-glslangvalidator -V texture.frag -o texture.frag.spv
-glslangvalidator -V skydome.vert -o skydome.vert.spv
-glslangvalidator -V skydome.frag -o skydome.frag.spv
-glslangvalidator -V post.vert -o post.vert.spv
-glslangvalidator -V post.frag -o post.frag.spv
-pause
+glslangvalidator -V basic.vert -o basic.vert.spv || exit /b 1
+glslangvalidator -V basic.frag -o basic.frag.spv || exit /b 1
+glslangvalidator -V texture.vert -o texture.vert.spv || exit /b 1
+glslangvalidator -V texture.frag -o texture.frag.spv || exit /b 1
+glslangvalidator -V skydome.vert -o skydome.vert.spv || exit /b 1
+glslangvalidator -V skydome.frag -o skydome.frag.spv || exit /b 1
+glslangvalidator -V post.vert -o post.vert.spv || exit /b 1
+glslangvalidator -V post.frag -o post.frag.spv || exit /b 1
+glslangvalidator -V -DPACKED_VERTICES basic.vert -o basic_packed.vert.spv || exit /b 1
+glslangvalidator -V -DPACKED_VERTICES texture.vert -o texture_packed.vert.spv || exit /b 1
+glslangvalidator -V -DPACKED_VERTICES skydome.vert -o skydome_packed.vert.spv || exit /b 1
+glslangvalidator -V -DPACKED_VERTICES post.vert -o post_packed.vert.spv || exit /b 1
+glslangvalidator -V -DINSTANCED texture.vert -o texture_instanced.vert.spv || exit /b 1
+glslangvalidator -V -DINSTANCED -DPACKED_VERTICES texture.vert -o texture_instanced_packed.vert.spv || exit /b 1
+rem the build runs this with an argument, double clicking it keeps the window open
+if "%~1"=="" pause
 
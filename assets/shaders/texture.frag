@@ -13,22 +13,10 @@ layout (location = 6) in vec3 light_dir;
 layout (location = 7) in mat3 TBN;
 
 layout (location = 11) in vec3 frag_tangent;
+layout (location = 12) flat in uvec3 texture_ids;
 
 layout (location = 0) out vec4 frag_color;
 
-layout (set = 0, binding = 0) uniform UBO1
-{
-  mat4 mvp;
-  mat4 model;
-  mat4 normal_matrix;
-
-  uint d_texture_id;
-  uint n_texture_id;
-  uint s_texture_id;
-
-  uint pad[13];
-} instance;
-
 layout (set = 1, binding = 0) uniform UBO2
 {
   vec3            light_pos;
@@ -50,9 +38,9 @@ void main()
 	vec3 diffuse_color = vec3( 0.0f, 0.0f, 0.0f );
 	vec3 specular_color = vec3( 0.0f, 0.0f, 0.0f );
 
-	vec3 texture_color = texture(m_texture[instance.d_texture_id], frag_uv).xyz;
-	vec3 normal_map = texture(m_texture[instance.n_texture_id], frag_uv).xyz;
-	vec3 specular_map = texture(m_texture[instance.s_texture_id], frag_uv).xyz;
+	vec3 texture_color = texture(m_texture[texture_ids.x], frag_uv).xyz;
+	vec3 normal_map = texture(m_texture[texture_ids.y], frag_uv).xyz;
+	vec3 specular_map = texture(m_texture[texture_ids.z], frag_uv).xyz;
 
 	vec3 normal = normalize( normal_map * 2.0f - 1.0f ) * TBN;
 	float specular_map_r = specular_map.x;
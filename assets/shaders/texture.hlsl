@@ -18,9 +18,10 @@ struct PSInput {
   float3x3 TBN : TBN;
 
   float3 tangent : TANGENT;
+  nointerpolation uint3 texture_ids : TEXTURE_IDS;
 };
 
-cbuffer InstanceData : register( b0, space0 ) {
+struct InstanceData {
   float4x4 mvp;
   float4x4 model;
   float4x4 normal_matrix;
@@ -28,10 +29,48 @@ cbuffer InstanceData : register( b0, space0 ) {
   uint d_texture_id;
   uint n_texture_id;
   uint s_texture_id;
+  uint pad0;
 
-  uint pad[13];
+  float4 bounds_min;
+  float4 bounds_scale;
+
+  uint pad[4];
+};
+
+#ifdef INSTANCED
+// the view starts at the batch's first instance, SV_InstanceID counts from zero on every draw
+StructuredBuffer<InstanceData> instances : register( t0, space1 );
+static InstanceData instance;
+#else
+ConstantBuffer<InstanceData> instance : register( b0, space0 );
+#endif
+
+#ifdef PACKED_VERTICES
+struct VSPackedInput {
+  float4 position : POSITION;
+  float2 normal : NORMAL;
+  float2 uv : TEXCOORD;
+  float2 tangent : TANGENT;
 };
 
+float3 decode_octahedral( float2 e ) {
+  float3 n = float3( e.xy, 1.0f - abs( e.x ) - abs( e.y ) );
+  if( n.z < 0.0f )
+    n.xy = ( 1.0f - abs( e.yx ) ) * float2( e.x >= 0.0f ? 1.0f : -1.0f, e.y >= 0.0f ? 1.0f : -1.0f );
+  return normalize( n );
+}
+
+VSInput decode_vertex( VSPackedInput p ) {
+  VSInput v;
+  v.position = float4( instance.bounds_min.xyz + p.position.xyz * instance.bounds_scale.xyz, 1.0f );
+  v.normal = decode_octahedral( p.normal );
+  v.uv = p.uv;
+  v.tangent = decode_octahedral( p.tangent );
+  v.bitangent = cross( v.normal, v.tangent ) * ( p.position.w * 2.0f - 1.0f );
+  return v;
+}
+#endif
+
 cbuffer FrameData : register( b1 ) {
   float3 light_pos;
   float sky_color;
@@ -68,16 +107,28 @@ static const float3 horizon_color = float3( 239.0f / 256.f, 96.0f / 256.f, 40.0f
 static const float3 mid_sky_color = float3( 176.0f / 256.f, 155.0f / 256.f, 112.0f / 256.f );
 static const float3 top_sky_color = float3( 94.0f / 256.f, 124.0f / 256.f, 148.0f / 256.f );
 
-PSInput VSMain( VSInput input ) {
+#ifdef PACKED_VERTICES
+PSInput VSMain( VSPackedInput packed, uint instance_id : SV_InstanceID ) {
+#ifdef INSTANCED
+  instance = instances[instance_id];
+#endif
+  VSInput input = decode_vertex( packed );
+#else
+PSInput VSMain( VSInput input, uint instance_id : SV_InstanceID ) {
+#ifdef INSTANCED
+  instance = instances[instance_id];
+#endif
+#endif
   PSInput result;
 
-  result.position = mul( float4( input.position.xyz, 1.0f ), mvp );
+  result.position = mul( float4( input.position.xyz, 1.0f ), instance.mvp );
 
   result.distance = result.position.z * 0.001f;
   result.distance = clamp( result.distance, 0.0f, 1.0f );
   result.uv = input.uv;
+  result.texture_ids = uint3( instance.d_texture_id, instance.n_texture_id, instance.s_texture_id );
 
-  float3 frag_normal = mul( ( float3x3 ) normal_matrix, input.normal.xyz );
+  float3 frag_normal = mul( ( float3x3 ) instance.normal_matrix, input.normal.xyz );
   frag_normal = normalize( frag_normal );
 
   result.spherical_harmonics = C1 * L22 * ( frag_normal.x * frag_normal.x - frag_normal.y * frag_normal.y ) +
@@ -100,14 +151,14 @@ PSInput VSMain( VSInput input ) {
   float3x3 TBN = transpose( float3x3( tangent, bitangent, frag_normal ) );
   result.TBN = TBN;
 
-  float3 pos = mul( float4( input.position.xyz, 1.0f ), model ).xyz;
+  float3 pos = mul( float4( input.position.xyz, 1.0f ), instance.model ).xyz;
   pos = input.position.xyz;
   result.eye_dir = normalize( pos - eye_view );
 
   result.light_dir = normalize( -light_pos );
   //result.light_dir.x = -result.light_dir.x;
   //result.light_dir.z = -result.light_dir.z;
-  result.light_dir = mul( float4( result.light_dir, 0.0f ), normal_matrix ).xyz;
+  result.light_dir = mul( float4( result.light_dir, 0.0f ), instance.normal_matrix ).xyz;
 
   result.tangent = tangent;
 
@@ -120,9 +171,9 @@ float4 PSMain( PSInput input ) : SV_TARGET
   float3 diffuse_color = float3( 0.0f, 0.0f, 0.0f );
   float3 specular_color = float3( 0.0f, 0.0f, 0.0f );
 
-  float3 texture_color = textures[d_texture_id].Sample( samplers[1], input.uv ).rgb;
-  float3 normal_map = textures[n_texture_id].Sample( samplers[1], input.uv ).rgb;
-  float3 specular_map = textures[s_texture_id].Sample( samplers[1], input.uv ).rgb;
+  float3 texture_color = textures[input.texture_ids.x].Sample( samplers[1], input.uv ).rgb;
+  float3 normal_map = textures[input.texture_ids.y].Sample( samplers[1], input.uv ).rgb;
+  float3 specular_map = textures[input.texture_ids.z].Sample( samplers[1], input.uv ).rgb;
 
   float3 normal = mul( normalize( normal_map * 2.0f - 1.0f ), input.TBN );
   float specular_map_r = specular_map.x;
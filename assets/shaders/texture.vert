@@ -3,11 +3,23 @@
 #extension GL_ARB_separate_shader_objects : enable
 #extension GL_ARB_shading_language_420pack : enable
 
+#ifdef PACKED_VERTICES
+layout (location = 0) in vec4 packed_position;
+layout (location = 1) in vec2 packed_normal;
+layout (location = 2) in vec2 uv;
+layout (location = 3) in vec2 packed_tangent;
+
+vec3 position;
+vec3 normal;
+vec3 tangent;
+vec3 bitangent;
+#else
 layout (location = 0) in vec3 position;
 layout (location = 1) in vec3 normal;
 layout (location = 2) in vec2 uv;
 layout (location = 3) in vec3 tangent;
 layout (location = 4) in vec3 bitangent;
+#endif
 
 layout (location = 0) out vec4 frag_position;
 layout (location = 1) out vec3 frag_normal;
@@ -19,7 +31,34 @@ layout (location = 6) out vec3 light_dir;
 layout (location = 7) out mat3 TBN;
 
 layout (location = 11) out vec3 frag_tangent;
+layout (location = 12) flat out uvec3 texture_ids;
+
+#ifdef INSTANCED
+struct instance_data
+{
+  mat4 mvp;
+  mat4 model;
+  mat4 normal_matrix;
+
+  uint d_texture_id;
+  uint n_texture_id;
+  uint s_texture_id;
+  uint pad0;
 
+  vec4 bounds_min;
+  vec4 bounds_scale;
+
+  uint pad[4];
+};
+
+// every instance of the batch reads its own entry, gl_InstanceIndex counts from the batch's first instance
+layout (std430, set = 0, binding = 0) readonly buffer SSBO1
+{
+  instance_data instances[];
+};
+
+instance_data instance;
+#else
 layout (set = 0, binding = 0) uniform UBO1
 {
   mat4 mvp;
@@ -29,9 +68,32 @@ layout (set = 0, binding = 0) uniform UBO1
   uint d_texture_id;
   uint n_texture_id;
   uint s_texture_id;
+  uint pad0;
+
+  vec4 bounds_min;
+  vec4 bounds_scale;
 
-  uint pad[13];
+  uint pad[4];
 } instance;
+#endif
+
+#ifdef PACKED_VERTICES
+vec3 decode_octahedral( vec2 e )
+{
+  vec3 n = vec3( e.xy, 1.0 - abs( e.x ) - abs( e.y ) );
+  if( n.z < 0.0 )
+    n.xy = ( 1.0 - abs( e.yx ) ) * vec2( e.x >= 0.0 ? 1.0 : -1.0, e.y >= 0.0 ? 1.0 : -1.0 );
+  return normalize( n );
+}
+
+void decode_vertex()
+{
+  position = instance.bounds_min.xyz + packed_position.xyz * instance.bounds_scale.xyz;
+  normal = decode_octahedral( packed_normal );
+  tangent = decode_octahedral( packed_tangent );
+  bitangent = cross( normal, tangent ) * ( packed_position.w * 2.0 - 1.0 );
+}
+#endif
 
 layout (set = 1, binding = 0) uniform UBO2
 {
@@ -67,6 +129,12 @@ const vec3 L22  = vec3(-0.161784, -0.191783, -0.219152);
 
 void main() 
 {
+#ifdef INSTANCED
+  instance = instances[gl_InstanceIndex];
+#endif
+#ifdef PACKED_VERTICES
+  decode_vertex();
+#endif
 	mat4 nm = instance.normal_matrix;
 
   	frag_normal = ( vec4( normal, 0.0f) * nm ).xyz;
@@ -88,6 +156,7 @@ void main()
 	distance = frag_position.z * 0.001f;
 	distance = clamp( distance, 0.0f, 1.0f );
   	frag_uv = uv;
+	texture_ids = uvec3( instance.d_texture_id, instance.n_texture_id, instance.s_texture_id );
 
 	vec3 s_tangent = ( vec4( tangent, 0.0f) * nm ).xyz;
   	s_tangent = normalize( tangent );
@@ -27,6 +27,29 @@ solution "D3D12 & Vulkan Procedural City"
 
     	files  "../../assets/**"
 
+		-- the SPIR-V binaries always come from the GLSL next to them, through the bundled glslangValidator
+		prebuildcommands { "cd ../assets/shaders && call spirv-compile.bat build" }
+
+		configuration "Debug"
+			targetsuffix "-d" 
+			defines { "_CRT_SECURE_NO_WARNINGS", "WIN32", "_DEBUG", "DEBUG", "VK_PROTOTYPES",
+			 "VK_USE_PLATFORM_WIN32_KHR", "_USE_MATH_DEFINES", "NOMINMAX", "WINDOWS" }
+			flags { "Symbols" }
+
+		configuration "Release"
+			defines { "_CRT_SECURE_NO_WARNINGS", "WIN32", "NDEBUG", "VK_PROTOTYPES", 
+			"VK_USE_PLATFORM_WIN32_KHR", "_USE_MATH_DEFINES", "NOMINMAX", "WINDOWS" }
+			flags { "Optimize" }
+
+	-- the harnesses that check the engine, the exit code is the number of them that failed
+	project "tests"
+		kind 'ConsoleApp'
+		files { "../../include/core/**.h", "../../src/**.cc", "../../src/**.h", "../../tests/**.cc" }
+		files { "../../include/**/**.cpp", "../../include/**/**.h", "../../include/**/**/**.h", "../../include/**/**.hh",
+		"../../include/**/**.cc" }
+		excludes { "../../src/main.cc" }
+		defines { "COUNT_ALLOCATIONS=1" }
+
 		configuration "Debug"
 			targetsuffix "-d" 
 			defines { "_CRT_SECURE_NO_WARNINGS", "WIN32", "_DEBUG", "DEBUG", "VK_PROTOTYPES",
@@ -19,8 +19,12 @@ http://opensource.org/licenses/MIT
 #include <memory>
 #include <atomic>
 #include <mutex>
+#include <functional>
+#include <unordered_map>
 
 #include "base.hh"
+#include "types.hh"
+#include "mesh_optimizer.hh"
 
 
 namespace kretash {
@@ -29,7 +33,42 @@ namespace kretash {
   class                               Geometry;
   struct                              queue;
   struct                              remove_queue;
-  struct                              mem_block;
+  struct                              staging_heap;
+  class                               Pool;
+
+  enum                                upload_state {
+    kUPLOAD_RESERVED = 0,
+    kUPLOAD_QUEUED,
+    kUPLOAD_IN_FLIGHT,
+    kUPLOAD_RESIDENT,
+    kUPLOAD_DISCARDED,
+  };
+
+  /* Owns a piece of the staging memory from reserve_staging until the upload thread copies it
+     to the GPU buffers, dropping the last reference before that gives the memory back. */
+  class                               UploadHandle {
+  public:
+    UploadHandle( std::shared_ptr<staging_heap> heap, staging_block s );
+    ~UploadHandle();
+
+    staging_block&                    get_staging() { return m_staging; }
+    uint64_t                          get_size() { return m_staging.block.m_size; }
+    upload_state                      get_state() { return m_state.load(); }
+
+    // runs once the data is resident or the upload got discarded, usually on the upload thread so keep it short
+    void                              on_complete( std::function<void( UploadHandle* )> callback );
+
+  private:
+    friend class                      GPU_pool;
+    void                              _set_state( upload_state s );
+    void                              _release();
+
+    std::shared_ptr<staging_heap>     m_heap;
+    staging_block                     m_staging;
+    std::atomic<upload_state>         m_state;
+    std::function<void( UploadHandle* )> m_callback;
+    std::mutex                        m_callback_mutex;
+  };
 
   class                               GPU_pool : public Base {
   public:
@@ -40,20 +79,31 @@ namespace kretash {
     void                              update();
     void                              synch();
 
-    void                              queue_geometry( Geometry* b, float* v_data, uint32_t v_size,
-      uint32_t* e_data, uint32_t e_size );
+    std::shared_ptr<UploadHandle>     reserve_staging( uint32_t v_count, uint32_t e_count, uint32_t c_count = 0 );
+    void                              queue_geometry( Geometry* b, std::shared_ptr<UploadHandle> h );
     void                              set_placeholder_building( Geometry* b );
     Geometry*                         get_placeholder_building() { return m_placeholder_building; }
     void                              remove( Geometry* b );
     void                              start_remove_thread();
     xxGeometry*                       get_xx_geometry() { return m_geometry.get(); }
 
+    // every uploaded geometry's clusters, indexed by Geometry::get_cluster_offset
+    const mesh_cluster*               get_clusters() { return m_clusters.data(); }
+
+    // geometries living in the pool against the allocations they actually take
+    void                              get_shared_stats( uint32_t* geometries, uint32_t* allocations, uint64_t* saved_bytes );
+
+    static uint32_t                   get_vertex_buffer_size( int32_t grid );
+    static uint32_t                   get_index_buffer_size( int32_t grid );
+    static uint32_t                   get_cluster_buffer_size( int32_t grid );
+
   private:
     void                              _debug_log();
-    void                              _save( Geometry* b, float* v_data, uint32_t v_size, uint32_t* e_data,
-      uint32_t e_size );
+    void                              _save( Geometry* b, std::shared_ptr<UploadHandle> h );
+    bool                              _share( Geometry* b, std::shared_ptr<UploadHandle> h, uint64_t hash );
+    bool                              _same_bytes( shared_geometry& shared, staging_block& s );
+    uint64_t                          _hash_staging( staging_block& s );
     void                              _remove( remove_queue remove_me );
-    void                              _defrag_vectors();
     void                              _thread();
 
     std::shared_ptr<xxGeometry>       m_geometry;
@@ -72,11 +122,19 @@ namespace kretash {
     std::mutex                        m_pool_mutex;
     std::vector<std::thread>          m_remove_threads;
     std::vector<remove_queue>         m_remove_queue;
+    std::vector<remove_queue>         m_retire_queue;
+    std::atomic<uint64_t>             m_completed_frame;
     std::mutex                        m_queue_mutex;
 
-    std::vector<mem_block>            m_V_free_memory;
-    std::vector<mem_block>            m_V_used_memory;
-    std::vector<mem_block>            m_I_free_memory;
-    std::vector<mem_block>            m_I_used_memory;
+    std::shared_ptr<Pool>             m_V_pool;
+    std::shared_ptr<Pool>             m_I_pool;
+    std::shared_ptr<Pool>             m_C_pool;
+    std::vector<mesh_cluster>         m_clusters;
+
+    std::unordered_map<uint32_t, shared_geometry> m_shared;
+    std::unordered_multimap<uint64_t, uint32_t> m_shared_lookup;
+    std::mutex                        m_shared_mutex;
+
+    std::shared_ptr<staging_heap>     m_staging;
   };
 }
\ No newline at end of file
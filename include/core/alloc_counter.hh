@@ -0,0 +1,38 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+#pragma once
+#include <cstdint>
+
+namespace kretash {
+
+  /* Counts the heap allocations made by each thread by replacing the global operator new.
+     It only counts when COUNT_ALLOCATIONS is defined to 1, like the tests project does, otherwise
+     the counters stay at zero and nothing gets replaced. */
+  namespace alloc_counter {
+
+    bool                    is_counting();
+
+    //allocations made so far by the calling thread
+    uint64_t                get_thread_allocations();
+
+    //allocations that shouldn't be blamed on the calling code, like handles owned by other systems
+    struct                  ignore_scope {
+      ignore_scope();
+      ~ignore_scope();
+    };
+  }
+}
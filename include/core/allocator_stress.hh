@@ -0,0 +1,90 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+#pragma once
+#include <vector>
+#include <string>
+#include <random>
+#include <memory>
+
+#include "types.hh"
+
+namespace kretash {
+
+  class                               Pool;
+
+  struct                              stress_report {
+    std::string                       name;
+    uint64_t                          pool_size;
+    uint32_t                          allocations;
+    uint32_t                          releases;
+    uint32_t                          failures;
+    float                             peak_fragmentation;
+    uint64_t                          min_largest_free_block;
+    double                            worst_alloc_time;
+    double                            worst_free_time;
+    double                            total_alloc_time;
+    double                            total_free_time;
+    bool                              no_overlap;
+    bool                              coalesced;
+
+    stress_report() :
+      name(),
+      pool_size( 0 ),
+      allocations( 0 ),
+      releases( 0 ),
+      failures( 0 ),
+      peak_fragmentation( 0.0f ),
+      min_largest_free_block( 0 ),
+      worst_alloc_time( 0.0 ),
+      worst_free_time( 0.0 ),
+      total_alloc_time( 0.0 ),
+      total_free_time( 0.0 ),
+      no_overlap( true ),
+      coalesced( true ) {
+    }
+  };
+
+  /* Replays synthetic and recorded allocation traces against the same Pool allocator used by
+     GPU_pool for the vertex/index buffers and by Vulkan for device and host texture memory. */
+  class                               AllocatorStress {
+  public:
+    AllocatorStress( uint32_t seed = 1337 );
+    ~AllocatorStress();
+
+    bool                              run();
+    bool                              replay( std::string filename );
+    void                              print_reports();
+
+  private:
+    void                              _building_moves( int32_t grid, int32_t frames );
+    void                              _random_fuzz( uint64_t size, int32_t operations );
+    void                              _texture_lod_changes( int32_t grid, int32_t frames );
+    void                              _texture_uploads( int32_t grid, int32_t frames );
+
+    void                              _begin( std::string name, Pool* p );
+    bool                              _alloc( Pool* p, uint64_t size, mem_block* m );
+    void                              _free( Pool* p, mem_block m );
+    void                              _sample( Pool* p );
+    void                              _finish( Pool* p, std::vector<mem_block>* live );
+    uint64_t                          _random_size( uint64_t min, uint64_t max );
+
+    std::mt19937                      m_random;
+    std::vector<stress_report>        m_reports;
+    stress_report                     m_current;
+    uint32_t                          m_operations;
+  };
+}
@@ -0,0 +1,82 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <functional>
+#include <unordered_map>
+
+#include "texture.hh"
+
+namespace kretash {
+
+  /* One image file, however many drawables use it. The owner is the first texture that asked
+     for it and the one holding the GPU texture, everybody else only borrows the id. Drawables
+     are never unlinked from the texture manager, so the owner lives as long as the asset. */
+  struct                                    texture_asset {
+    std::string                             filename;
+    int32_t                                 id;
+    uint32_t                                uses;
+    Texture*                                owner;
+    texture_t                               type;
+
+    // filled by the decode threads, freed once the GPU texture is created
+    unsigned char*                          pixels;
+    int32_t                                 width;
+    int32_t                                 height;
+    int32_t                                 channels;
+    std::atomic_bool                        decoded;
+  };
+
+  class                                     AssetRegistry {
+  public:
+    AssetRegistry();
+    ~AssetRegistry();
+
+    /* Finds the asset of filename or adds it for owner, queued for decoding and without an id
+       until the caller gives it one. Either way the asset counts one more use. */
+    texture_asset*                          acquire_texture( std::string filename, Texture* owner, texture_t type,
+                                              bool* created );
+
+    /* Decodes the queued files on a pool of threads. on_decoded runs on the calling thread
+       for every asset in the order they were queued, as soon as its pixels are there. */
+    void                                    decode_queued( std::function<void( texture_asset* )> on_decoded );
+
+    /* The same split in two for startup. decode only fills the pixels of the queued files so it
+       can run off the main thread, create_decoded then hands them to on_decoded and frees them. */
+    void                                    decode();
+    void                                    create_decoded( std::function<void( texture_asset* )> on_decoded );
+
+    // every known file goes back in the queue, a new context needs its textures again
+    void                                    requeue_all();
+
+    uint32_t                                get_asset_count() { return static_cast< uint32_t >( m_assets.size() ); }
+    uint32_t                                get_use_count() { return m_uses; }
+
+  private:
+    void                                    _start_decode( std::vector<std::thread>* threads );
+    void                                    _decode_loop();
+
+    std::unordered_map<std::string, std::shared_ptr<texture_asset>> m_assets;
+    std::vector<texture_asset*>             m_decode_queue;
+    std::atomic<uint32_t>                   m_next_decode;
+    uint32_t                                m_uses;
+  };
+}
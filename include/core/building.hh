@@ -22,9 +22,25 @@ http://opensource.org/licenses/MIT
 #include "building_gen.hh"
 #include "drawable.hh"
 
+#define MAX_BUILDING_INSTANCES 3
+// floors of the tallest stack, _get_p_rand( 2, 6, ... ) tops out at 7
+#define MAX_BUILDING_FLOORS 7
+// a spacer ring per stack plus the one the side neighbours share
+#define MAX_SPACER_RINGS ( MAX_BUILDING_INSTANCES + 1 )
+// one spacer per floor of every stack and of the four side neighbours
+#define MAX_SPACER_INSTANCES ( MAX_BUILDING_FLOORS * ( MAX_BUILDING_INSTANCES + 4 ) )
+
 class                                   OpenSimplexNoise;
 
 namespace kretash {
+
+  // A building always keeps LOD2, the finer LODs come and go with the camera
+  enum                                  lod_mask {
+    kLOD0_MASK = 1 << 0,
+    kLOD1_MASK = 1 << 1,
+    kLOD2_MASK = 1 << 2,
+  };
+
   class                                 Building : public Drawable {
   public:
     Building( bool placeholder = false );
@@ -33,17 +49,48 @@ namespace kretash {
     //prepare to generate, reuse safe (should be)
     void                                prepare( float seed_x, float seed_y );
 
-    //main heavy function
-    void                                generate();
+    //main heavy function, everything temporary goes into the worker arena, only the requested LODs get built
+    void                                generate( building_arena* arena );
 
-    //quick clean and upload
+    //quick clean and upload, ready to process again once all the requested LODs are on the GPU
     void                                upload_and_clean();
 
+    //LODs the next generate builds, prepare asks for LOD2 alone
+    void                                request_lods( uint32_t lods ) { m_requested_lods = lods; }
+    uint32_t                            get_requested_lods() { return m_requested_lods; }
+    uint32_t                            get_resident_lods() { return m_resident_lods; }
+
+    //gives a finer LOD's memory back, the slot falls back to the next coarser LOD
+    void                                evict_lod( int32_t LOD );
+
+    //the GPU pool holding the LODs went away, they get generated again on the next generate
+    void                                forget_lods();
+
+    //LOD2 of the building prepare placed, left uncombined in the arena for an HLOD to take, discard it after
+    BuildingGen*                        generate_hlod_part( building_arena* arena );
+
+    //stages the requested LODs again from the swap cache instead of generating them, false if any is missing
+    bool                                restore();
+
+    //drop the generated data without uploading it
+    void                                discard_upload();
+
+    //staging bytes held by the generated LODs until they get uploaded
+    uint64_t                            get_upload_size();
+
+    //vertices of the last generation before and after welding
+    void                                get_vertex_counts( int32_t LOD, uint32_t* unwelded, uint32_t* welded );
+    void                                get_triangle_counts( int32_t LOD, uint32_t* generated, uint32_t* hidden );
+    void                                get_cache_misses( int32_t LOD, uint32_t* unoptimized, uint32_t* optimized );
+
+    //LOD0 vertex bytes the last generation saved by instancing the spacer rings instead of baking every floor's copy
+    uint64_t                            get_spacer_saved_bytes() { return m_spacer_saved_bytes; }
+
     void                                clear();
     bool                                is_empty() { return m_empty; }
     bool                                is_ready_to_process() { return m_ready_to_process; }
     void                                set_ready_to_process( bool r ) { m_ready_to_process = r; }
-    void                                generate_placeholder();
+    void                                generate_placeholder( building_arena* arena );
 
   private:
 
@@ -51,6 +98,12 @@ namespace kretash {
     void                                _generate_modern_building();
     void                                _generate_factory();
 
+    void                                _begin_spacer_ring( building_settings bs );
+    void                                _add_spacer( float3 offset );
+    void                                _generate_spacers( building_scratch* scratch );
+    void                                _release_spacers( bool remove );
+
+    void                                _alias_missing_lods();
     void                                _init_noise( float seed_x, float seed_y );
     int32_t                             _get_p_rand( int32_t min, int32_t max, float sample );
     float                               _get_p_rand( float min, float max, float sample );
@@ -60,13 +113,24 @@ namespace kretash {
     std::shared_ptr<BuildingGen>        m_building_generator_LOD2;
     std::shared_ptr<OpenSimplexNoise>   m_noise_handle;
 
+    // each ring is generated once at the origin, the floors it sits on are its offsets
+    std::shared_ptr<BuildingGen>        m_spacer_generators[MAX_SPACER_RINGS];
+    building_settings                   m_spacer_rings[MAX_SPACER_RINGS];
+    float3                              m_spacer_offsets[MAX_SPACER_INSTANCES];
+    uint32_t                            m_spacer_first[MAX_SPACER_RINGS + 1];
+    uint32_t                            m_spacer_ring_count;
+    uint64_t                            m_spacer_saved_bytes;
+
     bool                                m_empty;
-    bool                                m_ready_to_process;
+    std::atomic_bool                    m_ready_to_process;
+    std::atomic_int                     m_pending_uploads;
+    uint32_t                            m_requested_lods;
+    uint32_t                            m_resident_lods;
     float                               m_noise;
     int32_t                             m_num_floors;
     int32_t                             m_num_sides;
     int32_t                             m_instances;
-    int32_t*                            m_angle_s;
+    int32_t                             m_angle_s[MAX_BUILDING_INSTANCES + 1];
     int32_t                             m_side_neibours;
 
     float                               m_base_size;
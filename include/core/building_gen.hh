@@ -16,24 +16,128 @@ http://opensource.org/licenses/MIT
 
 #pragma once
 #include <vector>
+#include <memory>
+#include <functional>
 #include "types.hh"
 #include "geometry.hh"
+#include "mesh_simplifier.hh"
+#include "mesh_optimizer.hh"
 
 namespace kretash {
+  class                     UploadHandle;
+
+  // Footprint and triangle range of one generated prism, used to find the faces
+  // buried inside its neighbours before the buffers get combined
+  struct                    building_prism {
+    uint32_t                first_triangle;
+    uint32_t                first_corner;
+    uint32_t                sides;
+    uint32_t                floors;
+    float                   floor_height;
+    float                   bottom;
+    float                   top;
+    float2                  center;
+    float2                  min;
+    float2                  max;
+  };
+
+  // Working memory of one BuildingGen while it generates, it keeps its capacity
+  // between buildings so a warm scratch doesn't touch the heap anymore
+  struct                    building_scratch {
+    std::vector<float3>     vertices;
+    std::vector<float3>     normals;
+    std::vector<float2>     uvs;
+    std::vector<uint32_t>   elems;
+    std::vector<float>      angles;
+    std::vector<float>      side_size;
+    std::vector<float3>     ring;
+    std::vector<float3>     ring_normals;
+    std::vector<building_prism> prisms;
+    std::vector<float2>     outlines;
+    std::vector<uint8_t>    hidden;
+
+    std::vector<float>      corners;
+    std::vector<uint32_t>   remap;
+    std::vector<uint32_t>   welded;
+    std::vector<uint64_t>   weld_keys;
+    std::vector<uint32_t>   weld_ids;
+    std::vector<mesh_cluster> clusters;
+    optimize_scratch        optimize;
+
+    void                    clear();
+    uint64_t                get_capacity();
+  };
+
+  // One scratch per LOD, every generator worker owns one of these
+  struct                    building_arena {
+    building_scratch        lod[3];
+    simplify_scratch        simplify;
+
+    uint64_t                get_capacity() {
+      return lod[0].get_capacity() + lod[1].get_capacity() + lod[2].get_capacity() +
+        simplify.get_capacity();
+    }
+  };
+
   class                     BuildingGen : public Geometry {
   public:
     BuildingGen();
     ~BuildingGen();
 
+    void                    begin( building_scratch* scratch );
     void                    generate( building_settings s );
-    float                   get_radius() { return m_radius; }
-    void                    combine_buffers();
-    void                    finish_and_upload();
+
+    // drops the faces buried between prisms, combine_buffers does it if nobody did before
+    void                    remove_hidden_faces();
+
+    // fills this LOD with source's mesh simplified to a share of its triangles, source
+    // has to be generated but not combined yet
+    void                    simplify( BuildingGen* source, float triangle_ratio, float max_error,
+                              bool lock_seams, simplify_scratch* scratch );
+    uint64_t                get_staging_size();
+
+    // copies source's mesh in moved by offset, so several buildings can be combined as one,
+    // source has to be generated or simplified but not combined yet
+    void                    append( BuildingGen* source, float3 offset );
+    // vertices gathered before welding, welding can only bring it down
+    uint32_t                get_gathered_vertex_count() {
+      return m_scratch != nullptr ? static_cast< uint32_t >( m_scratch->vertices.size() ) : 0;
+    }
+
+    // vertices before and after welding the last combine_buffers
+    uint32_t                get_unwelded_vertex_count() { return m_unwelded_vertices; }
+    uint32_t                get_welded_vertex_count() { return m_welded_vertices; }
+
+    // triangles generated and triangles dropped as buried by the last combine_buffers
+    uint32_t                get_generated_triangle_count() { return m_generated_triangles; }
+    uint32_t                get_hidden_triangle_count() { return m_hidden_triangles; }
+
+    // simulated post-transform cache misses before and after reordering the last combine_buffers
+    uint32_t                get_unoptimized_cache_misses() { return m_unoptimized_cache_misses; }
+    uint32_t                get_optimized_cache_misses() { return m_optimized_cache_misses; }
+    // with build_clusters the triangles are grouped for cluster culling and the clusters uploaded too
+    void                    combine_buffers( bool build_clusters = false );
+
+    // combine_buffers keeps a copy in the swap cache, restore stages that copy again instead
+    // of generating, false if there's none
+    void                    set_swap_cached( bool cached ) { m_swap_cached = cached; }
+    bool                    restore();
+    void                    finish_and_upload( std::function<void( UploadHandle* )> on_complete = nullptr );
+    void                    discard();
+    void                    forget_upload();
 
   private:
-    void                    _generate_floor( uint32_t i_s, uint32_t i_f, bool top );
-    void                    _generate_bot_face();
-    void                    _generate_top_face();
+    void                    _clear();
+    void                    _weld_corners( uint32_t stride );
+    void                    _optimize_triangle_order( uint32_t stride, bool build_clusters );
+    void                    _save_prism( uint32_t first_triangle );
+    bool                    _is_inside( const building_prism& p, float2 q );
+    bool                    _contains_segment( const building_prism& p, float2 a, float2 b );
+    void                    _generate_ring();
+    void                    _extrude_ring( float3* vertices, float height, uint32_t lap );
+    void                    _generate_floors( float3* vertices, float3* normals, float2* uvs );
+    void                    _generate_bot_face( float3* vertices, float3* normals, float2* uvs );
+    void                    _generate_top_face( float3* vertices, float3* normals, float2* uvs );
 
     void                    _generate_angles_1( float* angles_array, uint32_t sides );
     void                    _generate_angles_2( float* angles_array, uint32_t sides );
@@ -58,29 +162,29 @@ namespace kretash {
     static const float      angle_set_3[5][3];
     static const float      angle_set_2[5][2];
 
-    std::vector<float3>     n_vertices;
-    std::vector<float3>     n_normals;
-    std::vector<float2>     n_uvs;
-    std::vector<uint32_t>   n_elems;
+    building_scratch*       m_scratch;
     uint32_t                n_elem_offset;
 
-    uint32_t                m_vertex_length;
-    float*                  m_vertex_buffer;
-    uint32_t*               m_elem_buffer;
+    uint32_t                m_unwelded_vertices;
+    uint32_t                m_welded_vertices;
+    uint32_t                m_generated_triangles;
+    uint32_t                m_hidden_triangles;
+    uint32_t                m_unoptimized_cache_misses;
+    uint32_t                m_optimized_cache_misses;
+    bool                    m_swap_cached;
+
+    std::shared_ptr<UploadHandle> m_upload;
+    std::shared_ptr<UploadHandle> m_in_flight;
 
     uint32_t                n_sides;
     uint32_t                n_floors;
     float                   n_floor_height;
     float                   n_base_size;
-    float                   c_angle;
     float*                  n_angles;
     float*                  n_side_size;
-    float3                  c_pos;
-    float3                  c_norm;
-    float2                  n_uv;
+    float3                  ring_drift;
     uint32_t                a_id;
     uint32_t                p_id;
-    float                   m_radius;
     float                   uv_x_min;
     float                   uv_y_min;
     float                   uv_x_max;
@@ -39,6 +39,7 @@ namespace kretash {
     float4x4      get_projection() { return m_projection; }
     float3        get_position() { return m_eye; }
     float3        get_look_direction() { return m_look_dir; }
+    float         get_fov() { return m_fov; }
 
   private:
     float4x4      m_view;
@@ -23,13 +23,41 @@ http://opensource.org/licenses/MIT
 #include <queue>
 #include <map>
 
+// cells on each side of an HLOD tile
+#define HLOD_TILE_SIZE 4
+
 namespace kretash {
 
   class Renderer;
   class Building;
+  class BuildingGen;
   class Drawable;
   class Geometry;
   class Texture;
+  struct building_arena;
+
+  enum                                          hlod_state {
+    kHLOD_EMPTY = 0,
+    kHLOD_QUEUED,
+    kHLOD_READY,
+  };
+
+  // A square of world cells that draws as two meshes once it's far away, its buildings' LOD2
+  // merged together and its street blocks merged together. Slots are reused as the grid scrolls.
+  struct                                        hlod_tile {
+    int32_t                                     x;
+    int32_t                                     z;
+    float3                                      center;
+    bool                                        used;
+    bool                                        dirty;      // members changed since the mesh was built
+    bool                                        failed;     // too big for the index format, drawn cell by cell
+    hlod_state                                  state;
+    std::vector<int32_t>                        members;
+    float3                                      seeds[HLOD_TILE_SIZE * HLOD_TILE_SIZE];
+    std::shared_ptr<Drawable>                   buildings;
+    std::shared_ptr<Drawable>                   streets;
+    std::shared_ptr<BuildingGen>                generator;
+  };
 
   class                                         CityGenerator {
   public:
@@ -40,24 +68,78 @@ namespace kretash {
     void                                        regenerate();
     void                                        generate( std::shared_ptr<Renderer> ren );
     void                                        update();
+    void                                        pause();
+    uint64_t                                    get_upload_queue_bytes() { return m_to_upload_bytes.load(); }
+
+    //vertex count of every building generated so far, before and after welding
+    uint64_t                                    get_unwelded_vertices( int32_t LOD ) { return m_unwelded_vertices[LOD].load(); }
+    uint64_t                                    get_welded_vertices( int32_t LOD ) { return m_welded_vertices[LOD].load(); }
+
+    //triangle count of every building generated so far, and how many were buried and dropped
+    uint64_t                                    get_generated_triangles( int32_t LOD ) { return m_generated_triangles[LOD].load(); }
+    uint64_t                                    get_hidden_triangles( int32_t LOD ) { return m_hidden_triangles[LOD].load(); }
+    uint64_t                                    get_unoptimized_cache_misses( int32_t LOD ) { return m_unoptimized_cache_misses[LOD].load(); }
+    uint64_t                                    get_optimized_cache_misses( int32_t LOD ) { return m_optimized_cache_misses[LOD].load(); }
+
+    //LOD0 vertex bytes instancing the spacer rings saved, over how many LOD0 generations
+    uint64_t                                    get_spacer_saved_bytes() { return m_spacer_saved_bytes.load(); }
+    uint64_t                                    get_spacer_buildings() { return m_spacer_buildings.load(); }
+
+    //generations that ran on an arena that didn't grow, and how many of those still hit the heap
+    uint64_t                                    get_warm_buildings() { return m_warm_buildings.load(); }
+    uint64_t                                    get_allocating_buildings() { return m_allocating_buildings.load(); }
+
+    //buildings that have the given LOD on the GPU right now
+    uint32_t                                    get_resident_buildings( int32_t LOD );
+    uint32_t                                    get_building_count() { return static_cast< uint32_t >( m_buildigs.size() ); }
+
+    //tiles drawing their merged mesh when far, out of the tiles the grid covers
+    void                                        get_hlod_tiles( uint32_t* ready, uint32_t* used );
   private:
 
+    void                                        _create_buildings( int32_t first, int32_t last );
+    void                                        _start_generation();
+    void                                        _sort_nearest_first();
+    void                                        _add_city_drawables();
     void                                        _prepare_vectors();
     void                                        _generate_move_buildings();
     void                                        _apply_move_buildings( uint32_t count );
+    void                                        _schedule_lods( uint32_t count );
+
+    void                                        _assign_tile( int32_t building );
+    void                                        _leave_tile( int32_t slot, int32_t building );
+    void                                        _invalidate_tile( int32_t slot );
+    void                                        _update_hlod_tiles();
+    void                                        _reset_hlod_tiles();
+    void                                        _generate_hlod( hlod_tile* tile, int32_t worker );
 
     void                                        _apply_carry_to_outline( building_details outline );
 
     outline_type                                _oposite( outline_type s );
 
     //threaded function
-    void _generate_loop();
+    void _generate_loop( int32_t worker );
     std::vector<Building*>                      m_to_generate;
     std::mutex                                  m_to_generate_lock;
     std::vector<Building*>                      m_to_upload;
     std::mutex                                  m_to_upload_lock;
+    std::atomic<uint64_t>                       m_to_upload_bytes;
+    std::atomic<uint64_t>                       m_unwelded_vertices[3];
+    std::atomic<uint64_t>                       m_welded_vertices[3];
+    std::atomic<uint64_t>                       m_generated_triangles[3];
+    std::atomic<uint64_t>                       m_hidden_triangles[3];
+    std::atomic<uint64_t>                       m_unoptimized_cache_misses[3];
+    std::atomic<uint64_t>                       m_optimized_cache_misses[3];
+    std::atomic<uint64_t>                       m_spacer_saved_bytes;
+    std::atomic<uint64_t>                       m_spacer_buildings;
+    std::atomic<uint64_t>                       m_warm_buildings;
+    std::atomic<uint64_t>                       m_allocating_buildings;
     std::vector<std::thread>                    m_threads;
+    std::vector<std::shared_ptr<building_arena>> m_arenas;
+    std::shared_ptr<building_arena>             m_placeholder_arena;
     std::atomic_bool                            m_exit_threads;
+    std::atomic_bool                            m_pause_threads;
+    std::atomic_int                             m_busy_threads;
 
     int32_t                                     m_count;
     int32_t                                     m_grid;
@@ -76,5 +158,12 @@ namespace kretash {
     std::vector<building_details>               m_all_buildings;
     std::vector<building_details>               m_outline_positions;
     std::vector<move_operation>                 m_move_operations;
+
+    std::vector<hlod_tile>                      m_tiles;
+    std::vector<int32_t>                        m_building_tile;
+    std::vector<hlod_tile*>                     m_hlod_to_generate;
+    std::vector<hlod_tile*>                     m_hlod_to_upload;
+    std::vector<std::shared_ptr<Building>>      m_hlod_builders;
+    std::shared_ptr<Geometry>                   m_street_tile;
   };
 }
\ No newline at end of file
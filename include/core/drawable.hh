@@ -22,6 +22,14 @@ http://opensource.org/licenses/MIT
 #include "base.hh"
 
 namespace kretash {
+
+  // A small mesh a drawable repeats at several offsets from its origin, like the spacer
+  // rings between the floors of a building, drawn through the instanced batches
+  struct                            instanced_part {
+    std::shared_ptr<Geometry>       geometry;
+    std::vector<float3>             offsets;
+  };
+
   class                             Drawable : public Base {
   public:
     Drawable();
@@ -39,9 +47,30 @@ namespace kretash {
     void                            set_offsets( int32_t  cvb, int32_t  srv );
     void                            set_frustum_size( float radious, float max_height );
     void                            set_ignore_frustum();
+    void                            fit_bounds();
     void                            set_active( bool a ) { m_in_frustum = a; }
     void                            set_distance( float d ) { m_distance = d; }
 
+    // a far tile can stand in for this drawable, see RenderManager::_hlod_visible
+    void                            set_hlod( Drawable* h ) { m_hlod = h; }
+    Drawable*                       get_hlod() { return m_hlod; }
+
+    // drawables standing in for a whole tile, only drawn once their merged mesh is ready
+    void                            set_is_hlod( bool h ) { m_is_hlod = h; }
+    bool                            is_hlod() { return m_is_hlod; }
+    void                            set_hlod_ready( bool r ) { m_hlod_ready = r; }
+    bool                            is_hlod_ready() { return m_hlod_ready; }
+
+    // drawables sharing a mesh with many others, drawn in one instanced draw per mesh
+    void                            set_instanced( bool i ) { m_instanced = i; }
+    bool                            is_instanced() { return m_instanced; }
+
+    // parts are drawn with the drawable's model while it shows LOD0, max_instances bounds
+    // how many offsets the parts can ever add up to so the instance stream can be sized once
+    std::vector<instanced_part>*    get_instanced_parts() { return &m_instanced_parts; }
+    void                            set_max_part_instances( uint32_t m ) { m_max_part_instances = m; }
+    uint32_t                        get_max_part_instances() { return m_max_part_instances; }
+
     int32_t                         get_drawable_id() { return drawable_id; }
     xxDrawable*                     get_drawable() { return m_drawable.get(); }
     xxDescriptorBuffer*             get_buffer() { return m_buffer.get(); }
@@ -51,22 +80,35 @@ namespace kretash {
     Geometry*                       get_geometry() { return m_geometry[m_geo_lod].get(); }
     Geometry*                       get_geometry( int32_t  lod ) { return m_geometry[lod].get(); }
     float3                          get_position() { return m_position; }
+    float3                          get_scale() { return m_scale; }
+    float3                          get_rotation() { return m_rotation; }
     float4x4                        get_model();
     int32_t                         get_cvb_offset() { return m_offsets.cbv_offset; }
     int32_t                         get_srv_offset() { return m_offsets.srv_offset; }
-    const float                     get_max_height() const { return m_max_height; }
     const float                     get_radius() const { return m_radius; }
+    void                            get_world_sphere( float3* center, float* radius );
+    void                            get_world_bounds( float3* min, float3* max );
     const float                     get_distance() const { return m_distance; }
     const bool                      get_active() const { return m_in_frustum; }
+    int32_t                         get_max_lod() { return m_has_lod; }
+    int32_t                         get_lod() { return m_geo_lod; }
 
   protected:
     int32_t                         drawable_id;
     float                           m_distance;
     float                           m_radius;
+    float3                          m_sphere_center;
+    float3                          m_bounds_min;
+    float3                          m_bounds_max;
     bool                            m_in_frustum;
     int32_t                         m_has_lod;
     int32_t                         m_geo_lod;
-    float                           m_max_height;
+    Drawable*                       m_hlod;
+    bool                            m_is_hlod;
+    bool                            m_hlod_ready;
+    bool                            m_instanced;
+    uint32_t                        m_max_part_instances;
+    std::vector<instanced_part>     m_instanced_parts;
 
     std::shared_ptr<xxDrawable>     m_drawable;
     std::shared_ptr<xxDescriptorBuffer>       m_buffer;
@@ -36,6 +36,7 @@ namespace                   kretash {
     GRP_SRV,
     GRP_CONSTANT_CBV,
     GRP_SAMPLER,
+    GRP_INSTANCE_SRV,
     GRP_COUNT,
   };
 
@@ -111,7 +112,7 @@ namespace                   kretash {
     virtual void            create_indirect_command_buffer( xxRenderer* r, Drawable** draw, uint32_t d_count ) final;
 
     /* This will update the indirect command buffer in D3D12 and do nothing in D3D12*/
-    virtual void            update_indirect_command_buffer( xxRenderer* r, Drawable** draw, uint32_t d_count ) final;
+    virtual void            update_indirect_command_buffer( xxRenderer* r, draw_range* ranges, uint32_t r_count ) final;
 
     /* This will reset the render command list in Vulkan and D3D12 */
     virtual void            reset_render_command_list( Window* w ) final;
@@ -126,7 +127,10 @@ namespace                   kretash {
     virtual void            record_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) final;
 
     /* This will record indirect commands list in D3D12 and normal ones in Vulkan */
-    virtual void            record_indirect_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) final;
+    virtual void            record_indirect_commands( xxRenderer* r, Window* w, draw_range* ranges, uint32_t r_count ) final;
+
+    /* This will record one instanced draw per batch in Vulkan and D3D12 */
+    virtual void            record_instanced_commands( xxRenderer* r, Window* w, instance_batch* batches, uint32_t b_count ) final;
 
     /* This will execute the command list in Vulkan and D3D12 */
     virtual void            execute_render_command_list() final;
@@ -137,7 +141,18 @@ namespace                   kretash {
     /* This will wait for render to finish in Vulkan and D3D12 */
     virtual void            wait_render_completition() final;
 
+    /* This will signal the frame fence with the given frame number in Vulkan and D3D12 */
+    virtual void            signal_frame( uint64_t frame ) final;
+
+    /* This will return the last frame retired by the GPU in Vulkan and D3D12 */
+    virtual uint64_t        get_completed_frame() final;
+
+    /* This will wait until the given frame has been retired in Vulkan and D3D12 */
+    virtual void            wait_for_frame( uint64_t frame ) final;
+
   private:
+    void _bind_draw_state( xxRenderer* r, ID3D12PipelineState* pipeline );
+
     m_ptr<ID3D12Debug>                      m_debug_controller = nullptr;
     m_ptr<IDXGIFactory4>                    factory = nullptr;
     m_ptr<IDXGISwapChain3>                  m_swap_chain = nullptr;
@@ -171,6 +186,9 @@ namespace                   kretash {
     uint32_t                                m_pipeline_state_object_id_counter = 0;
     bool                                    m_fence_texture_upload_pending = false;
     uint64_t                                m_fence_texture_upload = 0;
+    HANDLE                                  m_frame_fence_event{};
+    m_ptr<ID3D12Fence>                      m_frame_fence = nullptr;
+    uint64_t                                m_submitted_frame = 0;
     bool                                    m_msaa_enabled = false;
     int32_t                                 m_mssa_count = 1;
   };
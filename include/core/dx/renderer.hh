@@ -52,6 +52,12 @@ namespace                   kretash {
     /* This will update the instance buffers object in Vulkan and D3D12 */
     virtual void update_instance_buffer_objects( std::vector<Drawable*>* d, std::vector<instance_buffer>* ib ) final;
 
+    /* This will create the instance stream read by the instanced draws in Vulkan and D3D12 */
+    virtual void            create_instance_stream( uint32_t max_instances ) final;
+
+    /* This will update the first count instances of the instance stream in Vulkan and D3D12 */
+    virtual void            update_instance_stream( std::vector<instance_buffer>* s, uint32_t count ) final;
+
     /* This will create the root signature in Vulkan and D3D12 */
     virtual void            create_root_signature() final;
 
@@ -61,7 +67,7 @@ namespace                   kretash {
   private:
 
     void _show_shader_error_message( ID3D10Blob* errorMessage, std::wstring filename );
-    void _load_and_compile_shaders( render_type s );
+    void _load_and_compile_shaders( render_type s, bool instanced = false );
 
     m_ptr<ID3D12CommandSignature>           m_command_signature = nullptr;
     std::vector<indirect_command>           m_indirect_commands = {};
@@ -76,12 +82,15 @@ namespace                   kretash {
     m_ptr<ID3DBlob>                         pixelShader = nullptr;
     m_ptr<ID3D12RootSignature>              m_root_signature = nullptr;
     m_ptr<ID3D12PipelineState>              m_pipeline_state = nullptr;
+    m_ptr<ID3D12PipelineState>              m_instanced_pipeline_state = nullptr;
     uint32_t                                m_pipeline_state_id = 0;
 
     m_ptr<ID3D12Resource>                   m_instance_buffer = nullptr;
     uint8_t*                                m_instance_buffer_WO = nullptr;
     D3D12_CONSTANT_BUFFER_VIEW_DESC         m_instance_buffer_desc = {};
 
+    m_ptr<ID3D12Resource>                   m_instance_stream = nullptr;
+
     m_ptr<ID3D12Resource>                   m_constant_buffer = nullptr;
     uint8_t*                                m_constant_buffer_WO = nullptr;
     D3D12_CONSTANT_BUFFER_VIEW_DESC         m_constant_buffer_desc {};
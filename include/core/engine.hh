@@ -19,6 +19,8 @@ http://opensource.org/licenses/MIT
 #include "types.hh"
 #include <memory>
 #include <vector>
+#include <atomic>
+#include <mutex>
 
 #define k_engine (kretash::Engine::get_instance())
 
@@ -38,6 +40,8 @@ namespace kretash {
   class                             Interface;
   class                             Factory;
   class                             CityGenerator;
+  class                             StartupGraph;
+  class                             SwapCache;
   class                             xxContext;
 
   class                             Engine : public Base {
@@ -80,10 +84,14 @@ namespace kretash {
     Input*                          get_input();
     Factory*                        get_factory();
     Interface*                      get_interface();
+    StartupGraph*                   get_startup() { return m_startup.get(); }
+    SwapCache*                      get_swap_cache() { return m_swap_cache.get(); }
     int32_t                         get_total_drawables();
     int32_t                         new_id();
     int64_t                         get_device_pool_size() { return m_device_pool_size; }
     int64_t                         get_host_visible_pool_size() { return m_host_visible_pool_size; }
+    uint64_t                        get_frame() { return m_frame; }
+    uint64_t                        get_completed_frame();
 
     void                            set_renderer( Renderer* r );
     void                            save_geometry( Geometry* g );
@@ -107,13 +115,17 @@ namespace kretash {
     std::shared_ptr<Input>          m_input;
     std::shared_ptr<Interface>      m_interface;
     std::shared_ptr<Factory>        m_factory;
+    std::shared_ptr<StartupGraph>   m_startup;
+    std::shared_ptr<SwapCache>      m_swap_cache;
     Renderer*                       m_renderers[rCOUNT];
     std::vector<Geometry*>          m_geometries;
+    std::mutex                      m_geometries_lock;
     CityGenerator*                  m_city;
 
     bool                            m_is_running;
-    int32_t                         m_drawable_id_count;
+    std::atomic<int32_t>            m_drawable_id_count;
     int64_t                         m_device_pool_size;
     int64_t                         m_host_visible_pool_size;
+    uint64_t                        m_frame;
   };
 }
\ No newline at end of file
@@ -17,6 +17,7 @@ http://opensource.org/licenses/MIT
 #pragma once
 #include <memory>
 #include <vector>
+#include <mutex>
 
 namespace                    kretash {
 
@@ -57,5 +58,6 @@ namespace                    kretash {
     std::vector<std::shared_ptr<xxDescriptorBuffer>*>     m_descriptors;
     std::vector<std::shared_ptr<xxTexture>*>              m_textures;
     std::vector<std::shared_ptr<xxGeometry>*>             m_geometries;
+    std::mutex                                            m_lock;     // drawables are made on the startup workers too
   };
 }
\ No newline at end of file
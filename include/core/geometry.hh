@@ -16,30 +16,64 @@ http://opensource.org/licenses/MIT
 
 #pragma once
 #include <string>
+#include <vector>
+#include <cstdint>
 
 #include "engine.hh"
 
 namespace kretash {
+  struct              mesh_cache_header;
+
   class               Geometry {
   public:
     Geometry();
     Geometry( const Geometry* c );
     ~Geometry();
 
-    void              load( std::string filename );
+    // with a tile bigger than one the mesh is repeated tile x tile times, spacing apart, around the origin
+    void              load( std::string filename, int32_t tile = 1, float spacing = 0.0f );
     void              reload();
 
     void              set_vertex_offset( int32_t v ) { m_vertex_offset = v; }
     void              set_index_offset( uint32_t i ) { m_indicies_offset = i; }
     void              set_indicies_count( uint32_t c ) { m_indicies_count = c; }
+    void              set_clusters( uint32_t offset, uint32_t count ) { m_cluster_offset = offset; m_cluster_count = count; }
 
     uint32_t          get_indicies_count() { return m_indicies_count; }
     uint32_t          get_indicies_offset() { return m_indicies_offset; }
     int               get_vertex_offset() { return m_vertex_offset; }
+
+    // where this geometry's clusters start in the GPU pool, count is 0 without clusters
+    uint32_t          get_cluster_offset() { return m_cluster_offset; }
+    uint32_t          get_cluster_count() { return m_cluster_count; }
+    float3            get_bounds_min() { return m_bounds_min; }
+    float3            get_bounds_scale() { return m_bounds_scale; }
+    float3            get_sphere_center() { return m_sphere_center; }
+    float             get_sphere_radius() { return m_sphere_radius; }
+
+    // how far this LOD can be from the full detail mesh, in object units
+    float             get_lod_error() { return m_lod_error; }
   protected:
+    void              _parse_obj( std::string filename_, std::vector<float>* vertices, std::vector<uint32_t>* elements );
+    void              _upload_mesh( const float* vertices, uint32_t vertex_count, const uint32_t* indices,
+                        uint32_t index_count, int32_t tile, float spacing, const mesh_cache_header* cache );
+    void              _encode_vertices( const float* vertices, const uint32_t* ids, uint32_t count, float* out );
+    void              _encode_indices( const uint32_t* indices, uint32_t count, uint32_t* out );
+    void              _fit_bounds( const float* vertices, const uint32_t* ids, uint32_t count );
+    void              _fit_sphere( const float* vertices, const uint32_t* ids, uint32_t count );
+
     std::string       m_filename;
+    int32_t           m_tile;
+    float             m_tile_spacing;
     uint32_t          m_indicies_count;
     uint32_t          m_indicies_offset;
     int32_t           m_vertex_offset;
+    uint32_t          m_cluster_offset;
+    uint32_t          m_cluster_count;
+    float3            m_bounds_min;
+    float3            m_bounds_scale;
+    float3            m_sphere_center;
+    float             m_sphere_radius;
+    float             m_lod_error;
   };
 }
\ No newline at end of file
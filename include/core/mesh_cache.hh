@@ -0,0 +1,79 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+#pragma once
+#include <string>
+#include <cstdint>
+#include "math/float3.hh"
+
+// bump it whenever the layout or the processing behind the vertices changes
+#define MESH_CACHE_VERSION 1
+#define MESH_CACHE_EXTENSION ".kmesh"
+
+namespace kretash {
+
+  /* Start of the binary mesh written next to an OBJ. The vertices are the 14 float layout
+     with the tangents and the triangle order already worked out, followed by 32 bit indices.
+     The source size and write time tell when the OBJ changed under the cache. */
+  struct                    mesh_cache_header {
+    uint32_t                magic;
+    uint32_t                version;
+    uint32_t                vertex_stride;
+    uint32_t                vertex_count;
+    uint32_t                index_count;
+    uint32_t                pad;
+    uint64_t                source_size;
+    uint64_t                source_time;
+    float3                  bounds_min;
+    float3                  bounds_scale;
+    float3                  sphere_center;
+    float                   sphere_radius;
+  };
+
+  // A cache file mapped read only, the vertices go from the mapping straight into the staging memory
+  class                     MeshCacheView {
+  public:
+    MeshCacheView();
+    ~MeshCacheView();
+
+    // false when the cache is missing, broken or older than its OBJ
+    bool                    open( std::string cache_path, std::string source_path );
+
+    const mesh_cache_header* get_header() { return reinterpret_cast< const mesh_cache_header* >( m_data ); }
+    const float*            get_vertices() { return reinterpret_cast< const float* >( m_data + sizeof( mesh_cache_header ) ); }
+    const uint32_t*         get_indices();
+
+  private:
+    void                    _close();
+
+    void*                   m_file;
+    void*                   m_mapping;
+    const uint8_t*          m_data;
+    uint64_t                m_size;
+  };
+
+  namespace mesh_cache {
+
+    // the cache sits next to the OBJ, teapot.obj gets teapot.kmesh
+    std::string             get_cache_path( std::string source_path );
+
+    /* Writes the cache of source_path through a temporary file so a half written cache is
+       never picked up. Failing to write it only costs parsing the OBJ again next time. */
+    bool                    write( std::string cache_path, std::string source_path, const float* vertices,
+                              uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+                              float3 bounds_min, float3 bounds_scale, float3 sphere_center, float sphere_radius );
+  }
+}
@@ -0,0 +1,104 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "math/float3.hh"
+
+namespace kretash {
+
+  /* A contiguous run of triangles inside a geometry's index range, with a sphere around it
+     and a cone holding all its normals. cone_cutoff is 1 when the normals spread too much
+     for the cluster to ever be back facing as a whole. */
+  struct                    mesh_cluster {
+    uint32_t                first_index;
+    uint32_t                index_count;
+    float3                  center;
+    float                   radius;
+    float3                  cone_axis;
+    float                   cone_cutoff;
+  };
+
+  // What a FIFO post-transform cache of a given size does with an index buffer
+  struct                    vertex_cache_stats {
+    uint32_t                misses;
+    float                   acmr;
+    float                   atvr;
+
+    vertex_cache_stats() :
+      misses( 0 ),
+      acmr( 0.0f ),
+      atvr( 0.0f ) {
+    }
+  };
+
+  // Working memory of the optimizer, it keeps its capacity between meshes
+  struct                    optimize_scratch {
+    std::vector<uint32_t>   source;
+    std::vector<uint32_t>   live;
+    std::vector<uint32_t>   adjacency_offset;
+    std::vector<uint32_t>   adjacency;
+    std::vector<uint32_t>   cache_time;
+    std::vector<uint8_t>    emitted;
+    std::vector<uint32_t>   dead_end;
+    std::vector<uint32_t>   candidates;
+
+    std::vector<uint32_t>   clusters;
+    std::vector<float>      sort_keys;
+    std::vector<uint32_t>   order;
+    std::vector<uint32_t>   remap;
+    std::vector<float3>     triangle_normals;
+    std::vector<uint32_t>   cluster_vertices;
+
+    uint64_t                get_capacity();
+  };
+
+  namespace mesh_optimizer {
+
+    /* Tipsify: reorders the triangles in place so they fan around vertices that are still
+       in a post-transform cache of cache_size entries. */
+    void                    optimize_vertex_cache( uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+                              uint32_t cache_size, optimize_scratch* scratch );
+
+    /* Cuts a cache optimized triangle order into clusters, letting the ACMR grow by threshold,
+       and sorts the clusters so the ones facing out of the mesh are drawn first. Positions are
+       the first three floats of every stride, picked by ids when there are ids. */
+    void                    optimize_overdraw( uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+                              const float* vertices, uint32_t stride, const uint32_t* ids,
+                              uint32_t cache_size, float threshold, optimize_scratch* scratch );
+
+    /* Regroups the triangles into clusters of up to max_vertices and max_triangles that face
+       roughly the same way, every cluster ends up as a contiguous range of elems. Seeds follow
+       the current order, so clusters come out in the order the triangles were. The vertices
+       need their normal right after the position, it decides which side a triangle faces. */
+    void                    build_clusters( uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+                              const float* vertices, uint32_t stride, const uint32_t* ids,
+                              uint32_t max_vertices, uint32_t max_triangles, optimize_scratch* scratch,
+                              std::vector<mesh_cluster>* out_clusters );
+
+    /* Renumbers the vertices in the order the triangles first use them. ids maps every vertex
+       to its data and gets permuted the same way, returns the vertices still referenced. */
+    uint32_t                optimize_vertex_fetch( uint32_t* elems, uint32_t elem_count, uint32_t* ids,
+                              uint32_t vertex_count, optimize_scratch* scratch );
+
+    /* Runs the index buffer through a FIFO cache, ACMR is misses per triangle and ATVR
+       misses per referenced vertex. */
+    vertex_cache_stats      analyze_vertex_cache( const uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+                              uint32_t cache_size, optimize_scratch* scratch );
+  }
+}
@@ -0,0 +1,96 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+
+#pragma once
+#include <vector>
+#include <cstdint>
+#include "math/float3.hh"
+#include "math/float2.hh"
+
+namespace kretash {
+
+  /* Indexed triangle mesh the simplifier reads, every vertex is a wedge: a position
+     with its own normal and uv. Wedges on the same position are welded for the topology
+     and their attributes are kept as seams. */
+  struct                    simplify_mesh {
+    const float3*           positions;
+    const float3*           normals;
+    const float2*           uvs;
+    uint32_t                vertex_count;
+
+    const uint32_t*         elems;
+    uint32_t                elem_count;
+
+    simplify_mesh() :
+      positions( nullptr ),
+      normals( nullptr ),
+      uvs( nullptr ),
+      vertex_count( 0 ),
+      elems( nullptr ),
+      elem_count( 0 ) {
+    }
+  };
+
+  struct                    quadric {
+    double                  a2, ab, ac, ad;
+    double                  b2, bc, bd;
+    double                  c2, cd;
+    double                  d2;
+  };
+
+  struct                    simplify_collapse {
+    float                   cost;
+    uint32_t                from;
+    uint32_t                to;
+    uint32_t                from_stamp;
+    uint32_t                to_stamp;
+  };
+
+  // Working memory of the simplifier, it keeps its capacity between meshes
+  struct                    simplify_scratch {
+    std::vector<uint32_t>   wedge_position;
+    std::vector<float3>     positions;
+    std::vector<uint64_t>   hash_keys;
+    std::vector<uint32_t>   hash_ids;
+    std::vector<quadric>    quadrics;
+    std::vector<uint32_t>   parent;
+    std::vector<uint32_t>   stamp;
+
+    std::vector<uint32_t>   triangles;
+    std::vector<uint8_t>    alive;
+    std::vector<uint32_t>   list_head;
+    std::vector<uint32_t>   list_tail;
+    std::vector<uint32_t>   node_triangle;
+    std::vector<uint32_t>   node_next;
+
+    std::vector<simplify_collapse> heap;
+    std::vector<uint32_t>   map_from;
+    std::vector<uint32_t>   map_to;
+
+    uint64_t                get_capacity();
+  };
+
+  namespace mesh_simplifier {
+
+    /* Quadric error edge collapse down to target_triangles, no collapse moves the surface
+       more than max_error. With lock_seams a wedge can only merge with a wedge across the
+       same triangle, so uv and normal seams stay where they are. Writes the kept triangles
+       as indices into the input vertices and returns the geometric error of the result. */
+    float                   simplify( const simplify_mesh& mesh, uint32_t target_triangles, float max_error,
+                              bool lock_seams, simplify_scratch* scratch, std::vector<uint32_t>* out_elems );
+  }
+}
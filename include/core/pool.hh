@@ -16,6 +16,8 @@ http://opensource.org/licenses/MIT
 
 #pragma once
 #include <vector>
+#include <string>
+#include <fstream>
 
 namespace kretash {
 
@@ -24,6 +26,10 @@ namespace kretash {
   enum pool_type {
     kDEVICE_MEMORY = 0,
     kHOST_VISIBLE = 1,
+    kCPU_STAGING = 2,
+    kVERTEX_BUFFER = 3,
+    kINDEX_BUFFER = 4,
+    kCLUSTER_BUFFER = 5,
   };
 
   class Pool {
@@ -33,11 +39,28 @@ namespace kretash {
 
     void                              init( uint64_t size, pool_type t );
     mem_block                         get_mem( uint64_t size );
+    bool                              try_get_mem( uint64_t size, mem_block* m );
     void                              release( mem_block m );
     void                              defrag();
 
+    // stats and checks, linear in the number of blocks
+    uint64_t                          get_size() { return m_size; }
+    uint64_t                          get_free_size();
+    uint64_t                          get_largest_free_block();
+    uint32_t                          get_free_block_count() { return ( uint32_t ) m_free_memory.size(); }
+    uint32_t                          get_used_block_count() { return ( uint32_t ) m_used_memory.size(); }
+    bool                              validate();
+
+    // writes every allocation and release into a text file to replay it later
+    void                              record_trace( std::string filename );
+    void                              stop_trace();
+
   private:
+    void                              _trace( char op, uint64_t start, uint64_t size );
+
     pool_type                         m_pool_type;
+    uint64_t                          m_size;
+    std::ofstream                     m_trace;
     std::vector<mem_block>            m_free_memory;
     std::vector<mem_block>            m_used_memory;
   };
@@ -33,13 +33,28 @@ namespace kretash {
     int32_t                 get_active_render_bin_size() { return static_cast< int32_t >( m_active_render_bin.size() ); }
     std::vector<Drawable*>* get_active_render_bin() { return &m_active_render_bin; }
 
+    // visible instanced drawables, the renderer batches them by mesh
+    std::vector<Drawable*>* get_instanced_bin() { return &m_instanced_bin; }
+
+    uint32_t                get_draw_range_count() { return static_cast< uint32_t >( m_draw_ranges.size() ); }
+    draw_range*             get_draw_ranges() { return m_draw_ranges.data(); }
+    uint32_t                get_total_clusters() { return m_total_clusters; }
+    uint32_t                get_visible_clusters() { return m_visible_clusters; }
+
   private:
-    bool                    _inside_frustum( float3 point, float r, float maxh );
+    bool                    _inside_frustum( Drawable* d );
+    int32_t                 _select_lod( Drawable* d, float distance, float world_per_pixel );
+    void                    _add_draw_ranges( Drawable* d, float3 camera );
+    bool                    _hlod_visible( Drawable* d, float3 camera, float hlod_distance );
 
     void                    _generate_frustum_planes();
     plane                   m_frustum_planes[6];
 
     std::vector<Drawable*>  m_render_bin;
     std::vector<Drawable*>  m_active_render_bin;
+    std::vector<Drawable*>  m_instanced_bin;
+    std::vector<draw_range> m_draw_ranges;
+    uint32_t                m_total_clusters;
+    uint32_t                m_visible_clusters;
   };
 }
\ No newline at end of file
@@ -23,6 +23,7 @@ http://opensource.org/licenses/MIT
 
 namespace kretash {
   class                       xxRenderer;
+  class                       Geometry;
   class                       Renderer : public Base {
   public:
     Renderer();
@@ -36,15 +37,37 @@ namespace kretash {
 
     std::vector<Drawable*>*         get_render_bin() { return m_render_manager->get_active_render_bin(); }
     int                             get_render_bin_size() { return m_render_manager->get_active_render_bin_size(); }
+    draw_range*                     get_draw_ranges() { return m_render_manager->get_draw_ranges(); }
+    uint32_t                        get_draw_range_count() { return m_render_manager->get_draw_range_count(); }
+    uint32_t                        get_total_clusters() { return m_render_manager->get_total_clusters(); }
+    uint32_t                        get_visible_clusters() { return m_render_manager->get_visible_clusters(); }
+    instance_batch*                 get_instance_batches() { return m_instance_batches.data(); }
+    uint32_t                        get_instance_batch_count() { return static_cast< uint32_t >( m_instance_batches.size() ); }
+    uint32_t                        get_instance_count() { return static_cast< uint32_t >( m_instance_refs.size() ); }
     xxRenderer*                     get_renderer() { return m_renderer.get(); }
     render_type                     get_renderer_type() { return m_render_type; }
 
   private:
+    // one instance of a batch, an instanced drawable or one offset of a drawable's part
+    struct                          instance_ref {
+      Geometry*                     geometry;
+      Drawable*                     drawable;
+      float3                        offset;
+    };
+
+    void                            _set_bounds( instance_buffer* ib, Geometry* g );
+    void                            _write_instance( instance_buffer* ib, Drawable* d, Geometry* g, float4x4 model,
+                                      float4x4 view_proj, bool vulkan );
+    void                            _build_instance_batches( float4x4 view_proj, bool vulkan );
+
     std::shared_ptr<xxRenderer>     m_renderer;
     render_type                     m_render_type;
     int32_t                         m_render_bin_objects;
     int32_t                         m_cbv_srv_offset;
     std::vector<instance_buffer>    m_instance_buffer;
+    std::vector<instance_buffer>    m_instance_stream;
+    std::vector<instance_batch>     m_instance_batches;
+    std::vector<instance_ref>       m_instance_refs;
     std::shared_ptr<RenderManager>  m_render_manager;
   };
 }
\ No newline at end of file
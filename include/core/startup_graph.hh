@@ -0,0 +1,82 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+
+namespace kretash {
+
+  enum                                      startup_state {
+    kSTAGE_WAITING = 0,
+    kSTAGE_RUNNING,
+    kSTAGE_DONE,
+  };
+
+  // One step of getting to the first frame, start and end are milliseconds since the engine started
+  struct                                    startup_stage {
+    std::string                             name;
+    std::function<void()>                   task;
+    std::vector<int32_t>                    after;
+    bool                                    main_thread;
+    startup_state                           state;
+    int32_t                                 thread;     // 0 is the main thread
+    double                                  start;
+    double                                  end;
+  };
+
+  /* The stages the engine and the city go through before the first frame. Stages that don't
+     depend on each other run at the same time, the ones touching the context stay on the main
+     thread. Every stage is kept so the whole startup can be looked at once the first frame is out. */
+  class                                     StartupGraph {
+  public:
+    StartupGraph();
+    ~StartupGraph();
+
+    /* Adds a stage that waits for the stages in after, which have to be added before it.
+       Returns the id other stages can wait on. */
+    int32_t                                 add( std::string name, std::function<void()> task,
+                                              std::vector<int32_t> after, bool main_thread );
+
+    // runs every stage added since the last run, returns once all of them are done
+    void                                    run();
+
+    // the first frame is out, prints the timeline the first time it's called
+    void                                    finish();
+
+    uint32_t                                get_stage_count() { return static_cast< uint32_t >( m_stages.size() ); }
+    const startup_stage*                    get_stage( uint32_t i ) { return m_stages[i].get(); }
+    double                                  get_first_frame_time() { return m_first_frame; }
+
+  private:
+    void                                    _worker_loop( int32_t thread );
+    startup_stage*                          _take_stage( bool main_thread );
+    void                                    _run_stage( startup_stage* s, int32_t thread );
+    double                                  _now();
+
+    std::vector<std::shared_ptr<startup_stage>> m_stages;
+    std::mutex                              m_lock;
+    std::atomic<uint32_t>                   m_remaining;
+    uint32_t                                m_first_pending;
+    double                                  m_first_frame;
+    std::chrono::high_resolution_clock::time_point m_start;
+  };
+}
@@ -0,0 +1,99 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+#pragma once
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <unordered_map>
+
+#include "types.hh"
+#include "texture.hh"
+#include "mesh_optimizer.hh"
+
+namespace kretash {
+
+  class                                     Geometry;
+
+  // A generated mesh before any context encoded it, 14 float vertices and 32 bit indices
+  struct                                    cached_mesh {
+    std::vector<float>                      vertices;
+    std::vector<uint32_t>                   indices;
+    std::vector<mesh_cluster>               clusters;
+    float                                   lod_error;
+  };
+
+  // The pixels of a procedural texture the way they went to the GPU, at the LOD they were made for
+  struct                                    cached_texture {
+    unsigned char*                          pixels[tCOUNT];
+    int32_t                                 width[tCOUNT];
+    int32_t                                 height[tCOUNT];
+    int32_t                                 channels[tCOUNT];
+    uint8_t                                 LOD;
+  };
+
+  /* CPU copies of what the city generated, kept out of the context so an API swap only has to
+     upload them again instead of generating everything from scratch. Entries are found by the
+     geometry or texture that made them and are only good until it gets something else. Whatever
+     doesn't fit the budget isn't kept, it just gets generated again. */
+  class                                     SwapCache {
+  public:
+    SwapCache( uint64_t budget );
+    ~SwapCache();
+
+    // copies the vertices picked by ids, or the first vertex_count without ids
+    void                                    store_mesh( const Geometry* owner, const float* vertices, const uint32_t* ids,
+                                              uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+                                              const mesh_cluster* clusters, uint32_t cluster_count, float lod_error );
+    std::shared_ptr<cached_mesh>            find_mesh( const Geometry* owner );
+    bool                                    has_mesh( const Geometry* owner );
+    void                                    forget_mesh( const Geometry* owner );
+
+    /* Takes over pixels, allocated with new[] and w x h x 4 bytes, for one map of owner.
+       False when it doesn't fit, the caller still owns them then. */
+    bool                                    store_texture( const Texture* owner, texture_t t, unsigned char* pixels,
+                                              int32_t width, int32_t height, int32_t channels, uint8_t LOD );
+
+    // all the maps of owner at LOD, nothing if any of them is missing
+    bool                                    find_texture( const Texture* owner, uint8_t LOD, cached_texture* out );
+    void                                    forget_texture( const Texture* owner );
+    void                                    forget_textures();
+
+    // what came back from the cache since the last swap started
+    void                                    begin_swap() { m_restored_meshes.store( 0 ); m_restored_textures.store( 0 ); }
+    void                                    count_restored_mesh() { ++m_restored_meshes; }
+    void                                    count_restored_texture() { ++m_restored_textures; }
+    uint32_t                                get_restored_meshes() { return m_restored_meshes.load(); }
+    uint32_t                                get_restored_textures() { return m_restored_textures.load(); }
+
+    uint64_t                                get_size() { return m_size.load(); }
+    uint64_t                                get_budget() { return m_budget; }
+
+  private:
+    uint64_t                                _mesh_size( const cached_mesh* m );
+    uint64_t                                _texture_size( const cached_texture* t );
+    void                                    _free_texture( cached_texture* t );
+
+    std::unordered_map<const Geometry*, std::shared_ptr<cached_mesh>> m_meshes;
+    std::unordered_map<const Texture*, cached_texture> m_textures;
+    std::mutex                              m_lock;
+    std::atomic<uint64_t>                   m_size;
+    uint64_t                                m_budget;
+    std::atomic<uint32_t>                   m_restored_meshes;
+    std::atomic<uint32_t>                   m_restored_textures;
+  };
+}
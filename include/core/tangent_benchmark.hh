@@ -0,0 +1,71 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+
+#pragma once
+#include <vector>
+#include <string>
+
+#include "types.hh"
+
+namespace kretash {
+
+  struct                              tangent_mesh {
+    std::string                       name;
+    std::vector<float>                positions;
+    std::vector<float>                normals;
+    std::vector<float>                uvs;
+    std::vector<uint32_t>             elems;
+  };
+
+  struct                              tangent_report {
+    std::string                       name;
+    uint32_t                          triangles;
+    uint32_t                          iterations;
+    double                            reference_time;
+    double                            kernel_time;
+    float                             max_difference;
+
+    tangent_report() :
+      name(),
+      triangles( 0 ),
+      iterations( 0 ),
+      reference_time( 0.0 ),
+      kernel_time( 0.0 ),
+      max_difference( 0.0f ) {
+    }
+  };
+
+  /* Times the shared tangent kernel against the scalar loop BuildingGen and Geometry::load
+     used to run, on LOD0 sized buildings and on teapot.obj, and checks both give the same vertices. */
+  class                               TangentBenchmark {
+  public:
+    TangentBenchmark();
+    ~TangentBenchmark();
+
+    bool                              run();
+    void                              print_reports();
+
+  private:
+    void                              _add_buildings();
+    bool                              _add_obj( std::string filename );
+    void                              _measure( tangent_mesh& m, uint32_t iterations );
+    void                              _reference_loop( tangent_mesh& m, float* out );
+
+    std::vector<tangent_mesh>         m_meshes;
+    std::vector<tangent_report>       m_reports;
+  };
+}
@@ -0,0 +1,75 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+
+#pragma once
+#include <cstdint>
+
+namespace kretash {
+
+  /* Component streams for the tangent kernel, every component has its own pointer and the
+     stride is in floats, so both SoA arrays and interleaved float3/float2 data can be read.
+     Positions, normals and uvs are all indexed by the same element. */
+  struct                    tangent_streams {
+    const float*            px;
+    const float*            py;
+    const float*            pz;
+    uint32_t                p_stride;
+
+    const float*            nx;
+    const float*            ny;
+    const float*            nz;
+    uint32_t                n_stride;
+
+    const float*            u;
+    const float*            v;
+    uint32_t                uv_stride;
+
+    const uint32_t*         elems;
+    uint32_t                elem_count;
+
+    tangent_streams() :
+      px( nullptr ), py( nullptr ), pz( nullptr ), p_stride( 0 ),
+      nx( nullptr ), ny( nullptr ), nz( nullptr ), n_stride( 0 ),
+      u( nullptr ), v( nullptr ), uv_stride( 0 ),
+      elems( nullptr ),
+      elem_count( 0 ) {
+    }
+
+    void                    set_positions( const float* xyz, uint32_t stride ) {
+      px = xyz; py = xyz + 1; pz = xyz + 2; p_stride = stride;
+    }
+    void                    set_normals( const float* xyz, uint32_t stride ) {
+      nx = xyz; ny = xyz + 1; nz = xyz + 2; n_stride = stride;
+    }
+    void                    set_uvs( const float* uv, uint32_t stride ) {
+      u = uv; v = uv + 1; uv_stride = stride;
+    }
+  };
+
+  namespace tangent_kernel {
+
+    /* Writes one 14 float vertex (position, normal, uv, tangent, bitangent) per element. The
+       tangent and bitangent are per triangle, the tangent is then made orthogonal to each
+       corner normal. Four triangles go through SSE at a time, the rest go through compute_scalar. */
+    void                    compute( const tangent_streams& s, float* out );
+
+    //same result one triangle at a time, starting at first_triangle
+    void                    compute_scalar( const tangent_streams& s, float* out, uint32_t first_triangle = 0 );
+
+    bool                    has_simd();
+  }
+}
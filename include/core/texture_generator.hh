@@ -31,6 +31,8 @@ namespace kretash {
     void                            generate( Texture* desc );
     bool                            texture_ready( Texture* desc );
     void                            gather_texture( Texture* desc );
+    bool                            can_queue( uint64_t bytes );
+    uint64_t                        get_queued_bytes() { return m_queued_bytes.load(); }
     void                            shutdown();
 
   private:
@@ -47,6 +49,7 @@ namespace kretash {
     std::vector<Texture*>           m_generate_queue;
     std::mutex                      m_queue_mutex;
     std::atomic_bool                m_exit_all_threads;
+    std::atomic<uint64_t>           m_queued_bytes;
 
   };
 }
\ No newline at end of file
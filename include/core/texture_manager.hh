@@ -27,7 +27,14 @@ namespace kretash {
   class                                     Drawable;
   class                                     Texture;
   class                                     TextureGenerator;
-  struct                                    texture_db;
+  class                                     AssetRegistry;
+  struct                                    texture_asset;
+
+  struct                                    retiring_texture {
+    Drawable*                               drawable;
+    int32_t                                 ids[3];
+    uint64_t                                frame;
+  };
 
   class                                     TextureManager : public Base {
   public:
@@ -35,22 +42,34 @@ namespace kretash {
     ~TextureManager();
 
     void                                    link_drawable( Drawable* d );
+
+    // makes the placeholder on the generator threads and waits for it, no GPU work
+    void                                    generate_placeholder();
+
+    /* Hands out the texture ids and queues the files, the decode can run on its own after this.
+       create_file_textures creates the decoded files and starts streaming the procedural ones. */
     void                                    prepare();
+    void                                    create_file_textures();
     void                                    update();
-    void                                    regenerate();
+    // with reuse_pixels the textures the swap cache kept are only uploaded again
+    void                                    regenerate( bool reuse_pixels = true );
     void                                    shutdown();
     void                                    synch();
+    uint64_t                                get_generated_texture_bytes();
+    AssetRegistry*                          get_assets() { return m_assets.get(); }
 
   protected:
 
   private:
-    void                                    _generate_placeholder_texture();
+    void                                    _create_file_texture( texture_asset* a );
+    bool                                    _restore_texture( Texture* t );
     void                                    _upload_generated_textures();
     void                                    _sort_vectors();
     void                                    _clean_up_textures();
     void                                    _look_for_upload_textures();
     void                                    _look_for_upgrade_textures();
     void                                    _clear_deprecated_textures();
+    void                                    _release_retired_textures( bool flush );
     int32_t                                 _get_new_id();
 
     uint64_t                                m_device_memory_free;
@@ -66,7 +85,8 @@ namespace kretash {
     std::vector<Drawable*>                  m_non_textured_drawables;
     std::vector<Drawable*>                  m_loading_textures;
     std::vector<Texture*>                   m_clean_up_textures;
-    std::vector<texture_db>                 m_texture_db;
+    std::vector<retiring_texture>           m_retiring_textures;
+    std::shared_ptr<AssetRegistry>          m_assets;
     std::shared_ptr<TextureGenerator>       m_texture_generator;
   };
 
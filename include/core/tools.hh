@@ -19,6 +19,8 @@ http://opensource.org/licenses/MIT
 #include <iostream>
 #include <stdio.h>
 #include <cassert>
+#include <cstring>
+#include <cmath>
 #include "core/engine_settings.hh"
 #include <d3dcompiler.h>
 
@@ -68,6 +70,82 @@ namespace kretash {
       return v.x * 0.212f + v.y * 0.716f + v.z * 0.072f;
     }
 
+    // Round to nearest, tiny values flush to zero and big ones saturate to infinity
+    static inline uint16_t float_to_half( float f ) {
+      uint32_t bits;
+      memcpy( &bits, &f, sizeof( float ) );
+
+      uint32_t sign = ( bits >> 16 ) & 0x8000;
+      int32_t exponent = static_cast< int32_t >( ( bits >> 23 ) & 0xff ) - 127 + 15;
+      uint32_t mantissa = bits & 0x7fffff;
+
+      if( exponent <= 0 ) return static_cast< uint16_t >( sign );
+      if( exponent >= 31 ) return static_cast< uint16_t >( sign | 0x7c00 );
+
+      uint32_t half = sign | ( exponent << 10 ) | ( mantissa >> 13 );
+      if( mantissa & 0x1000 ) ++half;
+      return static_cast< uint16_t >( half );
+    }
+
+    static inline uint32_t pack_unorm16( float v ) {
+      return static_cast< uint32_t >( clamp( v, 0.0f, 1.0f ) * 65535.0f + 0.5f );
+    }
+
+    static inline uint32_t pack_snorm16( float v ) {
+      float s = clamp( v, -1.0f, 1.0f ) * 32767.0f;
+      return static_cast< uint32_t >( static_cast< int16_t >( s < 0.0f ? s - 0.5f : s + 0.5f ) ) & 0xffff;
+    }
+
+    // Octahedral mapping of a unit vector into two snorm16, x in the low half
+    static inline uint32_t pack_octahedral( float3 n ) {
+      float l1 = fabsf( n.x ) + fabsf( n.y ) + fabsf( n.z );
+      if( l1 < 1e-20f ) return 0;
+
+      float x = n.x / l1;
+      float y = n.y / l1;
+
+      if( n.z < 0.0f ) {
+        float ox = ( 1.0f - fabsf( y ) ) * ( x >= 0.0f ? 1.0f : -1.0f );
+        float oy = ( 1.0f - fabsf( x ) ) * ( y >= 0.0f ? 1.0f : -1.0f );
+        x = ox;
+        y = oy;
+      }
+
+      return pack_snorm16( x ) | ( pack_snorm16( y ) << 16 );
+    }
+
+    // 14 float vertex into the 5 dword packed layout, position is stored relative to the bounds
+    //  [0] x | y    unorm16    [1] z | bitangent sign    unorm16
+    //  [2] normal   octahedral [3] uv half2               [4] tangent octahedral
+    static inline void pack_vertex( const float* v, float3 bounds_min, float3 bounds_scale, uint32_t* out ) {
+      float3 p = float3( v[0], v[1], v[2] );
+      float3 n = float3( v[3], v[4], v[5] );
+      float3 t = float3( v[8], v[9], v[10] );
+      float3 b = float3( v[11], v[12], v[13] );
+
+      float px = bounds_scale.x > 0.0f ? ( p.x - bounds_min.x ) / bounds_scale.x : 0.0f;
+      float py = bounds_scale.y > 0.0f ? ( p.y - bounds_min.y ) / bounds_scale.y : 0.0f;
+      float pz = bounds_scale.z > 0.0f ? ( p.z - bounds_min.z ) / bounds_scale.z : 0.0f;
+
+      // the shader rebuilds the bitangent as cross( n, t ) * sign
+      float sign = float3::dot( float3::cross( n, t ), b ) < 0.0f ? 0.0f : 1.0f;
+
+      out[0] = pack_unorm16( px ) | ( pack_unorm16( py ) << 16 );
+      out[1] = pack_unorm16( pz ) | ( pack_unorm16( sign ) << 16 );
+      out[2] = pack_octahedral( n );
+      out[3] = static_cast< uint32_t >( float_to_half( v[6] ) ) | ( static_cast< uint32_t >( float_to_half( v[7] ) ) << 16 );
+      out[4] = pack_octahedral( t );
+    }
+
+    // FNV-1a over dwords, cheap enough to run over every geometry that gets uploaded
+    static inline uint64_t hash_dwords( const uint32_t* data, size_t count, uint64_t h = 14695981039346656037ull ) {
+      for( size_t i = 0; i < count; ++i ) {
+        h ^= data[i];
+        h *= 1099511628211ull;
+      }
+      return h;
+    }
+
     static void compile_vulkan_shaders( std::string shader, std::string* error ) {
 
       FILE *fp = nullptr;
@@ -16,6 +16,8 @@ http://opensource.org/licenses/MIT
 
 #pragma once
 #include <Windows.h>
+#include <memory>
+#include <vector>
 #include "math/float3.hh"
 #include "math/float2.hh"
 
@@ -95,37 +97,99 @@ namespace kretash {
     }
   };
 
+  struct mesh_cluster;
+
+  struct staging_block {
+    mem_block   block;
+    float*      v_data;
+    uint32_t    v_count;
+    uint32_t*   i_data;     // holds uint16_t when the context uses short indices
+    uint32_t    i_count;
+    mesh_cluster* c_data;   // CPU only, copied into the cluster pool instead of the GPU
+    uint32_t    c_count;
+
+    staging_block() :
+      block(),
+      v_data( nullptr ),
+      v_count( 0 ),
+      i_data( nullptr ),
+      i_count( 0 ),
+      c_data( nullptr ),
+      c_count( 0 ) {
+    }
+  };
+
+  class UploadHandle;
+
   struct queue {
     mem_block   v_block;
     float*      v_data;
     mem_block   i_block;
     uint32_t*   i_data;
+    std::shared_ptr<UploadHandle> handle;
 
-    queue( mem_block v, float* vp, mem_block i, uint32_t* ip ) {
+    queue( mem_block v, float* vp, mem_block i, uint32_t* ip, std::shared_ptr<UploadHandle> h ) {
       v_block = v; v_data = vp;
       i_block = i; i_data = ip;
+      handle = h;
     }
     queue() :
       v_block(),
       v_data( nullptr ),
       i_block(),
-      i_data( nullptr ) {
+      i_data( nullptr ),
+      handle( nullptr ) {
     }
   };
 
   struct remove_queue {
     uint32_t   v_mem;
     uint32_t   i_mem;
+    uint32_t   c_mem;      // 0xffffffff when the geometry had no clusters
+    uint64_t   frame;
 
-    remove_queue( uint32_t v, uint32_t i ) {
-      v_mem = v; i_mem = i;
+    remove_queue( uint32_t v, uint32_t i, uint32_t c, uint64_t f ) {
+      v_mem = v; i_mem = i; c_mem = c; frame = f;
     }
     remove_queue() :
       v_mem( 0 ),
-      i_mem( 0 ) {
+      i_mem( 0 ),
+      c_mem( 0xffffffff ),
+      frame( 0 ) {
     }
   };
 
+  // A vertex/index allocation handed to every geometry with the same content
+  struct shared_geometry {
+    uint32_t   v_offset;     // in floats, the key of the allocation in the shared map
+    uint32_t   i_offset;
+    uint32_t   c_offset;
+    uint32_t   c_count;
+    uint32_t   v_count;
+    uint32_t   i_count;
+    uint32_t   refs;
+    uint64_t   hash;
+    std::vector<uint8_t> bytes; // vertices then indices, a hash match is only shared if these match too
+  };
+
+  class Drawable;
+
+  // One indirect draw, a run of the drawable's current geometry indices
+  struct draw_range {
+    Drawable*  drawable;
+    uint32_t   first_index;  // relative to the geometry's first index
+    uint32_t   index_count;
+  };
+
+  class Geometry;
+
+  // One instanced draw of a mesh, its instances sit together in the renderer's instance stream
+  struct instance_batch {
+    Geometry*  geometry;
+    uint32_t   first_instance;
+    uint32_t   instance_count;
+  };
+
   struct texel {
     uint8_t r, g, b, a;
     texel() :
@@ -206,16 +270,6 @@ namespace kretash {
     }
   };
 
-  struct texture_db {
-    std::string filename;
-    int32_t id;
-
-    texture_db( std::string filename, int32_t id ) {
-      this->filename = filename;
-      this->id = id;
-    }
-  };
-
   enum API {
     kVulkan = 1,
     kD3D12 = 2,
@@ -240,6 +294,11 @@ namespace kretash {
     API m_api;
     bool update_city;
     bool debug_textures;
+    bool packed_vertices;
+    bool short_indices;
+    float lod_pixel_error;
+    float hlod_distance;
+    int32_t swap_cache_size;
 
     engine_settings() :
       resolution_width( 0 ),
@@ -251,6 +310,11 @@ namespace kretash {
       msaa_enabled( false ),
       update_city( true ),
       debug_textures( false ),
+      packed_vertices( false ),
+      short_indices( false ),
+      lod_pixel_error( 2.0f ),
+      hlod_distance( 450.0f ),
+      swap_cache_size( 512 ),
       msaa_count( 0 ),
       upscale_render( 1.0f ),
       anim_camera_base_speed( 1.0f ),
@@ -73,6 +73,9 @@ namespace                   kretash {
     /* This will create a pipeline cache in Vulkan and do nothing in D3D12 */
     virtual void            create_pipeline_cache() final;
 
+    /* This will create the frame fence and the present semaphore in Vulkan */
+    virtual void            create_fences() final;
+
     /* This will wait for all setup actions to be completed */
     virtual void            wait_for_setup_completion() final;
 
@@ -122,7 +125,10 @@ namespace                   kretash {
     virtual void            record_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) final;
 
     /* This will record indirect commands list in D3D12 and normal ones in Vulkan */
-    virtual void            record_indirect_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) final;
+    virtual void            record_indirect_commands( xxRenderer* r, Window* w, draw_range* ranges, uint32_t r_count ) final;
+
+    /* This will record one instanced draw per batch in Vulkan and D3D12 */
+    virtual void            record_instanced_commands( xxRenderer* r, Window* w, instance_batch* batches, uint32_t b_count ) final;
 
     /* This will execute the command list in Vulkan and D3D12 */
     virtual void            execute_render_command_list() final;
@@ -133,9 +139,19 @@ namespace                   kretash {
     /* This will wait for render to finish in Vulkan and D3D12 */
     virtual void            wait_render_completition() final;
 
+    /* This will signal the frame fence with the given frame number in Vulkan and D3D12 */
+    virtual void            signal_frame( uint64_t frame ) final;
+
+    /* This will return the last frame retired by the GPU in Vulkan and D3D12 */
+    virtual uint64_t        get_completed_frame() final;
+
+    /* This will wait until the given frame has been retired in Vulkan and D3D12 */
+    virtual void            wait_for_frame( uint64_t frame ) final;
+
   private:
 
     bool _get_memory_type( uint32_t typeBits, VkFlags properties, uint32_t * typeIndex );
+    void _bind_draw_state( xxRenderer* r, Window* w, int32_t cb, bool instanced = false );
 
     struct depth_stencil {
       VkImage                                       m_image = VK_NULL_HANDLE;
@@ -166,12 +182,18 @@ namespace                   kretash {
     std::vector<VkShaderModule>                     m_shader_modules;
     VkDescriptorSetLayout                           m_instance_descriptor_set_layout = VK_NULL_HANDLE;
     VkDescriptorSetLayout                           m_constant_descriptor_set_layout = VK_NULL_HANDLE;
+    VkDescriptorSetLayout                           m_stream_descriptor_set_layout = VK_NULL_HANDLE;
     VkDescriptorSet                                 m_constant_descriptor_set = VK_NULL_HANDLE;
     VkDescriptorPool                                m_descriptor_pool = VK_NULL_HANDLE;
     VkPipelineLayout                                m_pipeline_layout = VK_NULL_HANDLE;
+    VkPipelineLayout                                m_instanced_pipeline_layout = VK_NULL_HANDLE;
     VkDeviceMemory                                  m_device_pool_memory = VK_NULL_HANDLE;
     VkDeviceMemory                                  m_host_pool_memory = VK_NULL_HANDLE;
     std::shared_ptr<Pool>                         m_vk_device_pool;
     std::shared_ptr<Pool>                         m_vk_host_pool;
+    VkFence                                         m_frame_fence = VK_NULL_HANDLE;
+    VkSemaphore                                     m_present_complete_semaphore = VK_NULL_HANDLE;
+    uint64_t                                        m_submitted_frame = 0;
+    uint64_t                                        m_completed_frame = 0;
   };
 }
\ No newline at end of file
@@ -40,6 +40,12 @@ namespace                   kretash {
     /* This will update the instance buffers object in Vulkan and D3D12 */
     virtual void update_instance_buffer_objects( std::vector<Drawable*>* d, std::vector<instance_buffer>* ib ) final;
 
+    /* This will create the instance stream read by the instanced draws in Vulkan and D3D12 */
+    virtual void            create_instance_stream( uint32_t max_instances ) final;
+
+    /* This will update the first count instances of the instance stream in Vulkan and D3D12 */
+    virtual void            update_instance_stream( std::vector<instance_buffer>* s, uint32_t count ) final;
+
     /* This will create the root signature in Vulkan and D3D12 */
     virtual void            create_root_signature() final;
 
@@ -49,12 +55,16 @@ namespace                   kretash {
   private:
 
     VkPipelineShaderStageCreateInfo                 _load_shaders( std::string filename, VkShaderStageFlagBits flags );
+    void                                            _release_instance_stream();
 
     std::vector<VkShaderModule>                     m_shader_modules = {};
     VkPipeline                                      m_pipeline = VK_NULL_HANDLE;
+    VkPipeline                                      m_instanced_pipeline = VK_NULL_HANDLE;
     VkPipelineVertexInputStateCreateInfo            m_vi = {};
     std::vector<VkVertexInputBindingDescription>    m_binding_descriptions = {};
     std::vector<VkVertexInputAttributeDescription>  m_attribute_descriptions = {};
     vkDescriptorBuffer                              m_uniform_buffer = {};
+    vkDescriptorBuffer                              m_instance_stream = {};
+    VkDescriptorSet                                 m_stream_descriptor_set = VK_NULL_HANDLE;
   };
 }
\ No newline at end of file
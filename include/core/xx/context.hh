@@ -19,11 +19,22 @@ http://opensource.org/licenses/MIT
 #include <memory>
 #include "core/math/float4x4.hh"
 #include "core/math/float3.hh"
+#include "core/engine_settings.hh"
+
+// floats per vertex, the packed layout is 5 dwords
+#define VERTEX_STRIDE 14
+#define PACKED_VERTEX_STRIDE 5
+// biggest vertex count a geometry can address with short indices
+#define MAX_SHORT_INDEX_VERTICES 0xffff
+// indirect draws a drawable can take once its clusters are culled
+#define MAX_DRAW_RANGES 4
 
 namespace                   kretash {
 
   enum                      render_type;
   struct                    constant_buffer;
+  struct                    draw_range;
+  struct                    instance_batch;
   class                     Window;
   class                     Drawable;
   class                     xxRenderer;
@@ -128,7 +139,7 @@ namespace                   kretash {
     virtual void            create_indirect_command_buffer( xxRenderer* r, Drawable** draw, uint32_t d_count ) {};
 
     /* This will update the indirect command buffer in D3D12 and do nothing in D3D12*/
-    virtual void            update_indirect_command_buffer( xxRenderer* r, Drawable** draw, uint32_t d_count ) {};
+    virtual void            update_indirect_command_buffer( xxRenderer* r, draw_range* ranges, uint32_t r_count ) {};
 
     /* This will reset the render command list in Vulkan and D3D12 */
     virtual void            reset_render_command_list( Window* w ) {};
@@ -143,7 +154,10 @@ namespace                   kretash {
     virtual void            record_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) {};
 
     /* This will record indirect commands list in D3D12 and normal ones in Vulkan */
-    virtual void            record_indirect_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) {};
+    virtual void            record_indirect_commands( xxRenderer* r, Window* w, draw_range* ranges, uint32_t r_count ) {};
+
+    /* This will record one instanced draw per batch in Vulkan and D3D12 */
+    virtual void            record_instanced_commands( xxRenderer* r, Window* w, instance_batch* batches, uint32_t b_count ) {};
 
     /* This will execute the command list in Vulkan and D3D12 */
     virtual void            execute_render_command_list() {};
@@ -154,8 +168,26 @@ namespace                   kretash {
     /* This will wait for render to finish in Vulkan and D3D12 */
     virtual void            wait_render_completition() {};
 
+    /* This will signal the frame fence with the given frame number in Vulkan and D3D12 */
+    virtual void            signal_frame( uint64_t frame ) {};
+
+    /* This will return the last frame retired by the GPU in Vulkan and D3D12 */
+    virtual uint64_t        get_completed_frame() { return 0; };
+
+    /* This will wait until the given frame has been retired in Vulkan and D3D12 */
+    virtual void            wait_for_frame( uint64_t frame ) {};
+
+    /* This will return the floats per vertex used by the buffers in Vulkan and D3D12 */
+    int32_t                 get_stride() { return m_stride; }
+
+    /* This will return the bytes per index used by the buffers in Vulkan and D3D12 */
+    uint32_t                get_index_size() { return m_index_size; }
+
   protected:
-    const int32_t           m_stride = 14;
+    const int32_t           m_stride = k_engine_settings->get_settings().packed_vertices ?
+                              PACKED_VERTEX_STRIDE : VERTEX_STRIDE;
+    const uint32_t          m_index_size = k_engine_settings->get_settings().short_indices ?
+                              sizeof( uint16_t ) : sizeof( uint32_t );
     const uint32_t          m_frame_count = 2;
     const int32_t           m_max_textures = 2048;
   };
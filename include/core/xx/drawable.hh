@@ -18,6 +18,7 @@ http://opensource.org/licenses/MIT
 #include <memory>
 #include <vector>
 #include "core/math/float4x4.hh"
+#include "core/math/float4.hh"
 
 namespace                   kretash {
 
@@ -29,13 +30,20 @@ namespace                   kretash {
     uint32_t                                        d_texture_id;
     uint32_t                                        n_texture_id;
     uint32_t                                        s_texture_id;
+    uint32_t                                        pad0;
 
-    uint32_t                                        pad[13];
+    float4                                          bounds_min;
+    float4                                          bounds_scale;
+
+    uint32_t                                        pad[4];
 
     instance_buffer() :
       d_texture_id( 0 ),
       n_texture_id( 0 ),
-      s_texture_id( 0 ) {
+      s_texture_id( 0 ),
+      pad0( 0 ),
+      bounds_min( 0.0f, 0.0f, 0.0f, 0.0f ),
+      bounds_scale( 1.0f, 1.0f, 1.0f, 0.0f ) {
     }
   };
 
@@ -38,6 +38,12 @@ namespace                   kretash {
     /* This will update the instance buffers object in Vulkan and D3D12 */
     virtual void update_instance_buffer_objects( std::vector<Drawable*>* d, std::vector<instance_buffer>* ib ) {};
 
+    /* This will create the instance stream read by the instanced draws in Vulkan and D3D12 */
+    virtual void            create_instance_stream( uint32_t max_instances ) {};
+
+    /* This will update the first count instances of the instance stream in Vulkan and D3D12 */
+    virtual void            update_instance_stream( std::vector<instance_buffer>* s, uint32_t count ) {};
+
     /* This will create the root signature in Vulkan and D3D12 */
     virtual void            create_root_signature() {};
 
@@ -7,13 +7,73 @@
 #include "core/building.hh"
 #include "core/vk/geometry.hh"
 #include "core/factory.h"
+#include "core/pool.hh"
+#include "core/tools.hh"
+#include "core/xx/context.hh"
 
 #define VERTEX_BUFFER_AVERAGE (uint32_t)250000
 #define INDEX_BUFFER_AVERAGE (uint32_t)30000
 #define BUFFER_SIZE_INFLATE (uint32_t)35000000
+#define CLUSTER_BUFFER_AVERAGE (uint32_t)64
+#define CLUSTER_BUFFER_INFLATE (uint32_t)4096
+#define STAGING_BUFFER_SIZE (uint64_t)64000000
+#define STAGING_ALIGNMENT (uint64_t)16
+#define RECORD_ALLOCATOR_TRACES 0
 
 namespace kretash {
 
+  // Shared by the pool and every handle, so it stays alive until the last reservation is gone
+  struct staging_heap {
+    uint8_t*                memory;
+    Pool                    pool;
+    std::mutex              mutex;
+
+    staging_heap() : memory( nullptr ) {}
+    ~staging_heap() { delete[] memory; }
+  };
+
+  UploadHandle::UploadHandle( std::shared_ptr<staging_heap> heap, staging_block s ) :
+    m_heap( heap ),
+    m_staging( s ),
+    m_callback( nullptr ) {
+    m_state.store( kUPLOAD_RESERVED );
+  }
+
+  void UploadHandle::on_complete( std::function<void( UploadHandle* )> callback ) {
+    m_callback_mutex.lock();
+    m_callback = callback;
+    m_callback_mutex.unlock();
+  }
+
+  void UploadHandle::_set_state( upload_state s ) {
+    m_state.store( s );
+
+    if( s == kUPLOAD_RESIDENT || s == kUPLOAD_DISCARDED ) {
+      _release();
+
+      m_callback_mutex.lock();
+      if( m_callback ) m_callback( this );
+      m_callback = nullptr;
+      m_callback_mutex.unlock();
+    }
+  }
+
+  void UploadHandle::_release() {
+
+    if( m_staging.block.m_size == 0 ) return;
+
+    m_heap->mutex.lock();
+    m_heap->pool.release( m_staging.block );
+    m_heap->mutex.unlock();
+
+    m_staging = staging_block();
+  }
+
+  UploadHandle::~UploadHandle() {
+    upload_state s = m_state.load();
+    if( s != kUPLOAD_RESIDENT && s != kUPLOAD_DISCARDED ) _set_state( kUPLOAD_DISCARDED );
+  }
+
   GPU_pool::GPU_pool() :
     m_vertex_pointer( 0 ),
     m_index_pointer( 0 ),
@@ -24,18 +84,28 @@ namespace kretash {
 
     m_removing_geometry.store( false );
     m_remove_thread_working.store( true );
+    m_completed_frame.store( 0 );
 
     Factory* factory = k_engine->get_factory();
     factory->make_geometry( &m_geometry );
 
     m_remove_threads.resize( 1 );
 
+    // Generation workers write the final vertices here, the upload thread copies them to the GPU
+    m_staging = std::make_shared<staging_heap>();
+    m_staging->memory = new uint8_t[STAGING_BUFFER_SIZE];
+    m_staging->pool.init( STAGING_BUFFER_SIZE, kCPU_STAGING );
+
+    m_V_pool = std::make_shared<Pool>();
+    m_I_pool = std::make_shared<Pool>();
+    m_C_pool = std::make_shared<Pool>();
+
   }
 
   void GPU_pool::init() {
-    int building_num = k_engine_settings->get_settings().grid * k_engine_settings->get_settings().grid;
-    m_max_vertex_buffer = BUFFER_SIZE_INFLATE + VERTEX_BUFFER_AVERAGE * building_num;
-    m_max_index_buffer = BUFFER_SIZE_INFLATE + INDEX_BUFFER_AVERAGE * building_num;
+    int32_t grid = k_engine_settings->get_settings().grid;
+    m_max_vertex_buffer = get_vertex_buffer_size( grid );
+    m_max_index_buffer = get_index_buffer_size( grid );
 
     m_geometry->create_empty_vertex_buffer( m_max_vertex_buffer );
     m_geometry->create_empty_index_buffer( m_max_index_buffer );
@@ -50,35 +120,105 @@ namespace kretash {
       size, -size, e, e, e, e, 1.0f, 1.0f, e, e, e, e, e, e,
       size, size, e, e, e, e, 1.0f, 0.0f, e, e, e, e, e, e
     };
+    const uint32_t stride = k_engine->get_context()->get_stride();
+    const uint32_t quad_size = 4 * stride * sizeof( float );
+
+    // the post shader unpacks the quad with fixed bounds
+    float packed_quad[4 * PACKED_VERTEX_STRIDE];
+    for( uint32_t i = 0; i < 4; ++i ) {
+      tools::pack_vertex( &quad[i * VERTEX_STRIDE], float3( -size, -size, 0.0f ), float3( size * 2.0f, size * 2.0f, 1.0f ),
+        reinterpret_cast< uint32_t* >( &packed_quad[i * PACKED_VERTEX_STRIDE] ) );
+    }
+
     queue q = {};
-    q.v_block = mem_block( 0, sizeof( quad ) );
-    q.v_data = &quad[0];
+    q.v_block = mem_block( 0, quad_size );
+    q.v_data = stride == VERTEX_STRIDE ? &quad[0] : &packed_quad[0];
     m_upload_queue.push_back( q );
     m_geometry->upload_queue_into_vertex_buffer( &m_upload_queue );
     m_upload_queue.clear();
     // -------------
 
-    m_V_free_memory.push_back( mem_block( sizeof( quad ), m_max_vertex_buffer ) );
-    m_I_free_memory.push_back( mem_block( 0, m_max_index_buffer ) );
+    m_V_pool->init( m_max_vertex_buffer, kVERTEX_BUFFER );
+    m_I_pool->init( m_max_index_buffer, kINDEX_BUFFER );
+
+    // clusters never reach the GPU, the pool just hands out ranges of m_clusters
+    uint32_t max_clusters = get_cluster_buffer_size( grid );
+    m_clusters.resize( max_clusters );
+    m_C_pool->init( max_clusters * sizeof( mesh_cluster ), kCLUSTER_BUFFER );
+
+#if RECORD_ALLOCATOR_TRACES
+    m_V_pool->record_trace( "vertex_pool.trace" );
+    m_I_pool->record_trace( "index_pool.trace" );
+#endif
+
+    // the quad lives at the start of the buffer forever
+    m_V_pool->get_mem( quad_size );
 
     m_remove_threads[0] = std::thread( &GPU_pool::_thread, this );
   }
 
+  uint32_t GPU_pool::get_vertex_buffer_size( int32_t grid ) {
+    return BUFFER_SIZE_INFLATE + VERTEX_BUFFER_AVERAGE * grid * grid;
+  }
+
+  uint32_t GPU_pool::get_index_buffer_size( int32_t grid ) {
+    return BUFFER_SIZE_INFLATE + INDEX_BUFFER_AVERAGE * grid * grid;
+  }
+
+  uint32_t GPU_pool::get_cluster_buffer_size( int32_t grid ) {
+    return CLUSTER_BUFFER_INFLATE + CLUSTER_BUFFER_AVERAGE * grid * grid;
+  }
+
   void GPU_pool::set_placeholder_building( Geometry* b ) {
     m_placeholder_building = b;
   }
 
-  void GPU_pool::queue_geometry( Geometry* b, float* v_data, uint32_t v_count, uint32_t* e_data, uint32_t e_count ) {
+  std::shared_ptr<UploadHandle> GPU_pool::reserve_staging( uint32_t v_count, uint32_t e_count, uint32_t c_count ) {
+
+    uint64_t v_size = v_count * sizeof( float );
+    v_size = ( v_size + STAGING_ALIGNMENT - 1 ) & ~( STAGING_ALIGNMENT - 1 );
+    uint64_t e_size = e_count * k_engine->get_context()->get_index_size();
+    e_size = ( e_size + STAGING_ALIGNMENT - 1 ) & ~( STAGING_ALIGNMENT - 1 );
+    uint64_t c_size = c_count * sizeof( mesh_cluster );
+
+    assert( v_size + e_size + c_size <= STAGING_BUFFER_SIZE && "STAGING RESERVATION TOO BIG" );
+
+    staging_block s = {};
+
+    while( true ) {
+      m_staging->mutex.lock();
+      bool found = m_staging->pool.try_get_mem( v_size + e_size + c_size, &s.block );
+      m_staging->mutex.unlock();
+
+      if( found ) break;
+
+      //the upload thread will give some memory back
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+
+    s.v_data = reinterpret_cast< float* >( m_staging->memory + s.block.m_start );
+    s.v_count = v_count;
+    s.i_data = reinterpret_cast< uint32_t* >( m_staging->memory + s.block.m_start + v_size );
+    s.i_count = e_count;
+    s.c_data = c_count ? reinterpret_cast< mesh_cluster* >( m_staging->memory + s.block.m_start + v_size + e_size ) : nullptr;
+    s.c_count = c_count;
+
+    return std::make_shared<UploadHandle>( m_staging, s );
+  }
+
+  void GPU_pool::queue_geometry( Geometry* b, std::shared_ptr<UploadHandle> h ) {
     if( m_removing_geometry.load() == true ) {
       std::cout << "queue thread sync failed.\n";
       while( m_removing_geometry.load() ) { /*wait*/ }
     }
 
-    _save( b, v_data, v_count, e_data, e_count );
+    _save( b, h );
   }
 
   void GPU_pool::update() {
 
+    m_completed_frame.store( k_engine->get_completed_frame() );
+
     if( m_upload_queue.size() != 0 ) {
       m_uploading_geometry.store( true );
     }
@@ -94,169 +234,193 @@ namespace kretash {
     }
   }
 
-  void GPU_pool::_save( Geometry* b, float* v_data, uint32_t v_count, uint32_t* e_data, uint32_t e_count ) {
+  void GPU_pool::_save( Geometry* b, std::shared_ptr<UploadHandle> h ) {
     mem_block v_mem = { 0, 0 };
     mem_block i_mem = { 0, 0 };
+    staging_block& s = h->get_staging();
 
-    size_t v_size = v_count * sizeof( float );
-
-    for( std::vector<mem_block>::iterator i = m_V_free_memory.begin(); i != m_V_free_memory.end(); ++i ) {
-      if( i->m_size >= v_size ) {
-
-        mem_block free_mem = *i._Ptr;
-        i = m_V_free_memory.erase( i );
-
-        v_mem.m_start = free_mem.m_start;
-        v_mem.m_size = v_size;
-        m_V_used_memory.push_back( v_mem );
+    uint64_t hash = _hash_staging( s );
+    if( _share( b, h, hash ) ) return;
 
-        free_mem.m_start += v_size;
-        free_mem.m_size -= v_size;
-        m_V_free_memory.push_back( free_mem );
-        break;
-      }
-    }
+    size_t v_size = s.v_count * sizeof( float );
+    bool v_found = m_V_pool->try_get_mem( v_size, &v_mem );
 
-    assert( v_mem.m_size != 0 && "BLOCK NOT FOUND" );
-    if( v_mem.m_size == 0 ) { std::cout << "full GPU v pool\n"; return; }
+    assert( v_found && "BLOCK NOT FOUND" );
+    if( !v_found ) { std::cout << "full GPU v pool\n"; h->_set_state( kUPLOAD_DISCARDED ); return; }
     b->set_vertex_offset( static_cast< uint32_t >( v_mem.m_start ) / sizeof( float ) );
 
-    size_t e_size = e_count * sizeof( uint32_t );
-
-    for( std::vector<mem_block>::iterator i = m_I_free_memory.begin(); i != m_I_free_memory.end(); ++i ) {
-      if( i->m_size >= e_size ) {
+    const uint32_t index_size = k_engine->get_context()->get_index_size();
+    size_t e_size = s.i_count * index_size;
+    bool i_found = m_I_pool->try_get_mem( e_size, &i_mem );
 
-        mem_block free_mem = *i._Ptr;
-        i = m_I_free_memory.erase( i );
-
-        i_mem.m_start = free_mem.m_start;
-        i_mem.m_size = e_size;
-        m_I_used_memory.push_back( i_mem );
+    assert( i_found && "BLOCK NOT FOUND" );
+    if( !i_found ) { std::cout << "full GPU i pool\n"; m_V_pool->release( v_mem ); h->_set_state( kUPLOAD_DISCARDED ); return; }
+    b->set_index_offset( static_cast< uint32_t >( i_mem.m_start / index_size ) );
+    ++m_instances;
 
-        free_mem.m_start += e_size;
-        free_mem.m_size -= e_size;
-        m_I_free_memory.push_back( free_mem );
-        break;
+    // without room for its clusters a geometry is still fine, it just gets drawn whole
+    mem_block c_mem = { 0, 0 };
+    b->set_clusters( 0, 0 );
+    if( s.c_count != 0 ) {
+      if( m_C_pool->try_get_mem( s.c_count * sizeof( mesh_cluster ), &c_mem ) ) {
+        uint32_t c_offset = static_cast< uint32_t >( c_mem.m_start / sizeof( mesh_cluster ) );
+        memcpy( &m_clusters[c_offset], s.c_data, s.c_count * sizeof( mesh_cluster ) );
+        b->set_clusters( c_offset, s.c_count );
+      } else {
+        std::cout << "full cluster pool\n";
       }
     }
 
-    assert( i_mem.m_size != 0 && "BLOCK NOT FOUND" );
-    if( v_mem.m_size == 0 ) { std::cout << "full GPU i pool\n"; return; }
-    b->set_index_offset( static_cast< int >( i_mem.m_start ) / sizeof( uint32_t ) );
-    ++m_instances;
+    // the placeholder is never removed, buildings must not end up pointing at it
+    if( m_placeholder_building != nullptr ) {
+      shared_geometry shared = {};
+      shared.v_offset = b->get_vertex_offset();
+      shared.i_offset = b->get_indicies_offset();
+      shared.c_offset = b->get_cluster_offset();
+      shared.c_count = b->get_cluster_count();
+      shared.v_count = s.v_count;
+      shared.i_count = s.i_count;
+      shared.refs = 1;
+      shared.hash = hash;
+
+      // the staging memory goes back after the upload, later matches are checked against this copy
+      shared.bytes.resize( v_size + e_size );
+      memcpy( shared.bytes.data(), s.v_data, v_size );
+      memcpy( shared.bytes.data() + v_size, s.i_data, e_size );
+
+      m_shared_mutex.lock();
+      m_shared_lookup.insert( std::make_pair( hash, shared.v_offset ) );
+      m_shared[shared.v_offset] = std::move( shared );
+      m_shared_mutex.unlock();
+    }
 
     //push to the queue
     m_queue_mutex.lock();
-    m_upload_queue.push_back( queue( v_mem, v_data, i_mem, e_data ) );
+    h->_set_state( kUPLOAD_QUEUED );
+    m_upload_queue.push_back( queue( v_mem, s.v_data, i_mem, s.i_data, h ) );
     m_queue_mutex.unlock();
   }
 
-  void GPU_pool::remove( Geometry* b ) {
+  // Points the geometry at an allocation with the same content, the staging memory is
+  // given back straight away since there is nothing to upload
+  bool GPU_pool::_share( Geometry* b, std::shared_ptr<UploadHandle> h, uint64_t hash ) {
+    staging_block& s = h->get_staging();
 
-    assert( b->get_vertex_offset() != m_placeholder_building->get_vertex_offset() ||
-      b->get_indicies_offset() != m_placeholder_building->get_indicies_offset()
-      && "BUILDING ALREADY DELETED" );
+    m_shared_mutex.lock();
 
-    m_pool_mutex.lock();
+    // every allocation with this hash is a candidate, only the bytes say if it really is the same mesh
+    shared_geometry* match = nullptr;
+    auto candidates = m_shared_lookup.equal_range( hash );
+    for( auto i = candidates.first; i != candidates.second && match == nullptr; ++i ) {
+      shared_geometry& candidate = m_shared[i->second];
+      if( _same_bytes( candidate, s ) ) match = &candidate;
+    }
 
-    m_remove_queue.push_back(
-      remove_queue( b->get_vertex_offset() * sizeof( float ),
-        b->get_indicies_offset() * sizeof( uint32_t ) ) );
+    if( match == nullptr ) {
+      m_shared_mutex.unlock();
+      return false;
+    }
 
-    m_pool_mutex.unlock();
+    shared_geometry& shared = *match;
+    ++shared.refs;
+    b->set_vertex_offset( shared.v_offset );
+    b->set_index_offset( shared.i_offset );
+    b->set_clusters( shared.c_offset, shared.c_count );
+    m_shared_mutex.unlock();
 
-    b->set_vertex_offset( m_placeholder_building->get_vertex_offset() );
-    b->set_index_offset( m_placeholder_building->get_indicies_offset() );
-    b->set_indicies_count( m_placeholder_building->get_indicies_count() );
+    h->_set_state( kUPLOAD_RESIDENT );
+    return true;
   }
 
-  void GPU_pool::_remove( remove_queue remove_me ) {
-
-    int32_t rV_start = remove_me.v_mem;
-    int32_t rI_start = remove_me.i_mem;
-    int32_t removed = 0;
+  bool GPU_pool::_same_bytes( shared_geometry& shared, staging_block& s ) {
+    if( shared.v_count != s.v_count || shared.i_count != s.i_count ) return false;
 
-    for( std::vector<mem_block>::iterator i = m_V_used_memory.begin(); i != m_V_used_memory.end(); i++ ) {
-      if( i->m_start == rV_start ) {
-
-        mem_block used_mem = *i._Ptr;
-        m_V_used_memory.erase( i );
-        m_V_free_memory.push_back( used_mem );
-        removed++;
-        break;
-      }
-    }
+    size_t v_size = s.v_count * sizeof( float );
+    size_t e_size = s.i_count * k_engine->get_context()->get_index_size();
+    return memcmp( shared.bytes.data(), s.v_data, v_size ) == 0 &&
+      memcmp( shared.bytes.data() + v_size, s.i_data, e_size ) == 0;
+  }
 
+  uint64_t GPU_pool::_hash_staging( staging_block& s ) {
+    const uint32_t index_size = k_engine->get_context()->get_index_size();
+    size_t i_bytes = s.i_count * index_size;
 
-    for( std::vector<mem_block>::iterator i = m_I_used_memory.begin(); i != m_I_used_memory.end(); i++ ) {
-      if( i->m_start == rI_start ) {
+    uint64_t hash = tools::hash_dwords( reinterpret_cast< uint32_t* >( s.v_data ), s.v_count );
+    hash = tools::hash_dwords( s.i_data, i_bytes / sizeof( uint32_t ), hash );
 
-        mem_block used_mem = *i._Ptr;
-        m_I_used_memory.erase( i );
-        m_I_free_memory.push_back( used_mem );
-        removed++;
-        break;
-      }
+    // an odd count of short indices leaves half a dword, the other half is staging garbage
+    if( i_bytes % sizeof( uint32_t ) != 0 ) {
+      uint32_t tail = reinterpret_cast< uint16_t* >( s.i_data )[s.i_count - 1];
+      hash = tools::hash_dwords( &tail, 1, hash );
     }
-
-    assert( removed == 2 && "REMOVE COUNT WRONG" );
+    return hash;
   }
 
-  void GPU_pool::_defrag_vectors() {
-    {
-      std::sort( m_V_free_memory.begin(), m_V_free_memory.end() );
-      std::vector<mem_block>::iterator i = m_V_free_memory.begin();
-      while( i != m_V_free_memory.end() ) {
-
-        std::vector<mem_block>::iterator next_i = i;
-        next_i++;
-
-        if( next_i == m_V_free_memory.end() )
-          break;
+  void GPU_pool::get_shared_stats( uint32_t* geometries, uint32_t* allocations, uint64_t* saved_bytes ) {
+    const uint32_t index_size = k_engine->get_context()->get_index_size();
+    *geometries = 0;
+    *allocations = 0;
+    *saved_bytes = 0;
+
+    m_shared_mutex.lock();
+    for( std::unordered_map<uint32_t, shared_geometry>::iterator i = m_shared.begin(); i != m_shared.end(); ++i ) {
+      uint64_t size = i->second.v_count * sizeof( float ) + i->second.i_count * index_size;
+      *geometries += i->second.refs;
+      *allocations += 1;
+      *saved_bytes += ( i->second.refs - 1 ) * size;
+    }
+    m_shared_mutex.unlock();
+  }
 
-        if( ( i->m_start + i->m_size ) == next_i->m_start ) {
+  void GPU_pool::remove( Geometry* b ) {
 
-          mem_block grouped = {};
-          grouped.m_start = i->m_start;
-          grouped.m_size = i->m_size + next_i->m_size;
-          i = m_V_free_memory.insert( i, grouped );
+    assert( b->get_vertex_offset() != m_placeholder_building->get_vertex_offset() ||
+      b->get_indicies_offset() != m_placeholder_building->get_indicies_offset()
+      && "BUILDING ALREADY DELETED" );
 
-          i++;
-          i = m_V_free_memory.erase( i );
-          i = m_V_free_memory.erase( i );
-          i--;
-        } else {
-          i++;
+    // the memory only goes back with the last geometry sharing it
+    bool last = true;
+    m_shared_mutex.lock();
+    std::unordered_map<uint32_t, shared_geometry>::iterator found = m_shared.find( b->get_vertex_offset() );
+    if( found != m_shared.end() ) {
+      last = --found->second.refs == 0;
+      if( last ) {
+        auto candidates = m_shared_lookup.equal_range( found->second.hash );
+        for( auto i = candidates.first; i != candidates.second; ++i ) {
+          if( i->second == found->first ) {
+            m_shared_lookup.erase( i );
+            break;
+          }
         }
+        m_shared.erase( found );
       }
     }
-    {
-      std::sort( m_I_free_memory.begin(), m_I_free_memory.end() );
-      std::vector<mem_block>::iterator i = m_I_free_memory.begin();
-      while( i != m_I_free_memory.end() ) {
+    m_shared_mutex.unlock();
 
-        std::vector<mem_block>::iterator next_i = i;
-        next_i++;
+    m_pool_mutex.lock();
 
-        if( next_i == m_I_free_memory.end() )
-          break;
+    uint32_t c_mem = b->get_cluster_count() != 0 ?
+      b->get_cluster_offset() * sizeof( mesh_cluster ) : 0xffffffff;
 
-        if( ( i->m_start + i->m_size ) == next_i->m_start ) {
+    if( last ) {
+      m_remove_queue.push_back(
+        remove_queue( b->get_vertex_offset() * sizeof( float ),
+          b->get_indicies_offset() * k_engine->get_context()->get_index_size(), c_mem, k_engine->get_frame() ) );
+    }
 
-          mem_block grouped = {};
-          grouped.m_start = i->m_start;
-          grouped.m_size = i->m_size + next_i->m_size;
-          i = m_I_free_memory.insert( i, grouped );
+    m_pool_mutex.unlock();
 
-          i++;
-          i = m_I_free_memory.erase( i );
-          i = m_I_free_memory.erase( i );
-          i--;
-        } else {
-          i++;
-        }
-      }
-    }
+    b->set_vertex_offset( m_placeholder_building->get_vertex_offset() );
+    b->set_index_offset( m_placeholder_building->get_indicies_offset() );
+    b->set_indicies_count( m_placeholder_building->get_indicies_count() );
+    b->set_clusters( m_placeholder_building->get_cluster_offset(), m_placeholder_building->get_cluster_count() );
+  }
+
+  void GPU_pool::_remove( remove_queue remove_me ) {
+    m_V_pool->release( mem_block( remove_me.v_mem, 0 ) );
+    m_I_pool->release( mem_block( remove_me.i_mem, 0 ) );
+    if( remove_me.c_mem != 0xffffffff )
+      m_C_pool->release( mem_block( remove_me.c_mem, 0 ) );
   }
 
   void GPU_pool::start_remove_thread() {
@@ -270,19 +434,24 @@ namespace kretash {
 
         m_queue_mutex.lock();
 
+        for( int32_t i = 0; i < m_upload_queue.size(); ++i ) {
+          if( m_upload_queue[i].handle != nullptr )
+            m_upload_queue[i].handle->_set_state( kUPLOAD_IN_FLIGHT );
+        }
+
         m_geometry->upload_queue_into_vertex_buffer( &m_upload_queue );
         m_geometry->upload_queue_into_index_buffer( &m_upload_queue );
-        
-#if 0 // This is no longer done here
-        std::vector<queue>::iterator i = m_upload_queue.begin();
-        while( i != m_upload_queue.end() ) {
-          delete[] i->v_data;
-          delete[] i->i_data;
-          i->v_data = nullptr;
-          i->i_data = nullptr;
-          i = m_upload_queue.erase( i );
+
+        // The data is on the GPU buffers now, the handles give the staging memory back
+        for( int32_t i = 0; i < m_upload_queue.size(); ++i ) {
+          if( m_upload_queue[i].handle != nullptr )
+            m_upload_queue[i].handle->_set_state( kUPLOAD_RESIDENT );
         }
-#endif
+
+        m_staging->mutex.lock();
+        m_staging->pool.defrag();
+        m_staging->mutex.unlock();
+
         m_upload_queue.clear();
 
         m_queue_mutex.unlock();
@@ -295,16 +464,26 @@ namespace kretash {
 
         m_pool_mutex.lock();
 
-        while( m_remove_queue.size() != 0 ) {
+        // The frame in flight could still be reading this memory, wait for it to retire
+        m_retire_queue.insert( m_retire_queue.end(), m_remove_queue.begin(), m_remove_queue.end() );
+        m_remove_queue.clear();
 
-          remove_queue remove_me = m_remove_queue[0];
-          m_remove_queue.erase( m_remove_queue.begin() );
+        uint64_t completed_frame = m_completed_frame.load();
+        std::vector<remove_queue>::iterator i = m_retire_queue.begin();
+        while( i != m_retire_queue.end() ) {
 
-          _remove( remove_me );
+          if( i->frame <= completed_frame ) {
+            _remove( *i._Ptr );
+            i = m_retire_queue.erase( i );
+          } else {
+            ++i;
+          }
 
         }
 
-        _defrag_vectors();
+        m_V_pool->defrag();
+        m_I_pool->defrag();
+        m_C_pool->defrag();
 
         m_pool_mutex.unlock();
         m_removing_geometry.store( false );
@@ -348,5 +527,9 @@ namespace kretash {
     }
 
     m_remove_threads.clear();
+
+    // handles still waiting in the queue are discarded, the heap goes with the last one
+    m_upload_queue.clear();
+    m_staging = nullptr;
   }
 }
\ No newline at end of file
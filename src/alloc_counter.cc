@@ -0,0 +1,64 @@
+#include "core/alloc_counter.hh"
+#include <cstdlib>
+#include <new>
+
+// Replaces the global operator new for the whole program, only for allocation checks.
+// The tests project builds with it enabled.
+#ifndef COUNT_ALLOCATIONS
+#define COUNT_ALLOCATIONS 0
+#endif
+
+namespace kretash {
+
+  namespace alloc_counter {
+
+    static thread_local uint64_t t_allocations = 0;
+    static thread_local int32_t t_ignore = 0;
+
+    bool is_counting() {
+      return COUNT_ALLOCATIONS != 0;
+    }
+
+    uint64_t get_thread_allocations() {
+      return t_allocations;
+    }
+
+    ignore_scope::ignore_scope() {
+      ++t_ignore;
+    }
+
+    ignore_scope::~ignore_scope() {
+      --t_ignore;
+    }
+
+    static void _count() {
+      if( t_ignore == 0 ) ++t_allocations;
+    }
+  }
+}
+
+#if COUNT_ALLOCATIONS
+
+void* operator new( size_t size ) {
+  kretash::alloc_counter::_count();
+  void* p = malloc( size == 0 ? 1 : size );
+  if( p == nullptr ) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[]( size_t size ) {
+  kretash::alloc_counter::_count();
+  void* p = malloc( size == 0 ? 1 : size );
+  if( p == nullptr ) throw std::bad_alloc();
+  return p;
+}
+
+void operator delete( void* p ) noexcept {
+  free( p );
+}
+
+void operator delete[]( void* p ) noexcept {
+  free( p );
+}
+
+#endif
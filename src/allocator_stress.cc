@@ -0,0 +1,490 @@
+#include "core/allocator_stress.hh"
+#include "core/engine_settings.hh"
+#include "core/GPU_pool.hh"
+#include "core/pool.hh"
+
+#include <algorithm>
+#include <iostream>
+#include <fstream>
+#include <chrono>
+#include <cmath>
+#include <map>
+
+#define VALIDATE_EVERY 256
+
+#define VERTEX_STRIDE_BYTES (uint64_t)( 14 * sizeof( float ) )
+#define FRAMES_IN_FLIGHT 2
+
+#define DEVICE_POOL_SIZE ( ( uint64_t ) 1024 * ( uint64_t ) 512 * ( uint64_t ) 4 * ( uint64_t ) 512 )
+#define HOST_POOL_SIZE ( ( uint64_t ) 1024 * ( uint64_t ) 512 * ( uint64_t ) 4 * ( uint64_t ) 64 )
+
+#define MAX_UPGRADE_TEXTURES 16
+#define MAX_CLEAR_TEXTURES 32
+#define MAX_UPLOAD_TEXTURES 12
+
+namespace kretash {
+
+  // Same sizes the texture manager uses for its accounting
+  static const uint64_t texture_LOD_size[4] = {
+    ( uint64_t ) 1024 * ( uint64_t ) 512 * ( uint64_t ) 4,
+    ( uint64_t ) 512 * ( uint64_t ) 256 * ( uint64_t ) 4,
+    ( uint64_t ) 256 * ( uint64_t ) 128 * ( uint64_t ) 4,
+    ( uint64_t ) 128 * ( uint64_t ) 64 * ( uint64_t ) 4
+  };
+
+  struct stress_retire {
+    mem_block block;
+    int32_t frame;
+  };
+
+  AllocatorStress::AllocatorStress( uint32_t seed ) :
+    m_random( seed ),
+    m_current(),
+    m_operations( 0 ) {
+  }
+
+  bool AllocatorStress::run() {
+
+    int32_t grid = k_engine_settings->get_settings().grid;
+
+    _building_moves( grid, 2000 );
+    _random_fuzz( ( uint64_t ) 64 * ( uint64_t ) 1024 * ( uint64_t ) 1024, 200000 );
+    _texture_lod_changes( grid, 2000 );
+    _texture_uploads( grid, 2000 );
+
+    bool passed = true;
+    for( int32_t i = 0; i < m_reports.size(); ++i )
+      passed &= m_reports[i].no_overlap && m_reports[i].coalesced;
+
+    return passed;
+  }
+
+  /* Text trace written by Pool::record_trace, one operation per line:
+     p <type> <size> | a <start> <size> | f <start> <size> | x 0 <size> | d 0 0 */
+  bool AllocatorStress::replay( std::string filename ) {
+
+    std::ifstream trace( filename.c_str() );
+    if( !trace.is_open() ) {
+      std::cout << "TRACE NOT FOUND " << filename << std::endl;
+      return false;
+    }
+
+    std::shared_ptr<Pool> pool = nullptr;
+    std::map<uint64_t, mem_block> recorded;
+
+    char op = 0;
+    uint64_t a = 0;
+    uint64_t b = 0;
+
+    while( trace >> op >> a >> b ) {
+
+      if( op == 'p' ) {
+        pool = std::make_shared<Pool>();
+        pool->init( b, static_cast< pool_type >( a ) );
+        _begin( "replay " + filename, pool.get() );
+        continue;
+      }
+
+      if( pool == nullptr ) {
+        std::cout << "TRACE WITHOUT POOL HEADER " << filename << std::endl;
+        return false;
+      }
+
+      if( op == 'a' ) {
+        mem_block m;
+        if( _alloc( pool.get(), b, &m ) ) recorded[a] = m;
+      } else if( op == 'f' ) {
+        std::map<uint64_t, mem_block>::iterator i = recorded.find( a );
+        if( i != recorded.end() ) {
+          _free( pool.get(), i->second );
+          recorded.erase( i );
+        }
+      } else if( op == 'x' ) {
+        // the recording ran out of memory here, see if we do too
+        mem_block m;
+        if( _alloc( pool.get(), b, &m ) ) _free( pool.get(), m );
+      } else if( op == 'd' ) {
+        pool->defrag();
+      }
+    }
+
+    if( pool == nullptr ) return false;
+
+    std::vector<mem_block> live;
+    for( std::map<uint64_t, mem_block>::iterator i = recorded.begin(); i != recorded.end(); ++i )
+      live.push_back( i->second );
+
+    _finish( pool.get(), &live );
+
+    return m_reports.back().no_overlap && m_reports.back().coalesced;
+  }
+
+  // GPU_pool vertex and index buffers, rows of buildings get removed and regenerated like the
+  // city does, frees only go back once the frames using them retire.
+  void AllocatorStress::_building_moves( int32_t grid, int32_t frames ) {
+
+    int32_t buildings = grid * grid * 3;
+
+    for( int32_t buffer = 0; buffer < 2; ++buffer ) {
+
+      bool vertex = buffer == 0;
+      uint64_t size = vertex ? GPU_pool::get_vertex_buffer_size( grid ) : GPU_pool::get_index_buffer_size( grid );
+
+      Pool pool;
+      pool.init( size, vertex ? kVERTEX_BUFFER : kINDEX_BUFFER );
+      _begin( vertex ? "GPU_pool vertex, building moves" : "GPU_pool index, building moves", &pool );
+
+      auto geometry_size = [&] ( int32_t LOD ) {
+        uint64_t vertices = 0;
+        if( LOD == 0 ) vertices = _random_size( 1800, 6200 );
+        else if( LOD == 1 ) vertices = _random_size( 250, 900 );
+        else vertices = 48;
+        return vertex ? vertices * VERTEX_STRIDE_BYTES : vertices * sizeof( uint32_t );
+      };
+
+      std::vector<mem_block> live( buildings );
+      std::vector<bool> resident( buildings, false );
+      std::vector<stress_retire> retire;
+
+      for( int32_t i = 0; i < buildings; ++i )
+        resident[i] = _alloc( &pool, geometry_size( i % 3 ), &live[i] );
+
+      for( int32_t frame = 0; frame < frames; ++frame ) {
+
+        // a row of buildings moves
+        std::vector<int32_t> moved;
+        for( int32_t i = 0; i < grid; ++i ) {
+          int32_t building = ( int32_t ) ( m_random() % ( grid * grid ) );
+          for( int32_t LOD = 0; LOD < 3; ++LOD ) {
+            int32_t id = building * 3 + LOD;
+            if( !resident[id] ) continue;
+            stress_retire r = {};
+            r.block = live[id];
+            r.frame = frame;
+            retire.push_back( r );
+            resident[id] = false;
+            moved.push_back( id );
+          }
+        }
+
+        // the remove thread
+        std::vector<stress_retire>::iterator i = retire.begin();
+        while( i != retire.end() ) {
+          if( i->frame <= frame - FRAMES_IN_FLIGHT ) {
+            _free( &pool, i->block );
+            i = retire.erase( i );
+          } else {
+            ++i;
+          }
+        }
+        pool.defrag();
+
+        // generated buildings come back
+        for( int32_t e = 0; e < moved.size(); ++e ) {
+          int32_t id = moved[e];
+          resident[id] = _alloc( &pool, geometry_size( id % 3 ), &live[id] );
+        }
+
+        _sample( &pool );
+      }
+
+      std::vector<mem_block> remaining;
+      for( int32_t i = 0; i < buildings; ++i )
+        if( resident[i] ) remaining.push_back( live[i] );
+      for( int32_t i = 0; i < retire.size(); ++i )
+        remaining.push_back( retire[i].block );
+
+      _finish( &pool, &remaining );
+    }
+  }
+
+  // Random sizes over a couple of orders of magnitude, frees in random order
+  void AllocatorStress::_random_fuzz( uint64_t size, int32_t operations ) {
+
+    Pool pool;
+    pool.init( size, kVERTEX_BUFFER );
+    _begin( "random fuzz", &pool );
+
+    std::vector<mem_block> live;
+
+    for( int32_t op = 0; op < operations; ++op ) {
+
+      bool allocate = live.size() == 0 || ( m_random() % 100 ) < 55;
+
+      if( allocate ) {
+        uint64_t min = 256;
+        uint64_t max = 2 * 1024 * 1024;
+        // log uniform, small blocks are a lot more common
+        float t = ( float ) ( m_random() % 10000 ) / 10000.0f;
+        uint64_t block = ( uint64_t ) ( min * powf( ( float ) max / ( float ) min, t ) );
+
+        mem_block m;
+        if( _alloc( &pool, block, &m ) ) {
+          live.push_back( m );
+        } else {
+          for( int32_t i = 0; i < 4 && live.size() != 0; ++i ) {
+            int32_t victim = ( int32_t ) ( m_random() % live.size() );
+            _free( &pool, live[victim] );
+            live[victim] = live.back();
+            live.pop_back();
+          }
+          pool.defrag();
+        }
+      } else {
+        int32_t victim = ( int32_t ) ( m_random() % live.size() );
+        _free( &pool, live[victim] );
+        live[victim] = live.back();
+        live.pop_back();
+
+        if( ( m_random() % 64 ) == 0 ) pool.defrag();
+      }
+
+      if( ( op % 64 ) == 0 ) _sample( &pool );
+    }
+
+    _finish( &pool, &live );
+  }
+
+  // Vulkan device pool, textures move between LODs as the camera moves and get cleared under pressure
+  void AllocatorStress::_texture_lod_changes( int32_t grid, int32_t frames ) {
+
+    Pool pool;
+    pool.init( DEVICE_POOL_SIZE, kDEVICE_MEMORY );
+    _begin( "Vulkan device pool, texture LOD changes", &pool );
+
+    int32_t drawables = grid * grid;
+    std::vector<int32_t> LOD( drawables, -1 );
+    std::vector<mem_block> live( drawables * 3 );
+    std::vector<stress_retire> retire;
+
+    for( int32_t frame = 0; frame < frames; ++frame ) {
+
+      int32_t changed = 0;
+      for( int32_t i = 0; i < MAX_UPGRADE_TEXTURES; ++i ) {
+
+        int32_t d = ( int32_t ) ( m_random() % drawables );
+        int32_t new_LOD = ( int32_t ) ( m_random() % 4 );
+        if( new_LOD == LOD[d] ) continue;
+
+        mem_block fresh[3];
+        bool ok = true;
+        int32_t got = 0;
+        for( ; got < 3; ++got ) {
+          if( !_alloc( &pool, texture_LOD_size[new_LOD], &fresh[got] ) ) { ok = false; break; }
+        }
+
+        if( !ok ) {
+          for( int32_t e = 0; e < got; ++e ) _free( &pool, fresh[e] );
+          continue;
+        }
+
+        // the old texture is used until the frame retires
+        if( LOD[d] != -1 ) {
+          for( int32_t e = 0; e < 3; ++e ) {
+            stress_retire r = {};
+            r.block = live[d * 3 + e];
+            r.frame = frame;
+            retire.push_back( r );
+          }
+        }
+
+        for( int32_t e = 0; e < 3; ++e ) live[d * 3 + e] = fresh[e];
+        LOD[d] = new_LOD;
+        ++changed;
+      }
+
+      // clear deprecated textures when running low
+      if( pool.get_free_size() < texture_LOD_size[0] * 128 ) {
+        int32_t cleared = 0;
+        for( int32_t d = 0; d < drawables && cleared < MAX_CLEAR_TEXTURES; ++d ) {
+          if( LOD[d] == -1 || ( m_random() % 2 ) == 0 ) continue;
+          for( int32_t e = 0; e < 3; ++e ) {
+            stress_retire r = {};
+            r.block = live[d * 3 + e];
+            r.frame = frame;
+            retire.push_back( r );
+          }
+          LOD[d] = -1;
+          ++cleared;
+        }
+      }
+
+      bool released = false;
+      std::vector<stress_retire>::iterator i = retire.begin();
+      while( i != retire.end() ) {
+        if( i->frame <= frame - FRAMES_IN_FLIGHT ) {
+          _free( &pool, i->block );
+          i = retire.erase( i );
+          released = true;
+        } else {
+          ++i;
+        }
+      }
+      if( released ) pool.defrag();
+
+      _sample( &pool );
+    }
+
+    std::vector<mem_block> remaining;
+    for( int32_t d = 0; d < drawables; ++d ) {
+      if( LOD[d] == -1 ) continue;
+      for( int32_t e = 0; e < 3; ++e ) remaining.push_back( live[d * 3 + e] );
+    }
+    for( int32_t i = 0; i < retire.size(); ++i )
+      remaining.push_back( retire[i].block );
+
+    _finish( &pool, &remaining );
+  }
+
+  // Vulkan host visible pool, upload images live for a frame or two and go away in batches
+  void AllocatorStress::_texture_uploads( int32_t grid, int32_t frames ) {
+
+    Pool pool;
+    pool.init( HOST_POOL_SIZE, kHOST_VISIBLE );
+    _begin( "Vulkan host pool, texture uploads", &pool );
+
+    std::vector<stress_retire> in_flight;
+
+    for( int32_t frame = 0; frame < frames; ++frame ) {
+
+      // uploads only happen every other frame
+      if( ( frame % 2 ) == 0 ) {
+        int32_t uploads = ( int32_t ) ( m_random() % ( MAX_UPLOAD_TEXTURES + 1 ) );
+        for( int32_t i = 0; i < uploads * 3; ++i ) {
+          uint64_t size = texture_LOD_size[m_random() % 4];
+          stress_retire r = {};
+          r.frame = frame + 1 + ( int32_t ) ( m_random() % 2 );
+          if( _alloc( &pool, size, &r.block ) ) in_flight.push_back( r );
+        }
+      }
+
+      bool released = false;
+      std::vector<stress_retire>::iterator i = in_flight.begin();
+      while( i != in_flight.end() ) {
+        if( i->frame <= frame ) {
+          _free( &pool, i->block );
+          i = in_flight.erase( i );
+          released = true;
+        } else {
+          ++i;
+        }
+      }
+      if( released ) pool.defrag();
+
+      _sample( &pool );
+    }
+
+    std::vector<mem_block> remaining;
+    for( int32_t i = 0; i < in_flight.size(); ++i )
+      remaining.push_back( in_flight[i].block );
+
+    _finish( &pool, &remaining );
+  }
+
+  void AllocatorStress::_begin( std::string name, Pool* p ) {
+    m_current = stress_report();
+    m_current.name = name;
+    m_current.pool_size = p->get_size();
+    m_current.min_largest_free_block = p->get_largest_free_block();
+    m_operations = 0;
+  }
+
+  bool AllocatorStress::_alloc( Pool* p, uint64_t size, mem_block* m ) {
+
+    using namespace std::chrono;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    bool found = p->try_get_mem( size, m );
+    double time = duration_cast< duration<double, std::micro> >( high_resolution_clock::now() - start ).count();
+
+    m_current.worst_alloc_time = std::max( m_current.worst_alloc_time, time );
+    m_current.total_alloc_time += time;
+
+    if( found ) ++m_current.allocations;
+    else ++m_current.failures;
+
+    if( ( ++m_operations % VALIDATE_EVERY ) == 0 )
+      m_current.no_overlap &= p->validate();
+
+    return found;
+  }
+
+  void AllocatorStress::_free( Pool* p, mem_block m ) {
+
+    using namespace std::chrono;
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    p->release( m );
+    double time = duration_cast< duration<double, std::micro> >( high_resolution_clock::now() - start ).count();
+
+    m_current.worst_free_time = std::max( m_current.worst_free_time, time );
+    m_current.total_free_time += time;
+    ++m_current.releases;
+
+    if( ( ++m_operations % VALIDATE_EVERY ) == 0 )
+      m_current.no_overlap &= p->validate();
+  }
+
+  void AllocatorStress::_sample( Pool* p ) {
+
+    uint64_t free_size = p->get_free_size();
+    uint64_t largest = p->get_largest_free_block();
+
+    // 0 when all the free memory is a single block, close to 1 when it's all crumbs
+    float fragmentation = 0.0f;
+    if( free_size != 0 )
+      fragmentation = 1.0f - ( float ) ( ( double ) largest / ( double ) free_size );
+
+    m_current.peak_fragmentation = std::max( m_current.peak_fragmentation, fragmentation );
+    m_current.min_largest_free_block = std::min( m_current.min_largest_free_block, largest );
+  }
+
+  void AllocatorStress::_finish( Pool* p, std::vector<mem_block>* live ) {
+
+    m_current.no_overlap &= p->validate();
+
+    for( int32_t i = 0; i < live->size(); ++i )
+      _free( p, ( *live )[i] );
+    live->clear();
+
+    p->defrag();
+
+    m_current.no_overlap &= p->validate();
+    m_current.coalesced = p->get_used_block_count() == 0 &&
+      p->get_free_block_count() == 1 &&
+      p->get_largest_free_block() == p->get_size();
+
+    m_reports.push_back( m_current );
+  }
+
+  uint64_t AllocatorStress::_random_size( uint64_t min, uint64_t max ) {
+    return min + ( uint64_t ) ( m_random() % ( max - min + 1 ) );
+  }
+
+  void AllocatorStress::print_reports() {
+
+    std::cout << "---------------------------------- allocator stress ----------------------------------" << std::endl;
+
+    for( int32_t i = 0; i < m_reports.size(); ++i ) {
+      stress_report& r = m_reports[i];
+
+      uint32_t ops = std::max( r.allocations + r.failures, ( uint32_t ) 1 );
+
+      std::cout << r.name << std::endl;
+      std::cout << "  pool size             " << r.pool_size / 1024 << " KB" << std::endl;
+      std::cout << "  allocations/releases  " << r.allocations << " / " << r.releases << std::endl;
+      std::cout << "  failures              " << r.failures << std::endl;
+      std::cout << "  peak fragmentation    " << r.peak_fragmentation * 100.0f << " %" << std::endl;
+      std::cout << "  min largest free      " << r.min_largest_free_block / 1024 << " KB" << std::endl;
+      std::cout << "  alloc worst/average   " << r.worst_alloc_time << " / " << r.total_alloc_time / ops << " us" << std::endl;
+      std::cout << "  free worst/average    " << r.worst_free_time << " / " <<
+        r.total_free_time / std::max( r.releases, ( uint32_t ) 1 ) << " us" << std::endl;
+      std::cout << "  no overlap            " << ( r.no_overlap ? "OK" : "FAILED" ) << std::endl;
+      std::cout << "  full coalescing       " << ( r.coalesced ? "OK" : "FAILED" ) << std::endl;
+    }
+
+    std::cout << "--------------------------------------------------------------------------------------" << std::endl;
+  }
+
+  AllocatorStress::~AllocatorStress() {
+
+  }
+}
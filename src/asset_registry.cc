@@ -0,0 +1,137 @@
+#include "core/asset_registry.hh"
+#include "core/engine_settings.hh"
+#include "stb/stb_image.h"
+
+#include <cassert>
+#include <algorithm>
+
+// the main thread creates the GPU textures while these decode
+#define MAX_DECODE_THREADS 4
+
+namespace kretash {
+
+  AssetRegistry::AssetRegistry() {
+    m_next_decode.store( 0 );
+    m_uses = 0;
+  }
+
+  texture_asset* AssetRegistry::acquire_texture( std::string filename, Texture* owner, texture_t type,
+    bool* created ) {
+
+    ++m_uses;
+
+    std::unordered_map<std::string, std::shared_ptr<texture_asset>>::iterator found = m_assets.find( filename );
+    if( found != m_assets.end() ) {
+      texture_asset* a = found->second.get();
+      ++a->uses;
+      *created = false;
+      return a;
+    }
+
+    std::shared_ptr<texture_asset> a = std::make_shared<texture_asset>();
+    a->filename = filename;
+    a->id = -1;
+    a->uses = 1;
+    a->owner = owner;
+    a->type = type;
+    a->pixels = nullptr;
+    a->width = 0;
+    a->height = 0;
+    a->channels = 0;
+    a->decoded.store( false );
+
+    m_assets[filename] = a;
+    m_decode_queue.push_back( a.get() );
+
+    *created = true;
+    return a.get();
+  }
+
+  void AssetRegistry::requeue_all() {
+    m_decode_queue.clear();
+    std::unordered_map<std::string, std::shared_ptr<texture_asset>>::iterator i = m_assets.begin();
+    for( ; i != m_assets.end(); ++i )
+      m_decode_queue.push_back( i->second.get() );
+  }
+
+  void AssetRegistry::decode_queued( std::function<void( texture_asset* )> on_decoded ) {
+    if( m_decode_queue.size() == 0 ) return;
+
+    std::vector<std::thread> threads;
+    _start_decode( &threads );
+
+    for( size_t i = 0; i < m_decode_queue.size(); ++i ) {
+      texture_asset* a = m_decode_queue[i];
+      while( !a->decoded.load() )
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+
+      on_decoded( a );
+
+      stbi_image_free( a->pixels );
+      a->pixels = nullptr;
+    }
+
+    for( size_t i = 0; i < threads.size(); ++i )
+      threads[i].join();
+
+    m_decode_queue.clear();
+  }
+
+  void AssetRegistry::decode() {
+    if( m_decode_queue.size() == 0 ) return;
+
+    std::vector<std::thread> threads;
+    _start_decode( &threads );
+
+    for( size_t i = 0; i < threads.size(); ++i )
+      threads[i].join();
+  }
+
+  void AssetRegistry::create_decoded( std::function<void( texture_asset* )> on_decoded ) {
+    for( size_t i = 0; i < m_decode_queue.size(); ++i ) {
+      texture_asset* a = m_decode_queue[i];
+      assert( a->decoded.load() && "TEXTURE NOT DECODED" );
+
+      on_decoded( a );
+
+      stbi_image_free( a->pixels );
+      a->pixels = nullptr;
+    }
+
+    m_decode_queue.clear();
+  }
+
+  void AssetRegistry::_start_decode( std::vector<std::thread>* threads ) {
+    for( size_t i = 0; i < m_decode_queue.size(); ++i )
+      m_decode_queue[i]->decoded.store( false );
+    m_next_decode.store( 0 );
+
+    uint32_t hardware = std::max( 1u, std::thread::hardware_concurrency() );
+    uint32_t count = std::min( std::min( hardware, ( uint32_t ) MAX_DECODE_THREADS ),
+      static_cast< uint32_t >( m_decode_queue.size() ) );
+
+    for( uint32_t i = 0; i < count; ++i )
+      threads->push_back( std::thread( &AssetRegistry::_decode_loop, this ) );
+  }
+
+  void AssetRegistry::_decode_loop() {
+    while( true ) {
+      uint32_t i = m_next_decode++;
+      if( i >= m_decode_queue.size() ) return;
+
+      texture_asset* a = m_decode_queue[i];
+      std::string path = TPATH;
+      path.append( a->filename );
+
+      a->pixels = stbi_load( path.c_str(), &a->width, &a->height, &a->channels, 4 );
+      a->decoded.store( true );
+    }
+  }
+
+  AssetRegistry::~AssetRegistry() {
+    std::unordered_map<std::string, std::shared_ptr<texture_asset>>::iterator i = m_assets.begin();
+    for( ; i != m_assets.end(); ++i ) {
+      if( i->second->pixels != nullptr ) stbi_image_free( i->second->pixels );
+    }
+  }
+}
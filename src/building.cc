@@ -3,9 +3,17 @@
 
 #include "core/building.hh"
 #include "core/GPU_pool.hh"
+#include "core/xx/context.hh"
 #include "core/tools.hh"
+#include "core/swap_cache.hh"
 #include "noise/OpenSimplexNoise.hh"
 
+// share of the LOD0 triangles each LOD aims for and how far it can drift from LOD0
+#define LOD1_TRIANGLE_RATIO 0.5f
+#define LOD1_MAX_ERROR 1.0f
+#define LOD2_TRIANGLE_RATIO 0.1f
+#define LOD2_MAX_ERROR 6.0f
+
 namespace kretash {
 
   Building::Building( bool placeholder ) :
@@ -14,7 +22,7 @@ namespace kretash {
     m_num_floors( 0 ),
     m_num_sides( 0 ),
     m_instances( 0 ),
-    m_angle_s( 0 ),
+    m_angle_s(),
     m_side_neibours( 0 ),
     m_base_size( 0.0f ),
     m_instance_decrement( 0.0f ),
@@ -28,6 +36,10 @@ namespace kretash {
       this->m_geometry[0] = std::make_shared<Geometry>( k_engine->get_GPU_pool()->get_placeholder_building() );
       this->m_geometry[1] = std::make_shared<Geometry>( k_engine->get_GPU_pool()->get_placeholder_building() );
       this->m_geometry[2] = std::make_shared<Geometry>( k_engine->get_GPU_pool()->get_placeholder_building() );
+      fit_bounds();
+
+      // only buildings that get drawn carry spacers, placeholders and HLOD builders don't
+      set_max_part_instances( MAX_SPACER_INSTANCES );
     }
 
     m_building_generator_LOD0 = std::auto_ptr<BuildingGen>( new BuildingGen );
@@ -35,46 +47,260 @@ namespace kretash {
     m_building_generator_LOD2 = std::auto_ptr<BuildingGen>( new BuildingGen );
     m_noise_handle = std::auto_ptr<OpenSimplexNoise>( new OpenSimplexNoise );
 
+    for( int32_t i = 0; i < MAX_SPACER_RINGS; ++i )
+      m_spacer_generators[i] = std::make_shared<BuildingGen>();
+    m_spacer_first[0] = 0;
+    m_spacer_ring_count = 0;
+    m_spacer_saved_bytes = 0;
+
+    // only what gets drawn outlives an API swap, placeholders and HLOD builders get made again
+    if( !placeholder ) {
+      m_building_generator_LOD0->set_swap_cached( true );
+      m_building_generator_LOD1->set_swap_cached( true );
+      m_building_generator_LOD2->set_swap_cached( true );
+      for( int32_t i = 0; i < MAX_SPACER_RINGS; ++i )
+        m_spacer_generators[i]->set_swap_cached( true );
+    }
+
     m_ready_to_process = true;
+    m_pending_uploads = 0;
+    m_requested_lods = kLOD2_MASK;
+    m_resident_lods = 0;
   }
 
   void Building::prepare( float seed_x, float seed_y ) {
-    if( !m_empty ) {
-      k_engine->get_GPU_pool()->remove( get_geometry( 0 ) );
-      k_engine->get_GPU_pool()->remove( get_geometry( 1 ) );
-      k_engine->get_GPU_pool()->remove( get_geometry( 2 ) );
-      m_empty = true;
-    }
+    clear();
+
+    // a new building starts from its coarsest LOD, the city asks for the rest when the camera gets close
+    m_requested_lods = kLOD2_MASK;
+
+    // the meshes kept for the last seed don't belong to this building anymore
+    SwapCache* cache = k_engine->get_swap_cache();
+    cache->forget_mesh( m_building_generator_LOD0.get() );
+    cache->forget_mesh( m_building_generator_LOD1.get() );
+    cache->forget_mesh( m_building_generator_LOD2.get() );
+    for( int32_t i = 0; i < MAX_SPACER_RINGS; ++i )
+      cache->forget_mesh( m_spacer_generators[i].get() );
 
     _init_noise( seed_x, seed_y );
   }
 
-  void Building::generate() {
+  // The ring settings and offsets are still the ones the kept meshes were generated with
+  bool Building::restore() {
+    uint32_t lods = m_requested_lods;
+    BuildingGen* generators[3] = { m_building_generator_LOD0.get(), m_building_generator_LOD1.get(),
+      m_building_generator_LOD2.get() };
+
+    bool restored = true;
+    for( int32_t i = 0; i < 3 && restored; ++i ) {
+      if( lods & ( 1 << i ) ) restored = generators[i]->restore();
+    }
+
+    if( lods & kLOD0_MASK ) {
+      for( uint32_t r = 0; r < m_spacer_ring_count && restored; ++r )
+        restored = m_spacer_generators[r]->restore();
+    }
+
+    if( !restored ) discard_upload();
+    return restored;
+  }
+
+  void Building::generate( building_arena* arena ) {
+    uint32_t lods = m_requested_lods;
+
+    // LOD0 is always generated, it's the source the other LODs get simplified from
+    m_building_generator_LOD0->begin( &arena->lod[0] );
+    if( lods & kLOD1_MASK ) m_building_generator_LOD1->begin( &arena->lod[1] );
+    if( lods & kLOD2_MASK ) m_building_generator_LOD2->begin( &arena->lod[2] );
+
     _generate_classic_building();
 
-    m_building_generator_LOD0->combine_buffers();
-    m_building_generator_LOD1->combine_buffers();
-    m_building_generator_LOD2->combine_buffers();
+    // the lower LODs are LOD0 simplified, so they only differ from it by their stored error
+    if( lods & kLOD1_MASK ) {
+      m_building_generator_LOD1->simplify( m_building_generator_LOD0.get(), LOD1_TRIANGLE_RATIO, LOD1_MAX_ERROR,
+        false, &arena->simplify );
+    }
+    if( lods & kLOD2_MASK ) {
+      m_building_generator_LOD2->simplify( m_building_generator_LOD0.get(), LOD2_TRIANGLE_RATIO, LOD2_MAX_ERROR,
+        false, &arena->simplify );
+    }
+
+    // only the full detail mesh is big and close enough for cluster culling to pay off
+    if( lods & kLOD0_MASK ) m_building_generator_LOD0->combine_buffers( true );
+    else m_building_generator_LOD0->discard();
+    if( lods & kLOD1_MASK ) m_building_generator_LOD1->combine_buffers();
+    if( lods & kLOD2_MASK ) m_building_generator_LOD2->combine_buffers();
+
+    // the spacers stick out a fraction of LOD1's error, they only come with LOD0
+    if( lods & kLOD0_MASK ) _generate_spacers( &arena->lod[0] );
+  }
+
+  // Every ring gets its own small mesh, LOD0's scratch is free again once LOD0 got combined
+  void Building::_generate_spacers( building_scratch* scratch ) {
+    uint32_t stride = k_engine->get_context()->get_stride();
+    m_spacer_saved_bytes = 0;
+
+    for( uint32_t r = 0; r < m_spacer_ring_count; ++r ) {
+      BuildingGen* gen = m_spacer_generators[r].get();
+      gen->begin( scratch );
+      gen->generate( m_spacer_rings[r] );
+      gen->combine_buffers();
+
+      // baked into LOD0 the ring's vertices were there once per floor
+      uint32_t copies = m_spacer_first[r + 1] - m_spacer_first[r];
+      m_spacer_saved_bytes += static_cast< uint64_t >( gen->get_welded_vertex_count() ) * ( copies - 1 ) *
+        stride * sizeof( float );
+    }
+  }
+
+  void Building::_begin_spacer_ring( building_settings bs ) {
+    assert( m_spacer_ring_count < MAX_SPACER_RINGS && "TOO MANY SPACER RINGS" );
+    m_spacer_rings[m_spacer_ring_count] = bs;
+    ++m_spacer_ring_count;
+    m_spacer_first[m_spacer_ring_count] = m_spacer_first[m_spacer_ring_count - 1];
+  }
+
+  void Building::_add_spacer( float3 offset ) {
+    assert( m_spacer_first[m_spacer_ring_count] < MAX_SPACER_INSTANCES && "TOO MANY SPACERS" );
+    m_spacer_offsets[m_spacer_first[m_spacer_ring_count]++] = offset;
+  }
+
+  // The parts go with LOD0, remove gives their memory back to the pool, without it they're just forgotten
+  void Building::_release_spacers( bool remove ) {
+    for( uint32_t i = 0; i < m_instanced_parts.size(); ++i ) {
+      if( remove ) k_engine->get_GPU_pool()->remove( m_instanced_parts[i].geometry.get() );
+    }
+    m_instanced_parts.clear();
+  }
+
+  BuildingGen* Building::generate_hlod_part( building_arena* arena ) {
+    m_building_generator_LOD0->begin( &arena->lod[0] );
+    m_building_generator_LOD2->begin( &arena->lod[2] );
+
+    _generate_classic_building();
+
+    m_building_generator_LOD2->simplify( m_building_generator_LOD0.get(), LOD2_TRIANGLE_RATIO, LOD2_MAX_ERROR,
+      false, &arena->simplify );
+    m_building_generator_LOD0->discard();
+
+    return m_building_generator_LOD2.get();
   }
 
   void Building::upload_and_clean() {
     m_empty = false;
+    uint32_t lods = m_requested_lods;
+    BuildingGen* generators[3] = { m_building_generator_LOD0.get(), m_building_generator_LOD1.get(),
+      m_building_generator_LOD2.get() };
+
+    // called from the upload thread once each LOD copy is done
+    uint32_t spacer_rings = ( lods & kLOD0_MASK ) ? m_spacer_ring_count : 0;
+    m_pending_uploads = ( ( lods & kLOD0_MASK ) ? 1 : 0 ) + ( ( lods & kLOD1_MASK ) ? 1 : 0 ) +
+      ( ( lods & kLOD2_MASK ) ? 1 : 0 ) + spacer_rings;
+    auto uploaded = [this] ( UploadHandle* h ) {
+      if( --m_pending_uploads == 0 ) m_ready_to_process = true;
+    };
+
+    for( int32_t i = 0; i < 3; ++i ) {
+      if( ( lods & ( 1 << i ) ) == 0 ) continue;
+
+      generators[i]->finish_and_upload( uploaded );
+      m_geometry[i] = std::make_shared<Geometry>( dynamic_cast< Geometry* >( generators[i] ) );
+      assert( m_geometry[i] != nullptr && "CAST TO GEOMETRY FAILED" );
+    }
 
-    m_building_generator_LOD0->finish_and_upload();
-    m_geometry[0] = std::make_shared<Geometry>( dynamic_cast< Geometry* >( m_building_generator_LOD0.get() ) );
-    assert( m_geometry[0] != nullptr && "CAST TO GEOMETRY FAILED" );
+    if( spacer_rings != 0 ) _release_spacers( true );
+    m_instanced_parts.resize( spacer_rings );
+    for( uint32_t r = 0; r < spacer_rings; ++r ) {
+      m_spacer_generators[r]->finish_and_upload( uploaded );
+      m_instanced_parts[r].geometry = std::make_shared<Geometry>( dynamic_cast< Geometry* >( m_spacer_generators[r].get() ) );
+      m_instanced_parts[r].offsets.assign( m_spacer_offsets + m_spacer_first[r], m_spacer_offsets + m_spacer_first[r + 1] );
+    }
+
+    m_resident_lods |= lods;
+    m_requested_lods = 0;
+    _alias_missing_lods();
+
+    fit_bounds();
+  }
 
-    m_building_generator_LOD1->finish_and_upload();
-    m_geometry[1] = std::make_shared<Geometry>( dynamic_cast< Geometry* >( m_building_generator_LOD1.get() ) );
-    assert( m_geometry[1] != nullptr && "CAST TO GEOMETRY FAILED" );
+  void Building::evict_lod( int32_t LOD ) {
+    assert( LOD != 2 && "LOD2 STAYS AS LONG AS THE BUILDING" );
+    if( ( m_resident_lods & ( 1 << LOD ) ) == 0 ) return;
 
-    m_building_generator_LOD2->finish_and_upload();
-    m_geometry[2] = std::make_shared<Geometry>( dynamic_cast< Geometry* >( m_building_generator_LOD2.get() ) );
-    assert( m_geometry[2] != nullptr && "CAST TO GEOMETRY FAILED" );
+    k_engine->get_GPU_pool()->remove( get_geometry( LOD ) );
+    if( LOD == 0 ) _release_spacers( true );
+    m_resident_lods &= ~( 1 << LOD );
+    _alias_missing_lods();
 
+    fit_bounds();
   }
 
-  void Building::generate_placeholder() {
+  void Building::forget_lods() {
+    m_requested_lods = m_resident_lods | kLOD2_MASK;
+    m_resident_lods = 0;
+    m_empty = true;
+    _release_spacers( false );
+
+    for( int32_t i = 0; i < 3; ++i )
+      m_geometry[i] = std::make_shared<Geometry>( k_engine->get_GPU_pool()->get_placeholder_building() );
+    fit_bounds();
+  }
+
+  // A LOD that isn't on the GPU draws the next coarser one, the selection never has to know
+  void Building::_alias_missing_lods() {
+    for( int32_t i = 1; i >= 0; --i ) {
+      if( ( m_resident_lods & ( 1 << i ) ) == 0 ) m_geometry[i] = m_geometry[i + 1];
+    }
+  }
+
+  uint64_t Building::get_upload_size() {
+    uint64_t spacers = 0;
+    for( int32_t i = 0; i < MAX_SPACER_RINGS; ++i )
+      spacers += m_spacer_generators[i]->get_staging_size();
+
+    return m_building_generator_LOD0->get_staging_size() +
+      m_building_generator_LOD1->get_staging_size() +
+      m_building_generator_LOD2->get_staging_size() + spacers;
+  }
+
+  void Building::get_vertex_counts( int32_t LOD, uint32_t* unwelded, uint32_t* welded ) {
+    BuildingGen* gen = m_building_generator_LOD0.get();
+    if( LOD == 1 ) gen = m_building_generator_LOD1.get();
+    if( LOD == 2 ) gen = m_building_generator_LOD2.get();
+
+    *unwelded = gen->get_unwelded_vertex_count();
+    *welded = gen->get_welded_vertex_count();
+  }
+
+  void Building::get_triangle_counts( int32_t LOD, uint32_t* generated, uint32_t* hidden ) {
+    BuildingGen* gen = m_building_generator_LOD0.get();
+    if( LOD == 1 ) gen = m_building_generator_LOD1.get();
+    if( LOD == 2 ) gen = m_building_generator_LOD2.get();
+
+    *generated = gen->get_generated_triangle_count();
+    *hidden = gen->get_hidden_triangle_count();
+  }
+
+  void Building::get_cache_misses( int32_t LOD, uint32_t* unoptimized, uint32_t* optimized ) {
+    BuildingGen* gen = m_building_generator_LOD0.get();
+    if( LOD == 1 ) gen = m_building_generator_LOD1.get();
+    if( LOD == 2 ) gen = m_building_generator_LOD2.get();
+
+    *unoptimized = gen->get_unoptimized_cache_misses();
+    *optimized = gen->get_optimized_cache_misses();
+  }
+
+  void Building::discard_upload() {
+    m_building_generator_LOD0->discard();
+    m_building_generator_LOD1->discard();
+    m_building_generator_LOD2->discard();
+    for( int32_t i = 0; i < MAX_SPACER_RINGS; ++i )
+      m_spacer_generators[i]->discard();
+  }
+
+  void Building::generate_placeholder( building_arena* arena ) {
+    m_building_generator_LOD0->begin( &arena->lod[0] );
+
     building_settings bs = {};
     bs.init_s( 4, 1, 30.0f, float3( 0.0f, 0.0f, 0.0f ) );
     bs.init_r( eSingle, 0, 0, 13.0f, m_main_texture_set );
@@ -94,9 +320,12 @@ namespace kretash {
 
   void Building::clear() {
     if( !m_empty ) {
-      k_engine->get_GPU_pool()->remove( get_geometry( 0 ) );
-      k_engine->get_GPU_pool()->remove( get_geometry( 1 ) );
-      k_engine->get_GPU_pool()->remove( get_geometry( 2 ) );
+      // the finer slots may be borrowing LOD2's geometry, only what is resident goes back
+      for( int32_t i = 0; i < 3; ++i ) {
+        if( m_resident_lods & ( 1 << i ) ) k_engine->get_GPU_pool()->remove( get_geometry( i ) );
+      }
+      _release_spacers( true );
+      m_resident_lods = 0;
       m_empty = true;
     }
   }
@@ -140,13 +369,14 @@ namespace kretash {
     m_spacers_size = _get_p_rand( 0.1f, 0.15f, 3.3f );
     m_ground_height = 5.0f;
 
-    m_angle_s = new int[m_instances + 1];
+    assert( m_instances <= MAX_BUILDING_INSTANCES && "TOO MANY INSTANCES" );
     for( int i = 0; i < m_instances + 1; ++i ) {
       m_angle_s[i] = _get_p_rand( 0, 5, 44.0f );
     }
 
     int side_s = _get_p_rand( 0, 5, 44.0f );
     float current_height = 0.0f;
+    m_spacer_ring_count = 0;
 
     building_settings bs = {};
     bs.init_s( m_num_sides, 1, m_ground_height, float3( 0.0f, current_height, 0.0f ) );
@@ -166,65 +396,57 @@ namespace kretash {
       m_building_generator_LOD0->generate( bs );
 
       bs.n_vertical_uv = 0.05f;
-      //Spacers
+      //Spacers, the same ring on every floor so it's generated once and instanced
+      bs.init_s( m_num_sides, 1, 0.3f, float3( 0.0f, 0.0f, 0.0f ) );
+      bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*( m_base_size + m_spacers_size ), m_roof_texture_set );
+      _begin_spacer_ring( bs );
       for( int e = 0; e < current_floors; ++e ) {
-        bs.init_s( m_num_sides, 1, 0.3f, float3( 0.0f, e * 3.0f + current_height, 0.0f ) );
-        bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*( m_base_size + m_spacers_size ), m_roof_texture_set );
-        m_building_generator_LOD0->generate( bs );
+        _add_spacer( float3( 0.0f, e * 3.0f + current_height, 0.0f ) );
       }
       bs.n_vertical_uv = 1.0f;
 
       //Neighbors
       if( i == 0 ) {
         if( m_side_neibours > 0 ) {
+          // all four neighbours share one spacer ring
+          bs.n_vertical_uv = 0.05f;
+          bs.init_s( m_num_sides, 1, 0.3f, float3( 0.0f, 0.0f, 0.0f ) );
+          bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*( m_side_neibours_size + m_spacers_size ), m_roof_texture_set );
+          _begin_spacer_ring( bs );
+          bs.n_vertical_uv = 1.0f;
+
           bs.init_s( m_num_sides, current_floors, 3.0f, float3( d*m_side_neibours_size, current_height - 0.1f, 0.0f ) );
           bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*m_side_neibours_size, m_main_texture_set );
           m_building_generator_LOD0->generate( bs );
 
-          bs.n_vertical_uv = 0.05f;
           for( int e = 0; e < current_floors; ++e ) {
-            bs.init_s( m_num_sides, 1, 0.3f, float3( d*m_side_neibours_size, e * 3.0f + current_height, 0.0f ) );
-            bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*( m_side_neibours_size + m_spacers_size ), m_roof_texture_set );
-            m_building_generator_LOD0->generate( bs );
+            _add_spacer( float3( d*m_side_neibours_size, e * 3.0f + current_height, 0.0f ) );
           }
-          bs.n_vertical_uv = 1.0f;
 
           bs.init_s( m_num_sides, current_floors, 3.0f, float3( -d*m_side_neibours_size, current_height - 0.1f, 0.0f ) );
           bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*m_side_neibours_size, m_main_texture_set );
           m_building_generator_LOD0->generate( bs );
 
-          bs.n_vertical_uv = 0.05f;
           for( int e = 0; e < current_floors; ++e ) {
-            bs.init_s( m_num_sides, 1, 0.3f, float3( -d*m_side_neibours_size, e * 3.0f + current_height, 0.0f ) );
-            bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*( m_side_neibours_size + m_spacers_size ), m_roof_texture_set );
-            m_building_generator_LOD0->generate( bs );
+            _add_spacer( float3( -d*m_side_neibours_size, e * 3.0f + current_height, 0.0f ) );
           }
-          bs.n_vertical_uv = 1.0f;
         }
         if( m_side_neibours > 1 ) {
           bs.init_s( m_num_sides, current_floors, 3.0f, float3( 0.0f, current_height - 0.1f, d*m_side_neibours_size ) );
           bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*m_side_neibours_size, m_main_texture_set );
           m_building_generator_LOD0->generate( bs );
 
-          bs.n_vertical_uv = 0.05f;
           for( int e = 0; e < current_floors; ++e ) {
-            bs.init_s( m_num_sides, 1, 0.3f, float3( 0.0f, e * 3.0f + current_height - 0.1f, d*m_side_neibours_size ) );
-            bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*( m_side_neibours_size + m_spacers_size ), m_roof_texture_set );
-            m_building_generator_LOD0->generate( bs );
+            _add_spacer( float3( 0.0f, e * 3.0f + current_height - 0.1f, d*m_side_neibours_size ) );
           }
-          bs.n_vertical_uv = 1.0f;
 
           bs.init_s( m_num_sides, current_floors, 3.0f, float3( 0.0f, current_height - 0.1f, -d*m_side_neibours_size ) );
           bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*m_side_neibours_size, m_main_texture_set );
           m_building_generator_LOD0->generate( bs );
 
-          bs.n_vertical_uv = 0.05f;
           for( int e = 0; e < current_floors; ++e ) {
-            bs.init_s( m_num_sides, 1, 0.3f, float3( 0.0f, e * 3.0f + current_height - 0.1f, -d*m_side_neibours_size ) );
-            bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*( m_side_neibours_size + m_spacers_size ), m_roof_texture_set );
-            m_building_generator_LOD0->generate( bs );
+            _add_spacer( float3( 0.0f, e * 3.0f + current_height - 0.1f, -d*m_side_neibours_size ) );
           }
-          bs.n_vertical_uv = 1.0f;
         }
       }
 
@@ -238,36 +460,6 @@ namespace kretash {
     m_building_generator_LOD0->generate( bs );
 
     current_height += 0.3f;
-    m_max_height = ( current_height + 10.0f )*1.2f;
-    m_radius = m_building_generator_LOD0->get_radius() * 1.2f;
-
-    current_height = 0.0f;
-
-    bs.init_s( m_num_sides, 1, m_ground_height, float3( 0.0f, current_height, 0.0f ) );
-    bs.init_r( m_iteration_group, m_angle_s[0], side_s, ( m_base_size + m_ground_size_offset ), m_main_texture_set );
-    m_building_generator_LOD1->generate( bs );
-    current_height += 5.0f;
-
-    for( int i = 0; i < m_instances; ++i ) {
-      // Main
-      float d = pow( m_instance_decrement, i );
-
-      int current_floors = m_num_floors - 2 * i;
-      current_floors = std::max( 1, current_floors );
-
-      bs.init_s( m_num_sides, current_floors, 3.0f, float3( 0.0f, current_height, 0.0f ) );
-      bs.init_r( m_iteration_group, m_angle_s[i + 1], side_s, d*m_base_size, m_main_texture_set );
-      m_building_generator_LOD1->generate( bs );
-
-      current_height += 3.0f * current_floors;
-    }
-
-    // LOD 2
-    bs.init_s( 4, 1, current_height, float3( 0.0f, 0.0f, 0.0f ) );
-    bs.init_r( eSingle, 0, side_s, 13.0f, m_main_texture_set );
-    m_building_generator_LOD2->generate( bs );
-
-    delete[] m_angle_s;
   }
 
   void Building::_generate_modern_building() {
@@ -312,6 +504,11 @@ namespace kretash {
   }
 
   Building::~Building() {
+    m_building_generator_LOD0->forget_upload();
+    m_building_generator_LOD1->forget_upload();
+    m_building_generator_LOD2->forget_upload();
+    for( int32_t i = 0; i < MAX_SPACER_RINGS; ++i )
+      m_spacer_generators[i]->forget_upload();
   }
 
 }
\ No newline at end of file
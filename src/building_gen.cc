@@ -1,10 +1,26 @@
 #include "core/building_gen.hh"
 #include "core/GPU_pool.hh"
 #include "core/tools.hh"
+#include "core/xx/context.hh"
 #include "core/engine_settings.hh"
 #include "core/math/float4x4.hh"
+#include "core/alloc_counter.hh"
+#include "core/tangent_kernel.hh"
+#include "core/swap_cache.hh"
 #include <vector>
 #include <cassert>
+#include <cstring>
+#include <cmath>
+
+#define WELD_EPSILON 0.0001f
+#define WELD_EMPTY 0xffffffff
+#define HSR_EPSILON 0.001f
+// FIFO size the triangle order is tuned and measured for, and the ACMR the overdraw sort may cost
+#define VERTEX_CACHE_SIZE 16
+#define OVERDRAW_THRESHOLD 1.05f
+// cluster limits for the CPU cluster culling, the usual meshlet sizes
+#define CLUSTER_MAX_VERTICES 64
+#define CLUSTER_MAX_TRIANGLES 124
 
 namespace kretash {
 
@@ -12,18 +28,36 @@ namespace kretash {
     n_sides( 0 ),
     n_floors( 0 ),
     n_floor_height( 0.0f ),
-    c_angle( 0.0f ),
     a_id( 0 ),
     p_id( 0 ),
     n_elem_offset( 0 ),
-    m_radius( 0.0f ),
-    m_vertex_length( 0 ),
-    m_vertex_buffer( nullptr ),
-    m_elem_buffer( nullptr ) {
+    m_scratch( nullptr ),
+    m_upload( nullptr ),
+    m_in_flight( nullptr ),
+    m_unwelded_vertices( 0 ),
+    m_welded_vertices( 0 ),
+    m_generated_triangles( 0 ),
+    m_hidden_triangles( 0 ),
+    m_unoptimized_cache_misses( 0 ),
+    m_optimized_cache_misses( 0 ),
+    m_swap_cached( false ) {
+  }
+
+  // Everything generate and combine_buffers need lives in the scratch, combine_buffers
+  // hands it back so the worker can use it for the next building
+  void BuildingGen::begin( building_scratch* scratch ) {
+    assert( scratch != nullptr && "NO SCRATCH TO GENERATE INTO" );
+    m_scratch = scratch;
+    m_scratch->clear();
+    n_elem_offset = 0;
+    m_lod_error = 0.0f;
+    m_hidden_triangles = 0;
   }
 
   void BuildingGen::generate( building_settings s ) {
 
+    assert( m_scratch != nullptr && "GENERATE WITHOUT BEGIN" );
+
     n_sides = s.n_sides;
     n_floors = s.n_floors;
     n_floor_height = s.n_floor_height;
@@ -33,12 +67,10 @@ namespace kretash {
     a_id = s.n_angle_seed;
     p_id = s.n_size_seed;
 
-    c_angle = 0.0f;
-    n_angles = new float[n_sides];
-    n_side_size = new float[n_sides];
-    c_pos = { 0.0f, 0.0f, 0.0f };
-    c_norm = { 0.0f, 0.0f, 0.0f };
-    n_uv = { 0.0f, 0.0f };
+    m_scratch->angles.resize( n_sides );
+    m_scratch->side_size.resize( n_sides );
+    n_angles = m_scratch->angles.data();
+    n_side_size = m_scratch->side_size.data();
 
     uv_x_min = 0.0f;
     uv_y_min = 0.0f;
@@ -64,58 +96,48 @@ namespace kretash {
       _generate_sizes_5( n_side_size, n_sides );
     }
 
-    {
-      float c_angle = 0.0f;
-      float3 c_pos = { 0.0f, 0.0f, 0.0f };
-      for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-        c_angle += n_angles[i_s];
-        c_pos.x += sinf( to_rad( c_angle ) ) * n_side_size[i_s];
-        c_pos.z += cosf( to_rad( c_angle ) ) * n_side_size[i_s];
-        center_pos = center_pos + c_pos;
-      }
-    }
-    center_pos = center_pos / ( float ) n_sides;
-    center_pos.y = 0;
+    center_offset = s.n_center_offset;
 
-    if( m_radius < float3::lenght( center_pos ) )
-      m_radius = float3::lenght( center_pos );
+    _generate_ring();
 
-    center_pos -= s.n_center_offset;
-    center_offset = s.n_center_offset;
+    // bottom cap, one row per floor side, top cap
+    const uint32_t row = n_sides * 2;
+    const uint32_t star_vertex = ( uint32_t ) m_scratch->vertices.size();
+    const uint32_t num_vertices = ( row + 1 ) * 2 + row * n_floors * 2;
 
-    uint32_t star_vertex = ( uint32_t ) n_vertices.size();
+    m_scratch->vertices.resize( star_vertex + num_vertices );
+    m_scratch->normals.resize( star_vertex + num_vertices );
+    m_scratch->uvs.resize( star_vertex + num_vertices );
 
-    _generate_bot_face();
+    float3* vertices = &m_scratch->vertices[star_vertex];
+    float3* normals = &m_scratch->normals[star_vertex];
+    float2* uvs = &m_scratch->uvs[star_vertex];
 
-    for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-      _generate_floor( i_s, 0, false );
-    }
+    _generate_bot_face( vertices, normals, uvs );
 
-    c_pos.y += n_floor_height;
+    vertices += row + 1;
+    normals += row + 1;
+    uvs += row + 1;
 
-    for( uint32_t i_f = 1; i_f < n_floors; ++i_f ) {
-      for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-        _generate_floor( i_s, i_f, true );
-      }
-      for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-        _generate_floor( i_s, i_f, false );
-      }
-      c_pos.y += n_floor_height;
-    }
+    _generate_floors( vertices, normals, uvs );
 
-    for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-      _generate_floor( i_s, n_floors, true );
-    }
+    vertices += row * n_floors * 2;
+    normals += row * n_floors * 2;
+    uvs += row * n_floors * 2;
+
+    _generate_top_face( vertices, normals, uvs );
 
-    _generate_top_face();
+    const uint32_t star_elem = ( uint32_t ) m_scratch->elems.size();
+    m_scratch->elems.resize( star_elem + n_sides * 6 + n_sides * n_floors * 6 );
+    uint32_t* elems = &m_scratch->elems[star_elem];
 
     uint32_t base_vertex = 0;
     uint32_t base_bot_vertex = 0;
 
     for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-      n_elems.push_back( n_elem_offset + base_vertex + base_bot_vertex + 1 );
-      n_elems.push_back( n_elem_offset + base_vertex );
-      n_elems.push_back( n_elem_offset + base_vertex + base_bot_vertex + 2 );
+      *elems++ = n_elem_offset + base_vertex + base_bot_vertex + 1;
+      *elems++ = n_elem_offset + base_vertex;
+      *elems++ = n_elem_offset + base_vertex + base_bot_vertex + 2;
 
       base_bot_vertex += 2;
     }
@@ -126,13 +148,13 @@ namespace kretash {
       for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
         const uint32_t offset = n_sides * 2;
 
-        n_elems.push_back( n_elem_offset + base_vertex + 1 );
-        n_elems.push_back( n_elem_offset + base_vertex + offset );
-        n_elems.push_back( n_elem_offset + base_vertex );
+        *elems++ = n_elem_offset + base_vertex + 1;
+        *elems++ = n_elem_offset + base_vertex + offset;
+        *elems++ = n_elem_offset + base_vertex;
 
-        n_elems.push_back( n_elem_offset + base_vertex + 1 );
-        n_elems.push_back( n_elem_offset + base_vertex + offset + 1 );
-        n_elems.push_back( n_elem_offset + base_vertex + offset );
+        *elems++ = n_elem_offset + base_vertex + 1;
+        *elems++ = n_elem_offset + base_vertex + offset + 1;
+        *elems++ = n_elem_offset + base_vertex + offset;
 
         base_vertex += 2;
       }
@@ -142,247 +164,622 @@ namespace kretash {
 
     uint32_t base_top_vertex = 0;
     for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-      n_elems.push_back( n_elem_offset + base_vertex + base_top_vertex + 2 );
-      n_elems.push_back( n_elem_offset + base_vertex );
-      n_elems.push_back( n_elem_offset + base_vertex + base_top_vertex + 1 );
+      *elems++ = n_elem_offset + base_vertex + base_top_vertex + 2;
+      *elems++ = n_elem_offset + base_vertex;
+      *elems++ = n_elem_offset + base_vertex + base_top_vertex + 1;
 
       base_top_vertex += 2;
     }
 
-    n_elem_offset += ( uint32_t ) n_vertices.size() - star_vertex;
+    _save_prism( star_elem / 3 );
 
-    delete[] n_angles;
-    delete[] n_side_size;
+    n_elem_offset += num_vertices;
 
   }
 
-  void BuildingGen::combine_buffers() {
-    // vertex
+  void BuildingGen::combine_buffers( bool build_clusters ) {
 
-    //horrible solution, but its not on the main thread so it shouldnt stall 
-    if( m_vertex_buffer != nullptr ) delete[] m_vertex_buffer;
-    if( m_elem_buffer != nullptr ) delete[] m_elem_buffer;
-    m_vertex_buffer = nullptr;
-    m_elem_buffer = nullptr;
+    // A previous reservation that never got uploaded goes back to the pool with its handle
+    m_upload = nullptr;
 
-    uint32_t num_vertices = static_cast< uint32_t >( n_vertices.size() );
-    num_vertices = num_vertices * static_cast< uint32_t >( 3 );
+    remove_hidden_faces();
 
-    uint32_t num_normals = static_cast< uint32_t >( n_normals.size() );
-    num_normals = num_normals * static_cast< uint32_t >( 3 );
+    uint32_t num_vertices = static_cast< uint32_t >( m_scratch->vertices.size() );
+    uint32_t num_normals = static_cast< uint32_t >( m_scratch->normals.size() );
 
     assert( num_vertices == num_normals && "WRONG GEOMETRY DATA" );
     assert( num_vertices != 0 && "WRONG GEOMETRY DATA" );
     assert( num_normals != 0 && "WRONG GEOMETRY DATA" );
 
-    std::vector<float3> nc_vertices;
-    std::vector<float3> nc_normals;
-    std::vector<float2> nc_uvs;
-    std::vector<float3> nc_tangent;
-    std::vector<float3> nc_bitangent;
-    std::vector<unsigned int> nc_elem;
+    // Tangents are per triangle, so first every element gets its own vertex, then the
+    // corners that ended up identical get welded back together behind a real index buffer.
+    const uint32_t stride = VERTEX_STRIDE;
+    m_indicies_count = static_cast< uint32_t >( m_scratch->elems.size() );
+    m_unwelded_vertices = m_indicies_count;
+    m_generated_triangles = m_indicies_count / 3 + m_hidden_triangles;
+
+    m_scratch->corners.resize( m_indicies_count * stride );
+
+    tangent_streams ts;
+    ts.set_positions( &m_scratch->vertices[0].x, 3 );
+    ts.set_normals( &m_scratch->normals[0].x, 3 );
+    ts.set_uvs( &m_scratch->uvs[0].x, 2 );
+    ts.elems = m_scratch->elems.data();
+    ts.elem_count = m_indicies_count;
+    tangent_kernel::compute( ts, m_scratch->corners.data() );
+
+    _weld_corners( stride );
+    _optimize_triangle_order( stride, build_clusters );
+
+    uint32_t num_welded = static_cast< uint32_t >( m_scratch->welded.size() );
+    m_welded_vertices = num_welded;
+
+    if( m_swap_cached ) {
+      // the copy belongs to the swap cache, it outlives the generation
+      alloc_counter::ignore_scope ignore;
+      k_engine->get_swap_cache()->store_mesh( this, m_scratch->corners.data(), m_scratch->welded.data(),
+        num_welded, m_scratch->remap.data(), m_indicies_count, m_scratch->clusters.data(),
+        static_cast< uint32_t >( m_scratch->clusters.size() ), m_lod_error );
+    }
+
+    {
+      // the handle belongs to the GPU pool, not to the generation
+      alloc_counter::ignore_scope ignore;
+      m_upload = k_engine->get_GPU_pool()->reserve_staging(
+        num_welded * k_engine->get_context()->get_stride(), m_indicies_count,
+        static_cast< uint32_t >( m_scratch->clusters.size() ) );
+    }
+
+    if( m_scratch->clusters.size() != 0 ) {
+      memcpy( m_upload->get_staging().c_data, m_scratch->clusters.data(),
+        m_scratch->clusters.size() * sizeof( mesh_cluster ) );
+    }
+
+    float* vertex_buffer = m_upload->get_staging().v_data;
+    uint32_t* elem_buffer = m_upload->get_staging().i_data;
+
+    _encode_vertices( m_scratch->corners.data(), m_scratch->welded.data(), num_welded, vertex_buffer );
+
+    assert( ( k_engine->get_context()->get_index_size() == sizeof( uint32_t ) ||
+      num_welded <= MAX_SHORT_INDEX_VERTICES ) && "BUILDING TOO BIG FOR SHORT INDICES" );
+    _encode_indices( m_scratch->remap.data(), m_indicies_count, elem_buffer );
+
+    m_scratch->clear();
+    m_scratch = nullptr;
+  }
+
+  // Same staging combine_buffers leaves behind, encoded for the current context from the
+  // welded and reordered mesh the last one kept
+  bool BuildingGen::restore() {
 
-    for( int e = 0; e < n_elems.size(); ++e ) {
+    std::shared_ptr<cached_mesh> mesh = k_engine->get_swap_cache()->find_mesh( this );
+    if( mesh == nullptr ) return false;
 
-      unsigned int v_i = n_elems[e];
-      nc_vertices.push_back( n_vertices[v_i] );
-      nc_normals.push_back( n_normals[v_i] );
-      nc_uvs.push_back( n_uvs[v_i] );
-      nc_elem.push_back( e );
+    uint32_t num_welded = static_cast< uint32_t >( mesh->vertices.size() / VERTEX_STRIDE );
+    uint32_t num_clusters = static_cast< uint32_t >( mesh->clusters.size() );
+    m_indicies_count = static_cast< uint32_t >( mesh->indices.size() );
+    m_welded_vertices = num_welded;
+    m_lod_error = mesh->lod_error;
 
+    {
+      alloc_counter::ignore_scope ignore;
+      m_upload = k_engine->get_GPU_pool()->reserve_staging(
+        num_welded * k_engine->get_context()->get_stride(), m_indicies_count, num_clusters );
     }
 
-    for( int e = 0; e < nc_elem.size(); e += 3 ) {
+    if( num_clusters != 0 )
+      memcpy( m_upload->get_staging().c_data, mesh->clusters.data(), num_clusters * sizeof( mesh_cluster ) );
+
+    assert( ( k_engine->get_context()->get_index_size() == sizeof( uint32_t ) ||
+      num_welded <= MAX_SHORT_INDEX_VERTICES ) && "BUILDING TOO BIG FOR SHORT INDICES" );
+    _encode_vertices( mesh->vertices.data(), nullptr, num_welded, m_upload->get_staging().v_data );
+    _encode_indices( mesh->indices.data(), m_indicies_count, m_upload->get_staging().i_data );
 
-      float3& v1 = nc_vertices[e];
-      float3& v2 = nc_vertices[e + 1];
-      float3& v3 = nc_vertices[e + 2];
+    k_engine->get_swap_cache()->count_restored_mesh();
+    return true;
+  }
 
-      float2& uv1 = nc_uvs[e];
-      float2& uv2 = nc_uvs[e + 1];
-      float2& uv3 = nc_uvs[e + 2];
+  // Corners are bucketed by their quantized attributes, a corner only joins a bucket
+  // if it's within WELD_EPSILON of the vertex already there. The buckets are an open
+  // addressing table in the scratch so welding doesn't allocate once it's warm.
+  void BuildingGen::_weld_corners( uint32_t stride ) {
 
-      float3 delta_pos1 = v2 - v1;
-      float3 delta_pos2 = v3 - v1;
+    uint32_t table_size = 1;
+    while( table_size < m_indicies_count * 2 ) table_size <<= 1;
 
-      float2 delta_uv1 = uv2 - uv1;
-      float2 delta_uv2 = uv3 - uv1;
+    m_scratch->weld_keys.resize( table_size );
+    m_scratch->weld_ids.assign( table_size, WELD_EMPTY );
+    m_scratch->welded.clear();
+    m_scratch->remap.resize( m_indicies_count );
 
-      float r = 1.0f / ( delta_uv1.x * delta_uv2.y - delta_uv1.y * delta_uv2.x );
-      float3 tangent = ( delta_pos1 * delta_uv2.y - delta_pos2 * delta_uv1.y )*r;
-      float3 bitangent = ( delta_pos2 * delta_uv1.x - delta_pos1 * delta_uv2.x )*r;
+    for( uint32_t c = 0; c < m_indicies_count; ++c ) {
 
-      //Tangent
-      nc_tangent.push_back( tangent );
-      nc_tangent.push_back( tangent );
-      nc_tangent.push_back( tangent );
+      const float* v = &m_scratch->corners[c * stride];
+
+      uint64_t hash = 14695981039346656037ULL;
+      for( uint32_t f = 0; f < stride; ++f ) {
+        int64_t q = ( int64_t ) floorf( v[f] / WELD_EPSILON + 0.5f );
+        hash = ( hash ^ ( uint64_t ) q ) * 1099511628211ULL;
+      }
 
-      //Bitangent
-      nc_bitangent.push_back( bitangent );
-      nc_bitangent.push_back( bitangent );
-      nc_bitangent.push_back( bitangent );
+      uint32_t slot = static_cast< uint32_t >( hash ) & ( table_size - 1 );
+      while( m_scratch->weld_ids[slot] != WELD_EMPTY && m_scratch->weld_keys[slot] != hash )
+        slot = ( slot + 1 ) & ( table_size - 1 );
 
+      uint32_t found = m_scratch->weld_ids[slot];
+
+      if( found != WELD_EMPTY ) {
+        const float* w = &m_scratch->corners[m_scratch->welded[found] * stride];
+
+        bool same = true;
+        for( uint32_t f = 0; f < stride && same; ++f )
+          same = fabsf( v[f] - w[f] ) <= WELD_EPSILON;
+
+        if( same ) {
+          m_scratch->remap[c] = found;
+          continue;
+        }
+      }
+
+      uint32_t id = static_cast< uint32_t >( m_scratch->welded.size() );
+      m_scratch->welded.push_back( c );
+      m_scratch->remap[c] = id;
+
+      // on a hash clash the first vertex keeps the bucket, this one just stays unwelded
+      if( found == WELD_EMPTY ) {
+        m_scratch->weld_keys[slot] = hash;
+        m_scratch->weld_ids[slot] = id;
+      }
     }
+  }
 
-    for( int e = 0; e < nc_tangent.size(); ++e ) {
-      float3& t = nc_tangent[e];
-      float3& b = nc_bitangent[e];
-      float3& n = nc_normals[e];
+  // Triangles get ordered for the post-transform cache and then, by clusters, front to back.
+  // The welded vertices follow the first use of the new order so fetches walk forward.
+  void BuildingGen::_optimize_triangle_order( uint32_t stride, bool build_clusters ) {
 
-      t = t - n * float3::dot( n, t );
+    optimize_scratch* optimize = &m_scratch->optimize;
+    uint32_t* elems = m_scratch->remap.data();
+    uint32_t num_welded = static_cast< uint32_t >( m_scratch->welded.size() );
 
-      if( float3::dot( float3::cross( n, t ), b ) < 0.0f )
-        t = t * -1.0f;
+    m_unoptimized_cache_misses = mesh_optimizer::analyze_vertex_cache( elems, m_indicies_count, num_welded,
+      VERTEX_CACHE_SIZE, optimize ).misses;
+
+    mesh_optimizer::optimize_vertex_cache( elems, m_indicies_count, num_welded, VERTEX_CACHE_SIZE, optimize );
+    mesh_optimizer::optimize_overdraw( elems, m_indicies_count, num_welded, m_scratch->corners.data(), stride,
+      m_scratch->welded.data(), VERTEX_CACHE_SIZE, OVERDRAW_THRESHOLD, optimize );
+
+    m_scratch->clusters.clear();
+    if( build_clusters ) {
+      mesh_optimizer::build_clusters( elems, m_indicies_count, num_welded, m_scratch->corners.data(), stride,
+        m_scratch->welded.data(), CLUSTER_MAX_VERTICES, CLUSTER_MAX_TRIANGLES, optimize, &m_scratch->clusters );
     }
+    num_welded = mesh_optimizer::optimize_vertex_fetch( elems, m_indicies_count, m_scratch->welded.data(),
+      num_welded, optimize );
+    m_scratch->welded.resize( num_welded );
 
-    m_indicies_count = ( uint32_t ) nc_elem.size();
-    int stride = 14;
-    m_vertex_length = ( uint32_t ) ( nc_vertices.size() * stride );
-    m_vertex_buffer = new float[m_vertex_length];
+    m_optimized_cache_misses = mesh_optimizer::analyze_vertex_cache( elems, m_indicies_count, num_welded,
+      VERTEX_CACHE_SIZE, optimize ).misses;
+  }
 
-    int count = 0;
-    for( int i = 0; i < nc_vertices.size(); ++i ) {
-      m_vertex_buffer[count++] = nc_vertices[i].x;
-      m_vertex_buffer[count++] = nc_vertices[i].y;
-      m_vertex_buffer[count++] = nc_vertices[i].z;
+  void BuildingGen::_save_prism( uint32_t first_triangle ) {
 
-      m_vertex_buffer[count++] = nc_normals[i].x;
-      m_vertex_buffer[count++] = nc_normals[i].y;
-      m_vertex_buffer[count++] = nc_normals[i].z;
+    // an outline that doesn't close drifts every lap, it isn't a prism anymore
+    if( fabsf( ring_drift.x ) > HSR_EPSILON || fabsf( ring_drift.z ) > HSR_EPSILON ) return;
 
-      m_vertex_buffer[count++] = nc_uvs[i].x;
-      m_vertex_buffer[count++] = nc_uvs[i].y;
+    const float3* ring = m_scratch->ring.data();
 
-      m_vertex_buffer[count++] = nc_tangent[i].x;
-      m_vertex_buffer[count++] = nc_tangent[i].y;
-      m_vertex_buffer[count++] = nc_tangent[i].z;
+    building_prism p;
+    p.first_triangle = first_triangle;
+    p.first_corner = static_cast< uint32_t >( m_scratch->outlines.size() );
+    p.sides = n_sides;
+    p.floors = n_floors;
+    p.floor_height = n_floor_height;
+    p.bottom = center_offset.y;
+    p.top = center_offset.y + n_floor_height * n_floors;
+    p.center = float2( center_offset.x, center_offset.z );
+    p.min = float2( ring[0].x, ring[0].z );
+    p.max = p.min;
 
-      m_vertex_buffer[count++] = nc_bitangent[i].x;
-      m_vertex_buffer[count++] = nc_bitangent[i].y;
-      m_vertex_buffer[count++] = nc_bitangent[i].z;
+    for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
+      float2 q = float2( ring[i_s * 2].x, ring[i_s * 2].z );
+      m_scratch->outlines.push_back( q );
 
+      if( p.min.x > q.x ) { p.min.x = q.x; }
+      if( p.min.y > q.y ) { p.min.y = q.y; }
+      if( p.max.x < q.x ) { p.max.x = q.x; }
+      if( p.max.y < q.y ) { p.max.y = q.y; }
     }
 
-    // Indices's Buffer
-    m_elem_buffer = new uint32_t[m_indicies_count];
-    memcpy( m_elem_buffer, &nc_elem[0], sizeof( uint32_t )*m_indicies_count );
+    m_scratch->prisms.push_back( p );
+  }
+
+  // Even-odd test against the outline, points on the outline count as outside so
+  // faces that only touch a neighbour are kept
+  bool BuildingGen::_is_inside( const building_prism& p, float2 q ) {
+
+    if( q.x < p.min.x - HSR_EPSILON || q.x > p.max.x + HSR_EPSILON ) return false;
+    if( q.y < p.min.y - HSR_EPSILON || q.y > p.max.y + HSR_EPSILON ) return false;
+
+    const float2* o = &m_scratch->outlines[p.first_corner];
+    bool inside = false;
+
+    for( uint32_t i = 0, j = p.sides - 1; i < p.sides; j = i++ ) {
+      const float2& a = o[j];
+      const float2& b = o[i];
 
+      float ex = b.x - a.x;
+      float ey = b.y - a.y;
+      float len = ex * ex + ey * ey;
+      float t = len > 0.0f ? tools::clamp( ( ( q.x - a.x ) * ex + ( q.y - a.y ) * ey ) / len, 0.0f, 1.0f ) : 0.0f;
+      float dx = a.x + ex * t - q.x;
+      float dy = a.y + ey * t - q.y;
+      if( dx * dx + dy * dy < HSR_EPSILON * HSR_EPSILON ) return false;
+
+      if( ( a.y > q.y ) != ( b.y > q.y ) && q.x < ex * ( q.y - a.y ) / ey + a.x )
+        inside = !inside;
+    }
+
+    return inside;
   }
 
-  void BuildingGen::finish_and_upload() {
+  bool BuildingGen::_contains_segment( const building_prism& p, float2 a, float2 b ) {
 
-    k_engine->get_GPU_pool()->queue_geometry( static_cast< Geometry* >( this ),
-      m_vertex_buffer, m_vertex_length, m_elem_buffer, m_indicies_count );
+    if( !_is_inside( p, a ) || !_is_inside( p, b ) ) return false;
 
-    n_vertices.clear();
-    n_normals.clear();
-    n_uvs.clear();
-    n_elems.clear();
+    const float2* o = &m_scratch->outlines[p.first_corner];
 
-    //avoiding the delete, vector will be reused anyway.
-    //n_vertices.shrink_to_fit();
-    //n_normals.shrink_to_fit();
-    //n_uvs.shrink_to_fit();
-    //n_elems.shrink_to_fit();
+    for( uint32_t i = 0, j = p.sides - 1; i < p.sides; j = i++ ) {
+      const float2& c = o[j];
+      const float2& d = o[i];
 
-    n_elem_offset = 0;
-    m_radius = 0.0f;
+      float d1 = ( b.x - a.x ) * ( c.y - a.y ) - ( b.y - a.y ) * ( c.x - a.x );
+      float d2 = ( b.x - a.x ) * ( d.y - a.y ) - ( b.y - a.y ) * ( d.x - a.x );
+      float d3 = ( d.x - c.x ) * ( a.y - c.y ) - ( d.y - c.y ) * ( a.x - c.x );
+      float d4 = ( d.x - c.x ) * ( b.y - c.y ) - ( d.y - c.y ) * ( b.x - c.x );
+
+      if( ( ( d1 > 0.0f && d2 < 0.0f ) || ( d1 < 0.0f && d2 > 0.0f ) ) &&
+        ( ( d3 > 0.0f && d4 < 0.0f ) || ( d3 < 0.0f && d4 > 0.0f ) ) )
+        return false;
+    }
+
+    return true;
   }
 
-  void BuildingGen::_generate_floor( uint32_t i_s, uint32_t i_f, bool top ) {
+  // Buildings are stacks of prisms that all emit their own caps and walls. Bottom caps
+  // on the ground, caps sealed by the prism above or below and walls buried inside a
+  // neighbour can never be seen, so their triangles are dropped before welding.
+  void BuildingGen::remove_hidden_faces() {
+
+    if( m_scratch->prisms.empty() ) return;
+
+    const uint32_t num_triangles = static_cast< uint32_t >( m_scratch->elems.size() ) / 3;
+
+    m_scratch->hidden.assign( num_triangles, 0 );
+    uint8_t* hidden = m_scratch->hidden.data();
+
+    const uint32_t num_prisms = static_cast< uint32_t >( m_scratch->prisms.size() );
+
+    for( uint32_t i_p = 0; i_p < num_prisms; ++i_p ) {
+      const building_prism& s = m_scratch->prisms[i_p];
+      const float2* o = &m_scratch->outlines[s.first_corner];
+
+      const uint32_t bot_cap = s.first_triangle;
+      const uint32_t walls = bot_cap + s.sides;
+      const uint32_t top_cap = walls + s.sides * s.floors * 2;
+
+      bool bot_hidden = s.bottom <= HSR_EPSILON;
+      bool top_hidden = false;
+
+      for( uint32_t i_o = 0; i_o < num_prisms; ++i_o ) {
+        const building_prism& p = m_scratch->prisms[i_o];
+
+        if( i_o == i_p ) continue;
+        if( p.top < s.bottom - HSR_EPSILON || p.bottom > s.top + HSR_EPSILON ) continue;
+        if( p.max.x < s.min.x || p.min.x > s.max.x || p.max.y < s.min.y || p.min.y > s.max.y ) continue;
+
+        // a cap is sealed when the occluder fills the space it faces
+        bool check_bot = !bot_hidden && p.bottom + HSR_EPSILON < s.bottom && s.bottom <= p.top + HSR_EPSILON;
+        bool check_top = !top_hidden && p.bottom - HSR_EPSILON <= s.top && s.top < p.top - HSR_EPSILON;
+
+        if( check_bot || check_top ) {
+          bool cap_inside = true;
+          for( uint32_t i_s = 0; i_s < s.sides && cap_inside; ++i_s ) {
+            cap_inside = _contains_segment( p, s.center, o[i_s] ) &&
+              _contains_segment( p, o[i_s], o[( i_s + 1 ) % s.sides] );
+          }
+          bot_hidden = bot_hidden || ( check_bot && cap_inside );
+          top_hidden = top_hidden || ( check_top && cap_inside );
+        }
+
+        for( uint32_t i_f = 0; i_f < s.floors; ++i_f ) {
+          float y0 = s.bottom + s.floor_height * i_f;
+          float y1 = y0 + s.floor_height;
+          if( y0 < p.bottom - HSR_EPSILON || y1 > p.top + HSR_EPSILON ) continue;
+
+          for( uint32_t i_s = 0; i_s < s.sides; ++i_s ) {
+            uint32_t t = walls + ( i_f * s.sides + i_s ) * 2;
+            if( hidden[t] ) continue;
+            if( !_contains_segment( p, o[i_s], o[( i_s + 1 ) % s.sides] ) ) continue;
+            hidden[t + 0] = 1;
+            hidden[t + 1] = 1;
+          }
+        }
+      }
 
-    float uv = uv_y_min;
-    if( top )
-      uv = uv_y_max;
+      if( bot_hidden ) memset( hidden + bot_cap, 1, s.sides );
+      if( top_hidden ) memset( hidden + top_cap, 1, s.sides );
+    }
 
-    n_vertices.push_back( c_pos - center_pos );
-    n_uvs.push_back( float2( uv_x_min, 1.0f - uv ) );
-    float3 A = c_pos;
+    uint32_t* elems = m_scratch->elems.data();
+    uint32_t kept = 0;
 
-    c_angle += n_angles[i_s];
-    c_pos.x += sinf( to_rad( c_angle ) ) * n_side_size[i_s];
-    c_pos.z += cosf( to_rad( c_angle ) ) * n_side_size[i_s];
+    for( uint32_t t = 0; t < num_triangles; ++t ) {
+      if( hidden[t] ) {
+        ++m_hidden_triangles;
+        continue;
+      }
+      elems[kept * 3 + 0] = elems[t * 3 + 0];
+      elems[kept * 3 + 1] = elems[t * 3 + 1];
+      elems[kept * 3 + 2] = elems[t * 3 + 2];
+      ++kept;
+    }
 
-    n_vertices.push_back( c_pos - center_pos );
-    n_uvs.push_back( float2( uv_x_max, 1.0f - uv ) );
+    m_scratch->elems.resize( kept * 3 );
 
-    float3 B = c_pos;
-    float3 C = c_pos + float3( 0.0f, n_floor_height, 0.0f );
-    c_norm = float3::cross( B - A, C - A );
-    c_norm.normalize();
-    n_normals.push_back( c_norm );
-    n_normals.push_back( c_norm );
+    // the triangle ranges of the prisms are stale now
+    m_scratch->prisms.clear();
+    m_scratch->outlines.clear();
   }
 
-  void BuildingGen::_generate_bot_face() {
-    float3 v_center = {};
-    v_center = center_offset;
-    c_pos.y = 0;
+  // Collapses source's edges while the triangle count is over the budget and no collapse
+  // moves the surface more than max_error, then copies the vertices that are still used.
+  // The error reached is stored in the geometry so the render manager can pick the LOD.
+  void BuildingGen::simplify( BuildingGen* source, float triangle_ratio, float max_error,
+    bool lock_seams, simplify_scratch* scratch ) {
+
+    assert( m_scratch != nullptr && "SIMPLIFY WITHOUT BEGIN" );
+    assert( m_scratch->elems.empty() && "SIMPLIFY INTO A USED LOD" );
+    assert( source->m_scratch != nullptr && "SIMPLIFY FROM A COMBINED BUILDING" );
+
+    source->remove_hidden_faces();
+    building_scratch* from = source->m_scratch;
+
+    simplify_mesh mesh;
+    mesh.positions = from->vertices.data();
+    mesh.normals = from->normals.data();
+    mesh.uvs = from->uvs.data();
+    mesh.vertex_count = static_cast< uint32_t >( from->vertices.size() );
+    mesh.elems = from->elems.data();
+    mesh.elem_count = static_cast< uint32_t >( from->elems.size() );
+
+    uint32_t target = static_cast< uint32_t >( ( mesh.elem_count / 3 ) * triangle_ratio );
+    m_lod_error = mesh_simplifier::simplify( mesh, target, max_error, lock_seams, scratch, &m_scratch->elems );
+
+    // only the vertices the kept triangles use come along
+    m_scratch->remap.assign( mesh.vertex_count, WELD_EMPTY );
+    for( uint32_t e = 0; e < m_scratch->elems.size(); ++e ) {
+      uint32_t w = m_scratch->elems[e];
+
+      if( m_scratch->remap[w] == WELD_EMPTY ) {
+        m_scratch->remap[w] = static_cast< uint32_t >( m_scratch->vertices.size() );
+        m_scratch->vertices.push_back( from->vertices[w] );
+        m_scratch->normals.push_back( from->normals[w] );
+        m_scratch->uvs.push_back( from->uvs[w] );
+      }
+      m_scratch->elems[e] = m_scratch->remap[w];
+    }
 
-    n_vertices.push_back( v_center );
-    n_uvs.push_back( float2( 0.0f, 0.0f ) );
-    n_normals.push_back( float3( 0.0f, 1.0f, 0.0f ) );
-    for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-      n_vertices.push_back( c_pos - center_pos );
+    n_elem_offset = static_cast< uint32_t >( m_scratch->vertices.size() );
+  }
 
-      c_angle += n_angles[i_s];
-      c_pos.x += sinf( to_rad( c_angle ) ) * n_side_size[i_s];
-      c_pos.z += cosf( to_rad( c_angle ) ) * n_side_size[i_s];
+  void BuildingGen::append( BuildingGen* source, float3 offset ) {
+
+    assert( m_scratch != nullptr && "APPEND WITHOUT BEGIN" );
+    assert( source->m_scratch != nullptr && "APPEND FROM A COMBINED BUILDING" );
 
-      n_vertices.push_back( c_pos - center_pos );
+    // the buried faces are only known while the source still has its prisms
+    source->remove_hidden_faces();
+    building_scratch* from = source->m_scratch;
 
-      n_uvs.push_back( float2( 0.0f, 0.0f ) );
-      n_uvs.push_back( float2( 0.0f, 0.0f ) );
-      n_normals.push_back( float3( 0.0f, 1.0f, 0.0f ) );
-      n_normals.push_back( float3( 0.0f, 1.0f, 0.0f ) );
+    uint32_t base = static_cast< uint32_t >( m_scratch->vertices.size() );
+    for( uint32_t v = 0; v < from->vertices.size(); ++v ) {
+      m_scratch->vertices.push_back( from->vertices[v] + offset );
+      m_scratch->normals.push_back( from->normals[v] );
+      m_scratch->uvs.push_back( from->uvs[v] );
     }
+    for( uint32_t e = 0; e < from->elems.size(); ++e )
+      m_scratch->elems.push_back( from->elems[e] + base );
+
+    m_lod_error = fmaxf( m_lod_error, source->m_lod_error );
+    n_elem_offset = static_cast< uint32_t >( m_scratch->vertices.size() );
   }
 
-  void BuildingGen::_generate_top_face() {
-    float3 v_center = {};
-    v_center = center_offset;
-    v_center.y += n_floor_height * n_floors;
-    c_pos.y = n_floor_height * n_floors;
+  void BuildingGen::finish_and_upload( std::function<void( UploadHandle* )> on_complete ) {
+
+    assert( m_upload != nullptr && "NOTHING TO UPLOAD" );
+
+    // the previous upload finished or got dropped, it can't call back anymore
+    forget_upload();
+
+    m_upload->on_complete( on_complete );
+    k_engine->get_GPU_pool()->queue_geometry( static_cast< Geometry* >( this ), m_upload );
+    m_in_flight = m_upload;
+    m_upload = nullptr;
+
+    _clear();
+  }
+
+  void BuildingGen::discard() {
+
+    m_upload = nullptr;
+
+    _clear();
+  }
+
+  void BuildingGen::forget_upload() {
+    if( m_in_flight != nullptr ) m_in_flight->on_complete( nullptr );
+    m_in_flight = nullptr;
+  }
+
+  uint64_t BuildingGen::get_staging_size() {
+    if( m_upload == nullptr ) return 0;
+    return m_upload->get_size();
+  }
 
-    float2 pos_min;
-    float2 pos_max;
+  void BuildingGen::_clear() {
+
+    // the scratch went back to its worker at the end of combine_buffers
+    if( m_scratch != nullptr ) m_scratch->clear();
+    m_scratch = nullptr;
+
+    n_elem_offset = 0;
+  }
+
+  void building_scratch::clear() {
+    vertices.clear();
+    normals.clear();
+    uvs.clear();
+    elems.clear();
+    ring.clear();
+    ring_normals.clear();
+    prisms.clear();
+    outlines.clear();
+    hidden.clear();
+    corners.clear();
+    remap.clear();
+    welded.clear();
+    clusters.clear();
+  }
+
+  uint64_t building_scratch::get_capacity() {
+    return vertices.capacity() * sizeof( float3 ) + normals.capacity() * sizeof( float3 ) +
+      uvs.capacity() * sizeof( float2 ) + elems.capacity() * sizeof( uint32_t ) +
+      angles.capacity() * sizeof( float ) + side_size.capacity() * sizeof( float ) +
+      ring.capacity() * sizeof( float3 ) + ring_normals.capacity() * sizeof( float3 ) +
+      prisms.capacity() * sizeof( building_prism ) + outlines.capacity() * sizeof( float2 ) +
+      hidden.capacity() * sizeof( uint8_t ) +
+      corners.capacity() * sizeof( float ) + remap.capacity() * sizeof( uint32_t ) +
+      welded.capacity() * sizeof( uint32_t ) + weld_keys.capacity() * sizeof( uint64_t ) +
+      weld_ids.capacity() * sizeof( uint32_t ) + clusters.capacity() * sizeof( mesh_cluster ) +
+      optimize.get_capacity();
+  }
 
-    n_vertices.push_back( v_center );
-    n_normals.push_back( float3( 0.0f, 1.0f, 0.0f ) );
+  // The footprint only depends on the angle and size tables, so the corners and side
+  // normals are worked out once here and every floor and cap just offsets them. The
+  // outline doesn't have to close, each lap starts where the previous one ended.
+  void BuildingGen::_generate_ring() {
+
+    const uint32_t row = n_sides * 2;
+    m_scratch->ring.resize( row );
+    m_scratch->ring_normals.resize( row );
+    float3* ring = m_scratch->ring.data();
+    float3* ring_normals = m_scratch->ring_normals.data();
+
+    float c_angle = 0.0f;
+    float3 c_pos = { 0.0f, 0.0f, 0.0f };
 
     for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
-      n_vertices.push_back( c_pos - center_pos );
+      float3 A = c_pos;
+
       c_angle += n_angles[i_s];
       c_pos.x += sinf( to_rad( c_angle ) ) * n_side_size[i_s];
       c_pos.z += cosf( to_rad( c_angle ) ) * n_side_size[i_s];
+      center_pos = center_pos + c_pos;
 
-      n_vertices.push_back( c_pos - center_pos );
-      if( pos_min.x > c_pos.x ) { pos_min.x = c_pos.x; }
-      if( pos_min.y > c_pos.z ) { pos_min.y = c_pos.z; }
-      if( pos_max.x < c_pos.x ) { pos_max.x = c_pos.x; }
-      if( pos_max.y < c_pos.z ) { pos_max.y = c_pos.z; }
+      float3 B = c_pos;
+      float3 C = c_pos + float3( 0.0f, n_floor_height, 0.0f );
+      float3 c_norm = float3::cross( B - A, C - A );
+      c_norm.normalize();
 
-      n_normals.push_back( float3( 0.0f, 1.0f, 0.0f ) );
-      n_normals.push_back( float3( 0.0f, 1.0f, 0.0f ) );
+      ring[i_s * 2 + 0] = A;
+      ring[i_s * 2 + 1] = B;
+      ring_normals[i_s * 2 + 0] = c_norm;
+      ring_normals[i_s * 2 + 1] = c_norm;
     }
+    ring_drift = c_pos;
 
-    //forced uvs
-    n_uvs.push_back( float2( 0.5f, 0.0f ) );
+    center_pos = center_pos / ( float ) n_sides;
+    center_pos.y = 0;
 
-    float uv_x = 0.0f;
-    float uv_y = 0.0f;
+    center_pos -= center_offset;
 
-    for( uint32_t i_s = 0; i_s < n_sides; ++i_s ) {
+    for( uint32_t i = 0; i < row; ++i )
+      ring[i] -= center_pos;
+  }
+
+  void BuildingGen::_extrude_ring( float3* vertices, float height, uint32_t lap ) {
 
-      uv_x = 0.75f;
-      uv_y = 1.0f;
+    const float3* ring = m_scratch->ring.data();
+    const uint32_t row = n_sides * 2;
+    const float x = ring_drift.x * ( float ) lap;
+    const float y = height;
+    const float z = ring_drift.z * ( float ) lap;
 
-      n_uvs.push_back( float2( uv_x, uv_y ) );
+    for( uint32_t i = 0; i < row; ++i ) {
+      vertices[i].x = ring[i].x + x;
+      vertices[i].y = ring[i].y + y;
+      vertices[i].z = ring[i].z + z;
+    }
+  }
+
+  void BuildingGen::_generate_floors( float3* vertices, float3* normals, float2* uvs ) {
+
+    const uint32_t row = n_sides * 2;
+    const size_t normals_size = row * sizeof( float3 );
+
+    for( uint32_t i = 0; i < row; i += 2 ) {
+      uvs[i + 0] = float2( uv_x_min, 1.0f - uv_y_min );
+      uvs[i + 1] = float2( uv_x_max, 1.0f - uv_y_min );
+      uvs[row + i + 0] = float2( uv_x_min, 1.0f - uv_y_max );
+      uvs[row + i + 1] = float2( uv_x_max, 1.0f - uv_y_max );
+    }
+
+    // every floor is a bottom row at its base and a top row at the next base
+    for( uint32_t i_f = 0; i_f < n_floors; ++i_f ) {
+      float3* bot = vertices + row * i_f * 2;
+      float3* top = bot + row;
 
-      uv_x = 1.0f;
-      uv_y = 0.5f;
+      _extrude_ring( bot, n_floor_height * i_f, i_f * 2 + 1 );
+      _extrude_ring( top, n_floor_height * ( i_f + 1 ), i_f * 2 + 2 );
 
-      n_uvs.push_back( float2( uv_x, uv_y ) );
+      memcpy( normals + row * i_f * 2, m_scratch->ring_normals.data(), normals_size );
+      memcpy( normals + row * i_f * 2 + row, m_scratch->ring_normals.data(), normals_size );
+
+      if( i_f != 0 ) memcpy( uvs + row * i_f * 2, uvs, row * 2 * sizeof( float2 ) );
+    }
+  }
+
+  void BuildingGen::_generate_bot_face( float3* vertices, float3* normals, float2* uvs ) {
+    const uint32_t row = n_sides * 2;
+
+    vertices[0] = center_offset;
+    _extrude_ring( vertices + 1, 0.0f, 0 );
+
+    for( uint32_t i = 0; i <= row; ++i ) {
+      normals[i] = float3( 0.0f, 1.0f, 0.0f );
+      uvs[i] = float2( 0.0f, 0.0f );
+    }
+  }
+
+  void BuildingGen::_generate_top_face( float3* vertices, float3* normals, float2* uvs ) {
+    const uint32_t row = n_sides * 2;
+
+    float3 v_center = {};
+    v_center = center_offset;
+    v_center.y += n_floor_height * n_floors;
+
+    vertices[0] = v_center;
+    _extrude_ring( vertices + 1, n_floor_height * n_floors, n_floors * 2 + 1 );
+
+    //forced uvs
+    normals[0] = float3( 0.0f, 1.0f, 0.0f );
+    uvs[0] = float2( 0.5f, 0.0f );
+
+    for( uint32_t i = 1; i <= row; i += 2 ) {
+      normals[i + 0] = float3( 0.0f, 1.0f, 0.0f );
+      normals[i + 1] = float3( 0.0f, 1.0f, 0.0f );
+      uvs[i + 0] = float2( 0.75f, 1.0f );
+      uvs[i + 1] = float2( 1.0f, 0.5f );
     }
   }
 
@@ -473,10 +870,9 @@ namespace kretash {
 
 
   BuildingGen::~BuildingGen() {
-    if( m_vertex_buffer != nullptr ) delete[] m_vertex_buffer;
-    if( m_elem_buffer != nullptr ) delete[] m_elem_buffer;
-    m_vertex_buffer = nullptr;
-    m_elem_buffer = nullptr;
+    // the handles own the staging memory, they can outlive the GPU pool
+    forget_upload();
+    m_upload = nullptr;
   }
 
   const float BuildingGen::pattern_set_5[5][5] =
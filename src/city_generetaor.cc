@@ -3,16 +3,31 @@
 #include "core/texture_manager.hh"
 #include "core/renderer.hh"
 #include "core/building.hh"
+#include "core/building_gen.hh"
+#include "core/xx/context.hh"
 #include "core/GPU_pool.hh"
 #include "core/camera.hh"
+#include "core/window.hh"
 #include "core/texture.hh"
 #include "core/input.hh"
 #include "core/tools.hh"
+#include "core/alloc_counter.hh"
+#include "core/startup_graph.hh"
 #include <limits>
+#include <algorithm>
 #include <cassert>
 
 #define building_ite std::vector<building_details>::iterator
 
+// Generated buildings waiting for upload, the workers stop picking up new buildings past this
+#define UPLOAD_QUEUE_BUDGET (uint64_t)32000000
+#define GENERATOR_THREADS 5
+// startup stages the buildings are created in, each one a band of rows
+#define STARTUP_BUILDING_STAGES 4
+// finer LODs are asked for a bit before the render manager would pick them, and dropped well after
+#define LOD_LOAD_MARGIN 1.25f
+#define LOD_EVICT_MARGIN 2.0f
+
 namespace kretash {
 
   CityGenerator::CityGenerator() :
@@ -23,26 +38,110 @@ namespace kretash {
     m_max_radius( 0.0f ) {
 
     m_exit_threads.store( false );
+    m_pause_threads.store( false );
+    m_busy_threads.store( 0 );
+    m_to_upload_bytes.store( 0 );
+    for( int32_t i = 0; i < 3; ++i ) {
+      m_unwelded_vertices[i].store( 0 );
+      m_welded_vertices[i].store( 0 );
+      m_generated_triangles[i].store( 0 );
+      m_hidden_triangles[i].store( 0 );
+      m_unoptimized_cache_misses[i].store( 0 );
+      m_optimized_cache_misses[i].store( 0 );
+    }
+    m_spacer_saved_bytes.store( 0 );
+    m_spacer_buildings.store( 0 );
+    m_warm_buildings.store( 0 );
+    m_allocating_buildings.store( 0 );
     k_engine->save_city( this );
   }
 
-  void CityGenerator::_generate_loop() {
+  void CityGenerator::_generate_loop( int32_t worker ) {
+    building_arena* arena = m_arenas[worker].get();
+
     while( !m_exit_threads.load() ) {
       if( m_to_generate_lock.try_lock() ) {
-        if( m_to_generate.size() > 0 ) {
+        bool upload_full = m_to_upload_bytes.load() >= UPLOAD_QUEUE_BUDGET;
+        if( m_to_generate.size() > 0 && !m_pause_threads.load() && !upload_full ) {
           Building* building = m_to_generate[0];
           m_to_generate.erase( m_to_generate.begin() );
+          ++m_busy_threads;
           m_to_generate_lock.unlock();
 
-          building->generate();
-
-          assert( building->get_geometry( 0 )->get_indicies_count() != 0 && "EMPTY GEOMETRY" );
-          assert( building->get_geometry( 1 )->get_indicies_count() != 0 && "EMPTY GEOMETRY" );
-          assert( building->get_geometry( 2 )->get_indicies_count() != 0 && "EMPTY GEOMETRY" );
+          // after an API swap most buildings only need their kept meshes uploaded again
+          if( !building->restore() ) {
+            uint64_t arena_capacity = arena->get_capacity();
+            uint64_t allocations = alloc_counter::get_thread_allocations();
+            uint32_t lods = building->get_requested_lods();
+
+            building->generate( arena );
+
+            // once the arena stops growing a building has to come out without touching the heap
+            allocations = alloc_counter::get_thread_allocations() - allocations;
+            if( arena_capacity == arena->get_capacity() ) ++m_warm_buildings;
+            if( allocations != 0 && arena_capacity == arena->get_capacity() ) {
+              ++m_allocating_buildings;
+              std::cout << "building generation did " << allocations << " heap allocations\n";
+              assert( false && "BUILDING GENERATION ALLOCATED" );
+            }
+
+            assert( building->get_geometry( 0 )->get_indicies_count() != 0 && "EMPTY GEOMETRY" );
+            assert( building->get_geometry( 1 )->get_indicies_count() != 0 && "EMPTY GEOMETRY" );
+            assert( building->get_geometry( 2 )->get_indicies_count() != 0 && "EMPTY GEOMETRY" );
+
+            for( int32_t i = 0; i < 3; ++i ) {
+              if( ( lods & ( 1 << i ) ) == 0 ) continue;
+
+              uint32_t unwelded = 0, welded = 0;
+              building->get_vertex_counts( i, &unwelded, &welded );
+              m_unwelded_vertices[i] += unwelded;
+              m_welded_vertices[i] += welded;
+
+              uint32_t generated = 0, hidden = 0;
+              building->get_triangle_counts( i, &generated, &hidden );
+              m_generated_triangles[i] += generated;
+              m_hidden_triangles[i] += hidden;
+
+              uint32_t unoptimized = 0, optimized = 0;
+              building->get_cache_misses( i, &unoptimized, &optimized );
+              m_unoptimized_cache_misses[i] += unoptimized;
+              m_optimized_cache_misses[i] += optimized;
+            }
+
+            if( lods & kLOD0_MASK ) {
+              m_spacer_saved_bytes += building->get_spacer_saved_bytes();
+              ++m_spacer_buildings;
+            }
+          }
 
           m_to_upload_lock.lock();
           m_to_upload.push_back( building );
+          m_to_upload_bytes += building->get_upload_size();
           m_to_upload_lock.unlock();
+          --m_busy_threads;
+        } else if( m_hlod_to_generate.size() > 0 && !m_pause_threads.load() && !upload_full ) {
+          // tiles only get merged once no building is waiting, the cells come first
+          hlod_tile* tile = m_hlod_to_generate[0];
+          m_hlod_to_generate.erase( m_hlod_to_generate.begin() );
+          ++m_busy_threads;
+          m_to_generate_lock.unlock();
+
+          uint64_t arena_capacity = arena->get_capacity();
+          uint64_t allocations = alloc_counter::get_thread_allocations();
+
+          _generate_hlod( tile, worker );
+
+          allocations = alloc_counter::get_thread_allocations() - allocations;
+          if( allocations != 0 && arena_capacity == arena->get_capacity() ) {
+            std::cout << "HLOD generation did " << allocations << " heap allocations\n";
+            assert( false && "HLOD GENERATION ALLOCATED" );
+          }
+
+          m_to_upload_lock.lock();
+          m_hlod_to_upload.push_back( tile );
+          m_to_upload_bytes += tile->generator->get_staging_size();
+          m_to_upload_lock.unlock();
+          --m_busy_threads;
         } else {
           m_to_generate_lock.unlock();
           std::this_thread::sleep_for( std::chrono::milliseconds( 4 ) );
@@ -54,6 +153,33 @@ namespace kretash {
 
   }
 
+  // Stops the workers and drops everything waiting for upload, the staging
+  // memory belongs to the GPU pool and it's about to be destroyed
+  void CityGenerator::pause() {
+
+    m_pause_threads.store( true );
+
+    m_to_generate_lock.lock();
+    m_to_generate_lock.unlock();
+
+    while( m_busy_threads.load() != 0 ) {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+    }
+
+    m_to_upload_lock.lock();
+    for( int32_t i = 0; i < m_to_upload.size(); ++i ) {
+      m_to_upload[i]->discard_upload();
+    }
+    m_to_upload.clear();
+    for( int32_t i = 0; i < m_hlod_to_upload.size(); ++i ) {
+      m_hlod_to_upload[i]->generator->discard();
+    }
+    m_hlod_to_upload.clear();
+    m_to_upload_bytes.store( 0 );
+    m_to_upload_lock.unlock();
+
+  }
+
   void CityGenerator::regenerate() {
 
     m_count = 0;
@@ -63,16 +189,21 @@ namespace kretash {
 
     //m_placeholder_building = nullptr;
     //m_placeholder_building = std::make_shared<Building>( true );
-    m_placeholder_building->generate_placeholder();
+    m_placeholder_building->generate_placeholder( m_placeholder_arena.get() );
     m_placeholder_building->get_texture()->init_procedural( 0.0f, 0.0f, 0 );
+    _reset_hlod_tiles();
 
     for( int32_t i = 0; i < m_grid; i++ ) {
       for( int32_t e = 0; e < m_grid; e++ ) {
+        m_buildigs[m_count]->forget_lods();
         m_buildigs[m_count]->set_ready_to_process( false );
         m_to_generate.push_back( m_buildigs[m_count].get() );
         ++m_count;
       }
     }
+    // what the camera sees comes back first, most of it straight from the swap cache
+    _sort_nearest_first();
+    m_pause_threads.store( false );
     m_to_generate_lock.unlock();
 
   }
@@ -87,69 +218,55 @@ namespace kretash {
 
     m_renderer = ren;
 
-    m_street_block = std::make_shared<Geometry>();
-    m_street_block->load( "street_block.obj" );
-
-    m_placeholder_building = std::make_shared<Building>( true );
-    m_placeholder_building->generate_placeholder();
-    m_placeholder_building->get_texture()->init_procedural( 0.0f, 0.0f, 0 );
-
-    m_count = 0;
     m_buildigs.resize( m_grid*m_grid );
     m_street_block_D.resize( m_grid*m_grid );
 
-    for( int32_t i = 0; i < m_grid; i++ ) {
-      for( int32_t e = 0; e < m_grid; e++ ) {
-
-        m_buildigs[m_count] = std::make_shared<Building>();
-
-        m_buildigs[m_count]->set_position( ( m_half_grid - e )*m_scale, 0.0f, ( m_half_grid - i )*m_scale );
-        m_building_positions[m_count] = float3( ( m_half_grid - e )*m_scale, 0.0f, ( m_half_grid - i )*m_scale );
-
-        building_details bd = {};
-        bd.building_i = m_count;
-        bd.position.x = ( m_half_grid - e )*m_scale;
-        bd.position.y = 0.0f;
-        bd.position.z = ( m_half_grid - i )*m_scale;
-        bd.type = kTOP;
-        m_all_buildings.push_back( bd );
-
-        float seed_x = ( float ) ( m_half_grid - e )*m_scale;
-        float seed_y = ( float ) ( m_half_grid - i )*m_scale;
-
-        m_buildigs[m_count]->prepare( seed_x, seed_y );
-        m_buildigs[m_count]->get_texture()->init_procedural( seed_x, seed_y, 0 );
-
-        m_renderer->add_child( m_buildigs[m_count].get() );
-
-        m_street_block_D[m_count] = std::make_shared<Drawable>();
-        m_street_block_D[m_count]->set_frustum_size( 35.0f, 30.0f );
-        m_street_block_D[m_count]->set_position( ( m_half_grid - e )*m_scale, 0.0f, ( m_half_grid - i )*m_scale );
-        m_street_block_D[m_count]->init( m_street_block.get() );
-
-        m_street_block_D[m_count]->get_texture()->load( tDIFFUSE, "street_block_d.png" );
-        m_street_block_D[m_count]->get_texture()->load( tNORMAL, "street_block_n.png" );
-        m_street_block_D[m_count]->get_texture()->load( tSPECULAR, "street_block_s.png" );
-
-        m_renderer->add_child( m_street_block_D[m_count].get() );
-
-        ++m_count;
-      }
+    // enough slots for every tile the grid can touch while it's not aligned to the tiles
+    int32_t tiles_side = m_grid / HLOD_TILE_SIZE + 2;
+    m_tiles.resize( tiles_side * tiles_side );
+    m_building_tile.resize( m_grid*m_grid, -1 );
+
+    /* The meshes upload on the main thread while the workers create the buildings, the
+       nearest cells start generating as soon as their buildings exist. Only the renderer
+       and the tiles need everything in place, they come last. */
+    StartupGraph* startup = k_engine->get_startup();
+
+    int32_t placeholder = startup->add( "placeholder building", [this] () {
+      m_placeholder_arena = std::make_shared<building_arena>();
+      m_placeholder_building = std::make_shared<Building>( true );
+      m_placeholder_building->generate_placeholder( m_placeholder_arena.get() );
+      m_placeholder_building->get_texture()->init_procedural( 0.0f, 0.0f, 0 );
+    }, {}, true );
+
+    int32_t streets = startup->add( "street meshes", [this] () {
+      m_street_block = std::make_shared<Geometry>();
+      m_street_block->load( "street_block.obj" );
+
+      m_street_tile = std::make_shared<Geometry>();
+      m_street_tile->load( "street_block.obj", HLOD_TILE_SIZE, m_scale );
+    }, {}, true );
+
+    std::vector<int32_t> buildings;
+    int32_t rows = ( m_grid + STARTUP_BUILDING_STAGES - 1 ) / STARTUP_BUILDING_STAGES;
+    for( int32_t i = 0; i < m_grid; i += rows ) {
+      int32_t first = i * m_grid;
+      int32_t last = std::min( i + rows, m_grid ) * m_grid;
+      buildings.push_back( startup->add( "buildings", [this, first, last] () {
+        _create_buildings( first, last );
+      }, { placeholder }, false ) );
     }
 
-    for( int i = 0; i < 5; ++i )
-      m_threads.push_back( std::thread( &CityGenerator::_generate_loop, this ) );
+    startup->add( "nearby cells", [this] () {
+      _start_generation();
+    }, buildings, false );
 
-    m_count = 0;
-    m_to_generate_lock.lock();
-    for( int32_t i = 0; i < m_grid; i++ ) {
-      for( int32_t e = 0; e < m_grid; e++ ) {
-        m_buildigs[m_count]->set_ready_to_process( false );
-        m_to_generate.push_back( m_buildigs[m_count].get() );
-        ++m_count;
-      }
-    }
-    m_to_generate_lock.unlock();
+    std::vector<int32_t> drawables_after = buildings;
+    drawables_after.push_back( streets );
+    startup->add( "city drawables", [this] () {
+      _add_city_drawables();
+    }, drawables_after, true );
+
+    startup->run();
 
     for( int32_t i = 0; i < m_grid; i++ ) {
       m_outline_positions.push_back(
@@ -185,6 +302,121 @@ namespace kretash {
 
   }
 
+  // Cells first to last in grid order, only touches the buildings so it can run on any thread
+  void CityGenerator::_create_buildings( int32_t first, int32_t last ) {
+    for( int32_t c = first; c < last; ++c ) {
+      int32_t i = c / m_grid;
+      int32_t e = c % m_grid;
+
+      float seed_x = ( float ) ( m_half_grid - e )*m_scale;
+      float seed_y = ( float ) ( m_half_grid - i )*m_scale;
+
+      m_buildigs[c] = std::make_shared<Building>();
+      m_buildigs[c]->set_position( seed_x, 0.0f, seed_y );
+      m_buildigs[c]->prepare( seed_x, seed_y );
+      m_buildigs[c]->get_texture()->init_procedural( seed_x, seed_y, 0 );
+    }
+  }
+
+  // The generator threads start on the cells closest to the camera, they're the first ones seen
+  void CityGenerator::_start_generation() {
+    for( int i = 0; i < GENERATOR_THREADS; ++i )
+      m_arenas.push_back( std::make_shared<building_arena>() );
+    for( int i = 0; i < GENERATOR_THREADS; ++i )
+      m_hlod_builders.push_back( std::make_shared<Building>( true ) );
+
+    m_to_generate_lock.lock();
+    for( int32_t i = 0; i < m_buildigs.size(); ++i ) {
+      m_buildigs[i]->set_ready_to_process( false );
+      m_to_generate.push_back( m_buildigs[i].get() );
+    }
+    _sort_nearest_first();
+    m_to_generate_lock.unlock();
+
+    for( int i = 0; i < GENERATOR_THREADS; ++i )
+      m_threads.push_back( std::thread( &CityGenerator::_generate_loop, this, i ) );
+  }
+
+  // Closest cells to the camera go first, the caller holds m_to_generate_lock
+  void CityGenerator::_sort_nearest_first() {
+    float3 eye = k_engine->get_camera()->get_position();
+
+    std::stable_sort( m_to_generate.begin(), m_to_generate.end(), [eye] ( Building* a, Building* b ) {
+      float3 pa = a->get_position();
+      float3 pb = b->get_position();
+      float da = ( pa.x - eye.x )*( pa.x - eye.x ) + ( pa.z - eye.z )*( pa.z - eye.z );
+      float db = ( pb.x - eye.x )*( pb.x - eye.x ) + ( pb.z - eye.z )*( pb.z - eye.z );
+      return da < db;
+    } );
+  }
+
+  // Everything that goes through the renderer or the tiles, main thread only
+  void CityGenerator::_add_city_drawables() {
+    m_count = 0;
+    for( int32_t i = 0; i < m_grid; i++ ) {
+      for( int32_t e = 0; e < m_grid; e++ ) {
+
+        m_building_positions[m_count] = float3( ( m_half_grid - e )*m_scale, 0.0f, ( m_half_grid - i )*m_scale );
+
+        building_details bd = {};
+        bd.building_i = m_count;
+        bd.position.x = ( m_half_grid - e )*m_scale;
+        bd.position.y = 0.0f;
+        bd.position.z = ( m_half_grid - i )*m_scale;
+        bd.type = kTOP;
+        m_all_buildings.push_back( bd );
+
+        m_renderer->add_child( m_buildigs[m_count].get() );
+
+        m_street_block_D[m_count] = std::make_shared<Drawable>();
+        m_street_block_D[m_count]->set_position( ( m_half_grid - e )*m_scale, 0.0f, ( m_half_grid - i )*m_scale );
+        m_street_block_D[m_count]->init( m_street_block.get() );
+        m_street_block_D[m_count]->fit_bounds();
+        m_street_block_D[m_count]->set_instanced( true );
+
+        m_street_block_D[m_count]->get_texture()->load( tDIFFUSE, "street_block_d.png" );
+        m_street_block_D[m_count]->get_texture()->load( tNORMAL, "street_block_n.png" );
+        m_street_block_D[m_count]->get_texture()->load( tSPECULAR, "street_block_s.png" );
+
+        m_renderer->add_child( m_street_block_D[m_count].get() );
+
+        ++m_count;
+      }
+    }
+
+    for( int32_t i = 0; i < m_tiles.size(); ++i ) {
+      hlod_tile* t = &m_tiles[i];
+      t->x = 0;
+      t->z = 0;
+      t->used = false;
+      t->dirty = false;
+      t->failed = false;
+      t->state = kHLOD_EMPTY;
+      t->members.reserve( HLOD_TILE_SIZE * HLOD_TILE_SIZE );
+      t->generator = std::make_shared<BuildingGen>();
+
+      t->buildings = std::make_shared<Drawable>();
+      t->buildings->set_is_hlod( true );
+      t->buildings->init( k_engine->get_GPU_pool()->get_placeholder_building() );
+      t->buildings->fit_bounds();
+      t->buildings->get_texture()->init_procedural( ( float ) i, ( float ) i, 0 );
+      m_renderer->add_child( t->buildings.get() );
+
+      t->streets = std::make_shared<Drawable>();
+      t->streets->set_is_hlod( true );
+      t->streets->init( m_street_tile.get() );
+      t->streets->fit_bounds();
+      t->streets->set_instanced( true );
+      t->streets->get_texture()->load( tDIFFUSE, "street_block_d.png" );
+      t->streets->get_texture()->load( tNORMAL, "street_block_n.png" );
+      t->streets->get_texture()->load( tSPECULAR, "street_block_s.png" );
+      m_renderer->add_child( t->streets.get() );
+    }
+
+    for( int32_t i = 0; i < m_buildigs.size(); ++i )
+      _assign_tile( i );
+  }
+
   void CityGenerator::update() {
     std::cout.precision( 5 );
 
@@ -205,6 +437,8 @@ namespace kretash {
 
     if( count == 0 ) { //0.01 norm and spikes to 0.13 max
       _apply_move_buildings( max_movements );
+      _schedule_lods( max_movements );
+      _update_hlod_tiles();
       k_engine->get_GPU_pool()->start_remove_thread();
     }
 
@@ -222,9 +456,9 @@ namespace kretash {
 
           Building* building = m_to_upload[0];
           m_to_upload.erase( m_to_upload.begin() );
+          m_to_upload_bytes -= building->get_upload_size();
 
           building->upload_and_clean();
-          building->set_ready_to_process( true );
         }
         if( locked ) m_to_upload_lock.unlock();
       }
@@ -358,6 +592,7 @@ namespace kretash {
       m_buildigs[move_me.building_i]->set_position( move_me.end_position );
       m_buildigs[move_me.building_i]->prepare( move_me.end_position.x, move_me.end_position.z );
       m_street_block_D[move_me.building_i]->set_position( move_me.end_position );
+      _assign_tile( move_me.building_i );
 
       m_to_generate.push_back( m_buildigs[move_me.building_i].get() );
 
@@ -366,6 +601,224 @@ namespace kretash {
     m_to_generate_lock.unlock();
   }
 
+  // LOD n gets picked once LOD n+1's error projects over the pixel budget, so that error tells
+  // how close the camera has to be before LOD n is worth having. A LOD's error is only known
+  // once it exists, so the finer LODs arrive one step at a time as the camera approaches.
+  void CityGenerator::_schedule_lods( uint32_t count ) {
+    if( m_to_generate_lock.try_lock() == false )
+      return;
+
+    Camera* c = k_engine->get_camera();
+    float3 camera = c->get_position();
+    float height = ( float ) k_engine->get_window()->get_height();
+    float pixel_error = k_engine_settings->get_settings().lod_pixel_error * 2.0f * tanf( c->get_fov() * 0.5f ) / height;
+
+    uint32_t scheduled = 0;
+    for( int32_t i = 0; i < m_buildigs.size() && scheduled < count; ++i ) {
+
+      Building* b = m_buildigs[i].get();
+      if( b->is_empty() || b->is_ready_to_process() == false )
+        continue;
+
+      float distance = float3::lenght( camera - b->get_position() );
+      uint32_t resident = b->get_resident_lods();
+      uint32_t wanted = kLOD2_MASK;
+      uint32_t keep = kLOD2_MASK;
+
+      for( int32_t lod = 1; lod >= 0; --lod ) {
+        if( ( resident & ( 1 << ( lod + 1 ) ) ) == 0 ) break;
+
+        float switch_distance = b->get_geometry( lod + 1 )->get_lod_error() / pixel_error;
+        if( distance < switch_distance * LOD_LOAD_MARGIN ) wanted |= 1 << lod;
+        if( distance < switch_distance * LOD_EVICT_MARGIN ) keep |= 1 << lod;
+      }
+
+      // LOD0 without LOD1 would leave a hole in the chain of errors
+      uint32_t evict = resident & ~keep;
+      if( evict & kLOD1_MASK ) evict |= resident & kLOD0_MASK;
+      if( evict & kLOD0_MASK ) b->evict_lod( 0 );
+      if( evict & kLOD1_MASK ) b->evict_lod( 1 );
+
+      uint32_t missing = wanted & ~b->get_resident_lods();
+      if( missing != 0 ) {
+        b->request_lods( missing );
+        b->set_ready_to_process( false );
+        m_to_generate.push_back( b );
+        ++scheduled;
+      }
+    }
+
+    m_to_generate_lock.unlock();
+  }
+
+  uint32_t CityGenerator::get_resident_buildings( int32_t LOD ) {
+    uint32_t count = 0;
+    for( int32_t i = 0; i < m_buildigs.size(); ++i ) {
+      if( m_buildigs[i]->get_resident_lods() & ( 1 << LOD ) ) ++count;
+    }
+    return count;
+  }
+
+  // Cells map to tiles by their grid coordinates, so a tile keeps its place in the world
+  // and only its members come and go as the grid scrolls over it
+  void CityGenerator::_assign_tile( int32_t building ) {
+    float3 p = m_buildigs[building]->get_position();
+    int32_t cx = ( int32_t ) floorf( p.x / m_scale + 0.5f );
+    int32_t cz = ( int32_t ) floorf( p.z / m_scale + 0.5f );
+    int32_t tx = cx >= 0 ? cx / HLOD_TILE_SIZE : ( cx - HLOD_TILE_SIZE + 1 ) / HLOD_TILE_SIZE;
+    int32_t tz = cz >= 0 ? cz / HLOD_TILE_SIZE : ( cz - HLOD_TILE_SIZE + 1 ) / HLOD_TILE_SIZE;
+
+    int32_t old = m_building_tile[building];
+    if( old >= 0 && m_tiles[old].x == tx && m_tiles[old].z == tz )
+      return;
+    if( old >= 0 )
+      _leave_tile( old, building );
+
+    int32_t slot = -1;
+    for( int32_t i = 0; i < m_tiles.size() && slot < 0; ++i ) {
+      if( m_tiles[i].used && m_tiles[i].x == tx && m_tiles[i].z == tz ) slot = i;
+    }
+    // a slot still merging its old tile can't be handed out until the result comes back
+    for( int32_t i = 0; i < m_tiles.size() && slot < 0; ++i ) {
+      if( !m_tiles[i].used && m_tiles[i].state != kHLOD_QUEUED ) slot = i;
+    }
+
+    m_building_tile[building] = slot;
+    if( slot < 0 ) {
+      m_buildigs[building]->set_hlod( nullptr );
+      m_street_block_D[building]->set_hlod( nullptr );
+      return;
+    }
+
+    hlod_tile* t = &m_tiles[slot];
+    if( !t->used ) {
+      float offset = ( HLOD_TILE_SIZE - 1 ) * 0.5f;
+      t->used = true;
+      t->x = tx;
+      t->z = tz;
+      t->center = float3( ( tx * HLOD_TILE_SIZE + offset ) * m_scale, 0.0f, ( tz * HLOD_TILE_SIZE + offset ) * m_scale );
+      t->members.clear();
+      t->buildings->set_position( t->center );
+      t->streets->set_position( t->center );
+    }
+
+    t->members.push_back( building );
+    _invalidate_tile( slot );
+    m_buildigs[building]->set_hlod( t->buildings.get() );
+    m_street_block_D[building]->set_hlod( t->streets.get() );
+  }
+
+  void CityGenerator::_leave_tile( int32_t slot, int32_t building ) {
+    hlod_tile* t = &m_tiles[slot];
+    t->members.erase( std::find( t->members.begin(), t->members.end(), building ) );
+    _invalidate_tile( slot );
+    if( t->members.size() == 0 )
+      t->used = false;
+  }
+
+  void CityGenerator::_invalidate_tile( int32_t slot ) {
+    hlod_tile* t = &m_tiles[slot];
+    t->dirty = true;
+    t->buildings->set_hlod_ready( false );
+    t->streets->set_hlod_ready( false );
+    if( t->state == kHLOD_READY ) {
+      k_engine->get_GPU_pool()->remove( t->buildings->get_geometry( 0 ) );
+      t->state = kHLOD_EMPTY;
+    }
+  }
+
+  // Main thread side of the tiles, merged meshes that came back get uploaded unless their
+  // tile changed meanwhile, and complete tiles that changed get sent to the workers
+  void CityGenerator::_update_hlod_tiles() {
+
+    if( m_to_upload_lock.try_lock() ) {
+      for( int32_t i = 0; i < m_hlod_to_upload.size(); ++i ) {
+        hlod_tile* t = m_hlod_to_upload[i];
+        m_to_upload_bytes -= t->generator->get_staging_size();
+        t->state = kHLOD_EMPTY;
+
+        if( t->dirty || !t->used || t->failed ) {
+          t->generator->discard();
+          continue;
+        }
+
+        t->generator->finish_and_upload();
+        t->buildings->init( t->generator.get() );
+        t->buildings->fit_bounds();
+        t->buildings->set_hlod_ready( true );
+        t->streets->set_hlod_ready( true );
+        t->state = kHLOD_READY;
+      }
+      m_hlod_to_upload.clear();
+      m_to_upload_lock.unlock();
+    }
+
+    if( m_to_generate_lock.try_lock() ) {
+      for( int32_t i = 0; i < m_tiles.size(); ++i ) {
+        hlod_tile* t = &m_tiles[i];
+        if( !t->used || !t->dirty || t->state != kHLOD_EMPTY ) continue;
+        if( t->members.size() != HLOD_TILE_SIZE * HLOD_TILE_SIZE ) continue;
+
+        for( int32_t m = 0; m < t->members.size(); ++m )
+          t->seeds[m] = m_buildigs[t->members[m]]->get_position();
+
+        t->dirty = false;
+        t->failed = false;
+        t->state = kHLOD_QUEUED;
+        m_hlod_to_generate.push_back( t );
+      }
+      m_to_generate_lock.unlock();
+    }
+  }
+
+  // The GPU pool got rebuilt, every merged mesh is gone with it
+  void CityGenerator::_reset_hlod_tiles() {
+    m_hlod_to_generate.clear();
+    for( int32_t i = 0; i < m_tiles.size(); ++i ) {
+      hlod_tile* t = &m_tiles[i];
+      t->dirty = true;
+      t->state = kHLOD_EMPTY;
+      t->buildings->init( k_engine->get_GPU_pool()->get_placeholder_building() );
+      t->buildings->set_hlod_ready( false );
+      t->streets->set_hlod_ready( false );
+    }
+  }
+
+  // Every member's LOD2 is generated again from its seed and moved into the tile's frame,
+  // all of them end up in the tile's generator and get combined as one mesh
+  void CityGenerator::_generate_hlod( hlod_tile* tile, int32_t worker ) {
+    building_arena* arena = m_arenas[worker].get();
+    Building* builder = m_hlod_builders[worker].get();
+    BuildingGen* merged = tile->generator.get();
+
+    merged->begin( &arena->lod[1] );
+    for( int32_t i = 0; i < HLOD_TILE_SIZE * HLOD_TILE_SIZE; ++i ) {
+      builder->prepare( tile->seeds[i].x, tile->seeds[i].z );
+      BuildingGen* part = builder->generate_hlod_part( arena );
+      merged->append( part, tile->seeds[i] - tile->center );
+      part->discard();
+    }
+
+    // the cells keep drawing themselves if the tile doesn't fit the index format
+    if( k_engine->get_context()->get_index_size() != sizeof( uint32_t ) &&
+      merged->get_gathered_vertex_count() > MAX_SHORT_INDEX_VERTICES ) {
+      merged->discard();
+      tile->failed = true;
+      return;
+    }
+
+    merged->combine_buffers();
+  }
+
+  void CityGenerator::get_hlod_tiles( uint32_t* ready, uint32_t* used ) {
+    *ready = 0;
+    *used = 0;
+    for( int32_t i = 0; i < m_tiles.size(); ++i ) {
+      if( m_tiles[i].used ) ++*used;
+      if( m_tiles[i].state == kHLOD_READY ) ++*ready;
+    }
+  }
+
   void CityGenerator::_apply_carry_to_outline( building_details outline ) {
     if( outline.carry != 0 ) {
       for( std::vector<building_details>::iterator all_outlines = m_outline_positions.begin(); all_outlines != m_outline_positions.end(); ++all_outlines ) {
@@ -421,6 +874,9 @@ namespace kretash {
     m_buildigs.shrink_to_fit();
     m_street_block_D.clear();
     m_street_block_D.shrink_to_fit();
+    m_tiles.clear();
+    m_hlod_builders.clear();
+    m_street_tile.reset();
 
     m_placeholder_building.reset();
     m_street_block.reset();
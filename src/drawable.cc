@@ -4,6 +4,7 @@
 #include "core/vk/drawable.hh"
 #include "core/factory.h"
 #include <cassert>
+#include <cmath>
 
 namespace kretash {
 
@@ -11,12 +12,24 @@ namespace kretash {
     drawable_id = k_engine->new_id();
     m_position = float3( 0.0f, 0.0f, 0.0f );
     m_scale = float3( 1.0f, 1.0f, 1.0f );
+    m_rotation = float3( 0.0f, 0.0f, 0.0f );
     m_distance = 99999.9f;
 
+    //Not culled until it gets a volume
+    m_radius = -0.1f;
+    m_sphere_center = float3( 0.0f, 0.0f, 0.0f );
+    m_bounds_min = float3( 0.0f, 0.0f, 0.0f );
+    m_bounds_max = float3( 0.0f, 0.0f, 0.0f );
+
     //LOD not supported by default
     m_geo_lod = 0;
     m_has_lod = 0;
     m_in_frustum = false;
+    m_hlod = nullptr;
+    m_is_hlod = false;
+    m_hlod_ready = false;
+    m_instanced = false;
+    m_max_part_instances = 0;
     m_texture = std::make_shared<Texture>();
 
     Factory* factory = k_engine->get_factory();
@@ -83,14 +96,90 @@ namespace kretash {
     m_offsets.srv_offset = srv;
   }
 
+  // A hand made volume, a cylinder of radius from the ground up to max_height
   void Drawable::set_frustum_size( float radius, float max_height ) {
-    m_radius = radius;
-    m_max_height = max_height;
+    m_bounds_min = float3( -radius, 0.0f, -radius );
+    m_bounds_max = float3( radius, max_height, radius );
+    m_sphere_center = float3( 0.0f, max_height * 0.5f, 0.0f );
+    m_radius = sqrtf( radius * radius + max_height * max_height * 0.25f );
   }
 
   void Drawable::set_ignore_frustum() {
     m_radius = -0.1f;
-    m_max_height = -0.1f;
+  }
+
+  // The culling volume holds every LOD, so it doesn't depend on the LOD that gets picked
+  void Drawable::fit_bounds() {
+
+    bool first = true;
+    for( int32_t i = 0; i < 3; ++i ) {
+      Geometry* g = m_geometry[i].get();
+      if( g == nullptr || g->get_indicies_count() == 0 ) continue;
+
+      float3 min = g->get_bounds_min();
+      float3 max = min + g->get_bounds_scale();
+      float3 center = g->get_sphere_center();
+      float radius = g->get_sphere_radius();
+
+      if( first ) {
+        m_bounds_min = min;
+        m_bounds_max = max;
+        m_sphere_center = center;
+        m_radius = radius;
+        first = false;
+        continue;
+      }
+
+      m_bounds_min = float3( fminf( m_bounds_min.x, min.x ), fminf( m_bounds_min.y, min.y ), fminf( m_bounds_min.z, min.z ) );
+      m_bounds_max = float3( fmaxf( m_bounds_max.x, max.x ), fmaxf( m_bounds_max.y, max.y ), fmaxf( m_bounds_max.z, max.z ) );
+
+      // smallest sphere around both spheres
+      float d = float3::lenght( center - m_sphere_center );
+      if( d + radius <= m_radius ) continue;
+      if( d + m_radius <= radius ) {
+        m_sphere_center = center;
+        m_radius = radius;
+        continue;
+      }
+      float grown = ( d + m_radius + radius ) * 0.5f;
+      m_sphere_center = m_sphere_center + ( center - m_sphere_center ) * ( ( grown - m_radius ) / d );
+      m_radius = grown;
+    }
+
+    // nothing to fit, better drawn than lost
+    if( first ) set_ignore_frustum();
+  }
+
+  void Drawable::get_world_sphere( float3* center, float* radius ) {
+    float scale = fmaxf( fabsf( m_scale.x ), fmaxf( fabsf( m_scale.y ), fabsf( m_scale.z ) ) );
+    float3 c = float3( m_sphere_center.x * m_scale.x, m_sphere_center.y * m_scale.y, m_sphere_center.z * m_scale.z );
+
+    *center = c + m_position;
+    *radius = m_radius * scale;
+
+    // spun around y the center could be anywhere on its circle, the sphere takes the whole circle
+    if( m_rotation.y != 0.0f ) {
+      *center = float3( 0.0f, c.y, 0.0f ) + m_position;
+      *radius += sqrtf( c.x * c.x + c.z * c.z );
+    }
+  }
+
+  // The box only follows scale and position, a rotated drawable gets the box around its sphere
+  void Drawable::get_world_bounds( float3* min, float3* max ) {
+
+    if( m_rotation.y != 0.0f ) {
+      float3 center;
+      float radius;
+      get_world_sphere( &center, &radius );
+      *min = center - float3( radius, radius, radius );
+      *max = center + float3( radius, radius, radius );
+      return;
+    }
+
+    float3 a = float3( m_bounds_min.x * m_scale.x, m_bounds_min.y * m_scale.y, m_bounds_min.z * m_scale.z );
+    float3 b = float3( m_bounds_max.x * m_scale.x, m_bounds_max.y * m_scale.y, m_bounds_max.z * m_scale.z );
+    *min = float3( fminf( a.x, b.x ), fminf( a.y, b.y ), fminf( a.z, b.z ) ) + m_position;
+    *max = float3( fmaxf( a.x, b.x ), fmaxf( a.y, b.y ), fmaxf( a.z, b.z ) ) + m_position;
   }
 
   Drawable::~Drawable() {
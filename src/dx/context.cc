@@ -312,6 +312,14 @@ namespace kretash {
     m_fence_event = CreateEventEx( nullptr, FALSE, FALSE, EVENT_ALL_ACCESS );
     assert( m_fence_event != nullptr && "ERROR CREATING THE FENCE EVENT" );
 
+    // The frame fence is never recreated, its value is the last frame submitted
+    result = m_device->CreateFence( 0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS( &m_frame_fence ) );
+    assert( result == S_OK && "ERROR CREATING THE FRAME FENCE" );
+    m_submitted_frame = 0;
+
+    m_frame_fence_event = CreateEventEx( nullptr, FALSE, FALSE, EVENT_ALL_ACCESS );
+    assert( m_frame_fence_event != nullptr && "ERROR CREATING THE FRAME FENCE EVENT" );
+
   }
 
   /* This will wait for all setup actions to be completed */
@@ -524,7 +532,8 @@ namespace kretash {
     result = m_buffer_command_list->Reset( m_buffer_command_allocator.Get(), nullptr );
     assert( result == S_OK && "COMMAND LIST RESET FAILED" );
 
-    UINT command_buffer_size = d_count * sizeof( indirect_command );
+    // room for every drawable split into the most ranges cluster culling can leave
+    UINT command_buffer_size = d_count * MAX_DRAW_RANGES * sizeof( indirect_command );
 
     D3D12_RESOURCE_DESC command_buffer_desc = CD3DX12_RESOURCE_DESC::Buffer( command_buffer_size );
 
@@ -551,7 +560,7 @@ namespace kretash {
     D3D12_GPU_VIRTUAL_ADDRESS addr = m_renderer->m_instance_buffer->GetGPUVirtualAddress();
 
     UINT index = 0;
-    m_renderer->m_indirect_commands.resize( d_count );
+    m_renderer->m_indirect_commands.resize( d_count * MAX_DRAW_RANGES );
 
     for( index = 0; index < d_count; ++index ) {
 
@@ -618,13 +627,15 @@ namespace kretash {
   }
 
   /* This will update the indirect command buffer in D3D12 and do nothing in D3D12*/
-  void dxContext::update_indirect_command_buffer( xxRenderer* r, Drawable** draw, uint32_t d_count ) {
+  void dxContext::update_indirect_command_buffer( xxRenderer* r, draw_range* ranges, uint32_t r_count ) {
 
     uint32_t index = 0;
     dxRenderer* m_renderer = dynamic_cast< dxRenderer* >( r );
 
+    assert( r_count <= m_renderer->m_indirect_commands.size() && "TOO MANY DRAW RANGES FOR THE COMMAND BUFFER" );
+
     D3D12_GPU_VIRTUAL_ADDRESS addr = m_renderer->m_instance_buffer->GetGPUVirtualAddress();
-    uint32_t command_buffer_size = d_count * sizeof( indirect_command );
+    uint32_t command_buffer_size = r_count * sizeof( indirect_command );
 
     HRESULT result = E_FAIL;
 
@@ -634,22 +645,22 @@ namespace kretash {
     result = m_buffer_command_list->Reset( m_buffer_command_allocator.Get(), nullptr );
     assert( result == S_OK && "COMMAND LIST RESET FAILED" );
 
-    for( index = 0; index < d_count; ++index ) {
+    for( index = 0; index < r_count; ++index ) {
 
-      int id = draw[index]->get_drawable_id();
+      Drawable* d = ranges[index].drawable;
+      int id = d->get_drawable_id();
 
       indirect_command tmp = {};
 
       tmp.cbv = addr + ( id * sizeof( instance_buffer ) );
 
       tmp.draw_arguments.BaseVertexLocation =
-        draw[index]->get_geometry()->get_vertex_offset() / m_stride;
+        d->get_geometry()->get_vertex_offset() / m_stride;
 
-      tmp.draw_arguments.IndexCountPerInstance =
-        draw[index]->get_geometry()->get_indicies_count();
+      tmp.draw_arguments.IndexCountPerInstance = ranges[index].index_count;
 
       tmp.draw_arguments.StartIndexLocation =
-        draw[index]->get_geometry()->get_indicies_offset();
+        d->get_geometry()->get_indicies_offset() + ranges[index].first_index;
 
       tmp.draw_arguments.InstanceCount = 1;
       tmp.draw_arguments.StartInstanceLocation = 0;
@@ -783,23 +794,57 @@ namespace kretash {
   }
 
   /* This will record commands list in Vulkan and D3D12 */
-  void dxContext::record_indirect_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) {
+  void dxContext::record_indirect_commands( xxRenderer* r, Window* w, draw_range* ranges, uint32_t r_count ) {
+
+    dxRenderer* m_renderer = dynamic_cast< dxRenderer* >( r );
+    _bind_draw_state( r, m_renderer->m_pipeline_state.Get() );
+
+    m_render_command_list->SetGraphicsRootConstantBufferView(
+      GRP_INSTANCE_CBV, m_renderer->m_instance_buffer->GetGPUVirtualAddress() );
+
+    //Draw all
+    m_render_command_list->ExecuteIndirect(
+      m_renderer->m_command_signature.Get(),
+      r_count,
+      m_renderer->m_command_buffer.Get(),
+      0,
+      nullptr,
+      0 );
+  }
+
+  /* This will record one instanced draw per batch in Vulkan and D3D12 */
+  void dxContext::record_instanced_commands( xxRenderer* r, Window* w, instance_batch* batches, uint32_t b_count ) {
+
+    dxRenderer* m_renderer = dynamic_cast< dxRenderer* >( r );
+    _bind_draw_state( r, m_renderer->m_instanced_pipeline_state.Get() );
+
+    // SV_InstanceID starts at zero on every draw, the stream view starts at the batch instead
+    D3D12_GPU_VIRTUAL_ADDRESS addr = m_renderer->m_instance_stream->GetGPUVirtualAddress();
+
+    for( uint32_t i = 0; i < b_count; ++i ) {
+      Geometry* g = batches[i].geometry;
+
+      m_render_command_list->SetGraphicsRootShaderResourceView(
+        GRP_INSTANCE_SRV, addr + batches[i].first_instance * sizeof( instance_buffer ) );
+
+      m_render_command_list->DrawIndexedInstanced( g->get_indicies_count(), batches[i].instance_count,
+        g->get_indicies_offset(), g->get_vertex_offset() / m_stride, 0 );
+    }
+  }
+
+  void dxContext::_bind_draw_state( xxRenderer* r, ID3D12PipelineState* pipeline ) {
 
     dxRenderer* m_renderer = dynamic_cast< dxRenderer* >( r );
     dxDescriptorBuffer* m_buffer = dynamic_cast< dxDescriptorBuffer* >( k_engine->get_world()->get_buffer() );
     dxGeometry* m_geometry = dynamic_cast< dxGeometry* >( k_engine->get_GPU_pool()->get_xx_geometry() );
 
-    uint32_t count = 0;
-    m_render_command_list->SetPipelineState( m_renderer->m_pipeline_state.Get() );
+    m_render_command_list->SetPipelineState( pipeline );
     m_render_command_list->SetGraphicsRootSignature( m_renderer->m_root_signature.Get() );
     m_render_command_list->IASetPrimitiveTopology( D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST );
 
     m_render_command_list->IASetVertexBuffers( 0, 1, &m_geometry->m_vertexBufferView );
     m_render_command_list->IASetIndexBuffer( &m_geometry->m_indexBufferView );
 
-    m_render_command_list->SetGraphicsRootConstantBufferView(
-      GRP_INSTANCE_CBV, m_renderer->m_instance_buffer->GetGPUVirtualAddress() );
-
     m_render_command_list->SetGraphicsRootConstantBufferView(
       GRP_CONSTANT_CBV, m_buffer->m_constant_buffer->GetGPUVirtualAddress() );
 
@@ -818,15 +863,6 @@ namespace kretash {
       0,
       m_sampler_descriptor_size );
     m_render_command_list->SetGraphicsRootDescriptorTable( GRP_SAMPLER, sampler_handle );
-
-    //Draw all
-    m_render_command_list->ExecuteIndirect(
-      m_renderer->m_command_signature.Get(),
-      d_count,
-      m_renderer->m_command_buffer.Get(),
-      0,
-      nullptr,
-      0 );
   }
 
   /* This will execute the command list in Vulkan and D3D12 */
@@ -884,6 +920,33 @@ namespace kretash {
 
   }
 
+  /* This will signal the frame fence with the given frame number in Vulkan and D3D12 */
+  void dxContext::signal_frame( uint64_t frame ) {
+
+    HRESULT result = m_command_queue->Signal( m_frame_fence.Get(), frame );
+    assert( result == S_OK && "ERROR SIGNALING THE FRAME FENCE" );
+    m_submitted_frame = frame;
+
+  }
+
+  /* This will return the last frame retired by the GPU in Vulkan and D3D12 */
+  uint64_t dxContext::get_completed_frame() {
+    return m_frame_fence->GetCompletedValue();
+  }
+
+  /* This will wait until the given frame has been retired in Vulkan and D3D12 */
+  void dxContext::wait_for_frame( uint64_t frame ) {
+
+    if( frame > m_submitted_frame ) return;
+
+    if( m_frame_fence->GetCompletedValue() < frame ) {
+      HRESULT result = m_frame_fence->SetEventOnCompletion( frame, m_frame_fence_event );
+      assert( result == S_OK && "SET EVENT ON COMPLETITION FAILED" );
+      WaitForSingleObject( m_frame_fence_event, INFINITE );
+    }
+
+  }
+
   dxContext::dxContext() {
 
     m_debug_controller = nullptr;
@@ -905,8 +968,10 @@ namespace kretash {
     m_dsv_heap = nullptr;
     m_sampler_heap = nullptr;
     m_fence = nullptr;
+    m_frame_fence = nullptr;
 
     m_fence_event = {};
+    m_frame_fence_event = {};
 
     m_render_targets.clear();
     m_render_targets.shrink_to_fit();
@@ -919,6 +984,7 @@ namespace kretash {
     m_frame_index = 0;
     m_fence_value = 0;
     m_fence_texture_upload = 0;
+    m_submitted_frame = 0;
     m_mssa_count = 1;
 
   }
@@ -945,8 +1011,10 @@ namespace kretash {
     m_dsv_heap = nullptr;
     m_sampler_heap = nullptr;
     m_fence = nullptr;
+    m_frame_fence = nullptr;
 
     m_fence_event = {};
+    m_frame_fence_event = {};
 
     m_render_targets.clear();
     m_render_targets.shrink_to_fit();
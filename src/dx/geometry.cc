@@ -58,7 +58,7 @@ namespace kretash {
     m_indexBuffer->SetName( L"bbIndexBuffer" );
 
     m_indexBufferView.BufferLocation = m_indexBuffer->GetGPUVirtualAddress();
-    m_indexBufferView.Format = DXGI_FORMAT_R32_UINT;
+    m_indexBufferView.Format = m_context->m_index_size == sizeof( uint16_t ) ? DXGI_FORMAT_R16_UINT : DXGI_FORMAT_R32_UINT;
     m_indexBufferView.SizeInBytes = indices_buffer_size;
 
     UINT8* data_begin;
@@ -60,6 +60,34 @@ namespace kretash {
 
   }
 
+  /* This will create the instance stream read by the instanced draws in Vulkan and D3D12 */
+  void dxRenderer::create_instance_stream( uint32_t max_instances ) {
+
+    dxContext* m_context = dynamic_cast< dxContext* >( k_engine->get_context() );
+
+    HRESULT result = m_context->m_device->CreateCommittedResource(
+      &CD3DX12_HEAP_PROPERTIES( D3D12_HEAP_TYPE_UPLOAD ),
+      D3D12_HEAP_FLAG_NONE,
+      &CD3DX12_RESOURCE_DESC::Buffer( sizeof( instance_buffer ) * max_instances ),
+      D3D12_RESOURCE_STATE_GENERIC_READ,
+      nullptr,
+      IID_PPV_ARGS( &m_instance_stream ) );
+    assert( result == S_OK && "CREATING THE INSTANCE STREAM FAILED" );
+    m_instance_stream->SetName( L"INSTANCE STREAM" );
+
+  }
+
+  /* This will update the first count instances of the instance stream in Vulkan and D3D12 */
+  void dxRenderer::update_instance_stream( std::vector<instance_buffer>* s, uint32_t count ) {
+
+    uint8_t* data = nullptr;
+    HRESULT result = m_instance_stream->Map( 0, nullptr, reinterpret_cast< void** >( &data ) );
+    assert( result == S_OK && "MAPPING THE INSTANCE STREAM FAILED" );
+    memcpy( data, s->data(), sizeof( instance_buffer ) * count );
+    m_instance_stream->Unmap( 0, nullptr );
+
+  }
+
   /* This will create the root signature in Vulkan and D3D12 */
   void dxRenderer::create_root_signature() {
     HRESULT result;
@@ -74,6 +102,7 @@ namespace kretash {
     rootParameters[GRP_SRV].InitAsDescriptorTable( 1, &ranges[1], D3D12_SHADER_VISIBILITY_ALL );
     rootParameters[GRP_CONSTANT_CBV].InitAsConstantBufferView( 1, 0, D3D12_SHADER_VISIBILITY_ALL );
     rootParameters[GRP_SAMPLER].InitAsDescriptorTable( 1, &ranges[2], D3D12_SHADER_VISIBILITY_ALL );
+    rootParameters[GRP_INSTANCE_SRV].InitAsShaderResourceView( 0, 1, D3D12_SHADER_VISIBILITY_VERTEX );
 
     D3D12_ROOT_SIGNATURE_FLAGS rootSignatureFlags =
       D3D12_ROOT_SIGNATURE_FLAG_ALLOW_INPUT_ASSEMBLER_INPUT_LAYOUT;
@@ -116,11 +145,12 @@ namespace kretash {
 
     _load_and_compile_shaders( rt );
 
-    const UINT input_element_desc_size = 5;
-    D3D12_INPUT_ELEMENT_DESC inputElementsDesc[input_element_desc_size];
-
     dxContext* m_context = dynamic_cast< dxContext* >( k_engine->get_context() );
 
+    const bool packed = m_context->m_stride == PACKED_VERTEX_STRIDE;
+    const UINT input_element_desc_size = packed ? 4 : 5;
+    D3D12_INPUT_ELEMENT_DESC inputElementsDesc[5];
+
     m_context->m_pipeline_state_object_id_counter++;
 
     m_pipeline_state_id = m_context->m_pipeline_state_object_id_counter;
@@ -136,6 +166,17 @@ namespace kretash {
     inputElementsDesc[4] = { "BITANGENT", 0, DXGI_FORMAT_R32G32B32_FLOAT, 0, 44,
       D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
 
+    if( packed ) {
+      inputElementsDesc[0] = { "POSITION", 0, DXGI_FORMAT_R16G16B16A16_UNORM, 0, 0,
+        D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
+      inputElementsDesc[1] = { "NORMAL", 0, DXGI_FORMAT_R16G16_SNORM, 0, 8,
+        D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
+      inputElementsDesc[2] = { "TEXCOORD", 0, DXGI_FORMAT_R16G16_FLOAT, 0, 12,
+        D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
+      inputElementsDesc[3] = { "TANGENT", 0, DXGI_FORMAT_R16G16_SNORM, 0, 16,
+        D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 };
+    }
+
     CD3DX12_DEPTH_STENCIL_DESC depthStencilDesc( D3D12_DEFAULT );
     depthStencilDesc.DepthEnable = true;
     depthStencilDesc.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ALL;
@@ -171,10 +212,22 @@ namespace kretash {
 
     result = m_context->m_device->CreateGraphicsPipelineState( &psoDesc, IID_PPV_ARGS( &m_pipeline_state ) );
     assert( result == S_OK && "ERROR CREATING THE PIPELINE STATE" );
+
+    // same state, but the vertex shader reads its instance from the instance stream
+    if( rt == rTEXTURE ) {
+      _load_and_compile_shaders( rt, true );
+      psoDesc.VS = { reinterpret_cast< UINT8* >( vertexShader->GetBufferPointer() ),
+        vertexShader->GetBufferSize() };
+      psoDesc.PS = { reinterpret_cast< UINT8* >( pixelShader->GetBufferPointer() ),
+        pixelShader->GetBufferSize() };
+
+      result = m_context->m_device->CreateGraphicsPipelineState( &psoDesc, IID_PPV_ARGS( &m_instanced_pipeline_state ) );
+      assert( result == S_OK && "ERROR CREATING THE INSTANCED PIPELINE STATE" );
+    }
   }
 
   /*compiles shaders*/
-  void dxRenderer::_load_and_compile_shaders( render_type s ) {
+  void dxRenderer::_load_and_compile_shaders( render_type s, bool instanced ) {
     HRESULT result;
 
     //D3DCOMPILE_ENABLE_UNBOUNDED_DESCRIPTOR_TABLES
@@ -196,7 +249,14 @@ namespace kretash {
     else if( s == rPOST )
       filename = WSPATH"post.hlsl";
 
-    result = D3DCompileFromFile( filename.c_str(), nullptr, nullptr, "VSMain", "vs_5_1", compileFlags, compileFlags,
+    dxContext* m_context = dynamic_cast< dxContext* >( k_engine->get_context() );
+    D3D_SHADER_MACRO defines[3] = {};
+    uint32_t define_count = 0;
+    if( m_context->m_stride == PACKED_VERTEX_STRIDE ) defines[define_count++] = { "PACKED_VERTICES", "1" };
+    if( instanced ) defines[define_count++] = { "INSTANCED", "1" };
+    defines[define_count] = { nullptr, nullptr };
+
+    result = D3DCompileFromFile( filename.c_str(), defines, nullptr, "VSMain", "vs_5_1", compileFlags, compileFlags,
       &vertexShader, &error_msg );
     if( error_msg )
       _show_shader_error_message( error_msg, filename );
@@ -237,8 +297,10 @@ namespace kretash {
     pixelShader = nullptr;
     m_root_signature = nullptr;
     m_pipeline_state = nullptr;
+    m_instanced_pipeline_state = nullptr;
     m_instance_buffer = nullptr;
     m_instance_buffer_WO = nullptr;
+    m_instance_stream = nullptr;
     m_constant_buffer = nullptr;
     m_constant_buffer_WO = nullptr;
 
@@ -263,8 +325,10 @@ namespace kretash {
     pixelShader = nullptr;
     m_root_signature = nullptr;
     m_pipeline_state = nullptr;
+    m_instanced_pipeline_state = nullptr;
     m_instance_buffer = nullptr;
     m_instance_buffer_WO = nullptr;
+    m_instance_stream = nullptr;
     m_constant_buffer = nullptr;
     m_constant_buffer_WO = nullptr;
 
@@ -19,6 +19,9 @@
 #include "core/factory.h"
 #include "core/interface.hh"
 #include "core/pool.hh"
+#include "core/startup_graph.hh"
+#include "core/asset_registry.hh"
+#include "core/swap_cache.hh"
 
 namespace kretash {
 
@@ -30,7 +33,8 @@ namespace kretash {
     m_world( nullptr ),
     m_is_running( true ),
     m_city( nullptr ),
-    m_drawable_id_count( 0 ) {
+    m_drawable_id_count( 0 ),
+    m_frame( 1 ) {
 
     for( int i = 0; i < rCOUNT; ++i )
       m_renderers[i] = nullptr;
@@ -44,6 +48,9 @@ namespace kretash {
 
     srand( ( uint32_t ) time( nullptr ) );
 
+    m_startup = std::make_shared<StartupGraph>();
+    m_swap_cache = std::make_shared<SwapCache>( ( uint64_t ) k_engine_settings->get_settings().swap_cache_size *
+      ( uint64_t ) 1024 * ( uint64_t ) 1024 );
     m_factory = std::make_shared<Factory>();
 
     m_factory->make_context( &m_context );
@@ -56,51 +63,93 @@ namespace kretash {
     m_texture_manager = std::make_shared<TextureManager>();
     m_interface = std::make_shared<Interface>();
 
-    m_window->init();
+    // the placeholder texture is pure CPU work, it gets made while the context comes up
+    int32_t window = m_startup->add( "window", [this] () {
+      m_window->init();
+    }, {}, true );
+
+    int32_t context = m_startup->add( "context", [this] () {
+      m_context->create_instance();
+      m_context->create_factory();
+      m_context->create_device();
+      m_context->create_swap_chain( m_window.get() );
+      m_context->create_command_pool();
+      m_context->create_setup_command_buffer();
+      m_context->setup_swap_chain( m_window.get() );
+      m_context->create_buffer_command_buffer();
+      m_context->create_texture_command_buffer();
+      m_context->create_render_command_buffer();
+      m_context->create_render_pass();
+      m_context->create_depth_stencil( m_window.get() );
+      m_context->create_framebuffer( m_window.get() );
+      m_context->create_pipeline_cache();
+      m_context->allocate_device_memory( m_device_pool_size );
+      m_context->allocate_host_memory( m_host_visible_pool_size );
+      m_context->create_sampler_view_heap();
+      m_context->create_fences();
+    }, { window }, true );
+
+    m_startup->add( "GPU pool", [this] () {
+      m_gpu_pool->init();
+      m_camera->init();
+      m_interface->init();
+
+      m_context->wait_for_setup_completion();
+    }, { context }, true );
+
+    m_startup->add( "placeholder texture", [this] () {
+      m_texture_manager->generate_placeholder();
+    }, {}, false );
+
+    m_startup->run();
 
-    m_context->create_instance();
-    m_context->create_factory();
-    m_context->create_device();
-    m_context->create_swap_chain( m_window.get() );
-    m_context->create_command_pool();
-    m_context->create_setup_command_buffer();
-    m_context->setup_swap_chain( m_window.get() );
-    m_context->create_buffer_command_buffer();
-    m_context->create_texture_command_buffer();
-    m_context->create_render_command_buffer();
-    m_context->create_render_pass();
-    m_context->create_depth_stencil( m_window.get() );
-    m_context->create_framebuffer( m_window.get() );
-    m_context->create_pipeline_cache();
-    m_context->allocate_device_memory( m_device_pool_size );
-    m_context->allocate_host_memory( m_host_visible_pool_size );
-    m_context->create_sampler_view_heap();
-    m_context->create_fences();
+  }
 
-    m_gpu_pool->init();
-    m_camera->init();
-    m_interface->init();
+  void Engine::prepare() {
 
-    m_context->wait_for_setup_completion();
+    bool textures = m_renderers[rTEXTURE] != nullptr;
 
-  }
+    int32_t descriptors = m_startup->add( "descriptors", [this] () {
+      m_context->create_descriptor_pool();
+      m_context->create_descriptor_set_layout();
 
-  void Engine::prepare() {
+      m_world->init();
+    }, {}, true );
 
-    m_context->create_descriptor_pool();
-    m_context->create_descriptor_set_layout();
+    // the files decode while the renderers build their pipelines and upload the meshes
+    int32_t renderers_after = descriptors;
+    int32_t decode = -1;
+    if( textures ) {
+      renderers_after = m_startup->add( "texture ids", [this] () {
+        m_texture_manager->prepare();
+      }, { descriptors }, true );
 
-    m_world->init();
-    if( m_renderers[rTEXTURE] != nullptr )  m_texture_manager->prepare();
+      decode = m_startup->add( "texture decode", [this] () {
+        m_texture_manager->get_assets()->decode();
+      }, { renderers_after }, false );
+    }
 
-    for( int type = rBASIC; type < rCOUNT; ++type ) {
-      if( m_renderers[type] != nullptr )
-        m_renderers[type]->prepare();
+    int32_t renderers = m_startup->add( "renderers", [this] () {
+      for( int type = rBASIC; type < rCOUNT; ++type ) {
+        if( m_renderers[type] != nullptr )
+          m_renderers[type]->prepare();
+      }
+    }, { renderers_after }, true );
+
+    int32_t sound_after = renderers;
+    if( textures ) {
+      sound_after = m_startup->add( "file textures", [this] () {
+        m_texture_manager->create_file_textures();
+      }, { renderers, decode }, true );
     }
 
-    m_sound = std::make_shared<Sound>();
-    if( k_engine_settings->get_settings().play_sound )
-      m_sound->play_sound( k_engine_settings->get_settings().sound_file );
+    m_startup->add( "sound", [this] () {
+      m_sound = std::make_shared<Sound>();
+      if( k_engine_settings->get_settings().play_sound )
+        m_sound->play_sound( k_engine_settings->get_settings().sound_file );
+    }, { sound_after }, true );
+
+    m_startup->run();
 
   }
 
@@ -108,13 +157,21 @@ namespace kretash {
     k_engine_settings->start_frame();
     m_interface->new_frame();
 
+    // input and camera don't touch GPU memory, they run while the last frame finishes
+    m_input->update();//0.2-0.6
+    m_camera->update();
+
+    // There is one set of constant and instance buffers, texture descriptors and render
+    // command list, so only one frame is in flight: the frame submitted last has to retire
+    // before any of them or the host memory pool is touched
+    m_context->wait_for_frame( m_frame - 1 );
+
     if( m_renderers[rTEXTURE] != nullptr ){
       m_texture_manager->update();
     }
 
     m_gpu_pool->update();
-    m_input->update();//0.2-0.6
-    m_camera->update();
+
     m_world->update();
 
     if( m_input->get_key( key::k_SPACE ) ) {
@@ -156,13 +213,18 @@ namespace kretash {
 
   void Engine::render( Renderer* r ) {
 
-    if( r->get_render_bin_size() == 0 ) return;
+    if( r->get_draw_range_count() != 0 ) {
+      m_context->update_indirect_command_buffer( r->get_renderer(),
+        r->get_draw_ranges(), r->get_draw_range_count() );
 
-    m_context->update_indirect_command_buffer( r->get_renderer(),
-      &( *r->get_render_bin() )[0], r->get_render_bin_size() );
+      m_context->record_indirect_commands( r->get_renderer(), m_window.get(),
+        r->get_draw_ranges(), r->get_draw_range_count() );
+    }
 
-    m_context->record_indirect_commands( r->get_renderer(), m_window.get(),
-      &( *r->get_render_bin() )[0], r->get_render_bin_size() );
+    if( r->get_instance_batch_count() != 0 ) {
+      m_context->record_instanced_commands( r->get_renderer(), m_window.get(),
+        r->get_instance_batches(), r->get_instance_batch_count() );
+    }
 
   }
 
@@ -177,7 +239,9 @@ namespace kretash {
 
     m_context->execute_render_command_list();
     m_context->present_swap_chain();
-    m_context->wait_render_completition();
+    m_context->signal_frame( m_frame );
+    if( m_frame == 1 ) m_startup->finish();
+    ++m_frame;
 
     k_engine_settings->end_frame();
 
@@ -197,7 +261,9 @@ namespace kretash {
     m_is_running = false;
   }
 
+  // buildings are created on the startup workers, their generators save themselves from there
   void Engine::save_geometry( Geometry* g ) {
+    std::lock_guard<std::mutex> lock( m_geometries_lock );
     m_geometries.push_back( g );
   }
 
@@ -210,8 +276,12 @@ namespace kretash {
     m_context->execute_render_command_list();
     m_context->wait_render_completition();
 
+    if( m_city != nullptr )  m_city->pause();
+    m_swap_cache->begin_swap();
+
     m_gpu_pool = nullptr;
     m_factory->reload();
+    m_frame = 1;
 
     m_window->init();
 
@@ -290,6 +360,10 @@ namespace kretash {
   Interface*      Engine::get_interface() { return m_interface.get(); }
   CityGenerator*  Engine::get_city() { return m_city; }
 
+  uint64_t Engine::get_completed_frame() {
+    return m_context->get_completed_frame();
+  }
+
   void Engine::set_renderer( Renderer* r ) {
     assert( m_renderers[r->get_renderer_type()] == nullptr && "ONLY ONE RENDERER TYPE ALLOWED" );
     m_renderers[r->get_renderer_type()] = r;
@@ -304,13 +378,11 @@ namespace kretash {
   }
 
   int32_t Engine::new_id() {
-    int32_t  id = m_drawable_id_count;
-    m_drawable_id_count++;
-    return id;
+    return m_drawable_id_count++;
   }
 
   int32_t Engine::get_total_drawables() {
-    return m_drawable_id_count;
+    return m_drawable_id_count.load();
   }
 
   Engine::~Engine() {
@@ -58,6 +58,16 @@ namespace kretash {
     m_engine_settings.msaa_enabled = doc["MSAA_enabled"].GetBool();
     m_engine_settings.msaa_count = doc["MSAA_count"].GetInt();
     m_engine_settings.upscale_render = doc["upscale_render"].GetDouble();
+    if( doc.HasMember( "packed_vertices" ) )
+      m_engine_settings.packed_vertices = doc["packed_vertices"].GetBool();
+    if( doc.HasMember( "short_indices" ) )
+      m_engine_settings.short_indices = doc["short_indices"].GetBool();
+    if( doc.HasMember( "lod_pixel_error" ) )
+      m_engine_settings.lod_pixel_error = ( float ) doc["lod_pixel_error"].GetDouble();
+    if( doc.HasMember( "hlod_distance" ) )
+      m_engine_settings.hlod_distance = ( float ) doc["hlod_distance"].GetDouble();
+    if( doc.HasMember( "swap_cache_size" ) )
+      m_engine_settings.swap_cache_size = doc["swap_cache_size"].GetInt();
 
   }
 
@@ -122,6 +132,16 @@ namespace kretash {
     doc["MSAA_enabled"].SetBool( m_engine_settings.msaa_enabled );
     doc["MSAA_count"].SetInt( m_engine_settings.msaa_count );
     doc["upscale_render"].SetDouble( m_engine_settings.upscale_render );
+    if( doc.HasMember( "packed_vertices" ) )
+      doc["packed_vertices"].SetBool( m_engine_settings.packed_vertices );
+    if( doc.HasMember( "short_indices" ) )
+      doc["short_indices"].SetBool( m_engine_settings.short_indices );
+    if( doc.HasMember( "lod_pixel_error" ) )
+      doc["lod_pixel_error"].SetDouble( m_engine_settings.lod_pixel_error );
+    if( doc.HasMember( "hlod_distance" ) )
+      doc["hlod_distance"].SetDouble( m_engine_settings.hlod_distance );
+    if( doc.HasMember( "swap_cache_size" ) )
+      doc["swap_cache_size"].SetInt( m_engine_settings.swap_cache_size );
 
     rapidjson::StringBuffer buffer;
     rapidjson::Writer<rapidjson::StringBuffer> writer( buffer );
@@ -43,6 +43,7 @@ namespace kretash {
   }
 
   void Factory::make_drawable( std::shared_ptr<xxDrawable>* d ) {
+    std::lock_guard<std::mutex> lock( m_lock );
     if( m_api == kVulkan ) {
       ( *d ) = std::make_shared<vkDrawable>();
       m_drawables.push_back( d );
@@ -53,6 +54,7 @@ namespace kretash {
   }
 
   void Factory::make_descriptor_buffer( std::shared_ptr<xxDescriptorBuffer>* db ) {
+    std::lock_guard<std::mutex> lock( m_lock );
     if( m_api == kVulkan ) {
       ( *db ) = std::make_shared<vkDescriptorBuffer>();
       m_descriptors.push_back( db );
@@ -63,6 +65,7 @@ namespace kretash {
   }
 
   void Factory::make_texture( std::shared_ptr<xxTexture>* t ) {
+    std::lock_guard<std::mutex> lock( m_lock );
     if( m_api == kVulkan ) {
       ( *t ) = std::make_shared<vkTexture>();
       m_textures.push_back( t );
@@ -73,6 +76,7 @@ namespace kretash {
   }
 
   void Factory::make_geometry( std::shared_ptr<xxGeometry>* g ) {
+    std::lock_guard<std::mutex> lock( m_lock );
     if( m_api == kVulkan ) {
       ( *g ) = std::make_shared<vkGeometry>();
       m_geometries.push_back( g );
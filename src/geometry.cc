@@ -1,4 +1,5 @@
 #include <cassert>
+#include <cfloat>
 
 #include "tinyobj/tiny_obj_loader.h"
 #include "core/engine_settings.hh"
@@ -6,6 +7,15 @@
 #include "core/GPU_pool.hh"
 #include "core/engine.hh"
 #include "core/window.hh"
+#include "core/tools.hh"
+#include "core/xx/context.hh"
+#include "core/tangent_kernel.hh"
+#include "core/mesh_optimizer.hh"
+#include "core/mesh_cache.hh"
+
+// FIFO size the triangle order is tuned for, and the ACMR the overdraw sort may cost
+#define VERTEX_CACHE_SIZE 16
+#define OVERDRAW_THRESHOLD 1.05f
 
 namespace kretash {
 
@@ -13,20 +23,67 @@ namespace kretash {
     m_indicies_count( 0 ),
     m_indicies_offset( 0 ),
     m_vertex_offset( 0 ),
-    m_filename() {
+    m_cluster_offset( 0 ),
+    m_cluster_count( 0 ),
+    m_bounds_min( 0.0f, 0.0f, 0.0f ),
+    m_bounds_scale( 1.0f, 1.0f, 1.0f ),
+    m_sphere_center( 0.0f, 0.0f, 0.0f ),
+    m_sphere_radius( 0.0f ),
+    m_lod_error( 0.0f ),
+    m_filename(),
+    m_tile( 1 ),
+    m_tile_spacing( 0.0f ) {
     k_engine->save_geometry( this );
   }
 
   Geometry::Geometry( const Geometry* c ) :
     m_indicies_count( c->m_indicies_count ),
     m_indicies_offset( c->m_indicies_offset ),
-    m_vertex_offset( c->m_vertex_offset ) {
+    m_vertex_offset( c->m_vertex_offset ),
+    m_cluster_offset( c->m_cluster_offset ),
+    m_cluster_count( c->m_cluster_count ),
+    m_bounds_min( c->m_bounds_min ),
+    m_bounds_scale( c->m_bounds_scale ),
+    m_sphere_center( c->m_sphere_center ),
+    m_sphere_radius( c->m_sphere_radius ),
+    m_lod_error( c->m_lod_error ),
+    m_tile( 1 ),
+    m_tile_spacing( 0.0f ) {
   }
 
-  void Geometry::load( std::string filename ) {
+  // The OBJ is only parsed when its binary cache is missing or stale, the parse writes the cache
+  // for the next run. Geometry::reload goes through here too, so an API swap maps the cache.
+  void Geometry::load( std::string filename, int32_t tile, float spacing ) {
 
     m_filename = filename;
+    m_tile = tile;
+    m_tile_spacing = spacing;
     std::string filename_ = OPATH + filename;
+    std::string cache_path = mesh_cache::get_cache_path( filename_ );
+
+    MeshCacheView cache;
+    if( cache.open( cache_path, filename_ ) ) {
+      const mesh_cache_header* h = cache.get_header();
+      _upload_mesh( cache.get_vertices(), h->vertex_count, cache.get_indices(), h->index_count, tile, spacing, h );
+      return;
+    }
+
+    std::vector<float> vertices;
+    std::vector<uint32_t> indices;
+    _parse_obj( filename_, &vertices, &indices );
+
+    const uint32_t vertex_count = ( uint32_t ) vertices.size() / VERTEX_STRIDE;
+    _fit_bounds( vertices.data(), nullptr, vertex_count );
+    if( !mesh_cache::write( cache_path, filename_, vertices.data(), vertex_count, indices.data(),
+      ( uint32_t ) indices.size(), m_bounds_min, m_bounds_scale, m_sphere_center, m_sphere_radius ) ) {
+      std::cout << "couldn't write the mesh cache " << cache_path << std::endl;
+    }
+
+    _upload_mesh( vertices.data(), vertex_count, indices.data(), ( uint32_t ) indices.size(), tile, spacing, nullptr );
+  }
+
+  // Parses the OBJ, orders its triangles and de-indexes it into 14 float vertices with tangents
+  void Geometry::_parse_obj( std::string filename_, std::vector<float>* vertices, std::vector<uint32_t>* elements ) {
 
     std::vector<tinyobj::shape_t> shapes;
     std::vector<tinyobj::material_t> materials;
@@ -47,119 +104,211 @@ namespace kretash {
 
     assert( shapes.size() == 1 && "NO NEED FOR MORE" );
 
-    std::vector<float3> n_vertices;
-    std::vector<float3> n_normals;
-    std::vector<float2> n_uvs;
-    std::vector<float3> n_tangent;
-    std::vector<float3> n_bitangent;
-    std::vector<unsigned int> n_elem;
-
-    for( int e = 0; e < shapes[0].mesh.indices.size(); ++e ) {
-
-      unsigned int v_i = shapes[0].mesh.indices[e] * 3;
-      unsigned int uv_i = shapes[0].mesh.indices[e] * 2;
-
-      n_vertices.push_back(
-        float3( shapes[0].mesh.positions[v_i], shapes[0].mesh.positions[v_i + 1], shapes[0].mesh.positions[v_i + 2] ) );
-      n_normals.push_back(
-        float3( shapes[0].mesh.normals[v_i], shapes[0].mesh.normals[v_i + 1], shapes[0].mesh.normals[v_i + 2] ) );
-
+    const std::vector<float>& positions = shapes[0].mesh.positions;
+    const std::vector<float>& normals = shapes[0].mesh.normals;
+    const std::vector<float>& texcoords = shapes[0].mesh.texcoords;
+    const uint32_t position_count = ( uint32_t ) positions.size() / 3;
+
+    // The OBJ indices share vertices, so the triangles are ordered on them. The corners
+    // are de-indexed below in that order, which keeps the overdraw part of the ordering.
+    optimize_scratch optimize;
+    std::vector<uint32_t> indices( shapes[0].mesh.indices.begin(), shapes[0].mesh.indices.end() );
+    mesh_optimizer::optimize_vertex_cache( indices.data(), ( uint32_t ) indices.size(), position_count,
+      VERTEX_CACHE_SIZE, &optimize );
+    mesh_optimizer::optimize_overdraw( indices.data(), ( uint32_t ) indices.size(), position_count,
+      positions.data(), 3, nullptr, VERTEX_CACHE_SIZE, OVERDRAW_THRESHOLD, &optimize );
+
+    // De-indexed, one vertex per element
+    const uint32_t corner_count = ( uint32_t ) indices.size();
+    vertices->resize( corner_count * VERTEX_STRIDE );
+    elements->resize( corner_count );
+
+    tangent_streams ts;
+    ts.set_positions( positions.data(), 3 );
+    ts.set_normals( normals.data(), 3 );
+    ts.set_uvs( texcoords.data(), 2 );
+    ts.elems = indices.data();
+    ts.elem_count = corner_count;
+    tangent_kernel::compute( ts, vertices->data() );
+
+    for( uint32_t e = 0; e < corner_count; ++e )
+      ( *elements )[e] = e;
+  }
 
-      n_uvs.push_back( float2( shapes[0].mesh.texcoords[uv_i], shapes[0].mesh.texcoords[uv_i + 1] ) );
+  // Copies the mesh into the staging memory, tiled if asked to. An untiled cache that's already
+  // in the context's layout goes in with two copies, everything else gets encoded.
+  void Geometry::_upload_mesh( const float* vertices, uint32_t vertex_count, const uint32_t* indices,
+    uint32_t index_count, int32_t tile, float spacing, const mesh_cache_header* cache ) {
+
+    const uint32_t stride = VERTEX_STRIDE;
+    const uint32_t copies = tile * tile;
+    const uint32_t tiled_vertices = vertex_count * copies;
+    m_indicies_count = index_count * copies;
+
+    assert( ( k_engine->get_context()->get_index_size() == sizeof( uint32_t ) ||
+      tiled_vertices <= MAX_SHORT_INDEX_VERTICES ) && "MESH TOO BIG FOR SHORT INDICES" );
+
+    std::shared_ptr<UploadHandle> upload = k_engine->get_GPU_pool()->reserve_staging(
+      tiled_vertices * k_engine->get_context()->get_stride(), m_indicies_count );
+    staging_block& sb = upload->get_staging();
+
+    bool raw = cache != nullptr && tile == 1 && k_engine->get_context()->get_stride() == stride &&
+      k_engine->get_context()->get_index_size() == sizeof( uint32_t );
+
+    if( raw ) {
+      memcpy( sb.v_data, vertices, vertex_count * stride * sizeof( float ) );
+      memcpy( sb.i_data, indices, index_count * sizeof( uint32_t ) );
+      m_bounds_min = cache->bounds_min;
+      m_bounds_scale = cache->bounds_scale;
+      m_sphere_center = cache->sphere_center;
+      m_sphere_radius = cache->sphere_radius;
+
+    } else {
+
+      // every copy after the first is the first one moved, each keeps the optimized order
+      std::vector<float> tiled( vertices, vertices + vertex_count * stride );
+      std::vector<uint32_t> elements( indices, indices + index_count );
+      tiled.resize( tiled_vertices * stride );
+      elements.resize( m_indicies_count );
+
+      float first = -0.5f * spacing * ( float ) ( tile - 1 );
+      for( uint32_t c = 1; c < copies; ++c ) {
+        float* copy = &tiled[c * vertex_count * stride];
+        memcpy( copy, tiled.data(), vertex_count * stride * sizeof( float ) );
+        for( uint32_t v = 0; v < vertex_count; ++v ) {
+          copy[v * stride + 0] += first + spacing * ( float ) ( c % tile );
+          copy[v * stride + 2] += first + spacing * ( float ) ( c / tile );
+        }
+        for( uint32_t e = 0; e < index_count; ++e )
+          elements[c * index_count + e] = indices[e] + c * vertex_count;
+      }
+      if( tile > 1 ) {
+        for( uint32_t v = 0; v < vertex_count; ++v ) {
+          tiled[v * stride + 0] += first;
+          tiled[v * stride + 2] += first;
+        }
+      }
 
-      n_elem.push_back( e );
+      _encode_vertices( tiled.data(), nullptr, tiled_vertices, sb.v_data );
+      _encode_indices( elements.data(), m_indicies_count, sb.i_data );
     }
 
-    for( int e = 0; e < n_elem.size(); e += 3 ) {
-
-      float3& v1 = n_vertices[e];
-      float3& v2 = n_vertices[e + 1];
-      float3& v3 = n_vertices[e + 2];
-
-      float2& uv1 = n_uvs[e];
-      float2& uv2 = n_uvs[e + 1];
-      float2& uv3 = n_uvs[e + 2];
-
-      float3 delta_pos1 = v2 - v1;
-      float3 delta_pos2 = v3 - v1;
+    //GPU pool gives the staging memory back after the upload
+    k_engine->get_GPU_pool()->queue_geometry( static_cast< Geometry* >( this ), upload );
+  }
 
-      float2 delta_uv1 = uv2 - uv1;
-      float2 delta_uv2 = uv3 - uv1;
+  // Takes 14 float vertices, picked by ids when there are ids, and writes them in the
+  // layout the context expects. The bounds are kept so the shaders can undo the quantization.
+  void Geometry::_encode_vertices( const float* vertices, const uint32_t* ids, uint32_t count, float* out ) {
 
-      float r = 1.0f / ( delta_uv1.x * delta_uv2.y - delta_uv1.y * delta_uv2.x );
-      float3 tangent = ( delta_pos1 * delta_uv2.y - delta_pos2 * delta_uv1.y )*r;
-      float3 bitangent = ( delta_pos2 * delta_uv1.x - delta_pos1 * delta_uv2.x )*r;
+    const uint32_t stride = VERTEX_STRIDE;
+    const uint32_t out_stride = k_engine->get_context()->get_stride();
 
-      //Tangent
-      n_tangent.push_back( tangent );
-      n_tangent.push_back( tangent );
-      n_tangent.push_back( tangent );
+    _fit_bounds( vertices, ids, count );
 
-      //Bitangent
-      n_bitangent.push_back( bitangent );
-      n_bitangent.push_back( bitangent );
-      n_bitangent.push_back( bitangent );
+    for( uint32_t i = 0; i < count; ++i ) {
+      const float* v = vertices + ( ids ? ids[i] : i ) * stride;
 
+      if( out_stride == stride )
+        memcpy( out + i * out_stride, v, stride * sizeof( float ) );
+      else
+        tools::pack_vertex( v, m_bounds_min, m_bounds_scale, reinterpret_cast< uint32_t* >( out + i * out_stride ) );
     }
+  }
 
-    for( int e = 0; e < n_tangent.size(); ++e ) {
-      float3& t = n_tangent[e];
-      float3& b = n_bitangent[e];
-      float3& n = n_normals[e];
+  void Geometry::_fit_bounds( const float* vertices, const uint32_t* ids, uint32_t count ) {
 
-      t = t - n * float3::dot( n, t );
+    const uint32_t stride = VERTEX_STRIDE;
+    float3 min = float3( FLT_MAX, FLT_MAX, FLT_MAX );
+    float3 max = float3( -FLT_MAX, -FLT_MAX, -FLT_MAX );
 
-      if( float3::dot( float3::cross( n, t ), b ) < 0.0f )
-        t = t * -1.0f;
+    for( uint32_t i = 0; i < count; ++i ) {
+      const float* v = vertices + ( ids ? ids[i] : i ) * stride;
+      min = float3( fminf( min.x, v[0] ), fminf( min.y, v[1] ), fminf( min.z, v[2] ) );
+      max = float3( fmaxf( max.x, v[0] ), fmaxf( max.y, v[1] ), fmaxf( max.z, v[2] ) );
     }
 
-    m_indicies_count = ( uint32_t ) n_elem.size();
-    int stride = 14;
-    uint32_t array_lenght = ( uint32_t ) ( n_vertices.size() * stride );
-    float* array_data = new float[array_lenght];
-
-    int count = 0;
-    for( int i = 0; i < n_vertices.size(); ++i ) {
-      array_data[count++] = n_vertices[i].x;
-      array_data[count++] = n_vertices[i].y;
-      array_data[count++] = n_vertices[i].z;
-
-      array_data[count++] = n_normals[i].x;
-      array_data[count++] = n_normals[i].y;
-      array_data[count++] = n_normals[i].z;
+    if( count == 0 ) {
+      min = float3( 0.0f, 0.0f, 0.0f );
+      max = float3( 0.0f, 0.0f, 0.0f );
+    }
 
-      array_data[count++] = n_uvs[i].x;
-      array_data[count++] = n_uvs[i].y;
+    m_bounds_min = min;
+    m_bounds_scale = max - min;
+    _fit_sphere( vertices, ids, count );
+  }
 
-      array_data[count++] = n_tangent[i].x;
-      array_data[count++] = n_tangent[i].y;
-      array_data[count++] = n_tangent[i].z;
+  // Ritter's sphere grown from the most separated pair of axis extremes, the sphere around
+  // the box is kept instead when that one is smaller
+  void Geometry::_fit_sphere( const float* vertices, const uint32_t* ids, uint32_t count ) {
+
+    const uint32_t stride = VERTEX_STRIDE;
+    float3 box_center = m_bounds_min + m_bounds_scale * 0.5f;
+    float box_radius = float3::lenght( m_bounds_scale ) * 0.5f;
+
+    m_sphere_center = box_center;
+    m_sphere_radius = box_radius;
+    if( count == 0 ) return;
+
+    uint32_t lo[3] = { 0, 0, 0 };
+    uint32_t hi[3] = { 0, 0, 0 };
+    for( uint32_t i = 0; i < count; ++i ) {
+      const float* v = vertices + ( ids ? ids[i] : i ) * stride;
+      for( uint32_t a = 0; a < 3; ++a ) {
+        if( v[a] < vertices[( ids ? ids[lo[a]] : lo[a] ) * stride + a] ) lo[a] = i;
+        if( v[a] > vertices[( ids ? ids[hi[a]] : hi[a] ) * stride + a] ) hi[a] = i;
+      }
+    }
 
-      array_data[count++] = n_bitangent[i].x;
-      array_data[count++] = n_bitangent[i].y;
-      array_data[count++] = n_bitangent[i].z;
+    float3 center = float3( 0.0f, 0.0f, 0.0f );
+    float radius = -1.0f;
+    for( uint32_t a = 0; a < 3; ++a ) {
+      const float* l = vertices + ( ids ? ids[lo[a]] : lo[a] ) * stride;
+      const float* h = vertices + ( ids ? ids[hi[a]] : hi[a] ) * stride;
+      float3 pl = float3( l[0], l[1], l[2] );
+      float3 ph = float3( h[0], h[1], h[2] );
+      float r = float3::lenght( ph - pl ) * 0.5f;
+      if( r > radius ) {
+        radius = r;
+        center = ( pl + ph ) * 0.5f;
+      }
+    }
 
+    for( uint32_t i = 0; i < count; ++i ) {
+      const float* v = vertices + ( ids ? ids[i] : i ) * stride;
+      float3 p = float3( v[0], v[1], v[2] );
+      float d = float3::lenght( p - center );
+      if( d > radius ) {
+        float grown = ( radius + d ) * 0.5f;
+        center = center + ( p - center ) * ( ( grown - radius ) / d );
+        radius = grown;
+      }
     }
 
-    // Indicies Buffer
-    uint32_t* elements_data = new uint32_t[m_indicies_count];
-    for( uint32_t e = 0; e < n_elem.size(); ++e )
-      elements_data[e] = n_elem[e];
+    if( radius < box_radius ) {
+      m_sphere_center = center;
+      m_sphere_radius = radius;
+    }
+  }
 
+  // Indices are local to the vertex block, so with short indices they just get narrowed
+  void Geometry::_encode_indices( const uint32_t* indices, uint32_t count, uint32_t* out ) {
 
-    k_engine->get_GPU_pool()->queue_geometry( static_cast< Geometry* >( this ),
-      array_data, array_lenght, elements_data, m_indicies_count );
+    if( k_engine->get_context()->get_index_size() == sizeof( uint32_t ) ) {
+      memcpy( out, indices, count * sizeof( uint32_t ) );
+      return;
+    }
 
-    //GPU pool responsible for deleting this
-    //delete[] array_data;
-    //delete[] elements_data;
+    uint16_t* short_out = reinterpret_cast< uint16_t* >( out );
+    for( uint32_t i = 0; i < count; ++i )
+      short_out[i] = static_cast< uint16_t >( indices[i] );
   }
 
   void Geometry::reload() {
 
     //if empty this is a procedural geometry
     if( m_filename.size() != 0 )
-      load( m_filename );
+      load( m_filename, m_tile, m_tile_spacing );
 
   }
 
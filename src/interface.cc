@@ -6,11 +6,16 @@
 #include "core/input.hh"
 #include "core/renderer.hh"
 #include "core/xx/renderer.hh"
+#include "core/xx/context.hh"
 #include "core/engine_settings.hh"
 #include "core/texture_manager.hh"
+#include "core/asset_registry.hh"
 #include "core/city_generetaor.hh"
 #include "core/world.hh"
 #include "core/tools.hh"
+#include "core/GPU_pool.hh"
+#include "core/startup_graph.hh"
+#include "core/swap_cache.hh"
 #include <fstream>
 #include <iostream>
 
@@ -175,6 +180,15 @@ namespace kretash {
       ImGui::Text( "Update Time: %.3f", update_t );
       ImGui::Text( "Render Time: %.3f", render_t );
       ImGui::Separator();
+
+      CityGenerator* city = k_engine->get_city();
+      TextureManager* tm = k_engine->get_texture_manager();
+      float mb = 1024.0f * 1024.0f;
+      if( city != nullptr ) ImGui::Text( "Mesh Queue : %.1f MB", ( float ) city->get_upload_queue_bytes() / mb );
+      if( tm != nullptr )   ImGui::Text( "Tex  Queue : %.1f MB", ( float ) tm->get_generated_texture_bytes() / mb );
+      if( tm != nullptr )   ImGui::Text( "Tex  Files : %u for %u uses", tm->get_assets()->get_asset_count(),
+        tm->get_assets()->get_use_count() );
+      ImGui::Separator();
       ImGui::Text( "Space Bar -> show the menu. " );
       ImGui::End();
 
@@ -264,7 +278,7 @@ namespace kretash {
     if( ImGui::CollapsingHeader( "Texture" ) ) {
       ImGui::Checkbox( "Debug Textures", &( k_engine_settings->get_psettings()->debug_textures ) );
       if( ImGui::Button( "Reload Textures" ) ) {
-        k_engine->get_texture_manager()->regenerate();
+        k_engine->get_texture_manager()->regenerate( false );
       }
 
     }
@@ -317,6 +331,81 @@ namespace kretash {
     ImGui::PlotHistogram( "Render Time", m_render_times.data(), ( int ) m_render_times.size(), 0, nullptr,
       0.0f, 60.0f, ImVec2( 0, 80 ) );
 
+    StartupGraph* startup = k_engine->get_startup();
+    if( startup->get_first_frame_time() >= 0.0 ) {
+      ImGui::Separator();
+      ImGui::Text( "Startup, %.0f ms to the first frame", startup->get_first_frame_time() );
+      for( uint32_t i = 0; i < startup->get_stage_count(); ++i ) {
+        const startup_stage* s = startup->get_stage( i );
+        ImGui::Text( "%-20s %6.0f -> %6.0f T%d", s->name.c_str(), s->start, s->end, s->thread );
+      }
+    }
+
+    SwapCache* swap_cache = k_engine->get_swap_cache();
+    ImGui::Separator();
+    ImGui::Text( "Swap cache %.0f / %.0f MB, last swap reused %u meshes and %u textures",
+      ( float ) swap_cache->get_size() / ( 1024.0f * 1024.0f ), ( float ) swap_cache->get_budget() / ( 1024.0f * 1024.0f ),
+      swap_cache->get_restored_meshes(), swap_cache->get_restored_textures() );
+
+    CityGenerator* city = k_engine->get_city();
+    if( city != nullptr ) {
+      ImGui::Separator();
+      ImGui::Text( "Building vertex memory after welding and packing" );
+      float stride = ( float ) k_engine->get_context()->get_stride();
+      for( int32_t i = 0; i < 3; ++i ) {
+        float unwelded = ( float ) city->get_unwelded_vertices( i ) * VERTEX_STRIDE * sizeof( float );
+        float welded = ( float ) city->get_welded_vertices( i ) * stride * sizeof( float );
+        float saved = unwelded > 0.0f ? 100.0f * ( 1.0f - welded / unwelded ) : 0.0f;
+        ImGui::Text( "LOD%d: %.1f MB -> %.1f MB (-%.0f%%)", i,
+          unwelded / ( 1024.0f * 1024.0f ), welded / ( 1024.0f * 1024.0f ), saved );
+      }
+
+      ImGui::Text( "Buildings with each LOD on the GPU, out of %u", city->get_building_count() );
+      ImGui::Text( "LOD0 %u, LOD1 %u, LOD2 %u", city->get_resident_buildings( 0 ),
+        city->get_resident_buildings( 1 ), city->get_resident_buildings( 2 ) );
+
+      uint32_t tiles_ready, tiles_used;
+      city->get_hlod_tiles( &tiles_ready, &tiles_used );
+      ImGui::Text( "HLOD tiles merged %u / %u", tiles_ready, tiles_used );
+
+      ImGui::Text( "Building triangles after removing buried faces" );
+      for( int32_t i = 0; i < 3; ++i ) {
+        float generated = ( float ) city->get_generated_triangles( i );
+        float hidden = ( float ) city->get_hidden_triangles( i );
+        float saved = generated > 0.0f ? 100.0f * hidden / generated : 0.0f;
+        ImGui::Text( "LOD%d: %.0fk -> %.0fk (-%.0f%%)", i,
+          generated / 1000.0f, ( generated - hidden ) / 1000.0f, saved );
+      }
+
+      ImGui::Text( "Building vertex cache after reordering (FIFO 16)" );
+      for( int32_t i = 0; i < 3; ++i ) {
+        float triangles = ( float ) ( city->get_generated_triangles( i ) - city->get_hidden_triangles( i ) );
+        float vertices = ( float ) city->get_welded_vertices( i );
+        float unoptimized = ( float ) city->get_unoptimized_cache_misses( i );
+        float optimized = ( float ) city->get_optimized_cache_misses( i );
+        if( triangles <= 0.0f || vertices <= 0.0f ) continue;
+        ImGui::Text( "LOD%d: ACMR %.2f -> %.2f, ATVR %.2f -> %.2f", i,
+          unoptimized / triangles, optimized / triangles, unoptimized / vertices, optimized / vertices );
+      }
+
+      uint64_t spacer_buildings = city->get_spacer_buildings();
+      if( spacer_buildings > 0 ) {
+        ImGui::Text( "Instanced spacers save %.1f KB of LOD0 vertices per building",
+          city->get_spacer_saved_bytes() / ( 1024.0f * spacer_buildings ) );
+      }
+
+      Renderer* r = k_engine->get_renderer( rTEXTURE );
+      ImGui::Text( "Clusters drawn %u / %u in %u draws", r->get_visible_clusters(),
+        r->get_total_clusters(), r->get_draw_range_count() );
+      ImGui::Text( "Instanced %u in %u draws", r->get_instance_count(), r->get_instance_batch_count() );
+
+      uint32_t geometries, allocations;
+      uint64_t saved_bytes;
+      k_engine->get_GPU_pool()->get_shared_stats( &geometries, &allocations, &saved_bytes );
+      ImGui::Text( "Shared meshes %u geometries in %u allocations (%.2fx, -%.1f MB)", geometries, allocations,
+        allocations > 0 ? ( float ) geometries / ( float ) allocations : 1.0f, saved_bytes / ( 1024.0f * 1024.0f ) );
+    }
+
     ImGui::End();
   }
 
@@ -83,6 +83,7 @@ int main( int argc, char **argv ) {
       std::shared_ptr<Drawable> tea = std::make_shared<Drawable>();
       tea->init( teapot.get() );
       tea->set_ignore_frustum();
+      tea->set_instanced( true );
       tea->get_texture()->load( tDIFFUSE, "stone_d.png" );
       tea->get_texture()->load( tNORMAL, "stone_n.png" );
       tea->get_texture()->load( tSPECULAR, "stone_s.png" );
@@ -0,0 +1,144 @@
+#include <windows.h>
+#include "core/mesh_cache.hh"
+#include "core/xx/context.hh"
+#include <fstream>
+#include <cassert>
+
+// "KMSH" read as a little endian dword
+#define MESH_CACHE_MAGIC 0x48534d4b
+
+namespace kretash {
+
+  // Size and last write time of a file, false if it isn't there
+  static bool _source_stamp( std::string path, uint64_t* size, uint64_t* time ) {
+    WIN32_FILE_ATTRIBUTE_DATA data;
+    if( GetFileAttributesExA( path.c_str(), GetFileExInfoStandard, &data ) == FALSE )
+      return false;
+
+    *size = ( static_cast< uint64_t >( data.nFileSizeHigh ) << 32 ) | data.nFileSizeLow;
+    *time = ( static_cast< uint64_t >( data.ftLastWriteTime.dwHighDateTime ) << 32 ) | data.ftLastWriteTime.dwLowDateTime;
+    return true;
+  }
+
+  MeshCacheView::MeshCacheView() :
+    m_file( INVALID_HANDLE_VALUE ),
+    m_mapping( nullptr ),
+    m_data( nullptr ),
+    m_size( 0 ) {
+  }
+
+  bool MeshCacheView::open( std::string cache_path, std::string source_path ) {
+    _close();
+
+    uint64_t source_size, source_time;
+    if( !_source_stamp( source_path, &source_size, &source_time ) )
+      return false;
+
+    m_file = CreateFileA( cache_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+      FILE_ATTRIBUTE_NORMAL | FILE_FLAG_SEQUENTIAL_SCAN, nullptr );
+    if( m_file == INVALID_HANDLE_VALUE )
+      return false;
+
+    LARGE_INTEGER size;
+    if( GetFileSizeEx( m_file, &size ) == FALSE || size.QuadPart < ( LONGLONG ) sizeof( mesh_cache_header ) ) {
+      _close();
+      return false;
+    }
+    m_size = static_cast< uint64_t >( size.QuadPart );
+
+    m_mapping = CreateFileMappingA( m_file, nullptr, PAGE_READONLY, 0, 0, nullptr );
+    if( m_mapping != nullptr )
+      m_data = reinterpret_cast< const uint8_t* >( MapViewOfFile( m_mapping, FILE_MAP_READ, 0, 0, 0 ) );
+    if( m_data == nullptr ) {
+      _close();
+      return false;
+    }
+
+    const mesh_cache_header* h = get_header();
+    uint64_t expected = sizeof( mesh_cache_header ) +
+      static_cast< uint64_t >( h->vertex_count ) * h->vertex_stride * sizeof( float ) +
+      static_cast< uint64_t >( h->index_count ) * sizeof( uint32_t );
+
+    bool valid = h->magic == MESH_CACHE_MAGIC && h->version == MESH_CACHE_VERSION &&
+      h->vertex_stride == VERTEX_STRIDE && h->index_count != 0 && m_size == expected &&
+      h->source_size == source_size && h->source_time == source_time;
+
+    if( !valid ) _close();
+    return valid;
+  }
+
+  const uint32_t* MeshCacheView::get_indices() {
+    const mesh_cache_header* h = get_header();
+    return reinterpret_cast< const uint32_t* >( m_data + sizeof( mesh_cache_header ) +
+      static_cast< uint64_t >( h->vertex_count ) * h->vertex_stride * sizeof( float ) );
+  }
+
+  void MeshCacheView::_close() {
+    if( m_data != nullptr ) UnmapViewOfFile( m_data );
+    if( m_mapping != nullptr ) CloseHandle( m_mapping );
+    if( m_file != INVALID_HANDLE_VALUE ) CloseHandle( m_file );
+
+    m_file = INVALID_HANDLE_VALUE;
+    m_mapping = nullptr;
+    m_data = nullptr;
+    m_size = 0;
+  }
+
+  MeshCacheView::~MeshCacheView() {
+    _close();
+  }
+
+  namespace mesh_cache {
+
+    std::string get_cache_path( std::string source_path ) {
+      std::size_t dot = source_path.find_last_of( '.' );
+      std::size_t slash = source_path.find_last_of( "/\\" );
+      if( dot == std::string::npos || ( slash != std::string::npos && dot < slash ) )
+        return source_path + MESH_CACHE_EXTENSION;
+
+      return source_path.substr( 0, dot ) + MESH_CACHE_EXTENSION;
+    }
+
+    bool write( std::string cache_path, std::string source_path, const float* vertices,
+      uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+      float3 bounds_min, float3 bounds_scale, float3 sphere_center, float sphere_radius ) {
+
+      mesh_cache_header h = {};
+      h.magic = MESH_CACHE_MAGIC;
+      h.version = MESH_CACHE_VERSION;
+      h.vertex_stride = VERTEX_STRIDE;
+      h.vertex_count = vertex_count;
+      h.index_count = index_count;
+      h.bounds_min = bounds_min;
+      h.bounds_scale = bounds_scale;
+      h.sphere_center = sphere_center;
+      h.sphere_radius = sphere_radius;
+      if( !_source_stamp( source_path, &h.source_size, &h.source_time ) )
+        return false;
+
+      std::string temp_path = cache_path + ".tmp";
+      {
+        std::ofstream file( temp_path.c_str(), std::ofstream::out | std::ofstream::binary | std::ofstream::trunc );
+        if( !file.is_open() )
+          return false;
+
+        file.write( reinterpret_cast< const char* >( &h ), sizeof( mesh_cache_header ) );
+        file.write( reinterpret_cast< const char* >( vertices ), static_cast< std::streamsize >( vertex_count ) *
+          VERTEX_STRIDE * sizeof( float ) );
+        file.write( reinterpret_cast< const char* >( indices ), static_cast< std::streamsize >( index_count ) *
+          sizeof( uint32_t ) );
+        if( !file.good() ) {
+          file.close();
+          DeleteFileA( temp_path.c_str() );
+          return false;
+        }
+      }
+
+      if( MoveFileExA( temp_path.c_str(), cache_path.c_str(), MOVEFILE_REPLACE_EXISTING ) == FALSE ) {
+        DeleteFileA( temp_path.c_str() );
+        return false;
+      }
+      return true;
+    }
+  }
+}
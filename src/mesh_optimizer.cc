@@ -0,0 +1,478 @@
+#include "core/mesh_optimizer.hh"
+#include "core/math/float3.hh"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+#define OPTIMIZE_NONE 0xffffffff
+// a triangle only joins a cluster facing within ~45 degrees of it
+#define CLUSTER_MIN_NORMAL_DOT 0.7f
+// a cone wider than this can't be back facing from anywhere worth testing
+#define CLUSTER_MIN_CONE_DOT 0.1f
+#define CLUSTER_SEARCH_WINDOW 256
+
+namespace kretash {
+
+  uint64_t optimize_scratch::get_capacity() {
+    return source.capacity() * sizeof( uint32_t ) + live.capacity() * sizeof( uint32_t ) +
+      adjacency_offset.capacity() * sizeof( uint32_t ) + adjacency.capacity() * sizeof( uint32_t ) +
+      cache_time.capacity() * sizeof( uint32_t ) + emitted.capacity() * sizeof( uint8_t ) +
+      dead_end.capacity() * sizeof( uint32_t ) + candidates.capacity() * sizeof( uint32_t ) +
+      clusters.capacity() * sizeof( uint32_t ) + sort_keys.capacity() * sizeof( float ) +
+      order.capacity() * sizeof( uint32_t ) + remap.capacity() * sizeof( uint32_t ) +
+      triangle_normals.capacity() * sizeof( float3 ) + cluster_vertices.capacity() * sizeof( uint32_t );
+  }
+
+  namespace mesh_optimizer {
+
+    static inline float3 _position( const float* vertices, uint32_t stride, const uint32_t* ids, uint32_t v ) {
+      const float* p = vertices + ( ids ? ids[v] : v ) * stride;
+      return float3( p[0], p[1], p[2] );
+    }
+
+    // FIFO cache made of timestamps, hits don't refresh an entry. Returns the misses.
+    static inline uint32_t _cache_triangle( const uint32_t* t, uint32_t* cache_time, uint32_t* time, uint32_t cache_size ) {
+      uint32_t misses = 0;
+      for( uint32_t c = 0; c < 3; ++c ) {
+        if( *time - cache_time[t[c]] > cache_size ) {
+          cache_time[t[c]] = ( *time )++;
+          ++misses;
+        }
+      }
+      return misses;
+    }
+
+    // Triangles around every vertex, live counts them. The cursors borrow cache_time.
+    static void _build_adjacency( const uint32_t* elems, uint32_t elem_count, uint32_t vertex_count, optimize_scratch* s ) {
+
+      s->live.assign( vertex_count, 0 );
+      for( uint32_t e = 0; e < elem_count; ++e )
+        ++s->live[elems[e]];
+
+      s->adjacency_offset.resize( vertex_count + 1 );
+      s->cache_time.resize( vertex_count );
+      uint32_t offset = 0;
+      for( uint32_t v = 0; v < vertex_count; ++v ) {
+        s->adjacency_offset[v] = offset;
+        s->cache_time[v] = offset;
+        offset += s->live[v];
+      }
+      s->adjacency_offset[vertex_count] = offset;
+
+      s->adjacency.resize( elem_count );
+      for( uint32_t e = 0; e < elem_count; ++e )
+        s->adjacency[s->cache_time[elems[e]]++] = e / 3;
+    }
+
+    static uint32_t _next_fan( optimize_scratch* s, uint32_t time, uint32_t cache_size, uint32_t* cursor, uint32_t vertex_count ) {
+
+      // the candidate that stays in the cache after its remaining triangles, the oldest wins
+      uint32_t best = OPTIMIZE_NONE;
+      int32_t best_priority = -1;
+      for( uint32_t i = 0; i < s->candidates.size(); ++i ) {
+        uint32_t v = s->candidates[i];
+        if( s->live[v] == 0 ) continue;
+
+        int32_t priority = 0;
+        if( time - s->cache_time[v] + 2 * s->live[v] <= cache_size )
+          priority = ( int32_t ) ( time - s->cache_time[v] );
+
+        if( priority > best_priority ) {
+          best_priority = priority;
+          best = v;
+        }
+      }
+      if( best != OPTIMIZE_NONE ) return best;
+
+      // dead end, go back to a vertex used recently and then to the input order
+      while( s->dead_end.size() > 0 ) {
+        uint32_t v = s->dead_end.back();
+        s->dead_end.pop_back();
+        if( s->live[v] > 0 ) return v;
+      }
+      while( *cursor < vertex_count ) {
+        if( s->live[*cursor] > 0 ) return *cursor;
+        ++( *cursor );
+      }
+      return OPTIMIZE_NONE;
+    }
+
+    void optimize_vertex_cache( uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+      uint32_t cache_size, optimize_scratch* s ) {
+
+      assert( elem_count % 3 == 0 && "NOT A TRIANGLE LIST" );
+      if( elem_count == 0 || vertex_count == 0 ) return;
+      const uint32_t triangle_count = elem_count / 3;
+
+      s->source.assign( elems, elems + elem_count );
+      const uint32_t* source = s->source.data();
+      _build_adjacency( source, elem_count, vertex_count, s );
+
+      s->cache_time.assign( vertex_count, 0 );
+      s->emitted.assign( triangle_count, 0 );
+      s->dead_end.clear();
+
+      uint32_t time = cache_size + 1;
+      uint32_t cursor = 0;
+      uint32_t out = 0;
+      uint32_t fan = source[0];
+
+      while( fan != OPTIMIZE_NONE ) {
+        s->candidates.clear();
+
+        for( uint32_t a = s->adjacency_offset[fan]; a < s->adjacency_offset[fan + 1]; ++a ) {
+          uint32_t t = s->adjacency[a];
+          if( s->emitted[t] ) continue;
+          s->emitted[t] = 1;
+
+          for( uint32_t c = 0; c < 3; ++c ) {
+            uint32_t v = source[t * 3 + c];
+            elems[out++] = v;
+            s->dead_end.push_back( v );
+            s->candidates.push_back( v );
+            --s->live[v];
+
+            if( time - s->cache_time[v] > cache_size )
+              s->cache_time[v] = time++;
+          }
+        }
+
+        fan = _next_fan( s, time, cache_size, &cursor, vertex_count );
+      }
+
+      assert( out == elem_count && "TRIANGLES LEFT BEHIND" );
+    }
+
+    void optimize_overdraw( uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+      const float* vertices, uint32_t stride, const uint32_t* ids,
+      uint32_t cache_size, float threshold, optimize_scratch* s ) {
+
+      assert( elem_count % 3 == 0 && "NOT A TRIANGLE LIST" );
+      if( elem_count == 0 || vertex_count == 0 ) return;
+      const uint32_t triangle_count = elem_count / 3;
+
+      // hard boundaries are the triangles that miss all three vertices, the cache restarts
+      // there. Inside a hard cluster a cut is fine wherever the running ACMR is already
+      // within threshold of the cluster's.
+      s->clusters.clear();
+      s->cache_time.assign( vertex_count, 0 );
+      uint32_t time = cache_size + 1;
+
+      uint32_t start = 0;
+      while( start < triangle_count ) {
+        uint32_t end = start + 1;
+        uint32_t cluster_misses = _cache_triangle( elems + start * 3, s->cache_time.data(), &time, cache_size );
+        while( end < triangle_count ) {
+          uint32_t misses = _cache_triangle( elems + end * 3, s->cache_time.data(), &time, cache_size );
+          if( misses == 3 ) break;
+          cluster_misses += misses;
+          ++end;
+        }
+
+        float cluster_acmr = ( float ) cluster_misses / ( float ) ( end - start );
+
+        // moving time a whole cache ahead empties it
+        time += cache_size + 1;
+        uint32_t soft_start = start;
+        uint32_t running = 0;
+        for( uint32_t t = start; t < end; ++t ) {
+          running += _cache_triangle( elems + t * 3, s->cache_time.data(), &time, cache_size );
+          if( ( float ) running <= cluster_acmr * threshold * ( float ) ( t + 1 - soft_start ) && t + 1 < end ) {
+            s->clusters.push_back( soft_start );
+            soft_start = t + 1;
+            running = 0;
+            time += cache_size + 1;
+          }
+        }
+        s->clusters.push_back( soft_start );
+
+        // the triangle that ended the cluster was cached above, it has to start from a cold cache again
+        time += cache_size + 1;
+        start = end;
+      }
+
+      const uint32_t cluster_count = static_cast< uint32_t >( s->clusters.size() );
+      s->clusters.push_back( triangle_count );
+
+      // area weighted centroids, a cluster facing away from the mesh center covers the rest
+      float3 mesh_center = float3( 0.0f, 0.0f, 0.0f );
+      float mesh_area = 0.0f;
+      for( uint32_t t = 0; t < triangle_count; ++t ) {
+        float3 a = _position( vertices, stride, ids, elems[t * 3 + 0] );
+        float3 b = _position( vertices, stride, ids, elems[t * 3 + 1] );
+        float3 c = _position( vertices, stride, ids, elems[t * 3 + 2] );
+        float area = float3::lenght( float3::cross( b - a, c - a ) );
+        mesh_center += ( a + b + c ) * ( area / 3.0f );
+        mesh_area += area;
+      }
+      if( mesh_area > 0.0f ) mesh_center = mesh_center / mesh_area;
+
+      s->sort_keys.resize( cluster_count );
+      s->order.resize( cluster_count );
+      for( uint32_t k = 0; k < cluster_count; ++k ) {
+        float3 center = float3( 0.0f, 0.0f, 0.0f );
+        float3 normal = float3( 0.0f, 0.0f, 0.0f );
+        float area = 0.0f;
+
+        for( uint32_t t = s->clusters[k]; t < s->clusters[k + 1]; ++t ) {
+          float3 a = _position( vertices, stride, ids, elems[t * 3 + 0] );
+          float3 b = _position( vertices, stride, ids, elems[t * 3 + 1] );
+          float3 c = _position( vertices, stride, ids, elems[t * 3 + 2] );
+          float3 n = float3::cross( b - a, c - a );
+          float triangle_area = float3::lenght( n );
+          center += ( a + b + c ) * ( triangle_area / 3.0f );
+          normal += n;
+          area += triangle_area;
+        }
+
+        if( area > 0.0f ) center = center / area;
+        float normal_length = float3::lenght( normal );
+        if( normal_length > 0.0f ) normal = normal / normal_length;
+
+        s->sort_keys[k] = float3::dot( center - mesh_center, normal );
+        s->order[k] = k;
+      }
+
+      const float* keys = s->sort_keys.data();
+      // ties keep the cache order, stable_sort would want a buffer from the heap
+      std::sort( s->order.begin(), s->order.end(), [keys]( uint32_t a, uint32_t b ) {
+        return keys[a] > keys[b] || ( keys[a] == keys[b] && a < b );
+      } );
+
+      s->source.assign( elems, elems + elem_count );
+      uint32_t out = 0;
+      for( uint32_t k = 0; k < cluster_count; ++k ) {
+        uint32_t cluster = s->order[k];
+        for( uint32_t e = s->clusters[cluster] * 3; e < s->clusters[cluster + 1] * 3; ++e )
+          elems[out++] = s->source[e];
+      }
+    }
+
+    // Face normal that agrees with the vertex normals, the winding isn't the same everywhere
+    // since nothing gets back face culled
+    static inline float3 _triangle_normal( const float* vertices, uint32_t stride, const uint32_t* ids, const uint32_t* t ) {
+      float3 a = _position( vertices, stride, ids, t[0] );
+      float3 b = _position( vertices, stride, ids, t[1] );
+      float3 c = _position( vertices, stride, ids, t[2] );
+      float3 n = float3::cross( b - a, c - a );
+      float length = float3::lenght( n );
+      if( length <= 0.0f ) return float3( 0.0f, 0.0f, 0.0f );
+
+      float3 shading = float3( 0.0f, 0.0f, 0.0f );
+      for( uint32_t i = 0; i < 3; ++i ) {
+        const float* v = vertices + ( ids ? ids[t[i]] : t[i] ) * stride;
+        shading += float3( v[3], v[4], v[5] );
+      }
+      if( float3::dot( n, shading ) < 0.0f ) length = -length;
+      return n / length;
+    }
+
+    static inline float3 _triangle_center( const float* vertices, uint32_t stride, const uint32_t* ids, const uint32_t* t ) {
+      return ( _position( vertices, stride, ids, t[0] ) + _position( vertices, stride, ids, t[1] ) +
+        _position( vertices, stride, ids, t[2] ) ) / 3.0f;
+    }
+
+    // Ritter's sphere around the cluster vertices, seeded with the first one and its furthest
+    static void _fit_cluster_sphere( const float* vertices, uint32_t stride, const uint32_t* ids,
+      const std::vector<uint32_t>& cluster_vertices, mesh_cluster* c ) {
+
+      float3 a = _position( vertices, stride, ids, cluster_vertices[0] );
+      float3 b = a;
+      float furthest = 0.0f;
+      for( uint32_t i = 1; i < cluster_vertices.size(); ++i ) {
+        float3 p = _position( vertices, stride, ids, cluster_vertices[i] );
+        float d = float3::lenght( p - a );
+        if( d > furthest ) { furthest = d; b = p; }
+      }
+
+      float3 center = ( a + b ) * 0.5f;
+      float radius = furthest * 0.5f;
+      for( uint32_t i = 0; i < cluster_vertices.size(); ++i ) {
+        float3 p = _position( vertices, stride, ids, cluster_vertices[i] );
+        float d = float3::lenght( p - center );
+        if( d > radius ) {
+          float grown = ( radius + d ) * 0.5f;
+          center = center + ( p - center ) * ( ( grown - radius ) / d );
+          radius = grown;
+        }
+      }
+
+      c->center = center;
+      c->radius = radius;
+    }
+
+    void build_clusters( uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+      const float* vertices, uint32_t stride, const uint32_t* ids,
+      uint32_t max_vertices, uint32_t max_triangles, optimize_scratch* s,
+      std::vector<mesh_cluster>* out_clusters ) {
+
+      assert( elem_count % 3 == 0 && "NOT A TRIANGLE LIST" );
+      assert( max_vertices >= 3 && max_triangles >= 1 && "CLUSTERS TOO SMALL" );
+      out_clusters->clear();
+      if( elem_count == 0 || vertex_count == 0 ) return;
+      const uint32_t triangle_count = elem_count / 3;
+
+      s->source.assign( elems, elems + elem_count );
+      const uint32_t* source = s->source.data();
+      _build_adjacency( source, elem_count, vertex_count, s );
+
+      s->triangle_normals.resize( triangle_count );
+      for( uint32_t t = 0; t < triangle_count; ++t )
+        s->triangle_normals[t] = _triangle_normal( vertices, stride, ids, source + t * 3 );
+
+      // cache_time marks the vertices already in the cluster being built
+      s->emitted.assign( triangle_count, 0 );
+      s->cache_time.assign( vertex_count, OPTIMIZE_NONE );
+
+      uint32_t out = 0;
+      uint32_t cursor = 0;
+      uint32_t cluster_id = 0;
+
+      while( out < triangle_count ) {
+        while( s->emitted[cursor] ) ++cursor;
+
+        mesh_cluster cluster = {};
+        cluster.first_index = out * 3;
+        s->cluster_vertices.clear();
+        float3 normal_sum = float3( 0.0f, 0.0f, 0.0f );
+        float3 center_sum = float3( 0.0f, 0.0f, 0.0f );
+        uint32_t triangles = 0;
+        uint32_t next = cursor;
+
+        while( next != OPTIMIZE_NONE ) {
+          const uint32_t* t = source + next * 3;
+          s->emitted[next] = 1;
+          for( uint32_t c = 0; c < 3; ++c ) {
+            if( s->cache_time[t[c]] != cluster_id ) {
+              s->cache_time[t[c]] = cluster_id;
+              s->cluster_vertices.push_back( t[c] );
+            }
+            elems[out * 3 + c] = t[c];
+          }
+          normal_sum += s->triangle_normals[next];
+          center_sum += _triangle_center( vertices, stride, ids, t );
+          ++triangles;
+          ++out;
+
+          if( triangles == max_triangles ) break;
+
+          float normal_length = float3::lenght( normal_sum );
+          float3 axis = normal_length > 0.0f ? normal_sum / normal_length : float3( 0.0f, 0.0f, 0.0f );
+          float3 center = center_sum / ( float ) triangles;
+          uint32_t room = max_vertices - ( uint32_t ) s->cluster_vertices.size();
+
+          // the neighbour that brings the fewest new vertices, then the one facing closest
+          next = OPTIMIZE_NONE;
+          float best = FLT_MAX;
+          for( uint32_t i = 0; i < s->cluster_vertices.size(); ++i ) {
+            uint32_t v = s->cluster_vertices[i];
+            for( uint32_t a = s->adjacency_offset[v]; a < s->adjacency_offset[v + 1]; ++a ) {
+              uint32_t candidate = s->adjacency[a];
+              if( s->emitted[candidate] ) continue;
+
+              float facing = float3::dot( s->triangle_normals[candidate], axis );
+              if( facing < CLUSTER_MIN_NORMAL_DOT ) continue;
+
+              const uint32_t* ct = source + candidate * 3;
+              uint32_t fresh = ( s->cache_time[ct[0]] != cluster_id ) + ( s->cache_time[ct[1]] != cluster_id ) +
+                ( s->cache_time[ct[2]] != cluster_id );
+              if( fresh > room ) continue;
+
+              float score = ( float ) fresh + ( 1.0f - facing );
+              if( score < best ) {
+                best = score;
+                next = candidate;
+              }
+            }
+          }
+          if( next != OPTIMIZE_NONE ) continue;
+
+          // nothing connected left, jump to the closest triangle facing the same way among
+          // the next few, the input order is already local enough
+          uint32_t window = std::min( triangle_count, cursor + CLUSTER_SEARCH_WINDOW );
+          for( uint32_t candidate = cursor; candidate < window; ++candidate ) {
+            if( s->emitted[candidate] ) continue;
+            if( float3::dot( s->triangle_normals[candidate], axis ) < CLUSTER_MIN_NORMAL_DOT ) continue;
+
+            const uint32_t* ct = source + candidate * 3;
+            uint32_t fresh = ( s->cache_time[ct[0]] != cluster_id ) + ( s->cache_time[ct[1]] != cluster_id ) +
+              ( s->cache_time[ct[2]] != cluster_id );
+            if( fresh > room ) continue;
+
+            float distance = float3::lenght( _triangle_center( vertices, stride, ids, ct ) - center );
+            if( distance < best ) {
+              best = distance;
+              next = candidate;
+            }
+          }
+        }
+
+        cluster.index_count = triangles * 3;
+        _fit_cluster_sphere( vertices, stride, ids, s->cluster_vertices, &cluster );
+
+        float normal_length = float3::lenght( normal_sum );
+        cluster.cone_axis = normal_length > 0.0f ? normal_sum / normal_length : float3( 0.0f, 1.0f, 0.0f );
+        float min_dot = normal_length > 0.0f ? 1.0f : -1.0f;
+        for( uint32_t e = cluster.first_index; e < cluster.first_index + cluster.index_count; e += 3 ) {
+          // the triangles were copied in emit order, so their normals have to be found again
+          float3 n = _triangle_normal( vertices, stride, ids, elems + e );
+          if( float3::lenght( n ) > 0.0f ) min_dot = fminf( min_dot, float3::dot( n, cluster.cone_axis ) );
+        }
+        cluster.cone_cutoff = min_dot < CLUSTER_MIN_CONE_DOT ? 1.0f : sqrtf( 1.0f - min_dot * min_dot );
+
+        out_clusters->push_back( cluster );
+        ++cluster_id;
+      }
+    }
+
+    uint32_t optimize_vertex_fetch( uint32_t* elems, uint32_t elem_count, uint32_t* ids,
+      uint32_t vertex_count, optimize_scratch* s ) {
+
+      s->remap.assign( vertex_count, OPTIMIZE_NONE );
+      s->order.resize( vertex_count );
+
+      uint32_t next = 0;
+      for( uint32_t e = 0; e < elem_count; ++e ) {
+        uint32_t v = elems[e];
+        if( s->remap[v] == OPTIMIZE_NONE ) {
+          s->remap[v] = next;
+          s->order[next] = ids[v];
+          ++next;
+        }
+        elems[e] = s->remap[v];
+      }
+
+      for( uint32_t v = 0; v < next; ++v )
+        ids[v] = s->order[v];
+
+      return next;
+    }
+
+    vertex_cache_stats analyze_vertex_cache( const uint32_t* elems, uint32_t elem_count, uint32_t vertex_count,
+      uint32_t cache_size, optimize_scratch* s ) {
+
+      vertex_cache_stats stats;
+      if( elem_count == 0 || vertex_count == 0 ) return stats;
+
+      s->cache_time.assign( vertex_count, 0 );
+      s->emitted.assign( vertex_count, 0 );
+      uint32_t time = cache_size + 1;
+      uint32_t referenced = 0;
+
+      for( uint32_t e = 0; e < elem_count; e += 3 ) {
+        stats.misses += _cache_triangle( elems + e, s->cache_time.data(), &time, cache_size );
+        for( uint32_t c = 0; c < 3; ++c ) {
+          if( s->emitted[elems[e + c]] == 0 ) {
+            s->emitted[elems[e + c]] = 1;
+            ++referenced;
+          }
+        }
+      }
+
+      stats.acmr = ( float ) stats.misses / ( float ) ( elem_count / 3 );
+      stats.atvr = ( float ) stats.misses / ( float ) referenced;
+      return stats;
+    }
+  }
+}
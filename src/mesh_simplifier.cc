@@ -0,0 +1,483 @@
+#include "core/mesh_simplifier.hh"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cfloat>
+
+#define SIMPLIFY_WELD_EPSILON 0.0001f
+#define SIMPLIFY_NONE 0xffffffff
+// wedges that face further apart than this don't merge when seams are unlocked
+#define SIMPLIFY_MIN_NORMAL_DOT 0.9f
+
+namespace kretash {
+
+  uint64_t simplify_scratch::get_capacity() {
+    return wedge_position.capacity() * sizeof( uint32_t ) + positions.capacity() * sizeof( float3 ) +
+      hash_keys.capacity() * sizeof( uint64_t ) + hash_ids.capacity() * sizeof( uint32_t ) +
+      quadrics.capacity() * sizeof( quadric ) + parent.capacity() * sizeof( uint32_t ) +
+      stamp.capacity() * sizeof( uint32_t ) + triangles.capacity() * sizeof( uint32_t ) +
+      alive.capacity() * sizeof( uint8_t ) + list_head.capacity() * sizeof( uint32_t ) +
+      list_tail.capacity() * sizeof( uint32_t ) + node_triangle.capacity() * sizeof( uint32_t ) +
+      node_next.capacity() * sizeof( uint32_t ) + heap.capacity() * sizeof( simplify_collapse ) +
+      map_from.capacity() * sizeof( uint32_t ) + map_to.capacity() * sizeof( uint32_t );
+  }
+
+  namespace mesh_simplifier {
+
+    static inline void _add_plane( quadric* q, double a, double b, double c, double d ) {
+      q->a2 += a * a; q->ab += a * b; q->ac += a * c; q->ad += a * d;
+      q->b2 += b * b; q->bc += b * c; q->bd += b * d;
+      q->c2 += c * c; q->cd += c * d;
+      q->d2 += d * d;
+    }
+
+    static inline void _add( quadric* q, const quadric& o ) {
+      q->a2 += o.a2; q->ab += o.ab; q->ac += o.ac; q->ad += o.ad;
+      q->b2 += o.b2; q->bc += o.bc; q->bd += o.bd;
+      q->c2 += o.c2; q->cd += o.cd;
+      q->d2 += o.d2;
+    }
+
+    // sum of the squared distances from p to every plane in the quadric
+    static inline double _distance( const quadric& q, const float3& p ) {
+      double x = p.x, y = p.y, z = p.z;
+      double e = q.a2 * x * x + 2.0 * q.ab * x * y + 2.0 * q.ac * x * z + 2.0 * q.ad * x +
+        q.b2 * y * y + 2.0 * q.bc * y * z + 2.0 * q.bd * y +
+        q.c2 * z * z + 2.0 * q.cd * z +
+        q.d2;
+      return e > 0.0 ? e : 0.0;
+    }
+
+    static inline bool _cheaper( const simplify_collapse& a, const simplify_collapse& b ) {
+      return a.cost > b.cost;
+    }
+
+    static inline uint64_t _mix( uint64_t k ) {
+      k ^= k >> 33;
+      k *= 0xff51afd7ed558ccdULL;
+      k ^= k >> 33;
+      return k;
+    }
+
+    static inline uint32_t _table_size( uint32_t count ) {
+      uint32_t size = 1;
+      while( size < count * 2 ) size <<= 1;
+      return size;
+    }
+
+    static inline uint32_t _position( simplify_scratch* s, uint32_t t, uint32_t c ) {
+      return s->wedge_position[s->triangles[t * 3 + c]];
+    }
+
+    static inline uint32_t _corner( simplify_scratch* s, uint32_t t, uint32_t p ) {
+      for( uint32_t c = 0; c < 3; ++c )
+        if( _position( s, t, c ) == p ) return c;
+      return 3;
+    }
+
+    static inline uint32_t _find_map( simplify_scratch* s, uint32_t w ) {
+      for( uint32_t i = 0; i < s->map_from.size(); ++i )
+        if( s->map_from[i] == w ) return i;
+      return SIMPLIFY_NONE;
+    }
+
+    // Wedges on the same position share a topology vertex, close enough counts as the same
+    static uint32_t _weld_positions( const simplify_mesh& mesh, simplify_scratch* s ) {
+
+      const uint32_t table_size = _table_size( mesh.vertex_count );
+      s->hash_keys.resize( table_size );
+      s->hash_ids.assign( table_size, SIMPLIFY_NONE );
+      s->wedge_position.resize( mesh.vertex_count );
+      s->positions.clear();
+
+      for( uint32_t w = 0; w < mesh.vertex_count; ++w ) {
+        const float3& p = mesh.positions[w];
+
+        uint64_t hash = 14695981039346656037ULL;
+        hash = ( hash ^ ( uint64_t ) ( int64_t ) floorf( p.x / SIMPLIFY_WELD_EPSILON + 0.5f ) ) * 1099511628211ULL;
+        hash = ( hash ^ ( uint64_t ) ( int64_t ) floorf( p.y / SIMPLIFY_WELD_EPSILON + 0.5f ) ) * 1099511628211ULL;
+        hash = ( hash ^ ( uint64_t ) ( int64_t ) floorf( p.z / SIMPLIFY_WELD_EPSILON + 0.5f ) ) * 1099511628211ULL;
+
+        uint32_t slot = static_cast< uint32_t >( _mix( hash ) ) & ( table_size - 1 );
+        while( s->hash_ids[slot] != SIMPLIFY_NONE && s->hash_keys[slot] != hash )
+          slot = ( slot + 1 ) & ( table_size - 1 );
+
+        uint32_t found = s->hash_ids[slot];
+        if( found != SIMPLIFY_NONE ) {
+          const float3& q = s->positions[found];
+          if( fabsf( p.x - q.x ) <= SIMPLIFY_WELD_EPSILON && fabsf( p.y - q.y ) <= SIMPLIFY_WELD_EPSILON &&
+            fabsf( p.z - q.z ) <= SIMPLIFY_WELD_EPSILON ) {
+            s->wedge_position[w] = found;
+            continue;
+          }
+        }
+
+        uint32_t id = static_cast< uint32_t >( s->positions.size() );
+        s->positions.push_back( p );
+        s->wedge_position[w] = id;
+
+        if( found == SIMPLIFY_NONE ) {
+          s->hash_keys[slot] = hash;
+          s->hash_ids[slot] = id;
+        }
+      }
+
+      return static_cast< uint32_t >( s->positions.size() );
+    }
+
+    // Open edges get a plane through them perpendicular to their triangle, so the
+    // outline of the mesh can slide along itself but not shrink
+    static void _add_border_planes( uint32_t num_triangles, simplify_scratch* s ) {
+
+      const uint32_t table_size = _table_size( num_triangles * 3 );
+      s->hash_keys.resize( table_size );
+      s->hash_ids.assign( table_size, SIMPLIFY_NONE );
+
+      for( uint32_t pass = 0; pass < 2; ++pass ) {
+        for( uint32_t t = 0; t < num_triangles; ++t ) {
+          if( !s->alive[t] ) continue;
+
+          for( uint32_t c = 0; c < 3; ++c ) {
+            uint32_t a = _position( s, t, c );
+            uint32_t b = _position( s, t, ( c + 1 ) % 3 );
+            uint64_t key = a < b ? ( ( uint64_t ) a << 32 ) | b : ( ( uint64_t ) b << 32 ) | a;
+
+            uint32_t slot = static_cast< uint32_t >( _mix( key ) ) & ( table_size - 1 );
+            while( s->hash_ids[slot] != SIMPLIFY_NONE && s->hash_keys[slot] != key )
+              slot = ( slot + 1 ) & ( table_size - 1 );
+
+            // first pass counts the triangles on every edge, the second one adds the planes
+            if( pass == 0 ) {
+              if( s->hash_ids[slot] == SIMPLIFY_NONE ) {
+                s->hash_keys[slot] = key;
+                s->hash_ids[slot] = 0;
+              }
+              ++s->hash_ids[slot];
+              continue;
+            }
+
+            if( s->hash_ids[slot] != 1 ) continue;
+
+            float3 p0 = s->positions[_position( s, t, 0 )];
+            float3 p1 = s->positions[_position( s, t, 1 )];
+            float3 p2 = s->positions[_position( s, t, 2 )];
+            float3 pa = s->positions[a];
+            float3 pb = s->positions[b];
+
+            float3 normal = float3::cross( p1 - p0, p2 - p0 );
+            float3 border = float3::cross( pb - pa, normal );
+            float length = float3::lenght( border );
+            if( length < 1e-12f ) continue;
+            border = border / length;
+
+            double d = -float3::dot( border, pa );
+            _add_plane( &s->quadrics[a], border.x, border.y, border.z, d );
+            _add_plane( &s->quadrics[b], border.x, border.y, border.z, d );
+          }
+        }
+      }
+    }
+
+    // How far the texture on triangle t slides once its corner c moves to p with the
+    // attributes of wedge w, in object units. The uv the triangle would have had at p is
+    // extrapolated from its own uv gradient and compared with the uv of w.
+    static float _texture_error( const simplify_mesh& mesh, simplify_scratch* s, uint32_t t, uint32_t c,
+      float3 p, uint32_t w ) {
+
+      uint32_t w0 = s->triangles[t * 3 + c];
+      uint32_t w1 = s->triangles[t * 3 + ( c + 1 ) % 3];
+      uint32_t w2 = s->triangles[t * 3 + ( c + 2 ) % 3];
+
+      float3 p0 = s->positions[s->wedge_position[w0]];
+      float3 e1 = s->positions[s->wedge_position[w1]] - p0;
+      float3 e2 = s->positions[s->wedge_position[w2]] - p0;
+      float3 move = p - p0;
+
+      float2 t0 = mesh.uvs[w0];
+      float2 t1 = mesh.uvs[w1];
+      float2 t2 = mesh.uvs[w2];
+      float2 d1 = t1 - t0;
+      float2 d2 = t2 - t0;
+
+      float a11 = float3::dot( e1, e1 );
+      float a12 = float3::dot( e1, e2 );
+      float a22 = float3::dot( e2, e2 );
+      float det = a11 * a22 - a12 * a12;
+      float uv_area = fabsf( d1.x * d2.y - d1.y * d2.x );
+
+      if( det <= 1e-12f || uv_area <= 1e-12f ) {
+        // no uv gradient to follow, only the same uv keeps the texture where it was
+        float du = mesh.uvs[w].x - t0.x;
+        float dv = mesh.uvs[w].y - t0.y;
+        return du * du + dv * dv < 1e-8f ? 0.0f : FLT_MAX;
+      }
+
+      float b1 = float3::dot( e1, move );
+      float b2 = float3::dot( e2, move );
+      float k1 = ( a22 * b1 - a12 * b2 ) / det;
+      float k2 = ( a11 * b2 - a12 * b1 ) / det;
+
+      float du = t0.x + d1.x * k1 + d2.x * k2 - mesh.uvs[w].x;
+      float dv = t0.y + d1.y * k1 + d2.y * k2 - mesh.uvs[w].y;
+
+      // sqrt( det ) is twice the triangle area, uv_area twice the uv one
+      float world_per_uv = sqrtf( sqrtf( det ) / uv_area );
+      return sqrtf( du * du + dv * dv ) * world_per_uv;
+    }
+
+    // Pairs the wedges of u with the wedges of v for moving u onto v and returns the error
+    // of the move, the larger of the quadric distance and the texture slide. Returns -1 if
+    // it would flip a triangle or, with locked seams, tear an attribute seam.
+    static float _evaluate( const simplify_mesh& mesh, simplify_scratch* s, uint32_t u, uint32_t v, bool lock_seams ) {
+
+      s->map_from.clear();
+      s->map_to.clear();
+
+      // the wedges of u pair up with the wedges of v across the triangles that go away
+      for( uint32_t n = s->list_head[u]; n != SIMPLIFY_NONE; n = s->node_next[n] ) {
+        uint32_t t = s->node_triangle[n];
+        if( !s->alive[t] ) continue;
+
+        uint32_t cv = _corner( s, t, v );
+        if( cv == 3 ) continue;
+
+        uint32_t wu = s->triangles[t * 3 + _corner( s, t, u )];
+        uint32_t wv = s->triangles[t * 3 + cv];
+        uint32_t m = _find_map( s, wu );
+
+        if( m == SIMPLIFY_NONE ) {
+          s->map_from.push_back( wu );
+          s->map_to.push_back( wv );
+        } else if( s->map_to[m] != wv && lock_seams ) {
+          return -1.0f;
+        }
+      }
+
+      // u and v don't share a triangle anymore
+      if( s->map_from.empty() ) return -1.0f;
+
+      quadric q = s->quadrics[u];
+      _add( &q, s->quadrics[v] );
+      float error = static_cast< float >( sqrt( _distance( q, s->positions[v] ) ) );
+
+      const float3 pv = s->positions[v];
+
+      for( uint32_t n = s->list_head[u]; n != SIMPLIFY_NONE; n = s->node_next[n] ) {
+        uint32_t t = s->node_triangle[n];
+        if( !s->alive[t] || _corner( s, t, v ) != 3 ) continue;
+
+        uint32_t cu = _corner( s, t, u );
+        float3 p[3];
+        for( uint32_t c = 0; c < 3; ++c ) p[c] = s->positions[_position( s, t, c )];
+
+        float3 before = float3::cross( p[1] - p[0], p[2] - p[0] );
+        p[cu] = pv;
+        float3 after = float3::cross( p[1] - p[0], p[2] - p[0] );
+        if( float3::dot( before, after ) <= 0.0f ) return -1.0f;
+
+        uint32_t wu = s->triangles[t * 3 + cu];
+        uint32_t m = _find_map( s, wu );
+
+        if( m == SIMPLIFY_NONE ) {
+          // a wedge of u with nothing to pair with across the edge would tear its seam
+          if( lock_seams ) return -1.0f;
+
+          uint32_t best = SIMPLIFY_NONE;
+          float best_dot = SIMPLIFY_MIN_NORMAL_DOT;
+          for( uint32_t k = s->list_head[v]; k != SIMPLIFY_NONE; k = s->node_next[k] ) {
+            uint32_t tv = s->node_triangle[k];
+            if( !s->alive[tv] ) continue;
+
+            uint32_t wv = s->triangles[tv * 3 + _corner( s, tv, v )];
+            float dot = float3::dot( mesh.normals[wu], mesh.normals[wv] );
+            if( dot > best_dot ) {
+              best_dot = dot;
+              best = wv;
+            }
+          }
+
+          // nothing at v faces the same way, the shading would break
+          if( best == SIMPLIFY_NONE ) return -1.0f;
+
+          m = static_cast< uint32_t >( s->map_from.size() );
+          s->map_from.push_back( wu );
+          s->map_to.push_back( best );
+        }
+
+        float texture = _texture_error( mesh, s, t, cu, pv, s->map_to[m] );
+        if( texture > error ) error = texture;
+      }
+
+      return error;
+    }
+
+    // Moves position u onto v with the wedge pairs _evaluate left in the scratch,
+    // returns how many triangles went away
+    static uint32_t _collapse( simplify_scratch* s, uint32_t u, uint32_t v ) {
+
+      uint32_t killed = 0;
+      for( uint32_t n = s->list_head[u]; n != SIMPLIFY_NONE; n = s->node_next[n] ) {
+        uint32_t t = s->node_triangle[n];
+        if( !s->alive[t] ) continue;
+
+        if( _corner( s, t, v ) != 3 ) {
+          s->alive[t] = 0;
+          ++killed;
+          continue;
+        }
+
+        uint32_t c = t * 3 + _corner( s, t, u );
+        s->triangles[c] = s->map_to[_find_map( s, s->triangles[c] )];
+      }
+
+      // every triangle that was around u is around v now
+      if( s->list_head[u] != SIMPLIFY_NONE ) {
+        if( s->list_head[v] == SIMPLIFY_NONE ) s->list_head[v] = s->list_head[u];
+        else s->node_next[s->list_tail[v]] = s->list_head[u];
+        s->list_tail[v] = s->list_tail[u];
+        s->list_head[u] = SIMPLIFY_NONE;
+        s->list_tail[u] = SIMPLIFY_NONE;
+      }
+
+      _add( &s->quadrics[v], s->quadrics[u] );
+      s->parent[u] = v;
+      ++s->stamp[u];
+      ++s->stamp[v];
+
+      return killed;
+    }
+
+    static void _push( const simplify_mesh& mesh, simplify_scratch* s, uint32_t from, uint32_t to, bool lock_seams ) {
+
+      float cost = _evaluate( mesh, s, from, to, lock_seams );
+      if( cost < 0.0f ) return;
+
+      simplify_collapse c;
+      c.cost = cost;
+      c.from = from;
+      c.to = to;
+      c.from_stamp = s->stamp[from];
+      c.to_stamp = s->stamp[to];
+
+      s->heap.push_back( c );
+      std::push_heap( s->heap.begin(), s->heap.end(), _cheaper );
+    }
+
+    float simplify( const simplify_mesh& mesh, uint32_t target_triangles, float max_error,
+      bool lock_seams, simplify_scratch* s, std::vector<uint32_t>* out_elems ) {
+
+      assert( mesh.elem_count % 3 == 0 && "SIMPLIFY NEEDS TRIANGLES" );
+      out_elems->clear();
+
+      const uint32_t num_triangles = mesh.elem_count / 3;
+      const uint32_t num_positions = _weld_positions( mesh, s );
+
+      quadric zero = {};
+      s->quadrics.assign( num_positions, zero );
+      s->parent.resize( num_positions );
+      s->stamp.assign( num_positions, 0 );
+      for( uint32_t p = 0; p < num_positions; ++p ) s->parent[p] = p;
+
+      s->triangles.assign( mesh.elems, mesh.elems + mesh.elem_count );
+      s->alive.assign( num_triangles, 1 );
+      s->list_head.assign( num_positions, SIMPLIFY_NONE );
+      s->list_tail.assign( num_positions, SIMPLIFY_NONE );
+      s->node_triangle.resize( mesh.elem_count );
+      s->node_next.resize( mesh.elem_count );
+
+      uint32_t live = 0;
+
+      for( uint32_t t = 0; t < num_triangles; ++t ) {
+        uint32_t p0 = _position( s, t, 0 );
+        uint32_t p1 = _position( s, t, 1 );
+        uint32_t p2 = _position( s, t, 2 );
+
+        if( p0 == p1 || p1 == p2 || p2 == p0 ) {
+          s->alive[t] = 0;
+          continue;
+        }
+        ++live;
+
+        float3 normal = float3::cross( s->positions[p1] - s->positions[p0], s->positions[p2] - s->positions[p0] );
+        float length = float3::lenght( normal );
+        if( length > 1e-12f ) {
+          normal = normal / length;
+          double d = -float3::dot( normal, s->positions[p0] );
+          _add_plane( &s->quadrics[p0], normal.x, normal.y, normal.z, d );
+          _add_plane( &s->quadrics[p1], normal.x, normal.y, normal.z, d );
+          _add_plane( &s->quadrics[p2], normal.x, normal.y, normal.z, d );
+        }
+
+        for( uint32_t c = 0; c < 3; ++c ) {
+          uint32_t p = _position( s, t, c );
+          uint32_t n = t * 3 + c;
+          s->node_triangle[n] = t;
+          s->node_next[n] = SIMPLIFY_NONE;
+          if( s->list_head[p] == SIMPLIFY_NONE ) s->list_head[p] = n;
+          else s->node_next[s->list_tail[p]] = n;
+          s->list_tail[p] = n;
+        }
+      }
+
+      _add_border_planes( num_triangles, s );
+
+      s->heap.clear();
+      for( uint32_t t = 0; t < num_triangles; ++t ) {
+        if( !s->alive[t] ) continue;
+        for( uint32_t c = 0; c < 3; ++c ) {
+          uint32_t a = _position( s, t, c );
+          uint32_t b = _position( s, t, ( c + 1 ) % 3 );
+          _push( mesh, s, a, b, lock_seams );
+          _push( mesh, s, b, a, lock_seams );
+        }
+      }
+
+      float reached = 0.0f;
+
+      while( live > target_triangles && !s->heap.empty() ) {
+        std::pop_heap( s->heap.begin(), s->heap.end(), _cheaper );
+        simplify_collapse c = s->heap.back();
+        s->heap.pop_back();
+
+        if( c.cost > max_error ) break;
+
+        // one of the ends moved since this was queued, it got queued again then
+        if( s->parent[c.from] != c.from || s->parent[c.to] != c.to ) continue;
+        if( s->stamp[c.from] != c.from_stamp || s->stamp[c.to] != c.to_stamp ) continue;
+
+        // the neighbourhood may have changed since, a collapse that got worse goes back in
+        float cost = _evaluate( mesh, s, c.from, c.to, lock_seams );
+        if( cost < 0.0f ) continue;
+        if( cost > c.cost + 1e-6f ) {
+          c.cost = cost;
+          s->heap.push_back( c );
+          std::push_heap( s->heap.begin(), s->heap.end(), _cheaper );
+          continue;
+        }
+
+        live -= _collapse( s, c.from, c.to );
+        if( cost > reached ) reached = cost;
+
+        for( uint32_t n = s->list_head[c.to]; n != SIMPLIFY_NONE; n = s->node_next[n] ) {
+          uint32_t t = s->node_triangle[n];
+          if( !s->alive[t] ) continue;
+          for( uint32_t k = 0; k < 3; ++k ) {
+            uint32_t p = _position( s, t, k );
+            if( p == c.to ) continue;
+            _push( mesh, s, c.to, p, lock_seams );
+            _push( mesh, s, p, c.to, lock_seams );
+          }
+        }
+      }
+
+      for( uint32_t t = 0; t < num_triangles; ++t ) {
+        if( !s->alive[t] ) continue;
+        out_elems->push_back( s->triangles[t * 3 + 0] );
+        out_elems->push_back( s->triangles[t * 3 + 1] );
+        out_elems->push_back( s->triangles[t * 3 + 2] );
+      }
+
+      return reached;
+    }
+  }
+}
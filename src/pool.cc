@@ -6,13 +6,16 @@
 
 namespace kretash {
 
-  Pool::Pool() {
+  Pool::Pool() :
+    m_pool_type( kDEVICE_MEMORY ),
+    m_size( 0 ) {
 
   }
 
   void Pool::init( uint64_t size, pool_type t ) {
     m_free_memory.push_back( mem_block( 0, size ) );
     m_pool_type = t;
+    m_size = size;
   }
 
   mem_block Pool::get_mem( uint64_t size ) {
@@ -28,6 +31,7 @@ namespace kretash {
         found.m_start = free_mem.m_start;
         found.m_size = size;
         m_used_memory.push_back( found );
+        _trace( 'a', found.m_start, size );
 
         if( free_mem.m_size >= size ){
           free_mem.m_start += size;
@@ -41,7 +45,7 @@ namespace kretash {
       }
     }
 
-    std::cout << "GET BLOCK NOT FOUND " << m_pool_type << " -- ( 0 - Device, 1 - HostVisible )" << std::endl;
+    std::cout << "GET BLOCK NOT FOUND " << m_pool_type << " -- ( 0 - Device, 1 - HostVisible, 2 - Staging, 3 - Vertex, 4 - Index, 5 - Cluster )" << std::endl;
     std::cout << "trying defrag.... \n";
     //if not found defrag and try again
     defrag();
@@ -55,6 +59,7 @@ namespace kretash {
         found.m_start = free_mem.m_start;
         found.m_size = size;
         m_used_memory.push_back( found );
+        _trace( 'a', found.m_start, size );
 
         if( free_mem.m_size >= size ) {
           free_mem.m_start += size;
@@ -66,11 +71,42 @@ namespace kretash {
       }
     }
 
+    _trace( 'x', 0, size );
     assert( false && "BLOCK NOT FOUND" );
-    std::cout << "GET BLOCK STILL NOT FOUND " << m_pool_type << " -- ( 0 - Device, 1 - HostVisible )" << std::endl;
+    std::cout << "GET BLOCK STILL NOT FOUND " << m_pool_type << " -- ( 0 - Device, 1 - HostVisible, 2 - Staging, 3 - Vertex, 4 - Index, 5 - Cluster )" << std::endl;
     return found;
   }
 
+  bool Pool::try_get_mem( uint64_t size, mem_block* m ) {
+
+    //same as get_mem but failing is fine, the caller will wait and try again
+    for( int32_t pass = 0; pass < 2; ++pass ) {
+      for( std::vector<mem_block>::iterator i = m_free_memory.begin(); i != m_free_memory.end(); ++i ) {
+        if( i->m_size >= size ) {
+
+          mem_block free_mem = *i._Ptr;
+          m_free_memory.erase( i );
+
+          m->m_start = free_mem.m_start;
+          m->m_size = size;
+          m_used_memory.push_back( *m );
+          _trace( 'a', m->m_start, size );
+
+          free_mem.m_start += size;
+          free_mem.m_size -= size;
+          if( free_mem.m_size != 0 )
+            m_free_memory.push_back( free_mem );
+
+          return true;
+        }
+      }
+      defrag();
+    }
+
+    _trace( 'x', 0, size );
+    return false;
+  }
+
   void Pool::release( mem_block m ) {
 
     bool found = false;
@@ -81,6 +117,7 @@ namespace kretash {
         mem_block used_mem = *i._Ptr;
         m_used_memory.erase( i );
         m_free_memory.push_back( used_mem );
+        _trace( 'f', used_mem.m_start, used_mem.m_size );
         found = true;
         break;
       }
@@ -88,10 +125,11 @@ namespace kretash {
 
     assert( found != false && "BLOCK NOT FOUND" );
     if( !found ) std::cout << "RELEASE BLOCK NOT FOUND " << m_pool_type << 
-      " -- ( 0 - Device, 1 - HostVisible ) ( " << m.m_start << " . " << m.m_size << " )" << std::endl;
+      " -- ( 0 - Device, 1 - HostVisible, 2 - Staging, 3 - Vertex, 4 - Index, 5 - Cluster ) ( " << m.m_start << " . " << m.m_size << " )" << std::endl;
   }
 
   void Pool::defrag() {
+    _trace( 'd', 0, 0 );
     std::sort( m_free_memory.begin(), m_free_memory.end() );
     std::vector<mem_block>::iterator i = m_free_memory.begin();
     while( i != m_free_memory.end() ) {
@@ -120,7 +158,78 @@ namespace kretash {
     }
   }
 
-  Pool::~Pool() {
+  uint64_t Pool::get_free_size() {
+    uint64_t free_size = 0;
+    for( int32_t i = 0; i < m_free_memory.size(); ++i )
+      free_size += m_free_memory[i].m_size;
+    return free_size;
+  }
+
+  uint64_t Pool::get_largest_free_block() {
+    uint64_t largest = 0;
+    for( int32_t i = 0; i < m_free_memory.size(); ++i ) {
+      if( m_free_memory[i].m_size > largest )
+        largest = m_free_memory[i].m_size;
+    }
+    return largest;
+  }
+
+  // No block may overlap another one or go past the end, and free plus used has to cover the pool
+  bool Pool::validate() {
+
+    std::vector<mem_block> all;
+    all.reserve( m_free_memory.size() + m_used_memory.size() );
+
+    for( int32_t i = 0; i < m_free_memory.size(); ++i ) {
+      if( m_free_memory[i].m_size != 0 ) all.push_back( m_free_memory[i] );
+    }
+    for( int32_t i = 0; i < m_used_memory.size(); ++i ) {
+      if( m_used_memory[i].m_size != 0 ) all.push_back( m_used_memory[i] );
+    }
+
+    std::sort( all.begin(), all.end() );
+
+    uint64_t covered = 0;
+    for( int32_t i = 0; i < all.size(); ++i ) {
+
+      if( all[i].m_start + all[i].m_size > m_size ) {
+        std::cout << "POOL BLOCK OUT OF RANGE ( " << all[i].m_start << " . " << all[i].m_size << " )" << std::endl;
+        return false;
+      }
 
+      if( i > 0 && all[i - 1].m_start + all[i - 1].m_size > all[i].m_start ) {
+        std::cout << "POOL BLOCKS OVERLAP ( " << all[i - 1].m_start << " . " << all[i - 1].m_size << " ) ( " <<
+          all[i].m_start << " . " << all[i].m_size << " )" << std::endl;
+        return false;
+      }
+
+      covered += all[i].m_size;
+    }
+
+    if( covered != m_size ) {
+      std::cout << "POOL LOST MEMORY " << m_size - covered << " bytes" << std::endl;
+      return false;
+    }
+
+    return true;
+  }
+
+  void Pool::record_trace( std::string filename ) {
+    if( m_trace.is_open() ) m_trace.close();
+    m_trace.open( filename.c_str(), std::ios::out | std::ios::trunc );
+    if( m_trace.is_open() ) m_trace << "p " << m_pool_type << " " << m_size << "\n";
+  }
+
+  void Pool::stop_trace() {
+    if( m_trace.is_open() ) m_trace.close();
+  }
+
+  void Pool::_trace( char op, uint64_t start, uint64_t size ) {
+    if( !m_trace.is_open() ) return;
+    m_trace << op << " " << start << " " << size << "\n";
+  }
+
+  Pool::~Pool() {
+    stop_trace();
   }
 }
\ No newline at end of file
@@ -3,11 +3,19 @@
 #include "core/engine.hh"
 #include "core/camera.hh"
 #include "core/input.hh"
+#include "core/window.hh"
+#include "core/GPU_pool.hh"
+#include "core/mesh_optimizer.hh"
+#include "core/xx/context.hh"
 #include <algorithm>
+#include <cmath>
 
 namespace kretash {
 
-  RenderManager::RenderManager() {}
+  RenderManager::RenderManager() {
+    m_total_clusters = 0;
+    m_visible_clusters = 0;
+  }
 
   void RenderManager::add_child( Drawable* d ) {
     m_render_bin.push_back( d );
@@ -24,33 +32,40 @@ namespace kretash {
       float3 c_pos = c->get_position();
       _generate_frustum_planes();
 
+      // size of a pixel one unit away from the camera, errors scale with the distance
+      float height = ( float ) k_engine->get_window()->get_height();
+      float world_per_pixel = 2.0f * tanf( c->get_fov() * 0.5f ) / height;
+
       float3 camera = k_engine->get_camera()->get_position();
+      float hlod_distance = k_engine_settings->get_settings().hlod_distance;
       m_active_render_bin.clear();
+      m_instanced_bin.clear();
+      m_draw_ranges.clear();
+      m_total_clusters = 0;
+      m_visible_clusters = 0;
 
       for( int32_t i = 0; i < m_render_bin.size(); ++i ) {
 
         float3 pos = m_render_bin[i]->get_position();
 
-        if( 0.0f < m_render_bin[i]->get_radius() ) {
+        if( !_hlod_visible( m_render_bin[i], c_pos, hlod_distance ) ) {
+          m_render_bin[i]->set_active( false );
+          continue;
+        }
 
-          float maxh = m_render_bin[i]->get_max_height();
+        if( 0.0f < m_render_bin[i]->get_radius() ) {
 
           float3 v_lenght = c_pos - pos;
           float length = float3::lenght( v_lenght );
           m_render_bin[i]->set_distance( length );
 
-          if( _inside_frustum( pos, m_render_bin[i]->get_radius(), maxh ) ||
-            float3::lenght( c_pos - pos ) < 100.0f
-            ) {
+          if( _inside_frustum( m_render_bin[i] ) ) {
 
-            m_active_render_bin.push_back( m_render_bin[i] );
+            if( m_render_bin[i]->is_instanced() ) m_instanced_bin.push_back( m_render_bin[i] );
+            else m_active_render_bin.push_back( m_render_bin[i] );
 
-            if( length < 500 )
-              m_render_bin[i]->set_lod( 0 );
-            else if( length < 1000 )
-              m_render_bin[i]->set_lod( 1 );
-            else
-              m_render_bin[i]->set_lod( 2 );
+            m_render_bin[i]->set_lod( _select_lod( m_render_bin[i], length, world_per_pixel ) );
+            _add_draw_ranges( m_render_bin[i], camera );
 
             m_render_bin[i]->set_active( true );
 
@@ -61,16 +76,13 @@ namespace kretash {
         } else {
 
           //Ignore frustum is enabled
-          m_active_render_bin.push_back( m_render_bin[i] );
+          if( m_render_bin[i]->is_instanced() ) m_instanced_bin.push_back( m_render_bin[i] );
+          else m_active_render_bin.push_back( m_render_bin[i] );
           float3 v_lenght = c_pos - pos;
           float length = float3::lenght( v_lenght );
 
-          if( length < 500 )
-            m_render_bin[i]->set_lod( 0 );
-          else if( length < 1000 )
-            m_render_bin[i]->set_lod( 1 );
-          else
-            m_render_bin[i]->set_lod( 2 );
+          m_render_bin[i]->set_lod( _select_lod( m_render_bin[i], length, world_per_pixel ) );
+          _add_draw_ranges( m_render_bin[i], camera );
 
           m_render_bin[i]->set_distance( length );
           m_render_bin[i]->set_active( true );
@@ -78,6 +90,17 @@ namespace kretash {
         }
       }
 
+    } else {
+
+      // the bin is frozen but geometry can still be swapped underneath it, draw it whole
+      m_draw_ranges.clear();
+      m_total_clusters = 0;
+      m_visible_clusters = 0;
+      for( int32_t i = 0; i < m_active_render_bin.size(); ++i ) {
+        Geometry* g = m_active_render_bin[i]->get_geometry();
+        m_draw_ranges.push_back( { m_active_render_bin[i], 0, g->get_indicies_count() } );
+      }
+
     }
     /*
     else {
@@ -112,56 +135,129 @@ namespace kretash {
     */
   }
 
-  bool RenderManager::_inside_frustum( float3 point, float r, float maxh ) {
+  // The coarsest LOD whose error still projects under the pixel budget at this distance
+  int32_t RenderManager::_select_lod( Drawable* d, float distance, float world_per_pixel ) {
+    float max_error = k_engine_settings->get_settings().lod_pixel_error * world_per_pixel * distance;
 
-    // 0 - Left clipping plane
-    // 1 - Right clipping plane
-    // 2 - Top clipping plane
-    // 3 - Bottom clipping plane
-    // 4 - Near clipping plane
-    // 5 - Far clipping plane
+    int32_t lod = 0;
+    for( int32_t i = 1; i <= d->get_max_lod(); ++i ) {
+      if( d->get_geometry( i )->get_lod_error() <= max_error )
+        lod = i;
+    }
+    return lod;
+  }
+
+  // Past hlod_distance a tile's merged mesh draws instead of the buildings and street blocks in it,
+  // until the merged mesh is ready the tile keeps drawing them one by one
+  bool RenderManager::_hlod_visible( Drawable* d, float3 camera, float hlod_distance ) {
+    if( d->is_hlod() )
+      return d->is_hlod_ready() && float3::lenght( camera - d->get_position() ) > hlod_distance;
+
+    Drawable* h = d->get_hlod();
+    return h == nullptr || !h->is_hlod_ready() || float3::lenght( camera - h->get_position() ) <= hlod_distance;
+  }
+
+  // Clusters facing away from the camera or outside the frustum are dropped, the survivors
+  // that sit next to each other in the index buffer are drawn together
+  void RenderManager::_add_draw_ranges( Drawable* d, float3 camera ) {
 
-    bool vulkan = k_engine_settings->get_settings().m_api == kVulkan;
-    float d = 0.0f;
+    // instanced drawables are drawn whole by their mesh's batch
+    if( d->is_instanced() ) return;
 
-    d = float3::dot( point, m_frustum_planes[0].xyz() );
-    d += r;
-    d += m_frustum_planes[0].d;
-    if( d <= 0 ) return false;
+    Geometry* g = d->get_geometry();
+    uint32_t cluster_count = g->get_cluster_count();
 
-    d = float3::dot( point, m_frustum_planes[1].xyz() );
-    d += r;
-    d += m_frustum_planes[1].d;
-    if( d <= 0 ) return false;
+    // the cluster bounds are in model space, only a translation keeps them valid
+    float3 scale = d->get_scale();
+    bool transformed = scale.x != 1.0f || scale.y != 1.0f || scale.z != 1.0f || d->get_rotation().y != 0.0f;
 
-    d = float3::dot( point, m_frustum_planes[2].xyz() );
+    if( cluster_count == 0 || transformed || d->get_radius() <= 0.0f ) {
+      m_draw_ranges.push_back( { d, 0, g->get_indicies_count() } );
+      return;
+    }
+
+    const mesh_cluster* clusters = k_engine->get_GPU_pool()->get_clusters() + g->get_cluster_offset();
+    float3 position = d->get_position();
+    size_t first = m_draw_ranges.size();
+    m_total_clusters += cluster_count;
+
+    for( uint32_t i = 0; i < cluster_count; ++i ) {
+
+      const mesh_cluster& c = clusters[i];
+      float3 center = c.center + position;
+
+      bool visible = true;
+      for( int32_t j = 0; j < 6 && visible; ++j ) {
+        if( float3::dot( center, m_frustum_planes[j].xyz() ) + m_frustum_planes[j].d + c.radius <= 0.0f )
+          visible = false;
+      }
+
+      // every triangle faces away when the camera sits outside the cone's mirror
+      if( visible && c.cone_cutoff < 1.0f ) {
+        float3 view = center - camera;
+        if( float3::dot( view, c.cone_axis ) >= c.cone_cutoff * float3::lenght( view ) + c.radius )
+          visible = false;
+      }
 
-    if( vulkan )
-      d += maxh + r;
-    else
-      d += r;
+      if( !visible ) continue;
+      ++m_visible_clusters;
 
-    d += m_frustum_planes[2].d;
-    if( d <= 0 ) return false;
+      if( m_draw_ranges.size() > first &&
+        m_draw_ranges.back().first_index + m_draw_ranges.back().index_count == c.first_index ) {
+        m_draw_ranges.back().index_count += c.index_count;
+      } else {
+        m_draw_ranges.push_back( { d, c.first_index, c.index_count } );
+      }
+    }
 
-    d = float3::dot( point, m_frustum_planes[3].xyz() );
-    if( vulkan )
-      d += r;
-    else
-      d += maxh + r;
+    // too many draws cost more than the triangles they skip, close the smallest gaps
+    while( m_draw_ranges.size() - first > MAX_DRAW_RANGES ) {
 
-    d += m_frustum_planes[3].d;
-    if( d <= 0 ) return false;
+      size_t best = first;
+      uint32_t best_gap = 0xffffffff;
+      for( size_t i = first; i + 1 < m_draw_ranges.size(); ++i ) {
+        uint32_t gap = m_draw_ranges[i + 1].first_index - ( m_draw_ranges[i].first_index + m_draw_ranges[i].index_count );
+        if( gap < best_gap ) {
+          best_gap = gap;
+          best = i;
+        }
+      }
 
-    d = float3::dot( point, m_frustum_planes[4].xyz() );
-    d += r;
-    d += m_frustum_planes[4].d;
-    if( d <= 0 ) return false;
+      m_draw_ranges[best].index_count =
+        m_draw_ranges[best + 1].first_index + m_draw_ranges[best + 1].index_count - m_draw_ranges[best].first_index;
+      m_draw_ranges.erase( m_draw_ranges.begin() + best + 1 );
+    }
+  }
 
-    d = float3::dot( point, m_frustum_planes[5].xyz() );
-    d += r;
-    d += m_frustum_planes[5].d;
-    if( d <= 0 ) return false;
+  // The sphere throws away most of what's outside, then the box has to be on the inner
+  // side of every plane with its corner furthest along the plane normal
+  bool RenderManager::_inside_frustum( Drawable* d ) {
+
+    // 0 - Left clipping plane
+    // 1 - Right clipping plane
+    // 2 - Top clipping plane
+    // 3 - Bottom clipping plane
+    // 4 - Near clipping plane
+    // 5 - Far clipping plane
+
+    float3 center;
+    float radius;
+    d->get_world_sphere( &center, &radius );
+
+    for( int32_t i = 0; i < 6; ++i ) {
+      if( float3::dot( center, m_frustum_planes[i].xyz() ) + m_frustum_planes[i].d + radius <= 0.0f )
+        return false;
+    }
+
+    float3 min, max;
+    d->get_world_bounds( &min, &max );
+
+    for( int32_t i = 0; i < 6; ++i ) {
+      const plane& p = m_frustum_planes[i];
+      float3 corner = float3( p.x >= 0.0f ? max.x : min.x, p.y >= 0.0f ? max.y : min.y, p.z >= 0.0f ? max.z : min.z );
+      if( float3::dot( corner, float3( p.x, p.y, p.z ) ) + p.d <= 0.0f )
+        return false;
+    }
 
     return true;
   }
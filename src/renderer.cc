@@ -2,6 +2,7 @@
 #include "core/renderer.hh"
 #include "core/drawable.hh"
 #include "core/texture.hh"
+#include "core/geometry.hh"
 #include "core/window.hh"
 #include "core/camera.hh"
 #include "core/tools.hh"
@@ -57,6 +58,16 @@ namespace kretash {
 
     m_renderer->create_instance_buffer_objects( rb );
 
+    uint32_t instanced = 0;
+    for( int32_t i = 0; i < m_render_bin_objects; ++i ) {
+      if( ( *rb )[i]->is_instanced() ) ++instanced;
+      instanced += ( *rb )[i]->get_max_part_instances();
+    }
+    m_instance_stream.resize( instanced );
+    m_instance_refs.reserve( instanced );
+    m_instance_batches.clear();
+    if( instanced != 0 ) m_renderer->create_instance_stream( instanced );
+
     uint32_t w = sizeof( instance_buffer );
     const uint32_t buffer_size = sizeof( instance_buffer ) + 255 & ~255;
     assert( w == buffer_size && "THIS IS MADNESS" );
@@ -75,6 +86,7 @@ namespace kretash {
       m_instance_buffer[id].d_texture_id = ( *rb )[i]->get_texture()->get_id( tDIFFUSE );
       m_instance_buffer[id].n_texture_id = ( *rb )[i]->get_texture()->get_id( tNORMAL );
       m_instance_buffer[id].s_texture_id = ( *rb )[i]->get_texture()->get_id( tSPECULAR );
+      _set_bounds( &m_instance_buffer[id], ( *rb )[i]->get_geometry() );
       ( *rb )[i]->set_instance_buffer( &m_instance_buffer[id] );
 
     }
@@ -99,8 +111,7 @@ namespace kretash {
 
       std::vector<Drawable*>* rb = m_render_manager->get_active_render_bin();
       Camera* c = k_engine->get_camera();
-      float4x4 view = c->get_view();
-      float4x4 proj = c->get_projection();
+      float4x4 view_proj = c->get_view() * c->get_projection();
 
       auto comp = [] ( Drawable* a, Drawable* b ) {
         return a->get_drawable_id() < b->get_drawable_id();
@@ -114,31 +125,109 @@ namespace kretash {
       for( int32_t i = 0; i < rb->size(); ++i ) {
         int32_t id = ( *rb )[i]->get_drawable_id();
 
-        float4x4 model = ( *rb )[i]->get_model();
-        m_instance_buffer[id].mvp = model * view * proj;
-        m_instance_buffer[id].model = model;
-
-        if( vulkan ) m_instance_buffer[id].model.transpose();
-        else m_instance_buffer[id].mvp.transpose();
-
-        m_instance_buffer[id].normal_matrix = float4x4::inverse( model );
-        if( vulkan ) m_instance_buffer[id].normal_matrix.transpose();
-
-        m_instance_buffer[id].d_texture_id = ( *rb )[i]->get_texture()->get_id( tDIFFUSE );
-        m_instance_buffer[id].n_texture_id = ( *rb )[i]->get_texture()->get_id( tNORMAL );
-        m_instance_buffer[id].s_texture_id = ( *rb )[i]->get_texture()->get_id( tSPECULAR );
-
+        Drawable* d = ( *rb )[i];
+        _write_instance( &m_instance_buffer[id], d, d->get_geometry(), d->get_model(), view_proj, vulkan );
         ( *rb )[i]->set_instance_buffer( &m_instance_buffer[id] );
 
       }
 
       m_renderer->update_instance_buffer_objects( rb, &m_instance_buffer );
 
+      _build_instance_batches( view_proj, vulkan );
+      if( m_instance_batches.size() != 0 )
+        m_renderer->update_instance_stream( &m_instance_stream, get_instance_count() );
+
       //GPU::update_instance_buffer_object( k_engine->get_engine_data(), &r_data, &m_instance_buffer[0] );//~0.5ms
       //GPU::update_decriptor_sets( k_engine->get_engine_data(), &r_data, rb );
     }
   }
 
+  void Renderer::_write_instance( instance_buffer* ib, Drawable* d, Geometry* g, float4x4 model,
+    float4x4 view_proj, bool vulkan ) {
+
+    ib->mvp = model * view_proj;
+    ib->model = model;
+
+    if( vulkan ) ib->model.transpose();
+    else ib->mvp.transpose();
+
+    ib->normal_matrix = float4x4::inverse( model );
+    if( vulkan ) ib->normal_matrix.transpose();
+
+    ib->d_texture_id = d->get_texture()->get_id( tDIFFUSE );
+    ib->n_texture_id = d->get_texture()->get_id( tNORMAL );
+    ib->s_texture_id = d->get_texture()->get_id( tSPECULAR );
+    _set_bounds( ib, g );
+  }
+
+  // Instances pointing at the same mesh in the GPU pool become one draw, they are written
+  // next to each other so the draw reads them as one run of the stream. Besides the instanced
+  // drawables, every visible drawable at LOD0 adds one instance per offset of its parts.
+  void Renderer::_build_instance_batches( float4x4 view_proj, bool vulkan ) {
+
+    std::vector<Drawable*>* ib = m_render_manager->get_instanced_bin();
+    std::vector<Drawable*>* rb = m_render_manager->get_active_render_bin();
+
+    m_instance_refs.clear();
+    for( uint32_t i = 0; i < ib->size(); ++i ) {
+      instance_ref r = { ( *ib )[i]->get_geometry(), ( *ib )[i], float3( 0.0f, 0.0f, 0.0f ) };
+      m_instance_refs.push_back( r );
+    }
+    for( uint32_t i = 0; i < rb->size(); ++i ) {
+      Drawable* d = ( *rb )[i];
+      if( d->get_lod() != 0 ) continue;
+
+      std::vector<instanced_part>* parts = d->get_instanced_parts();
+      for( uint32_t p = 0; p < parts->size(); ++p ) {
+        instanced_part& part = ( *parts )[p];
+        for( uint32_t o = 0; o < part.offsets.size(); ++o ) {
+          instance_ref r = { part.geometry.get(), d, part.offsets[o] };
+          m_instance_refs.push_back( r );
+        }
+      }
+    }
+    assert( m_instance_refs.size() <= m_instance_stream.size() && "MORE INSTANCES THAN PREPARE SIZED THE STREAM FOR" );
+
+    auto comp = [] ( const instance_ref& a, const instance_ref& b ) {
+      if( a.geometry->get_indicies_offset() != b.geometry->get_indicies_offset() )
+        return a.geometry->get_indicies_offset() < b.geometry->get_indicies_offset();
+      return a.geometry->get_vertex_offset() < b.geometry->get_vertex_offset();
+    };
+    std::sort( m_instance_refs.begin(), m_instance_refs.end(), comp );
+
+    m_instance_batches.clear();
+    for( uint32_t i = 0; i < m_instance_refs.size(); ++i ) {
+      instance_ref& r = m_instance_refs[i];
+
+      if( m_instance_batches.size() == 0 ||
+        m_instance_batches.back().geometry->get_indicies_offset() != r.geometry->get_indicies_offset() ||
+        m_instance_batches.back().geometry->get_vertex_offset() != r.geometry->get_vertex_offset() ) {
+        instance_batch b = { r.geometry, i, 0 };
+        m_instance_batches.push_back( b );
+      }
+      ++m_instance_batches.back().instance_count;
+
+      // the offset is in model space, it moves the part before the drawable's model does
+      float4x4 model = r.drawable->get_model();
+      if( r.offset.x != 0.0f || r.offset.y != 0.0f || r.offset.z != 0.0f ) {
+        float4x4 offset = float4x4( 1.0f );
+        offset.translate( r.offset );
+        model = offset * model;
+      }
+      _write_instance( &m_instance_stream[i], r.drawable, r.geometry, model, view_proj, vulkan );
+    }
+  }
+
+  // Packed vertices store the position relative to the geometry bounds
+  void Renderer::_set_bounds( instance_buffer* ib, Geometry* g ) {
+    if( g == nullptr ) return;
+
+    float3 min = g->get_bounds_min();
+    float3 scale = g->get_bounds_scale();
+    ib->bounds_min = float4( min.x, min.y, min.z, 0.0f );
+    ib->bounds_scale = float4( scale.x, scale.y, scale.z, 0.0f );
+  }
+
   Renderer::~Renderer() {
     m_render_manager = nullptr;
   }
@@ -0,0 +1,141 @@
+#include "core/startup_graph.hh"
+
+#include <thread>
+#include <cassert>
+#include <iomanip>
+#include <iostream>
+#include <algorithm>
+
+// the main thread takes its own stages, these take the rest
+#define MAX_STARTUP_THREADS 4
+
+namespace kretash {
+
+  StartupGraph::StartupGraph() :
+    m_first_pending( 0 ),
+    m_first_frame( -1.0 ) {
+    m_remaining.store( 0 );
+    m_start = std::chrono::high_resolution_clock::now();
+  }
+
+  int32_t StartupGraph::add( std::string name, std::function<void()> task, std::vector<int32_t> after,
+    bool main_thread ) {
+
+    int32_t id = static_cast< int32_t >( m_stages.size() );
+    for( size_t i = 0; i < after.size(); ++i )
+      assert( after[i] >= 0 && after[i] < id && "STARTUP STAGE WAITS ON A LATER ONE" );
+
+    std::shared_ptr<startup_stage> s = std::make_shared<startup_stage>();
+    s->name = name;
+    s->task = task;
+    s->after = after;
+    s->main_thread = main_thread;
+    s->state = kSTAGE_WAITING;
+    s->thread = -1;
+    s->start = 0.0;
+    s->end = 0.0;
+
+    m_stages.push_back( s );
+    return id;
+  }
+
+  void StartupGraph::run() {
+    uint32_t pending = static_cast< uint32_t >( m_stages.size() ) - m_first_pending;
+    if( pending == 0 ) return;
+
+    uint32_t worker_stages = 0;
+    for( size_t i = m_first_pending; i < m_stages.size(); ++i ) {
+      if( !m_stages[i]->main_thread ) ++worker_stages;
+    }
+
+    uint32_t hardware = std::max( 2u, std::thread::hardware_concurrency() );
+    uint32_t count = std::min( std::min( hardware - 1, ( uint32_t ) MAX_STARTUP_THREADS ), worker_stages );
+
+    m_remaining.store( pending );
+
+    std::vector<std::thread> threads;
+    for( uint32_t i = 0; i < count; ++i )
+      threads.push_back( std::thread( &StartupGraph::_worker_loop, this, i + 1 ) );
+
+    while( m_remaining.load() > 0 ) {
+      startup_stage* s = _take_stage( true );
+      if( s == nullptr ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        continue;
+      }
+      _run_stage( s, 0 );
+    }
+
+    for( size_t i = 0; i < threads.size(); ++i )
+      threads[i].join();
+
+    m_first_pending = static_cast< uint32_t >( m_stages.size() );
+  }
+
+  void StartupGraph::finish() {
+    if( m_first_frame >= 0.0 ) return;
+    m_first_frame = _now();
+
+    std::cout << "startup timeline" << std::endl;
+    for( size_t i = 0; i < m_stages.size(); ++i ) {
+      startup_stage* s = m_stages[i].get();
+      std::cout << "  " << std::left << std::setw( 22 ) << s->name << std::right << std::fixed <<
+        std::setprecision( 1 ) << std::setw( 8 ) << s->start << " -> " << std::setw( 8 ) << s->end <<
+        " ms  thread " << s->thread << std::endl;
+    }
+    std::cout << "first frame --- " << m_first_frame << " ms" << std::endl;
+    std::cout.unsetf( std::ios_base::floatfield );
+  }
+
+  void StartupGraph::_worker_loop( int32_t thread ) {
+    while( m_remaining.load() > 0 ) {
+      startup_stage* s = _take_stage( false );
+      if( s == nullptr ) {
+        std::this_thread::sleep_for( std::chrono::milliseconds( 1 ) );
+        continue;
+      }
+      _run_stage( s, thread );
+    }
+  }
+
+  // The first waiting stage of this kind whose stages before it are all done
+  startup_stage* StartupGraph::_take_stage( bool main_thread ) {
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    for( size_t i = m_first_pending; i < m_stages.size(); ++i ) {
+      startup_stage* s = m_stages[i].get();
+      if( s->state != kSTAGE_WAITING || s->main_thread != main_thread ) continue;
+
+      bool ready = true;
+      for( size_t e = 0; e < s->after.size() && ready; ++e )
+        ready = m_stages[s->after[e]]->state == kSTAGE_DONE;
+
+      if( ready ) {
+        s->state = kSTAGE_RUNNING;
+        return s;
+      }
+    }
+    return nullptr;
+  }
+
+  void StartupGraph::_run_stage( startup_stage* s, int32_t thread ) {
+    s->thread = thread;
+    s->start = _now();
+    s->task();
+    s->end = _now();
+
+    m_lock.lock();
+    s->state = kSTAGE_DONE;
+    m_lock.unlock();
+    --m_remaining;
+  }
+
+  double StartupGraph::_now() {
+    using namespace std::chrono;
+    duration<double> time_span = duration_cast< duration<double> >( high_resolution_clock::now() - m_start );
+    return time_span.count()*1000.0;
+  }
+
+  StartupGraph::~StartupGraph() {
+  }
+}
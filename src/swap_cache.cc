@@ -0,0 +1,162 @@
+#include "core/swap_cache.hh"
+#include "core/xx/context.hh"
+
+#include <cassert>
+#include <cstring>
+
+namespace kretash {
+
+  SwapCache::SwapCache( uint64_t budget ) :
+    m_budget( budget ) {
+    m_size.store( 0 );
+    m_restored_meshes.store( 0 );
+    m_restored_textures.store( 0 );
+  }
+
+  void SwapCache::store_mesh( const Geometry* owner, const float* vertices, const uint32_t* ids,
+    uint32_t vertex_count, const uint32_t* indices, uint32_t index_count,
+    const mesh_cluster* clusters, uint32_t cluster_count, float lod_error ) {
+
+    const uint32_t stride = VERTEX_STRIDE;
+    uint64_t size = static_cast< uint64_t >( vertex_count ) * stride * sizeof( float ) +
+      static_cast< uint64_t >( index_count ) * sizeof( uint32_t ) +
+      static_cast< uint64_t >( cluster_count ) * sizeof( mesh_cluster );
+
+    // the old copy goes either way, it doesn't match owner anymore
+    forget_mesh( owner );
+    if( m_size.load() + size > m_budget ) return;
+
+    std::shared_ptr<cached_mesh> m = std::make_shared<cached_mesh>();
+    m->vertices.resize( vertex_count * stride );
+    for( uint32_t i = 0; i < vertex_count; ++i )
+      memcpy( &m->vertices[i * stride], vertices + ( ids ? ids[i] : i ) * stride, stride * sizeof( float ) );
+    m->indices.assign( indices, indices + index_count );
+    m->clusters.assign( clusters, clusters + cluster_count );
+    m->lod_error = lod_error;
+
+    std::lock_guard<std::mutex> lock( m_lock );
+    m_meshes[owner] = m;
+    m_size += size;
+  }
+
+  std::shared_ptr<cached_mesh> SwapCache::find_mesh( const Geometry* owner ) {
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    std::unordered_map<const Geometry*, std::shared_ptr<cached_mesh>>::iterator found = m_meshes.find( owner );
+    if( found == m_meshes.end() ) return nullptr;
+    return found->second;
+  }
+
+  bool SwapCache::has_mesh( const Geometry* owner ) {
+    std::lock_guard<std::mutex> lock( m_lock );
+    return m_meshes.find( owner ) != m_meshes.end();
+  }
+
+  void SwapCache::forget_mesh( const Geometry* owner ) {
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    std::unordered_map<const Geometry*, std::shared_ptr<cached_mesh>>::iterator found = m_meshes.find( owner );
+    if( found == m_meshes.end() ) return;
+
+    m_size -= _mesh_size( found->second.get() );
+    m_meshes.erase( found );
+  }
+
+  bool SwapCache::store_texture( const Texture* owner, texture_t t, unsigned char* pixels,
+    int32_t width, int32_t height, int32_t channels, uint8_t LOD ) {
+
+    assert( pixels != nullptr && "NO PIXELS TO KEEP" );
+    uint64_t size = static_cast< uint64_t >( width ) * height * 4;
+
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    std::unordered_map<const Texture*, cached_texture>::iterator found = m_textures.find( owner );
+    if( found == m_textures.end() ) {
+      cached_texture empty = {};
+      found = m_textures.insert( std::make_pair( owner, empty ) ).first;
+    }
+    cached_texture* ct = &found->second;
+
+    // the maps of an older LOD can't be mixed with the new ones
+    if( ct->LOD != LOD ) {
+      m_size -= _texture_size( ct );
+      _free_texture( ct );
+      ct->LOD = LOD;
+    }
+
+    if( ct->pixels[t] != nullptr ) {
+      m_size -= static_cast< uint64_t >( ct->width[t] ) * ct->height[t] * 4;
+      delete[] ct->pixels[t];
+      ct->pixels[t] = nullptr;
+    }
+
+    if( m_size.load() + size > m_budget ) return false;
+
+    ct->pixels[t] = pixels;
+    ct->width[t] = width;
+    ct->height[t] = height;
+    ct->channels[t] = channels;
+    m_size += size;
+    return true;
+  }
+
+  bool SwapCache::find_texture( const Texture* owner, uint8_t LOD, cached_texture* out ) {
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    std::unordered_map<const Texture*, cached_texture>::iterator found = m_textures.find( owner );
+    if( found == m_textures.end() || found->second.LOD != LOD ) return false;
+
+    for( int32_t e = tDIFFUSE; e < tCOUNT; ++e ) {
+      if( found->second.pixels[e] == nullptr ) return false;
+    }
+
+    *out = found->second;
+    return true;
+  }
+
+  void SwapCache::forget_texture( const Texture* owner ) {
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    std::unordered_map<const Texture*, cached_texture>::iterator found = m_textures.find( owner );
+    if( found == m_textures.end() ) return;
+
+    m_size -= _texture_size( &found->second );
+    _free_texture( &found->second );
+    m_textures.erase( found );
+  }
+
+  void SwapCache::forget_textures() {
+    std::lock_guard<std::mutex> lock( m_lock );
+
+    std::unordered_map<const Texture*, cached_texture>::iterator i = m_textures.begin();
+    for( ; i != m_textures.end(); ++i ) {
+      m_size -= _texture_size( &i->second );
+      _free_texture( &i->second );
+    }
+    m_textures.clear();
+  }
+
+  uint64_t SwapCache::_mesh_size( const cached_mesh* m ) {
+    return m->vertices.size() * sizeof( float ) + m->indices.size() * sizeof( uint32_t ) +
+      m->clusters.size() * sizeof( mesh_cluster );
+  }
+
+  uint64_t SwapCache::_texture_size( const cached_texture* t ) {
+    uint64_t size = 0;
+    for( int32_t e = tDIFFUSE; e < tCOUNT; ++e ) {
+      if( t->pixels[e] != nullptr ) size += static_cast< uint64_t >( t->width[e] ) * t->height[e] * 4;
+    }
+    return size;
+  }
+
+  void SwapCache::_free_texture( cached_texture* t ) {
+    for( int32_t e = tDIFFUSE; e < tCOUNT; ++e ) {
+      delete[] t->pixels[e];
+      t->pixels[e] = nullptr;
+    }
+  }
+
+  SwapCache::~SwapCache() {
+    forget_textures();
+  }
+}
@@ -0,0 +1,235 @@
+#include "core/tangent_benchmark.hh"
+#include "core/tangent_kernel.hh"
+#include "core/engine_settings.hh"
+#include "core/building_gen.hh"
+#include "tinyobj/tiny_obj_loader.h"
+
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <cmath>
+
+#define VERTEX_FLOATS 14
+#define BENCHMARK_TRIANGLES 2000000
+#define MAX_DIFFERENCE 0.0001f
+
+namespace kretash {
+
+  TangentBenchmark::TangentBenchmark() {
+  }
+
+  bool TangentBenchmark::run() {
+
+    _add_buildings();
+    _add_obj( "teapot.obj" );
+
+    for( int32_t i = 0; i < m_meshes.size(); ++i ) {
+      uint32_t triangles = std::max( ( uint32_t ) m_meshes[i].elems.size() / 3, ( uint32_t ) 1 );
+      _measure( m_meshes[i], std::max( BENCHMARK_TRIANGLES / triangles, ( uint32_t ) 1 ) );
+    }
+
+    bool passed = true;
+    for( int32_t i = 0; i < m_reports.size(); ++i )
+      passed &= m_reports[i].max_difference <= MAX_DIFFERENCE;
+
+    return passed;
+  }
+
+  // Same stacks Building::_generate_classic_building puts in LOD0, one mesh per group
+  void TangentBenchmark::_add_buildings() {
+
+    building_scratch scratch;
+    BuildingGen gen;
+
+    for( int32_t g = eSingle; g <= ePenta; ++g ) {
+
+      uint32_t sides = g == eSingle ? 6 : 5 * g;
+      float base_size = ( 3.0f * 16.0f ) / ( float ) sides;
+
+      gen.begin( &scratch );
+
+      building_settings bs = {};
+      bs.init_s( sides, 1, 5.0f, float3( 0.0f, 0.0f, 0.0f ) );
+      bs.init_r( static_cast< groups >( g ), 0, 0, base_size, eLEFT );
+      gen.generate( bs );
+
+      float current_height = 5.0f;
+      for( int32_t i = 0; i < 3; ++i ) {
+        uint32_t floors = std::max( 1, 6 - 2 * i );
+
+        bs.init_s( sides, floors, 3.0f, float3( 0.0f, current_height, 0.0f ) );
+        bs.init_r( static_cast< groups >( g ), i, 0, base_size, eLEFT );
+        gen.generate( bs );
+
+        bs.n_vertical_uv = 0.05f;
+        for( uint32_t e = 0; e < floors; ++e ) {
+          bs.init_s( sides, 1, 0.3f, float3( 0.0f, e * 3.0f + current_height, 0.0f ) );
+          bs.init_r( static_cast< groups >( g ), i, 0, base_size + 0.1f, eRIGHT );
+          gen.generate( bs );
+        }
+        bs.n_vertical_uv = 1.0f;
+
+        current_height += 3.0f * floors;
+      }
+
+      tangent_mesh m;
+      m.name = "LOD0 building group " + std::to_string( g );
+      m.positions.assign( &scratch.vertices[0].x, &scratch.vertices[0].x + scratch.vertices.size() * 3 );
+      m.normals.assign( &scratch.normals[0].x, &scratch.normals[0].x + scratch.normals.size() * 3 );
+      m.uvs.assign( &scratch.uvs[0].x, &scratch.uvs[0].x + scratch.uvs.size() * 2 );
+      m.elems = scratch.elems;
+      m_meshes.push_back( m );
+    }
+  }
+
+  bool TangentBenchmark::_add_obj( std::string filename ) {
+
+    std::string filename_ = OPATH + filename;
+
+    std::vector<tinyobj::shape_t> shapes;
+    std::vector<tinyobj::material_t> materials;
+    std::string tiny_error = tinyobj::LoadObj( shapes, materials, filename_.c_str() );
+
+    if( shapes.size() != 1 ) {
+      std::cout << "couldn't load " << filename_ << " " << tiny_error << std::endl;
+      return false;
+    }
+
+    tangent_mesh m;
+    m.name = filename;
+    m.positions = shapes[0].mesh.positions;
+    m.normals = shapes[0].mesh.normals;
+    m.uvs = shapes[0].mesh.texcoords;
+    m.elems.assign( shapes[0].mesh.indices.begin(), shapes[0].mesh.indices.end() );
+    m_meshes.push_back( m );
+
+    return true;
+  }
+
+  void TangentBenchmark::_measure( tangent_mesh& m, uint32_t iterations ) {
+
+    tangent_report r;
+    r.name = m.name;
+    r.triangles = ( uint32_t ) m.elems.size() / 3;
+    r.iterations = iterations;
+
+    std::vector<float> reference( m.elems.size() * VERTEX_FLOATS );
+    std::vector<float> kernel( m.elems.size() * VERTEX_FLOATS );
+
+    tangent_streams ts;
+    ts.set_positions( m.positions.data(), 3 );
+    ts.set_normals( m.normals.data(), 3 );
+    ts.set_uvs( m.uvs.data(), 2 );
+    ts.elems = m.elems.data();
+    ts.elem_count = ( uint32_t ) m.elems.size();
+
+    std::chrono::high_resolution_clock::time_point start = std::chrono::high_resolution_clock::now();
+    for( uint32_t i = 0; i < iterations; ++i )
+      _reference_loop( m, reference.data() );
+    std::chrono::high_resolution_clock::time_point end = std::chrono::high_resolution_clock::now();
+    r.reference_time = std::chrono::duration<double, std::milli>( end - start ).count();
+
+    start = std::chrono::high_resolution_clock::now();
+    for( uint32_t i = 0; i < iterations; ++i )
+      tangent_kernel::compute( ts, kernel.data() );
+    end = std::chrono::high_resolution_clock::now();
+    r.kernel_time = std::chrono::duration<double, std::milli>( end - start ).count();
+
+    // degenerate uvs give infinities on both sides, only finite values are compared
+    for( size_t i = 0; i < reference.size(); ++i ) {
+      if( !std::isfinite( reference[i] ) || !std::isfinite( kernel[i] ) ) continue;
+      float d = fabsf( reference[i] - kernel[i] ) / std::max( 1.0f, fabsf( reference[i] ) );
+      r.max_difference = std::max( r.max_difference, d );
+    }
+
+    m_reports.push_back( r );
+  }
+
+  // The scalar AoS loop both generators had before the kernel
+  void TangentBenchmark::_reference_loop( tangent_mesh& m, float* out ) {
+
+    const uint32_t count = ( uint32_t ) m.elems.size();
+
+    for( uint32_t e = 0; e < count; e += 3 ) {
+
+      float3 v[3];
+      float3 n[3];
+      float2 uv[3];
+
+      for( uint32_t c = 0; c < 3; ++c ) {
+        unsigned int v_i = m.elems[e + c] * 3;
+        unsigned int uv_i = m.elems[e + c] * 2;
+
+        v[c] = float3( m.positions[v_i], m.positions[v_i + 1], m.positions[v_i + 2] );
+        n[c] = float3( m.normals[v_i], m.normals[v_i + 1], m.normals[v_i + 2] );
+        uv[c] = float2( m.uvs[uv_i], m.uvs[uv_i + 1] );
+      }
+
+      float3 delta_pos1 = v[1] - v[0];
+      float3 delta_pos2 = v[2] - v[0];
+
+      float2 delta_uv1 = uv[1] - uv[0];
+      float2 delta_uv2 = uv[2] - uv[0];
+
+      float r = 1.0f / ( delta_uv1.x * delta_uv2.y - delta_uv1.y * delta_uv2.x );
+      float3 tangent = ( delta_pos1 * delta_uv2.y - delta_pos2 * delta_uv1.y )*r;
+      float3 bitangent = ( delta_pos2 * delta_uv1.x - delta_pos1 * delta_uv2.x )*r;
+
+      for( uint32_t c = 0; c < 3; ++c ) {
+
+        float3 t = tangent - n[c] * float3::dot( n[c], tangent );
+
+        if( float3::dot( float3::cross( n[c], t ), bitangent ) < 0.0f )
+          t = t * -1.0f;
+
+        float* o = out + ( e + c ) * VERTEX_FLOATS;
+
+        o[0] = v[c].x;
+        o[1] = v[c].y;
+        o[2] = v[c].z;
+
+        o[3] = n[c].x;
+        o[4] = n[c].y;
+        o[5] = n[c].z;
+
+        o[6] = uv[c].x;
+        o[7] = uv[c].y;
+
+        o[8] = t.x;
+        o[9] = t.y;
+        o[10] = t.z;
+
+        o[11] = bitangent.x;
+        o[12] = bitangent.y;
+        o[13] = bitangent.z;
+      }
+    }
+  }
+
+  void TangentBenchmark::print_reports() {
+
+    std::cout << "---------------------------------- tangent kernel ------------------------------------" << std::endl;
+    std::cout << "  simd                  " << ( tangent_kernel::has_simd() ? "SSE" : "scalar" ) << std::endl;
+
+    for( int32_t i = 0; i < m_reports.size(); ++i ) {
+      tangent_report& r = m_reports[i];
+
+      double reference_tri = r.reference_time * 1000000.0 / ( ( double ) r.triangles * r.iterations );
+      double kernel_tri = r.kernel_time * 1000000.0 / ( ( double ) r.triangles * r.iterations );
+
+      std::cout << r.name << std::endl;
+      std::cout << "  triangles/iterations  " << r.triangles << " / " << r.iterations << std::endl;
+      std::cout << "  reference loop        " << r.reference_time << " ms ( " << reference_tri << " ns/tri )" << std::endl;
+      std::cout << "  kernel                " << r.kernel_time << " ms ( " << kernel_tri << " ns/tri )" << std::endl;
+      std::cout << "  speedup               " << r.reference_time / std::max( r.kernel_time, 0.000001 ) << "x" << std::endl;
+      std::cout << "  same vertices         " << ( r.max_difference <= MAX_DIFFERENCE ? "OK" : "FAILED" ) <<
+        " ( " << r.max_difference << " )" << std::endl;
+    }
+
+    std::cout << "--------------------------------------------------------------------------------------" << std::endl;
+  }
+
+  TangentBenchmark::~TangentBenchmark() {
+
+  }
+}
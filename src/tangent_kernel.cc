@@ -0,0 +1,229 @@
+#include "core/tangent_kernel.hh"
+#include "core/math/float3.hh"
+#include "core/math/float2.hh"
+#include <cassert>
+
+// SSE is always there on x64, the scalar path stays for everything else
+#if defined( _M_X64 ) || defined( _M_IX86 ) || defined( __SSE2__ )
+#define TANGENT_SIMD 1
+#include <xmmintrin.h>
+#else
+#define TANGENT_SIMD 0
+#endif
+
+#define VERTEX_FLOATS 14
+
+namespace kretash {
+
+  namespace tangent_kernel {
+
+    static inline void _write( float* out, float px, float py, float pz, float nx, float ny, float nz,
+      float u, float v, float tx, float ty, float tz, float bx, float by, float bz ) {
+
+      out[0] = px;
+      out[1] = py;
+      out[2] = pz;
+
+      out[3] = nx;
+      out[4] = ny;
+      out[5] = nz;
+
+      out[6] = u;
+      out[7] = v;
+
+      out[8] = tx;
+      out[9] = ty;
+      out[10] = tz;
+
+      out[11] = bx;
+      out[12] = by;
+      out[13] = bz;
+    }
+
+    void compute_scalar( const tangent_streams& s, float* out, uint32_t first_triangle ) {
+
+      assert( s.elem_count % 3 == 0 && "ELEMENTS ARE NOT TRIANGLES" );
+
+      for( uint32_t e = first_triangle * 3; e < s.elem_count; e += 3 ) {
+
+        float3 p[3];
+        float3 n[3];
+        float2 uv[3];
+
+        for( uint32_t c = 0; c < 3; ++c ) {
+          uint32_t i = s.elems[e + c];
+          p[c] = float3( s.px[i * s.p_stride], s.py[i * s.p_stride], s.pz[i * s.p_stride] );
+          n[c] = float3( s.nx[i * s.n_stride], s.ny[i * s.n_stride], s.nz[i * s.n_stride] );
+          uv[c] = float2( s.u[i * s.uv_stride], s.v[i * s.uv_stride] );
+        }
+
+        float3 delta_pos1 = p[1] - p[0];
+        float3 delta_pos2 = p[2] - p[0];
+
+        float2 delta_uv1 = uv[1] - uv[0];
+        float2 delta_uv2 = uv[2] - uv[0];
+
+        float r = 1.0f / ( delta_uv1.x * delta_uv2.y - delta_uv1.y * delta_uv2.x );
+        float3 tangent = ( delta_pos1 * delta_uv2.y - delta_pos2 * delta_uv1.y )*r;
+        float3 bitangent = ( delta_pos2 * delta_uv1.x - delta_pos1 * delta_uv2.x )*r;
+
+        for( uint32_t c = 0; c < 3; ++c ) {
+
+          float3 t = tangent - n[c] * float3::dot( n[c], tangent );
+
+          if( float3::dot( float3::cross( n[c], t ), bitangent ) < 0.0f )
+            t = t * -1.0f;
+
+          _write( out + ( e + c ) * VERTEX_FLOATS, p[c].x, p[c].y, p[c].z, n[c].x, n[c].y, n[c].z,
+            uv[c].x, uv[c].y, t.x, t.y, t.z, bitangent.x, bitangent.y, bitangent.z );
+        }
+      }
+    }
+
+#if TANGENT_SIMD
+
+    // one lane per triangle, the corner c of each of the four triangles
+    struct corner4 {
+      __m128 px, py, pz;
+      __m128 nx, ny, nz;
+      __m128 u, v;
+    };
+
+    static inline void _gather( const tangent_streams& s, uint32_t e, uint32_t c, corner4* o ) {
+      uint32_t i0 = s.elems[e + c];
+      uint32_t i1 = s.elems[e + 3 + c];
+      uint32_t i2 = s.elems[e + 6 + c];
+      uint32_t i3 = s.elems[e + 9 + c];
+
+      o->px = _mm_setr_ps( s.px[i0 * s.p_stride], s.px[i1 * s.p_stride], s.px[i2 * s.p_stride], s.px[i3 * s.p_stride] );
+      o->py = _mm_setr_ps( s.py[i0 * s.p_stride], s.py[i1 * s.p_stride], s.py[i2 * s.p_stride], s.py[i3 * s.p_stride] );
+      o->pz = _mm_setr_ps( s.pz[i0 * s.p_stride], s.pz[i1 * s.p_stride], s.pz[i2 * s.p_stride], s.pz[i3 * s.p_stride] );
+
+      o->nx = _mm_setr_ps( s.nx[i0 * s.n_stride], s.nx[i1 * s.n_stride], s.nx[i2 * s.n_stride], s.nx[i3 * s.n_stride] );
+      o->ny = _mm_setr_ps( s.ny[i0 * s.n_stride], s.ny[i1 * s.n_stride], s.ny[i2 * s.n_stride], s.ny[i3 * s.n_stride] );
+      o->nz = _mm_setr_ps( s.nz[i0 * s.n_stride], s.nz[i1 * s.n_stride], s.nz[i2 * s.n_stride], s.nz[i3 * s.n_stride] );
+
+      o->u = _mm_setr_ps( s.u[i0 * s.uv_stride], s.u[i1 * s.uv_stride], s.u[i2 * s.uv_stride], s.u[i3 * s.uv_stride] );
+      o->v = _mm_setr_ps( s.v[i0 * s.uv_stride], s.v[i1 * s.uv_stride], s.v[i2 * s.uv_stride], s.v[i3 * s.uv_stride] );
+    }
+
+    void compute( const tangent_streams& s, float* out ) {
+
+      assert( s.elem_count % 3 == 0 && "ELEMENTS ARE NOT TRIANGLES" );
+
+      const uint32_t triangles = s.elem_count / 3;
+      const uint32_t batches = triangles / 4;
+      const __m128 sign_bit = _mm_set1_ps( -0.0f );
+      const __m128 zero = _mm_setzero_ps();
+      const __m128 one = _mm_set1_ps( 1.0f );
+
+      corner4 k[3];
+
+      for( uint32_t b = 0; b < batches; ++b ) {
+
+        const uint32_t e = b * 12;
+
+        _gather( s, e, 0, &k[0] );
+        _gather( s, e, 1, &k[1] );
+        _gather( s, e, 2, &k[2] );
+
+        __m128 d1x = _mm_sub_ps( k[1].px, k[0].px );
+        __m128 d1y = _mm_sub_ps( k[1].py, k[0].py );
+        __m128 d1z = _mm_sub_ps( k[1].pz, k[0].pz );
+        __m128 d2x = _mm_sub_ps( k[2].px, k[0].px );
+        __m128 d2y = _mm_sub_ps( k[2].py, k[0].py );
+        __m128 d2z = _mm_sub_ps( k[2].pz, k[0].pz );
+
+        __m128 du1 = _mm_sub_ps( k[1].u, k[0].u );
+        __m128 dv1 = _mm_sub_ps( k[1].v, k[0].v );
+        __m128 du2 = _mm_sub_ps( k[2].u, k[0].u );
+        __m128 dv2 = _mm_sub_ps( k[2].v, k[0].v );
+
+        __m128 r = _mm_div_ps( one, _mm_sub_ps( _mm_mul_ps( du1, dv2 ), _mm_mul_ps( dv1, du2 ) ) );
+
+        __m128 tx = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( d1x, dv2 ), _mm_mul_ps( d2x, dv1 ) ), r );
+        __m128 ty = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( d1y, dv2 ), _mm_mul_ps( d2y, dv1 ) ), r );
+        __m128 tz = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( d1z, dv2 ), _mm_mul_ps( d2z, dv1 ) ), r );
+
+        __m128 bx = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( d2x, du1 ), _mm_mul_ps( d1x, du2 ) ), r );
+        __m128 by = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( d2y, du1 ), _mm_mul_ps( d1y, du2 ) ), r );
+        __m128 bz = _mm_mul_ps( _mm_sub_ps( _mm_mul_ps( d2z, du1 ), _mm_mul_ps( d1z, du2 ) ), r );
+
+        for( uint32_t c = 0; c < 3; ++c ) {
+
+          const corner4& n = k[c];
+
+          // Gram-Schmidt against the corner normal
+          __m128 d = _mm_add_ps( _mm_add_ps( _mm_mul_ps( n.nx, tx ), _mm_mul_ps( n.ny, ty ) ), _mm_mul_ps( n.nz, tz ) );
+          __m128 ox = _mm_sub_ps( tx, _mm_mul_ps( n.nx, d ) );
+          __m128 oy = _mm_sub_ps( ty, _mm_mul_ps( n.ny, d ) );
+          __m128 oz = _mm_sub_ps( tz, _mm_mul_ps( n.nz, d ) );
+
+          // flip when cross( n, t ) points away from the bitangent
+          __m128 cx = _mm_sub_ps( _mm_mul_ps( n.ny, oz ), _mm_mul_ps( n.nz, oy ) );
+          __m128 cy = _mm_sub_ps( _mm_mul_ps( n.nz, ox ), _mm_mul_ps( n.nx, oz ) );
+          __m128 cz = _mm_sub_ps( _mm_mul_ps( n.nx, oy ), _mm_mul_ps( n.ny, ox ) );
+          __m128 h = _mm_add_ps( _mm_add_ps( _mm_mul_ps( cx, bx ), _mm_mul_ps( cy, by ) ), _mm_mul_ps( cz, bz ) );
+          __m128 flip = _mm_and_ps( _mm_cmplt_ps( h, zero ), sign_bit );
+
+          ox = _mm_xor_ps( ox, flip );
+          oy = _mm_xor_ps( oy, flip );
+          oz = _mm_xor_ps( oz, flip );
+
+          // transpose back to one 14 float vertex per lane
+          __m128 r0 = n.px, r1 = n.py, r2 = n.pz, r3 = n.nx;
+          _MM_TRANSPOSE4_PS( r0, r1, r2, r3 );
+          __m128 r4 = n.ny, r5 = n.nz, r6 = n.u, r7 = n.v;
+          _MM_TRANSPOSE4_PS( r4, r5, r6, r7 );
+          __m128 r8 = ox, r9 = oy, r10 = oz, r11 = bx;
+          _MM_TRANSPOSE4_PS( r8, r9, r10, r11 );
+          __m128 r12 = by, r13 = bz, r14 = zero, r15 = zero;
+          _MM_TRANSPOSE4_PS( r12, r13, r14, r15 );
+
+          float* o0 = out + ( e + c ) * VERTEX_FLOATS;
+          float* o1 = out + ( e + 3 + c ) * VERTEX_FLOATS;
+          float* o2 = out + ( e + 6 + c ) * VERTEX_FLOATS;
+          float* o3 = out + ( e + 9 + c ) * VERTEX_FLOATS;
+
+          _mm_storeu_ps( o0, r0 );
+          _mm_storeu_ps( o0 + 4, r4 );
+          _mm_storeu_ps( o0 + 8, r8 );
+          _mm_storel_pi( ( __m64* ) ( o0 + 12 ), r12 );
+
+          _mm_storeu_ps( o1, r1 );
+          _mm_storeu_ps( o1 + 4, r5 );
+          _mm_storeu_ps( o1 + 8, r9 );
+          _mm_storel_pi( ( __m64* ) ( o1 + 12 ), r13 );
+
+          _mm_storeu_ps( o2, r2 );
+          _mm_storeu_ps( o2 + 4, r6 );
+          _mm_storeu_ps( o2 + 8, r10 );
+          _mm_storel_pi( ( __m64* ) ( o2 + 12 ), r14 );
+
+          _mm_storeu_ps( o3, r3 );
+          _mm_storeu_ps( o3 + 4, r7 );
+          _mm_storeu_ps( o3 + 8, r11 );
+          _mm_storel_pi( ( __m64* ) ( o3 + 12 ), r15 );
+        }
+      }
+
+      compute_scalar( s, out, batches * 4 );
+    }
+
+    bool has_simd() {
+      return true;
+    }
+
+#else
+
+    void compute( const tangent_streams& s, float* out ) {
+      compute_scalar( s, out, 0 );
+    }
+
+    bool has_simd() {
+      return false;
+    }
+
+#endif
+  }
+}
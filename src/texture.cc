@@ -4,6 +4,7 @@
 #include "core/texture.hh"
 #include "core/engine.hh"
 #include "core/factory.h"
+#include "core/swap_cache.hh"
 #include <iostream>
 
 #define STB_IMAGE_IMPLEMENTATION 1
@@ -32,6 +33,9 @@ namespace kretash {
   }
 
   void Texture::init_procedural( float seed_x, float seed_y, uint8_t LOD ) {
+    // pixels kept for the last seed would come back on the next API swap
+    k_engine->get_swap_cache()->forget_texture( this );
+
     m_seed_x = seed_x;
     m_seed_y = seed_y;
     m_LOD = LOD;
@@ -4,12 +4,16 @@
 #include "core/texture.hh"
 #include "core/tools.hh"
 #include "core/engine.hh"
+#include "core/swap_cache.hh"
 #include "core/vk/texture.hh"
 #include "core/dx/texture.hh"
 #include <cassert>
 
 #include "noise/PerlinNoise.h"
 
+// CPU texture memory between generate and gather, the texture manager stops asking for more past this
+#define GENERATED_TEXTURE_BUDGET ( ( uint64_t ) 1024 * ( uint64_t ) 1024 * ( uint64_t ) 96 )
+
 namespace kretash {
 
   using namespace tools;
@@ -82,6 +86,7 @@ namespace kretash {
   TextureGenerator::TextureGenerator() {
 
     m_exit_all_threads.store( false );
+    m_queued_bytes.store( 0 );
 
     for( int i = 0; i < 3; ++i )
       m_threads.push_back( std::thread( &TextureGenerator::_thread_generate, this ) );
@@ -91,6 +96,9 @@ namespace kretash {
     if( desc->m_ready.load() ) {
       desc->m_ready.store( false );
 
+      for( int32_t e = tDIFFUSE; e < tCOUNT; ++e )
+        m_queued_bytes += desc->m_width[e] * desc->m_height[e] * 4;
+
       m_queue_mutex.lock();
       m_generate_queue.push_back( desc );
       m_queue_mutex.unlock();
@@ -99,6 +107,12 @@ namespace kretash {
     }
   }
 
+  // Always lets one texture through so an empty queue never stalls
+  bool TextureGenerator::can_queue( uint64_t bytes ) {
+    uint64_t queued = m_queued_bytes.load();
+    return queued == 0 || queued + bytes <= GENERATED_TEXTURE_BUDGET;
+  }
+
   bool TextureGenerator::texture_ready( Texture* desc ) {
     return desc->m_ready.load();
   }
@@ -118,6 +132,8 @@ namespace kretash {
 #if 1
     desc->clear();
 
+    uint64_t bytes = 0;
+
     int32_t texture_start = tDIFFUSE;
     int32_t texture_end = tCOUNT;
     for( int32_t e = texture_start; e < texture_end; ++e ) {
@@ -143,8 +159,19 @@ namespace kretash {
       desc->get_texture( tt )->create_shader_resource_view( k_engine->get_renderer( rTEXTURE )->get_renderer(),
         desc->m_future_texture_id[e], desc->get_channels( tt ) );
 
+      // create_texture copied it into upload memory, the CPU copy only stays for the next API swap
+      bytes += desc->m_width[e] * desc->m_height[e] * 4;
+      if( k_engine->get_swap_cache()->store_texture( desc, tt,
+        ( unsigned char* ) desc->get_texture_pointer( tt ), w, h, c, desc->get_LOD() ) )
+        desc->m_texture_pointer[tt] = nullptr;
+      else
+        desc->delete_texture( tt );
     }
 
+    // textures queued on a generator that got replaced were never counted on this one
+    uint64_t queued = m_queued_bytes.load();
+    while( !m_queued_bytes.compare_exchange_weak( queued, queued > bytes ? queued - bytes : 0 ) ) {}
+
 #endif
   }
 
@@ -1,5 +1,6 @@
 #include "core/texture_manager.hh"
 #include "core/texture_generator.hh"
+#include "core/asset_registry.hh"
 #include "core/engine_settings.hh"
 #include "core/texture.hh"
 #include "core/engine.hh"
@@ -9,8 +10,8 @@
 #include "core/dx/texture.hh"
 #include "core/drawable.hh"
 #include "core/renderer.hh"
-#include "stb/stb_image.h"
 #include "core/pool.hh"
+#include "core/swap_cache.hh"
 
 #include <algorithm>
 #include <cassert>
@@ -42,6 +43,7 @@ namespace kretash {
 
   TextureManager::TextureManager() {
     m_texture_generator = std::make_shared<TextureGenerator>();
+    m_assets = std::make_shared<AssetRegistry>();
 
     for( int i = 0; i < MAX_TEXTURES; ++i )
       m_free_ids.push_back( i );
@@ -68,7 +70,8 @@ namespace kretash {
 
     m_context->reset_texture_command_list();
 
-    _generate_placeholder_texture();
+    if( m_placeholder_texture == nullptr ) generate_placeholder();
+    m_texture_generator->gather_texture( m_placeholder_texture.get() );
 
     int32_t texture_start = tDIFFUSE;
     int32_t texture_end = tCOUNT;
@@ -78,49 +81,15 @@ namespace kretash {
 
         Texture* c_t = m_drawables[i]->get_texture();
 
+        // a file seen before only hands out its id, a new one takes an id and waits to be decoded
         for( int32_t e = texture_start; e < texture_end; ++e ) {
 
-          bool found = false;
           texture_t tt = static_cast< texture_t >( e );
+          bool created = false;
+          texture_asset* a = m_assets->acquire_texture( c_t->get_filename( tt ), c_t, tt, &created );
 
-          for( int e = 0; e < m_texture_db.size(); ++e ) {
-            if( c_t->get_filename( tt ) == m_texture_db[e].filename ) {
-              c_t->set_id( tt, m_texture_db[e].id );
-              found = true;
-              break;
-            }
-          }
-
-          if( found ) continue;
-
-          std::string path = TPATH;
-          path.append( c_t->get_filename( tt ) );
-
-          unsigned char* image = stbi_load( path.c_str(),
-            c_t->get_width_ref( tt ), c_t->get_height_ref( tt ), c_t->get_channels_ref( tt ), 4 );
-
-          assert( image != nullptr && "IMAGE NOT FOUND" );
-
-          c_t->new_texture( tt );
-          c_t->copy_data( tt, image );
-          stbi_image_free( image );
-
-          int32_t w = c_t->get_width( tt );
-          int32_t h = c_t->get_height( tt );
-          int32_t c = c_t->get_channels( tt );
-
-          c_t->get_texture( tt )->create_texture( c_t->get_texture_pointer( tt ), w, h, c );
-
-          auto id_begin = m_free_ids.begin();
-          int32_t offset = *id_begin._Ptr;
-          m_free_ids.erase( id_begin );
-
-          c_t->get_texture( tt )->create_shader_resource_view( k_engine->get_renderer( rTEXTURE )->get_renderer(),
-            offset, 4 );
-
-          c_t->set_id( tt, offset );
-          m_texture_db.push_back( texture_db( c_t->get_filename( tt ), offset ) );
-
+          if( created ) a->id = _get_new_id();
+          c_t->set_id( tt, a->id );
         }
       } else if( m_drawables[i]->get_texture()->get_type() == tPROCEDURAL_TEXTURE ) {
 
@@ -134,6 +103,14 @@ namespace kretash {
       }
     }
 
+  }
+
+  void TextureManager::create_file_textures() {
+
+    xxContext* m_context = k_engine->get_context();
+
+    m_assets->create_decoded( [this] ( texture_asset* a ) { _create_file_texture( a ); } );
+
     m_context->compute_texture_upload();
     m_context->wait_for_texture_upload();
 
@@ -147,7 +124,7 @@ namespace kretash {
   }
 
   //should be synced
-  void TextureManager::regenerate() {
+  void TextureManager::regenerate( bool reuse_pixels ) {
 
     m_exit_thread.store( true );
     m_threads[0].join();
@@ -157,7 +134,8 @@ namespace kretash {
     m_texture_generator = nullptr;
     m_texture_generator = std::make_shared<TextureGenerator>();
 
-    m_texture_db.clear();
+    // The old context is gone, nothing can be reading these textures anymore
+    _release_retired_textures( true );
 
     m_device_memory_free = k_engine->get_device_pool_size();
     m_host_visible_memory_free = k_engine->get_host_visible_pool_size();
@@ -172,28 +150,45 @@ namespace kretash {
 
     m_context->reset_texture_command_list();
 
-    m_placeholder_texture->clear();
-    m_placeholder_texture->clear_upload();
-    m_placeholder_texture->delete_texture( tDIFFUSE );
-    m_placeholder_texture->delete_texture( tNORMAL );
-    m_placeholder_texture->delete_texture( tSPECULAR );
-    m_placeholder_texture->new_texture( tDIFFUSE );
-    m_placeholder_texture->new_texture( tNORMAL );
-    m_placeholder_texture->new_texture( tSPECULAR );
-
-    m_texture_generator->generate( m_placeholder_texture.get() );
-    while( !m_texture_generator->texture_ready( m_placeholder_texture.get() ) ){
-      std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );      
+    // an API swap only uploads what the last context had, asking for new textures throws them away
+    if( !reuse_pixels ) k_engine->get_swap_cache()->forget_textures();
+
+    bool placeholder_restored = _restore_texture( m_placeholder_texture.get() );
+    if( !placeholder_restored ) {
+      m_placeholder_texture->clear();
+      m_placeholder_texture->clear_upload();
+      m_placeholder_texture->delete_texture( tDIFFUSE );
+      m_placeholder_texture->delete_texture( tNORMAL );
+      m_placeholder_texture->delete_texture( tSPECULAR );
+      m_placeholder_texture->new_texture( tDIFFUSE );
+      m_placeholder_texture->new_texture( tNORMAL );
+      m_placeholder_texture->new_texture( tSPECULAR );
+
+      m_texture_generator->generate( m_placeholder_texture.get() );
     }
 
-    int32_t base_upload = 0;
-    int32_t upload_limit = 0;
+    // the files and their ids are known already, each one is created once more on its owner
+    m_assets->requeue_all();
+    m_assets->decode_queued( [this] ( texture_asset* a ) { _create_file_texture( a ); } );
 
-    for( int32_t i = base_upload; i < m_textured_drawables.size(); ++i ) {
+    if( !placeholder_restored ) m_texture_generator->gather_texture( m_placeholder_texture.get() );
 
-      Texture* c_t = m_textured_drawables[i]->get_texture();
+    // Kept textures go straight to the upload, the rest are generated a batch at a time
+    size_t next = 0;
+    while( true ) {
+      std::vector<Texture*> to_gather;
+      int32_t batch = 0;
+
+      for( ; next < m_textured_drawables.size() && batch < SWAP_UPLOAD_TEXTURES; ++next ) {
 
-      if( c_t->get_type() == tPROCEDURAL_TEXTURE ) {
+        Texture* c_t = m_textured_drawables[next]->get_texture();
+        if( c_t->get_type() != tPROCEDURAL_TEXTURE ) continue;
+        ++batch;
+
+        if( _restore_texture( c_t ) ) {
+          m_clean_up_textures.push_back( c_t );
+          continue;
+        }
 
         c_t->clear();
         c_t->clear_upload();
@@ -206,140 +201,79 @@ namespace kretash {
         c_t->new_texture( tSPECULAR );
 
         m_texture_generator->generate( c_t );
-
-        if( upload_limit++ > SWAP_UPLOAD_TEXTURES ) break;
+        to_gather.push_back( c_t );
       }
-    }
-
-    for( int32_t e = 0; e < m_drawables.size(); ++e ) {
-      if( m_drawables[e]->get_texture()->get_type() == tFILE_TEXTURE ) {
-
-        Texture* c_t = m_drawables[e]->get_texture();
-        int32_t texture_start = tDIFFUSE;
-        int32_t texture_end = tCOUNT;
-
-        for( int32_t o = texture_start; o < texture_end; ++o ) {
-          bool found = false;
-          texture_t tt = static_cast< texture_t >( o );
-
-          for( int u = 0; u < m_texture_db.size(); ++u ) {
-            if( c_t->get_filename( tt ) == m_texture_db[u].filename ) {
-              c_t->set_id( tt, m_texture_db[u].id );
-              found = true;
-              break;
-            }
-          }
-
-          if( found ) continue;
 
-          std::string path = TPATH;
-          path.append( c_t->get_filename( tt ) );
-
-          unsigned char* image = stbi_load( path.c_str(),
-            c_t->get_width_ref( tt ), c_t->get_height_ref( tt ), c_t->get_channels_ref( tt ), 4 );
-
-          assert( image != nullptr && "IMAGE NOT FOUND" );
-
-          //could just remove both, but I think this looks more clear
-          c_t->delete_texture( tt );
-          c_t->new_texture( tt );
-
-          c_t->copy_data( tt, image );
-          stbi_image_free( image );
-
-          int32_t w = c_t->get_width( tt );
-          int32_t h = c_t->get_height( tt );
-          int32_t c = c_t->get_channels( tt );
-
-          c_t->get_texture( tt )->create_texture( c_t->get_texture_pointer( tt ), w, h, c );
-
-          c_t->get_texture( tt )->create_shader_resource_view(
-            k_engine->get_renderer( rTEXTURE )->get_renderer(), c_t->get_id( tt ), 4 );
-
-          m_texture_db.push_back( texture_db( c_t->get_filename( tt ), c_t->get_id( tt ) ) );
-        }
+      for( int i = 0; i < to_gather.size(); ++i ) {
+        m_texture_generator->gather_texture( to_gather[i] );
+        m_clean_up_textures.push_back( to_gather[i] );
       }
-    }
-
-    m_texture_generator->gather_texture( m_placeholder_texture.get() );
-
-    //upload_limit = base_upload;
-    upload_limit = 0;
-
-    for( int i = base_upload; i < m_textured_drawables.size(); ++i ) {
 
-      Texture* c_t = m_textured_drawables[i]->get_texture();
-
-      if( c_t->get_type() == tPROCEDURAL_TEXTURE ) {
-        m_texture_generator->gather_texture( c_t );
-        m_clean_up_textures.push_back( c_t );
-        if( upload_limit++ > SWAP_UPLOAD_TEXTURES ) break;
-      } else {
+      m_context->compute_texture_upload();
+      m_context->wait_for_texture_upload();
+      _clean_up_textures();
 
-      }
+      if( next >= m_textured_drawables.size() ) break;
+      m_context->reset_texture_command_list();
     }
 
-    base_upload += upload_limit;
-    upload_limit = 0;
+    m_exit_thread.store( false );
+    m_upload_textures.store( false );
+    m_threads.push_back( std::thread( &TextureManager::_upload_generated_textures, this ) );
+  }
 
-    m_context->compute_texture_upload();
-    m_context->wait_for_texture_upload();
-    _clean_up_textures();
+  // The pixels the last context got, handed to this one without generating them again
+  bool TextureManager::_restore_texture( Texture* t ) {
 
-    while( true ) {
-      m_context->reset_texture_command_list();
-      std::vector<Texture*> to_gather;
+    cached_texture cached;
+    if( !k_engine->get_swap_cache()->find_texture( t, t->get_LOD(), &cached ) ) return false;
 
-      for( int i = base_upload; i < m_textured_drawables.size(); ++i ) {
+    t->apply_future_ids();
+    t->clear();
+    t->clear_upload();
 
-        Texture* c_t = m_textured_drawables[i]->get_texture();
+    for( int32_t e = tDIFFUSE; e < tCOUNT; ++e ) {
 
-        if( c_t->get_type() == tPROCEDURAL_TEXTURE ) {
+      texture_t tt = static_cast< texture_t >( e );
+      *t->get_width_ref( tt ) = cached.width[e];
+      *t->get_height_ref( tt ) = cached.height[e];
+      *t->get_channels_ref( tt ) = cached.channels[e];
 
-          c_t->clear();
-          c_t->clear_upload();
-          c_t->delete_texture( tDIFFUSE );
-          c_t->delete_texture( tNORMAL );
-          c_t->delete_texture( tSPECULAR );
+      t->get_texture( tt )->create_texture( cached.pixels[e], cached.width[e], cached.height[e], cached.channels[e] );
+      t->get_texture( tt )->create_shader_resource_view( k_engine->get_renderer( rTEXTURE )->get_renderer(),
+        t->get_id( tt ), cached.channels[e] );
+    }
 
-          c_t->new_texture( tDIFFUSE );
-          c_t->new_texture( tNORMAL );
-          c_t->new_texture( tSPECULAR );
+    k_engine->get_swap_cache()->count_restored_texture();
+    return true;
+  }
 
-          m_texture_generator->generate( c_t );
-          to_gather.push_back( c_t );
+  // The decoded file goes into its owner's texture, every other user already has the id
+  void TextureManager::_create_file_texture( texture_asset* a ) {
 
-          if( upload_limit++ > SWAP_UPLOAD_TEXTURES ) break;
-        }
-      }
-      
-      for( int i = 0; i < to_gather.size(); ++i ) {
+    assert( a->pixels != nullptr && "IMAGE NOT FOUND" );
 
-          Texture* c_t = to_gather[i];
-          m_texture_generator->gather_texture( c_t );
-          m_clean_up_textures.push_back( c_t );
+    Texture* c_t = a->owner;
+    texture_t tt = a->type;
+    *c_t->get_width_ref( tt ) = a->width;
+    *c_t->get_height_ref( tt ) = a->height;
+    *c_t->get_channels_ref( tt ) = a->channels;
 
-      }
+    //could just remove both, but I think this looks more clear
+    c_t->delete_texture( tt );
+    c_t->new_texture( tt );
+    c_t->copy_data( tt, a->pixels );
 
-      to_gather.clear();
-      base_upload += upload_limit;
-      upload_limit = 0;
+    int32_t w = c_t->get_width( tt );
+    int32_t h = c_t->get_height( tt );
+    int32_t c = c_t->get_channels( tt );
 
-      m_context->compute_texture_upload();
-      m_context->wait_for_texture_upload();
-      _clean_up_textures();
-      
-      if( base_upload >= m_textured_drawables.size() ){
-        break;
-      }
-    }
-
-    m_exit_thread.store( false );
-    m_upload_textures.store( false );
-    m_threads.push_back( std::thread( &TextureManager::_upload_generated_textures, this ) );
+    c_t->get_texture( tt )->create_texture( c_t->get_texture_pointer( tt ), w, h, c );
+    c_t->get_texture( tt )->create_shader_resource_view( k_engine->get_renderer( rTEXTURE )->get_renderer(),
+      a->id, 4 );
   }
 
-  void TextureManager::_generate_placeholder_texture() {
+  void TextureManager::generate_placeholder() {
 
     m_placeholder_texture = std::make_shared<Texture>();
 
@@ -354,7 +288,9 @@ namespace kretash {
     m_placeholder_texture->new_texture( tSPECULAR );
 
     m_texture_generator->generate( m_placeholder_texture.get() );
-    m_texture_generator->gather_texture( m_placeholder_texture.get() );
+    while( !m_texture_generator->texture_ready( m_placeholder_texture.get() ) ) {
+      std::this_thread::sleep_for( std::chrono::milliseconds( 2 ) );
+    }
 
   }
 
@@ -363,6 +299,7 @@ namespace kretash {
     static bool update_current_textures = false;
     update_current_textures = !update_current_textures;
 
+    _release_retired_textures( false );
     _clean_up_textures();
 
     if( !update_current_textures ) {
@@ -540,6 +477,8 @@ namespace kretash {
       free_memory &= m_device_memory_free > size * ADD_SIZE_MULTIPLIER;
 
       bool free_ids = m_free_ids.size() > 2;
+      if( !m_texture_generator->can_queue( size * tCOUNT ) ) break;
+
       bool close = m_non_textured_drawables[i]->get_distance() < LOD_1_THRESHOLD;
       bool active = m_non_textured_drawables[i]->get_active();
       
@@ -600,6 +539,8 @@ namespace kretash {
 
       if( free_memory && LOD != c_t->get_LOD() && m_textured_drawables[i]->get_active() ) {
 
+        if( !m_texture_generator->can_queue( size * tCOUNT ) ) break;
+
         c_t->set_LOD( LOD );
         c_t->new_texture( tDIFFUSE );
         c_t->new_texture( tNORMAL );
@@ -645,19 +586,20 @@ namespace kretash {
       t->get_texture( tNORMAL )->clear_descriptor_set( m_placeholder_texture->get_texture( tNORMAL ), t->get_id( tNORMAL ) );
       t->get_texture( tSPECULAR )->clear_descriptor_set( m_placeholder_texture->get_texture( tSPECULAR ), t->get_id( tSPECULAR ) );
 
-      ( *i._Ptr )->get_texture()->clear();
-
-      m_free_ids.push_back( ( *i._Ptr )->get_texture()->get_id( tDIFFUSE ) );
-      m_free_ids.push_back( ( *i._Ptr )->get_texture()->get_id( tNORMAL ) );
-      m_free_ids.push_back( ( *i._Ptr )->get_texture()->get_id( tSPECULAR ) );
-
+      // The texture and its ids are released once the frames using them retire
+      retiring_texture r = {};
+      r.drawable = ( *i._Ptr );
+      r.ids[0] = t->get_id( tDIFFUSE );
+      r.ids[1] = t->get_id( tNORMAL );
+      r.ids[2] = t->get_id( tSPECULAR );
+      r.frame = k_engine->get_frame();
+      m_retiring_textures.push_back( r );
 
       ( *i._Ptr )->get_texture()->set_placeholder(
         m_placeholder_texture->get_id( tDIFFUSE ),
         m_placeholder_texture->get_id( tNORMAL ),
         m_placeholder_texture->get_id( tSPECULAR ) );
 
-      m_non_textured_drawables.push_back( ( *i._Ptr ) );
       i = m_textured_drawables.erase( i );
       ++cleared;
 
@@ -665,9 +607,46 @@ namespace kretash {
 
     }
 
-    xxContext* m_context = k_engine->get_context();
-    m_context->defrag_device_memory_pool();
+  }
+
+  void TextureManager::_release_retired_textures( bool flush ) {
+
+    if( m_retiring_textures.size() == 0 ) return;
+
+    uint64_t completed_frame = k_engine->get_completed_frame();
+    int32_t released = 0;
+
+    auto i = m_retiring_textures.begin();
+    while( i != m_retiring_textures.end() ) {
+
+      if( flush || i->frame <= completed_frame ) {
+
+        i->drawable->get_texture()->clear();
+        k_engine->get_swap_cache()->forget_texture( i->drawable->get_texture() );
+
+        m_free_ids.push_back( i->ids[0] );
+        m_free_ids.push_back( i->ids[1] );
+        m_free_ids.push_back( i->ids[2] );
+
+        m_non_textured_drawables.push_back( i->drawable );
+        i = m_retiring_textures.erase( i );
+        ++released;
+
+      } else {
+        ++i;
+      }
+    }
+
+    if( released != 0 ) {
+      xxContext* m_context = k_engine->get_context();
+      m_context->defrag_device_memory_pool();
+    }
+
+  }
 
+  uint64_t TextureManager::get_generated_texture_bytes() {
+    if( m_texture_generator == nullptr ) return 0;
+    return m_texture_generator->get_queued_bytes();
   }
 
   int32_t TextureManager::_get_new_id() {
@@ -358,6 +358,30 @@ namespace kretash {
     vkassert( vkr );
   }
 
+  /* This will create the frame fence and the present semaphore in Vulkan */
+  void vkContext::create_fences() {
+
+    VkFenceCreateInfo fence_create_info = {};
+    fence_create_info.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+    fence_create_info.pNext = nullptr;
+    fence_create_info.flags = VK_FLAGS_NONE;
+
+    VkResult vkr = vkCreateFence( m_device, &fence_create_info, nullptr, &m_frame_fence );
+    vkassert( vkr );
+
+    VkSemaphoreCreateInfo semaphore_create_info = {};
+    semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
+    semaphore_create_info.pNext = nullptr;
+    semaphore_create_info.flags = VK_FLAGS_NONE;
+
+    vkr = vkCreateSemaphore( m_device, &semaphore_create_info, nullptr, &m_present_complete_semaphore );
+    vkassert( vkr );
+
+    m_submitted_frame = 0;
+    m_completed_frame = 0;
+
+  }
+
   /* This will wait for all setup actions to be completed */
   void vkContext::wait_for_setup_completion() {
 
@@ -460,21 +484,45 @@ namespace kretash {
     vkr = vkCreatePipelineLayout( m_device, &pipeline_layout_create, nullptr, &m_pipeline_layout );
     vkassert( vkr );
 
+    //Instance stream, the instanced pipeline reads it in place of the instance buffer
+    VkDescriptorSetLayoutBinding stream_binding = {};
+    stream_binding.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    stream_binding.descriptorCount = 1;
+    stream_binding.stageFlags = VK_SHADER_STAGE_VERTEX_BIT;
+    stream_binding.pImmutableSamplers = nullptr;
+    stream_binding.binding = 0;
+
+    descriptor_layout.pBindings = &stream_binding;
+    descriptor_layout.bindingCount = 1;
+    vkr = vkCreateDescriptorSetLayout( m_device, &descriptor_layout, nullptr, &m_stream_descriptor_set_layout );
+    vkassert( vkr );
+
+    VkDescriptorSetLayout instanced_dsl[2] = { m_stream_descriptor_set_layout, m_constant_descriptor_set_layout };
+    pipeline_layout_create.pSetLayouts = instanced_dsl;
+
+    vkr = vkCreatePipelineLayout( m_device, &pipeline_layout_create, nullptr, &m_instanced_pipeline_layout );
+    vkassert( vkr );
+
   }
 
   /* This will create descriptor pool in Vulkan and do nothing in D3D12 */
   void vkContext::create_descriptor_pool() {
 
-    VkDescriptorPoolSize type_counts[2];
+    VkDescriptorPoolSize type_counts[3];
     type_counts[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
     type_counts[0].descriptorCount = 1;
     type_counts[1].type = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
     type_counts[1].descriptorCount = 1;
+    // one instance stream per renderer at most
+    type_counts[2].type = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    type_counts[2].descriptorCount = rCOUNT;
 
+    // the instance stream sets are freed with their renderer
     VkDescriptorPoolCreateInfo descriptor_pool_info = {};
     descriptor_pool_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
     descriptor_pool_info.pNext = nullptr;
-    descriptor_pool_info.poolSizeCount = 2;
+    descriptor_pool_info.flags = VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT;
+    descriptor_pool_info.poolSizeCount = 3;
     descriptor_pool_info.pPoolSizes = type_counts;
     descriptor_pool_info.maxSets = k_engine->get_total_drawables() + m_max_textures + 16;
 
@@ -651,31 +699,7 @@ namespace kretash {
   void vkContext::record_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) {
 
     int32_t cb = 0;
-
-    VkViewport viewport = {};
-    viewport.width = ( float ) w->get_width();
-    viewport.height = ( float ) w->get_height();
-    viewport.minDepth = ( float )0.0f;
-    viewport.maxDepth = ( float )1.0f;
-    vkCmdSetViewport( m_draw_command_buffers[cb], 0, 1, &viewport );
-
-    VkRect2D scissor = {};
-    scissor.extent.width = w->get_width();
-    scissor.extent.height = w->get_height();
-    scissor.offset.x = 0;
-    scissor.offset.y = 0;
-    vkCmdSetScissor( m_draw_command_buffers[cb], 0, 1, &scissor );
-
-    vkRenderer* m_renderer = dynamic_cast< vkRenderer* >( r );
-
-    vkCmdBindPipeline( m_draw_command_buffers[cb], VK_PIPELINE_BIND_POINT_GRAPHICS, m_renderer->m_pipeline );
-
-    vkGeometry* m_geometry = dynamic_cast< vkGeometry* >( k_engine->get_GPU_pool()->get_xx_geometry() );
-
-    VkDeviceSize offsets[1] = { 0 };
-    vkCmdBindVertexBuffers( m_draw_command_buffers[cb], 0, 1, &m_geometry->m_v_buf, offsets );
-
-    vkCmdBindIndexBuffer( m_draw_command_buffers[cb], m_geometry->m_i_buf, 0, VK_INDEX_TYPE_UINT32 );
+    _bind_draw_state( r, w, cb );
 
     VkDescriptorSet ds[2] = {};
     ds[1] = m_constant_descriptor_set;
@@ -701,9 +725,68 @@ namespace kretash {
   }
 
   /* This will record indirect commands list in D3D12 and normal ones in Vulkan */
-  void vkContext::record_indirect_commands( xxRenderer* r, Window* w, Drawable** draw, uint32_t d_count ) {
-    //Just call the normal render function in Vulkan
-    record_commands( r, w, draw, d_count );
+  void vkContext::record_indirect_commands( xxRenderer* r, Window* w, draw_range* ranges, uint32_t r_count ) {
+
+    int32_t cb = 0;
+    _bind_draw_state( r, w, cb );
+
+    VkDescriptorSet ds[2] = {};
+    ds[1] = m_constant_descriptor_set;
+
+    Drawable* bound = nullptr;
+
+    uint32_t count = 0;
+    for( count; count < r_count; ++count ) {
+
+      Drawable* d = ranges[count].drawable;
+
+      // the ranges of a drawable come together, its descriptors are bound once
+      if( d != bound ) {
+        vkDrawable* m_drawable = dynamic_cast< vkDrawable* >( d->get_drawable() );
+
+        ds[0] = m_drawable->m_descriptor_set;
+
+        vkCmdBindDescriptorSets( m_draw_command_buffers[cb], VK_PIPELINE_BIND_POINT_GRAPHICS, m_pipeline_layout,
+          0, 2, &ds[0], 0, nullptr );
+        bound = d;
+      }
+
+      vkCmdDrawIndexed( m_draw_command_buffers[cb],
+        ranges[count].index_count,
+        1,
+        d->get_geometry()->get_indicies_offset() + ranges[count].first_index,
+        d->get_geometry()->get_vertex_offset() / m_stride,
+        1 );
+
+    }
+  }
+
+  /* This will record one instanced draw per batch in Vulkan and D3D12 */
+  void vkContext::record_instanced_commands( xxRenderer* r, Window* w, instance_batch* batches, uint32_t b_count ) {
+
+    int32_t cb = 0;
+    _bind_draw_state( r, w, cb, true );
+
+    vkRenderer* m_renderer = dynamic_cast< vkRenderer* >( r );
+
+    VkDescriptorSet ds[2] = {};
+    ds[0] = m_renderer->m_stream_descriptor_set;
+    ds[1] = m_constant_descriptor_set;
+
+    vkCmdBindDescriptorSets( m_draw_command_buffers[cb], VK_PIPELINE_BIND_POINT_GRAPHICS, m_instanced_pipeline_layout,
+      0, 2, &ds[0], 0, nullptr );
+
+    // gl_InstanceIndex starts at firstInstance, the whole stream stays bound
+    for( uint32_t i = 0; i < b_count; ++i ) {
+      Geometry* g = batches[i].geometry;
+
+      vkCmdDrawIndexed( m_draw_command_buffers[cb],
+        g->get_indicies_count(),
+        batches[i].instance_count,
+        g->get_indicies_offset(),
+        g->get_vertex_offset() / m_stride,
+        batches[i].first_instance );
+    }
   }
 
   /* This will execute the command list in Vulkan and D3D12 */
@@ -735,22 +818,14 @@ namespace kretash {
     VkResult vkr = vkEndCommandBuffer( m_draw_command_buffers[0] );
     vkassert( vkr );
 
-    VkSemaphore present_complete_semaphore;
-    VkSemaphoreCreateInfo prenset_complete_semaphore_create_info = {};
-    prenset_complete_semaphore_create_info.sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO;
-    prenset_complete_semaphore_create_info.pNext = nullptr;
-    prenset_complete_semaphore_create_info.flags = VK_FENCE_CREATE_SIGNALED_BIT;
-
-    vkr = vkCreateSemaphore( m_device, &prenset_complete_semaphore_create_info, nullptr, &present_complete_semaphore );
-    vkassert( vkr );
-
-    vkr = m_swap_chain.acquireNextImage( present_complete_semaphore, &m_current_buffer );
+    // The semaphore is reused every frame, the previous frame has been waited on by now
+    vkr = m_swap_chain.acquireNextImage( m_present_complete_semaphore, &m_current_buffer );
     vkassert( vkr );
 
     VkSubmitInfo submit_info = {};
     submit_info.sType = VK_STRUCTURE_TYPE_SUBMIT_INFO;
     submit_info.waitSemaphoreCount = 1;
-    submit_info.pWaitSemaphores = &present_complete_semaphore;
+    submit_info.pWaitSemaphores = &m_present_complete_semaphore;
     submit_info.commandBufferCount = 1;
     submit_info.pCommandBuffers = &m_draw_command_buffers[0];
 
@@ -760,8 +835,6 @@ namespace kretash {
     vkr = m_swap_chain.queuePresent( m_queue, m_current_buffer );
     vkassert( vkr );
 
-    vkDestroySemaphore( m_device, present_complete_semaphore, nullptr );
-    
   }
 
   /* This will present the swap chain in Vulkan and D3D12 */
@@ -818,6 +891,48 @@ namespace kretash {
     vkassert( vkr );
   }
 
+  /* This will signal the frame fence with the given frame number in Vulkan and D3D12 */
+  void vkContext::signal_frame( uint64_t frame ) {
+
+    // Only one fence for the one frame in flight, Engine::update already waited on it
+    wait_for_frame( m_submitted_frame );
+
+    VkResult vkr = vkResetFences( m_device, 1, &m_frame_fence );
+    vkassert( vkr );
+
+    // An empty submit signals the fence once all the previous work on the queue is done
+    vkr = vkQueueSubmit( m_queue, 0, nullptr, m_frame_fence );
+    vkassert( vkr );
+
+    m_submitted_frame = frame;
+
+  }
+
+  /* This will return the last frame retired by the GPU in Vulkan and D3D12 */
+  uint64_t vkContext::get_completed_frame() {
+
+    if( m_completed_frame < m_submitted_frame ) {
+      if( vkGetFenceStatus( m_device, m_frame_fence ) == VK_SUCCESS ) {
+        m_completed_frame = m_submitted_frame;
+      }
+    }
+
+    return m_completed_frame;
+  }
+
+  /* This will wait until the given frame has been retired in Vulkan and D3D12 */
+  void vkContext::wait_for_frame( uint64_t frame ) {
+
+    if( frame <= m_completed_frame ) return;
+    if( frame > m_submitted_frame ) return;
+
+    VkResult vkr = vkWaitForFences( m_device, 1, &m_frame_fence, VK_TRUE, UINT64_MAX );
+    vkassert( vkr );
+
+    m_completed_frame = m_submitted_frame;
+
+  }
+
   bool vkContext::_get_memory_type( uint32_t typeBits, VkFlags properties, uint32_t * typeIndex ) {
     for( uint32_t i = 0; i < 32; i++ ) {
       if( ( typeBits & 1 ) == 1 ) {
@@ -831,6 +946,36 @@ namespace kretash {
     return false;
   }
 
+  void vkContext::_bind_draw_state( xxRenderer* r, Window* w, int32_t cb, bool instanced ) {
+
+    VkViewport viewport = {};
+    viewport.width = ( float ) w->get_width();
+    viewport.height = ( float ) w->get_height();
+    viewport.minDepth = ( float )0.0f;
+    viewport.maxDepth = ( float )1.0f;
+    vkCmdSetViewport( m_draw_command_buffers[cb], 0, 1, &viewport );
+
+    VkRect2D scissor = {};
+    scissor.extent.width = w->get_width();
+    scissor.extent.height = w->get_height();
+    scissor.offset.x = 0;
+    scissor.offset.y = 0;
+    vkCmdSetScissor( m_draw_command_buffers[cb], 0, 1, &scissor );
+
+    vkRenderer* m_renderer = dynamic_cast< vkRenderer* >( r );
+
+    vkCmdBindPipeline( m_draw_command_buffers[cb], VK_PIPELINE_BIND_POINT_GRAPHICS,
+      instanced ? m_renderer->m_instanced_pipeline : m_renderer->m_pipeline );
+
+    vkGeometry* m_geometry = dynamic_cast< vkGeometry* >( k_engine->get_GPU_pool()->get_xx_geometry() );
+
+    VkDeviceSize offsets[1] = { 0 };
+    vkCmdBindVertexBuffers( m_draw_command_buffers[cb], 0, 1, &m_geometry->m_v_buf, offsets );
+
+    vkCmdBindIndexBuffer( m_draw_command_buffers[cb], m_geometry->m_i_buf, 0,
+      m_index_size == sizeof( uint16_t ) ? VK_INDEX_TYPE_UINT16 : VK_INDEX_TYPE_UINT32 );
+  }
+
   vkContext::vkContext() {
 
     m_graphics_queue_index = 0;
@@ -901,6 +1046,24 @@ namespace kretash {
       m_constant_descriptor_set_layout = VK_NULL_HANDLE;
     }
 
+    if( m_stream_descriptor_set_layout != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyDescriptorSetLayout( m_device, m_stream_descriptor_set_layout, nullptr );
+      m_stream_descriptor_set_layout = VK_NULL_HANDLE;
+    }
+
+    if( m_frame_fence != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyFence( m_device, m_frame_fence, nullptr );
+      m_frame_fence = VK_NULL_HANDLE;
+    }
+
+    if( m_present_complete_semaphore != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroySemaphore( m_device, m_present_complete_semaphore, nullptr );
+      m_present_complete_semaphore = VK_NULL_HANDLE;
+    }
+
     if( m_pipeline_cache != VK_NULL_HANDLE ) {
       assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
       vkDestroyPipelineCache( m_device, m_pipeline_cache, nullptr );
@@ -963,6 +1126,12 @@ namespace kretash {
       m_pipeline_layout = VK_NULL_HANDLE;
     }
 
+    if( m_instanced_pipeline_layout != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyPipelineLayout( m_device, m_instanced_pipeline_layout, nullptr );
+      m_instanced_pipeline_layout = VK_NULL_HANDLE;
+    }
+
     if( m_device_pool_memory != VK_NULL_HANDLE ) {
       assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
       vkFreeMemory( m_device, m_device_pool_memory, nullptr );
@@ -1057,6 +1226,24 @@ namespace kretash {
       m_constant_descriptor_set_layout = VK_NULL_HANDLE;
     }
 
+    if( m_stream_descriptor_set_layout != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyDescriptorSetLayout( m_device, m_stream_descriptor_set_layout, nullptr );
+      m_stream_descriptor_set_layout = VK_NULL_HANDLE;
+    }
+
+    if( m_frame_fence != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyFence( m_device, m_frame_fence, nullptr );
+      m_frame_fence = VK_NULL_HANDLE;
+    }
+
+    if( m_present_complete_semaphore != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroySemaphore( m_device, m_present_complete_semaphore, nullptr );
+      m_present_complete_semaphore = VK_NULL_HANDLE;
+    }
+
     if( m_pipeline_cache != VK_NULL_HANDLE ) {
       assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
       vkDestroyPipelineCache( m_device, m_pipeline_cache, nullptr );
@@ -1119,6 +1306,12 @@ namespace kretash {
       m_pipeline_layout = VK_NULL_HANDLE;
     }
 
+    if( m_instanced_pipeline_layout != VK_NULL_HANDLE ) {
+      assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyPipelineLayout( m_device, m_instanced_pipeline_layout, nullptr );
+      m_instanced_pipeline_layout = VK_NULL_HANDLE;
+    }
+
     if( m_device_pool_memory != VK_NULL_HANDLE ) {
       assert( m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
       vkFreeMemory( m_device, m_device_pool_memory, nullptr );
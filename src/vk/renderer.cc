@@ -31,6 +31,15 @@ namespace kretash {
       m_pipeline = VK_NULL_HANDLE;
     }
 
+    if( m_instanced_pipeline != VK_NULL_HANDLE ) {
+      vkContext* m_context = dynamic_cast< vkContext* >( k_engine->get_context() );
+      assert( m_context->m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyPipeline( m_context->m_device, m_instanced_pipeline, nullptr );
+      m_instanced_pipeline = VK_NULL_HANDLE;
+    }
+
+    _release_instance_stream();
+
     m_binding_descriptions.clear();
     m_binding_descriptions.shrink_to_fit();
     m_attribute_descriptions.clear();
@@ -38,6 +47,31 @@ namespace kretash {
   
   }
 
+  /* The renderers go away before the context on a swap or shutdown, the device and pool are still there */
+  void vkRenderer::_release_instance_stream() {
+
+    vkContext* m_context = dynamic_cast< vkContext* >( k_engine->get_context() );
+
+    if( m_stream_descriptor_set != VK_NULL_HANDLE ) {
+      assert( m_context->m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkFreeDescriptorSets( m_context->m_device, m_context->m_descriptor_pool, 1, &m_stream_descriptor_set );
+      m_stream_descriptor_set = VK_NULL_HANDLE;
+    }
+
+    if( m_instance_stream.m_buffer != VK_NULL_HANDLE ) {
+      assert( m_context->m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkDestroyBuffer( m_context->m_device, m_instance_stream.m_buffer, nullptr );
+      m_instance_stream.m_buffer = VK_NULL_HANDLE;
+    }
+
+    if( m_instance_stream.m_memory != VK_NULL_HANDLE ) {
+      assert( m_context->m_device != VK_NULL_HANDLE && "BAD REFERENCE" );
+      vkFreeMemory( m_context->m_device, m_instance_stream.m_memory, nullptr );
+      m_instance_stream.m_memory = VK_NULL_HANDLE;
+    }
+
+  }
+
   void vkRenderer::create_instance_buffer_objects( std::vector<Drawable*>* d ) {
 
     vkContext* m_context = dynamic_cast< vkContext* >( k_engine->get_context() );
@@ -49,7 +83,9 @@ namespace kretash {
     alloc_info.descriptorSetCount = 1;
     alloc_info.pSetLayouts = &m_context->m_instance_descriptor_set_layout;
 
+    // instanced drawables read the instance stream, they get no buffer of their own
     for( int32_t i = 0; i < d->size(); ++i ) {
+      if( d->at( i )->is_instanced() ) continue;
       vkDrawable* drawable = dynamic_cast<vkDrawable*>( d->at( i )->get_drawable() );
       vkr = vkAllocateDescriptorSets( m_context->m_device, &alloc_info, &drawable->m_descriptor_set );
       vkassert( vkr );
@@ -58,6 +94,7 @@ namespace kretash {
     std::vector<VkWriteDescriptorSet> desc;
 
     for( int32_t i = 0; i < d->size(); ++i ) {
+      if( d->at( i )->is_instanced() ) continue;
       vkDrawable* drawable = dynamic_cast<vkDrawable*>( d->at( i )->get_drawable() );
       vkDescriptorBuffer* buff = dynamic_cast<vkDescriptorBuffer*>( d->at( i )->get_buffer() );
 
@@ -113,7 +150,83 @@ namespace kretash {
 
     }
 
-    vkUpdateDescriptorSets( m_context->m_device, ( uint32_t ) desc.size(), &desc[0], 0, nullptr );
+    if( desc.size() != 0 )
+      vkUpdateDescriptorSets( m_context->m_device, ( uint32_t ) desc.size(), &desc[0], 0, nullptr );
+
+  }
+
+  /* This will create the instance stream read by the instanced draws in Vulkan and D3D12 */
+  void vkRenderer::create_instance_stream( uint32_t max_instances ) {
+
+    vkContext* m_context = dynamic_cast< vkContext* >( k_engine->get_context() );
+
+    // prepare can run again on the same context, the old stream is too small anyway
+    _release_instance_stream();
+
+    VkDescriptorSetAllocateInfo set_info = {};
+    set_info.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+    set_info.descriptorPool = m_context->m_descriptor_pool;
+    set_info.descriptorSetCount = 1;
+    set_info.pSetLayouts = &m_context->m_stream_descriptor_set_layout;
+
+    VkResult vkr = vkAllocateDescriptorSets( m_context->m_device, &set_info, &m_stream_descriptor_set );
+    vkassert( vkr );
+
+    VkMemoryRequirements mem_reqs = {};
+    VkMemoryAllocateInfo alloc_info = {};
+    alloc_info.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+    alloc_info.pNext = nullptr;
+    alloc_info.allocationSize = 0;
+    alloc_info.memoryTypeIndex = 0;
+
+    VkBufferCreateInfo buffer_info = {};
+    buffer_info.sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+    buffer_info.size = sizeof( instance_buffer ) * max_instances;
+    buffer_info.usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+
+    vkr = vkCreateBuffer( m_context->m_device, &buffer_info, nullptr, &m_instance_stream.m_buffer );
+    vkassert( vkr );
+
+    vkGetBufferMemoryRequirements( m_context->m_device, m_instance_stream.m_buffer, &mem_reqs );
+    alloc_info.allocationSize = mem_reqs.size;
+
+    m_context->_get_memory_type( mem_reqs.memoryTypeBits, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT, &alloc_info.memoryTypeIndex );
+
+    vkr = vkAllocateMemory( m_context->m_device, &alloc_info, nullptr, &m_instance_stream.m_memory );
+    vkassert( vkr );
+
+    vkr = vkBindBufferMemory( m_context->m_device, m_instance_stream.m_buffer, m_instance_stream.m_memory, 0 );
+    vkassert( vkr );
+
+    m_instance_stream.m_descriptor.buffer = m_instance_stream.m_buffer;
+    m_instance_stream.m_descriptor.offset = 0;
+    m_instance_stream.m_descriptor.range = buffer_info.size;
+
+    VkWriteDescriptorSet write_descriptor_set = {};
+    write_descriptor_set.sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+    write_descriptor_set.dstSet = m_stream_descriptor_set;
+    write_descriptor_set.descriptorCount = 1;
+    write_descriptor_set.descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+    write_descriptor_set.pBufferInfo = &m_instance_stream.m_descriptor;
+    write_descriptor_set.dstBinding = 0;
+
+    vkUpdateDescriptorSets( m_context->m_device, 1, &write_descriptor_set, 0, nullptr );
+
+  }
+
+  /* This will update the first count instances of the instance stream in Vulkan and D3D12 */
+  void vkRenderer::update_instance_stream( std::vector<instance_buffer>* s, uint32_t count ) {
+
+    vkContext* m_context = dynamic_cast< vkContext* >( k_engine->get_context() );
+
+    uint8_t* data = nullptr;
+    VkResult vkr = vkMapMemory( m_context->m_device, m_instance_stream.m_memory, 0, sizeof( instance_buffer ) * count,
+      0, ( void** ) &data );
+    vkassert( vkr );
+
+    memcpy( data, s->data(), sizeof( instance_buffer ) * count );
+
+    vkUnmapMemory( m_context->m_device, m_instance_stream.m_memory );
 
   }
 
@@ -180,6 +293,18 @@ namespace kretash {
     m_attribute_descriptions[4].format = VK_FORMAT_R32G32B32_SFLOAT;
     m_attribute_descriptions[4].offset = sizeof( float ) * 11;
 
+    if( m_context->m_stride == PACKED_VERTEX_STRIDE ) {
+      m_attribute_descriptions.resize( 4 );
+      m_attribute_descriptions[0].format = VK_FORMAT_R16G16B16A16_UNORM;
+      m_attribute_descriptions[0].offset = 0;
+      m_attribute_descriptions[1].format = VK_FORMAT_R16G16_SNORM;
+      m_attribute_descriptions[1].offset = sizeof( uint32_t ) * 2;
+      m_attribute_descriptions[2].format = VK_FORMAT_R16G16_SFLOAT;
+      m_attribute_descriptions[2].offset = sizeof( uint32_t ) * 3;
+      m_attribute_descriptions[3].format = VK_FORMAT_R16G16_SNORM;
+      m_attribute_descriptions[3].offset = sizeof( uint32_t ) * 4;
+    }
+
     m_vi.sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
     m_vi.pNext = nullptr;
     m_vi.vertexBindingDescriptionCount = ( uint32_t ) m_binding_descriptions.size();
@@ -250,18 +375,19 @@ namespace kretash {
     multisample_state.pSampleMask = nullptr;
     multisample_state.rasterizationSamples = VK_SAMPLE_COUNT_1_BIT;
 
+    bool packed = m_context->m_stride == PACKED_VERTEX_STRIDE;
     VkPipelineShaderStageCreateInfo shader_stages[2] = { {},{} };
     if( rt == rBASIC ) {
-      shader_stages[0] = _load_shaders( "basic.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
+      shader_stages[0] = _load_shaders( packed ? "basic_packed.vert.spv" : "basic.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
       shader_stages[1] = _load_shaders( "basic.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT );
     } else if( rt == rTEXTURE ) {
-      shader_stages[0] = _load_shaders( "texture.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
+      shader_stages[0] = _load_shaders( packed ? "texture_packed.vert.spv" : "texture.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
       shader_stages[1] = _load_shaders( "texture.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT );
     } else if( rt == rSKYDOME ) {
-      shader_stages[0] = _load_shaders( "skydome.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
+      shader_stages[0] = _load_shaders( packed ? "skydome_packed.vert.spv" : "skydome.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
       shader_stages[1] = _load_shaders( "skydome.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT );
     } else if( rt == rPOST ) {
-      shader_stages[0] = _load_shaders( "post.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
+      shader_stages[0] = _load_shaders( packed ? "post_packed.vert.spv" : "post.vert.spv", VK_SHADER_STAGE_VERTEX_BIT );
       shader_stages[1] = _load_shaders( "post.frag.spv", VK_SHADER_STAGE_FRAGMENT_BIT );
     } else {
       assert( false && "UNRECOGNIZED RENDERER" );
@@ -286,6 +412,20 @@ namespace kretash {
       nullptr, &m_pipeline );
     vkassert( vkr );
 
+    // same state, but the vertex shader reads its instance from the instance stream
+    if( rt == rTEXTURE ) {
+      shader_stages[0] = _load_shaders( packed ? "texture_instanced_packed.vert.spv" : "texture_instanced.vert.spv",
+        VK_SHADER_STAGE_VERTEX_BIT );
+      pipeline_create_info.layout = m_context->m_instanced_pipeline_layout;
+
+      if( m_instanced_pipeline != VK_NULL_HANDLE )
+        vkDestroyPipeline( m_context->m_device, m_instanced_pipeline, nullptr );
+
+      vkr = vkCreateGraphicsPipelines( m_context->m_device, m_context->m_pipeline_cache, 1, &pipeline_create_info,
+        nullptr, &m_instanced_pipeline );
+      vkassert( vkr );
+    }
+
   }
 
   VkPipelineShaderStageCreateInfo vkRenderer::_load_shaders( std::string filename, VkShaderStageFlagBits flags ) {
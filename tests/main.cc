@@ -0,0 +1,123 @@
+/*
+----------------------------------------------------------------------------------------------------
+------                  _   _____ _  __                     ------------ /_/\  ---------------------
+------              |/ |_) |_  | |_|(_ |_|                  ----------- / /\ \  --------------------
+------              |\ | \ |__ | | |__)| |                  ---------- / / /\ \  -------------------
+------   CARLOS MARTINEZ ROMERO - kretash.wordpress.com     --------- / / /\ \ \  ------------------
+------                                                      -------- / /_/__\ \ \  -----------------
+------       PROCEDURAL CITY RENDERING WITH THE NEW         ------  /_/______\_\/\  ----------------
+------            GENERATION GRAPHICS APIS                  ------- \_\_________\/ -----------------
+----------------------------------------------------------------------------------------------------
+
+Licensed under the MIT License (the "License"); you may not use this file except
+in compliance with the License. You may obtain a copy of the License at
+http://opensource.org/licenses/MIT
+*/
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <functional>
+
+#include "core/core.hh"
+#include "core/engine.hh"
+#include "core/renderer.hh"
+#include "core/city_generetaor.hh"
+#include "core/alloc_counter.hh"
+#include "core/allocator_stress.hh"
+#include "core/tangent_benchmark.hh"
+
+// buildings generated on warm arenas before the heap check passes, and frames to wait for them
+#define CHECKED_BUILDINGS 64
+#define MAX_FRAMES 5000
+
+using namespace kretash;
+
+/* tests [name] [traces...]
+   Runs every test, or only the one called name. The allocator test replays the traces recorded
+   with Pool::record_trace after its synthetic scenarios. The buildings test opens the engine window
+   and runs last. The exit code is the number of failures. */
+
+static bool _allocator_stress( std::vector<std::string>& traces ) {
+  AllocatorStress stress;
+  bool passed = stress.run();
+  for( size_t i = 0; i < traces.size(); ++i )
+    passed &= stress.replay( traces[i] );
+  stress.print_reports();
+  return passed;
+}
+
+// the shared kernel has to give the same vertices as the scalar loop it replaced
+static bool _tangent_benchmark() {
+  TangentBenchmark benchmark;
+  bool passed = benchmark.run();
+  benchmark.print_reports();
+  return passed;
+}
+
+// once the worker arenas stop growing, generating a building can't touch the heap
+static bool _building_allocations() {
+  if( !alloc_counter::is_counting() ) {
+    std::cout << "built without COUNT_ALLOCATIONS, nothing to check\n";
+    return false;
+  }
+
+  k_engine->init();
+
+  bool passed = false;
+  {
+    std::shared_ptr<Renderer> ren = std::make_shared<Renderer>();
+    ren->create( rTEXTURE );
+
+    std::shared_ptr<CityGenerator> c_gen = std::make_shared<CityGenerator>();
+    c_gen->generate( ren );
+
+    k_engine->prepare();
+
+    int32_t frames = 0;
+    while( k_engine->is_running() && frames < MAX_FRAMES && c_gen->get_warm_buildings() < CHECKED_BUILDINGS ) {
+      k_engine->update();
+      c_gen->update();
+
+      k_engine->reset_cmd_list();
+      k_engine->clear_color();
+      k_engine->clear_depth();
+      k_engine->render( ren.get() );
+      k_engine->execute_and_swap();
+      ++frames;
+    }
+
+    uint64_t warm = c_gen->get_warm_buildings();
+    uint64_t allocating = c_gen->get_allocating_buildings();
+    std::cout << warm << " buildings on warm arenas in " << frames << " frames, " << allocating <<
+      " of them allocated\n";
+    passed = warm >= CHECKED_BUILDINGS && allocating == 0;
+  }
+
+  k_engine->shutdown();
+  return passed;
+}
+
+static int32_t _run( std::string name, std::string only, std::function<bool()> test ) {
+  if( only != "" && only != name ) return 0;
+
+  std::cout << "---- " << name << std::endl;
+  bool passed = test();
+  std::cout << "---- " << name << ( passed ? " PASSED" : " FAILED" ) << std::endl;
+  return passed ? 0 : 1;
+}
+
+int main( int argc, char **argv ) {
+
+  std::string only = argc > 1 ? argv[1] : "";
+  std::vector<std::string> traces;
+  for( int32_t i = 2; i < argc; ++i )
+    traces.push_back( argv[i] );
+
+  int32_t failed = 0;
+  failed += _run( "allocator", only, [&traces] () { return _allocator_stress( traces ); } );
+  failed += _run( "tangents", only, _tangent_benchmark );
+  failed += _run( "buildings", only, _building_allocations );
+
+  return failed;
+}